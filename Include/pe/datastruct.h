@@ -144,6 +144,10 @@ typedef struct XSTL_PACKED _IMAGE_FILE_HEADER {
 #define IMAGE_FILE_MACHINE_MIPSFPU16         0x0466  // MIPS
 #define IMAGE_FILE_MACHINE_ALPHA64           0x0284  // ALPHA64
 #define IMAGE_FILE_MACHINE_AXP64             IMAGE_FILE_MACHINE_ALPHA64
+#define IMAGE_FILE_MACHINE_ARMNT             0x01c4  // ARM Thumb-2 Little-Endian
+#define IMAGE_FILE_MACHINE_EBC               0x0EBC  // EFI Byte Code
+#define IMAGE_FILE_MACHINE_AMD64             0x8664  // AMD64 (K8)
+#define IMAGE_FILE_MACHINE_ARM64             0xAA64  // ARM64 Little-Endian
 //
 // Directory format.
 //
@@ -888,8 +892,10 @@ typedef IMAGE_BASE_RELOCATION UNALIGNED * PIMAGE_BASE_RELOCATION;
 #define IMAGE_REL_BASED_HIGHLOW               3
 #define IMAGE_REL_BASED_HIGHADJ               4
 #define IMAGE_REL_BASED_MIPS_JMPADDR          5
+#define IMAGE_REL_BASED_ARM_MOV32             5
 #define IMAGE_REL_BASED_SECTION               6
 #define IMAGE_REL_BASED_REL32                 7
+#define IMAGE_REL_BASED_THUMB_MOV32           7
 
 #define IMAGE_REL_BASED_MIPS_JMPADDR16        9
 #define IMAGE_REL_BASED_IA64_IMM64            9
@@ -992,8 +998,8 @@ typedef VOID
 typedef struct XSTL_PACKED _IMAGE_TLS_DIRECTORY64 {
     ULONGLONG   StartAddressOfRawData;
     ULONGLONG   EndAddressOfRawData;
-    PDWORD  AddressOfIndex;
-    PIMAGE_TLS_CALLBACK *AddressOfCallBacks;
+    ULONGLONG   AddressOfIndex;         // PDWORD
+    ULONGLONG   AddressOfCallBacks;     // PIMAGE_TLS_CALLBACK *
     DWORD   SizeOfZeroFill;
     DWORD   Characteristics;
 } IMAGE_TLS_DIRECTORY64;
@@ -1002,8 +1008,8 @@ typedef IMAGE_TLS_DIRECTORY64 * PIMAGE_TLS_DIRECTORY64;
 typedef struct XSTL_PACKED _IMAGE_TLS_DIRECTORY32 {
     DWORD   StartAddressOfRawData;
     DWORD   EndAddressOfRawData;
-    PDWORD  AddressOfIndex;
-    PIMAGE_TLS_CALLBACK *AddressOfCallBacks;
+    DWORD   AddressOfIndex;             // PDWORD
+    DWORD   AddressOfCallBacks;         // PIMAGE_TLS_CALLBACK *
     DWORD   SizeOfZeroFill;
     DWORD   Characteristics;
 } IMAGE_TLS_DIRECTORY32;
@@ -1060,6 +1066,29 @@ typedef struct XSTL_PACKED _IMAGE_BOUND_FORWARDER_REF {
     WORD    Reserved;
 } IMAGE_BOUND_FORWARDER_REF, *PIMAGE_BOUND_FORWARDER_REF;
 
+//
+// Delay load import descriptors pointed to by DataDirectory[ IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT ]
+//
+
+typedef struct XSTL_PACKED _IMAGE_DELAYLOAD_DESCRIPTOR {
+    union {
+        DWORD AllAttributes;
+        struct {
+            DWORD RvaBased : 1;             // Delay load version 2
+            DWORD ReservedAttributes : 31;
+        };
+    } Attributes;
+
+    DWORD DllNameRVA;                       // RVA to the name of the target library (NULL-terminate ASCII string)
+    DWORD ModuleHandleRVA;                  // RVA to the HMODULE caching location (PHMODULE)
+    DWORD ImportAddressTableRVA;            // RVA to the start of the IAT (PIMAGE_THUNK_DATA)
+    DWORD ImportNameTableRVA;               // RVA to the start of the name table (PIMAGE_THUNK_DATA::AddressOfData)
+    DWORD BoundImportAddressTableRVA;       // RVA to an optional bound IAT
+    DWORD UnloadInformationTableRVA;        // RVA to an optional unload info table
+    DWORD TimeDateStamp;                    // 0 if not bound,
+                                            // O.W. date/time stamp of DLL bound to (Old BIND)
+} IMAGE_DELAYLOAD_DESCRIPTOR, *PIMAGE_DELAYLOAD_DESCRIPTOR;
+
 // Comment
 // Comment
 // Comment
@@ -1200,6 +1229,164 @@ typedef struct XSTL_PACKED _IMAGE_LOAD_CONFIG_DIRECTORY {
     DWORD   Reserved[ 1 ];
 } IMAGE_LOAD_CONFIG_DIRECTORY, *PIMAGE_LOAD_CONFIG_DIRECTORY;
 
+//
+// The size-versioned load configuration directories. The first DWORD is the
+// size of the structure; fields beyond it don't exist in the image.
+//
+
+typedef struct XSTL_PACKED _IMAGE_LOAD_CONFIG_CODE_INTEGRITY {
+    WORD    Flags;          // Flags to indicate if CI information is available, etc.
+    WORD    Catalog;        // 0xFFFF means not available
+    DWORD   CatalogOffset;
+    DWORD   Reserved;       // Additional bitmask to be defined later
+} IMAGE_LOAD_CONFIG_CODE_INTEGRITY, *PIMAGE_LOAD_CONFIG_CODE_INTEGRITY;
+
+typedef struct XSTL_PACKED _IMAGE_LOAD_CONFIG_DIRECTORY32 {
+    DWORD   Size;
+    DWORD   TimeDateStamp;
+    WORD    MajorVersion;
+    WORD    MinorVersion;
+    DWORD   GlobalFlagsClear;
+    DWORD   GlobalFlagsSet;
+    DWORD   CriticalSectionDefaultTimeout;
+    DWORD   DeCommitFreeBlockThreshold;
+    DWORD   DeCommitTotalFreeThreshold;
+    DWORD   LockPrefixTable;                // VA
+    DWORD   MaximumAllocationSize;
+    DWORD   VirtualMemoryThreshold;
+    DWORD   ProcessHeapFlags;
+    DWORD   ProcessAffinityMask;
+    WORD    CSDVersion;
+    WORD    DependentLoadFlags;
+    DWORD   EditList;                       // VA
+    DWORD   SecurityCookie;                 // VA
+    DWORD   SEHandlerTable;                 // VA
+    DWORD   SEHandlerCount;
+    DWORD   GuardCFCheckFunctionPointer;    // VA
+    DWORD   GuardCFDispatchFunctionPointer; // VA
+    DWORD   GuardCFFunctionTable;           // VA
+    DWORD   GuardCFFunctionCount;
+    DWORD   GuardFlags;
+    IMAGE_LOAD_CONFIG_CODE_INTEGRITY CodeIntegrity;
+    DWORD   GuardAddressTakenIatEntryTable; // VA
+    DWORD   GuardAddressTakenIatEntryCount;
+    DWORD   GuardLongJumpTargetTable;       // VA
+    DWORD   GuardLongJumpTargetCount;
+    DWORD   DynamicValueRelocTable;         // VA
+    DWORD   CHPEMetadataPointer;
+    DWORD   GuardRFFailureRoutine;          // VA
+    DWORD   GuardRFFailureRoutineFunctionPointer; // VA
+    DWORD   DynamicValueRelocTableOffset;
+    WORD    DynamicValueRelocTableSection;
+    WORD    Reserved2;
+    DWORD   GuardRFVerifyStackPointerFunctionPointer; // VA
+    DWORD   HotPatchTableOffset;
+    DWORD   Reserved3;
+    DWORD   EnclaveConfigurationPointer;    // VA
+    DWORD   VolatileMetadataPointer;        // VA
+    DWORD   GuardEHContinuationTable;       // VA
+    DWORD   GuardEHContinuationCount;
+} IMAGE_LOAD_CONFIG_DIRECTORY32, *PIMAGE_LOAD_CONFIG_DIRECTORY32;
+
+typedef struct XSTL_PACKED _IMAGE_LOAD_CONFIG_DIRECTORY64 {
+    DWORD      Size;
+    DWORD      TimeDateStamp;
+    WORD       MajorVersion;
+    WORD       MinorVersion;
+    DWORD      GlobalFlagsClear;
+    DWORD      GlobalFlagsSet;
+    DWORD      CriticalSectionDefaultTimeout;
+    ULONGLONG  DeCommitFreeBlockThreshold;
+    ULONGLONG  DeCommitTotalFreeThreshold;
+    ULONGLONG  LockPrefixTable;             // VA
+    ULONGLONG  MaximumAllocationSize;
+    ULONGLONG  VirtualMemoryThreshold;
+    ULONGLONG  ProcessAffinityMask;
+    DWORD      ProcessHeapFlags;
+    WORD       CSDVersion;
+    WORD       DependentLoadFlags;
+    ULONGLONG  EditList;                    // VA
+    ULONGLONG  SecurityCookie;              // VA
+    ULONGLONG  SEHandlerTable;              // VA
+    ULONGLONG  SEHandlerCount;
+    ULONGLONG  GuardCFCheckFunctionPointer; // VA
+    ULONGLONG  GuardCFDispatchFunctionPointer; // VA
+    ULONGLONG  GuardCFFunctionTable;        // VA
+    ULONGLONG  GuardCFFunctionCount;
+    DWORD      GuardFlags;
+    IMAGE_LOAD_CONFIG_CODE_INTEGRITY CodeIntegrity;
+    ULONGLONG  GuardAddressTakenIatEntryTable; // VA
+    ULONGLONG  GuardAddressTakenIatEntryCount;
+    ULONGLONG  GuardLongJumpTargetTable;    // VA
+    ULONGLONG  GuardLongJumpTargetCount;
+    ULONGLONG  DynamicValueRelocTable;      // VA
+    ULONGLONG  CHPEMetadataPointer;         // VA
+    ULONGLONG  GuardRFFailureRoutine;       // VA
+    ULONGLONG  GuardRFFailureRoutineFunctionPointer; // VA
+    DWORD      DynamicValueRelocTableOffset;
+    WORD       DynamicValueRelocTableSection;
+    WORD       Reserved2;
+    ULONGLONG  GuardRFVerifyStackPointerFunctionPointer; // VA
+    DWORD      HotPatchTableOffset;
+    DWORD      Reserved3;
+    ULONGLONG  EnclaveConfigurationPointer; // VA
+    ULONGLONG  VolatileMetadataPointer;     // VA
+    ULONGLONG  GuardEHContinuationTable;    // VA
+    ULONGLONG  GuardEHContinuationCount;
+} IMAGE_LOAD_CONFIG_DIRECTORY64, *PIMAGE_LOAD_CONFIG_DIRECTORY64;
+
+//
+// GuardFlags of the load configuration directory
+//
+
+#define IMAGE_GUARD_CF_INSTRUMENTED                    0x00000100 // Module performs control flow integrity checks using system-supplied support
+#define IMAGE_GUARD_CFW_INSTRUMENTED                   0x00000200 // Module performs control flow and write integrity checks
+#define IMAGE_GUARD_CF_FUNCTION_TABLE_PRESENT          0x00000400 // Module contains valid control flow target metadata
+#define IMAGE_GUARD_SECURITY_COOKIE_UNUSED             0x00000800 // Module does not make use of the /GS security cookie
+#define IMAGE_GUARD_PROTECT_DELAYLOAD_IAT              0x00001000 // Module supports read only delay load IAT
+#define IMAGE_GUARD_DELAYLOAD_IAT_IN_ITS_OWN_SECTION   0x00002000 // Delayload import table in its own .didat section
+#define IMAGE_GUARD_CF_EXPORT_SUPPRESSION_INFO_PRESENT 0x00004000 // Module contains suppressed export information
+#define IMAGE_GUARD_CF_ENABLE_EXPORT_SUPPRESSION       0x00008000 // Module enables suppression of exports
+#define IMAGE_GUARD_CF_LONGJUMP_TABLE_PRESENT          0x00010000 // Module contains longjmp target information
+#define IMAGE_GUARD_RF_INSTRUMENTED                    0x00020000 // Module contains return flow instrumentation and metadata
+#define IMAGE_GUARD_RF_ENABLE                          0x00040000 // Module requests that the OS enable return flow protection
+#define IMAGE_GUARD_RF_STRICT                          0x00080000 // Module requests that the OS enable return flow protection in strict mode
+#define IMAGE_GUARD_RETPOLINE_PRESENT                  0x00100000 // Module was built with retpoline support
+#define IMAGE_GUARD_EH_CONTINUATION_TABLE_PRESENT      0x00400000 // Module contains EH continuation target information
+#define IMAGE_GUARD_CF_FUNCTION_TABLE_SIZE_MASK        0xF0000000 // Stride of Guard CF function table encoded in these bits (additional count of bytes per element)
+#define IMAGE_GUARD_CF_FUNCTION_TABLE_SIZE_SHIFT       28         // Shift to right-justify Guard CF function table stride
+
+// The metadata byte of the guard CF tables entries
+#define IMAGE_GUARD_FLAG_FID_SUPPRESSED                0x01       // The call target is explicitly suppressed (do not treat it as valid)
+#define IMAGE_GUARD_FLAG_EXPORT_SUPPRESSED             0x02       // The call target is export suppressed
+
+//
+// Function table entry format for AMD64 images.  Function table is
+// pointed to by the IMAGE_DIRECTORY_ENTRY_EXCEPTION directory entry.
+//
+
+typedef struct XSTL_PACKED _IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY {
+    DWORD BeginAddress;
+    DWORD EndAddress;
+    DWORD UnwindInfoAddress;
+} IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY, *PIMAGE_AMD64_RUNTIME_FUNCTION_ENTRY;
+
+//
+// Function table entry format for ARM (Thumb-2) and ARM64 images. The
+// UnwindData is either the RVA of the .xdata record (the low two bits are
+// clear), or the packed unwind data itself, which holds the function length.
+//
+
+typedef struct XSTL_PACKED _IMAGE_ARM_RUNTIME_FUNCTION_ENTRY {
+    DWORD BeginAddress;
+    DWORD UnwindData;
+} IMAGE_ARM_RUNTIME_FUNCTION_ENTRY, *PIMAGE_ARM_RUNTIME_FUNCTION_ENTRY;
+
+typedef struct XSTL_PACKED _IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY {
+    DWORD BeginAddress;
+    DWORD UnwindData;
+} IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY, *PIMAGE_ARM64_RUNTIME_FUNCTION_ENTRY;
+
 
 //
 // Function table entry format for IA64 images.  Function table is
@@ -1264,6 +1451,27 @@ typedef PIMAGE_ALPHA_RUNTIME_FUNCTION_ENTRY PIMAGE_RUNTIME_FUNCTION_ENTRY;
 
 #endif
 
+//
+// Certificate table format. The table is pointed to by the
+// IMAGE_DIRECTORY_ENTRY_SECURITY directory entry, whose VirtualAddress is a
+// file offset. The entries are aligned on 8 bytes boundary.
+//
+
+typedef struct XSTL_PACKED _WIN_CERTIFICATE {
+    DWORD dwLength;                 // The length of the entry, including this header
+    WORD  wRevision;
+    WORD  wCertificateType;         // WIN_CERT_TYPE_xxx
+    BYTE  bCertificate[1];
+} WIN_CERTIFICATE, *LPWIN_CERTIFICATE;
+
+#define WIN_CERT_REVISION_1_0               (0x0100)
+#define WIN_CERT_REVISION_2_0               (0x0200)
+
+#define WIN_CERT_TYPE_X509                  (0x0001)   // bCertificate contains an X.509 Certificate
+#define WIN_CERT_TYPE_PKCS_SIGNED_DATA      (0x0002)   // bCertificate contains a PKCS SignedData structure
+#define WIN_CERT_TYPE_RESERVED_1            (0x0003)   // Reserved
+#define WIN_CERT_TYPE_TS_STACK_SIGNED       (0x0004)   // Terminal Server Protocol Stack Certificate signing
+
 //
 // Debug Format
 //
@@ -1290,6 +1498,15 @@ typedef struct XSTL_PACKED _IMAGE_DEBUG_DIRECTORY {
 #define IMAGE_DEBUG_TYPE_OMAP_FROM_SRC    8
 #define IMAGE_DEBUG_TYPE_BORLAND          9
 #define IMAGE_DEBUG_TYPE_RESERVED10       10
+#define IMAGE_DEBUG_TYPE_CLSID            11
+#define IMAGE_DEBUG_TYPE_VC_FEATURE       12
+#define IMAGE_DEBUG_TYPE_POGO             13
+#define IMAGE_DEBUG_TYPE_ILTCG            14
+#define IMAGE_DEBUG_TYPE_MPX              15
+#define IMAGE_DEBUG_TYPE_REPRO            16
+#define IMAGE_DEBUG_TYPE_EMBEDDED_PORTABLE_PDB 17
+#define IMAGE_DEBUG_TYPE_PDBCHECKSUM      19
+#define IMAGE_DEBUG_TYPE_EX_DLLCHARACTERISTICS 20
 
 
 typedef struct XSTL_PACKED _IMAGE_COFF_SYMBOLS_HEADER {
@@ -1486,6 +1703,28 @@ typedef struct _GUID {
 } GUID;
 #endif
 
+//
+// CodeView records, pointed by IMAGE_DEBUG_TYPE_CODEVIEW entries
+//
+
+#define CV_SIGNATURE_NB10   0x3031424E  // 'NB10'
+#define CV_SIGNATURE_RSDS   0x53445352  // 'RSDS'
+
+typedef struct XSTL_PACKED _CV_INFO_PDB20 {
+    DWORD   CvSignature;                // CV_SIGNATURE_NB10
+    DWORD   Offset;
+    DWORD   Signature;                  // seconds since 01.01.1970
+    DWORD   Age;                        // an always-incrementing value
+    BYTE    PdbFileName[1];             // zero terminated string with the name of the PDB file
+} CV_INFO_PDB20, *PCV_INFO_PDB20;
+
+typedef struct XSTL_PACKED _CV_INFO_PDB70 {
+    DWORD   CvSignature;                // CV_SIGNATURE_RSDS
+    GUID    Signature;                  // unique identifier
+    DWORD   Age;                        // an always-incrementing value
+    BYTE    PdbFileName[1];             // zero terminated string with the name of the PDB file
+} CV_INFO_PDB70, *PCV_INFO_PDB70;
+
 #ifndef XSTL_LINUX
     #pragma pack(pop)
 #endif
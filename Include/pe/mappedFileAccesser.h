@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_MAPPED_FILE_ACCESSER_H
+#define __TBA_PE_MAPPED_FILE_ACCESSER_H
+
+/*
+ * mappedFileAccesser.h
+ *
+ * A read-only memory accesser over a file which is mapped into the address
+ * space of the process (mmap / MapViewOfFile). Used as a zero-copy backend
+ * for cNtHeader: the sections become views into the mapping instead of
+ * private snapshots.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/string.h"
+#include "xStl/data/smartptr.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+
+/*
+ * Maps an entire file for reading. The address space of the accesser is the
+ * file offset: address 0 is the first byte of the file.
+ *
+ * NOTE: The mapping is released when the object is destroyed. Any stream
+ *       which was forked over the accesser keeps it alive by reference.
+ */
+class cMappedFileAccesser : public cVirtualMemoryAccesser {
+public:
+    defaultEndianImpl;
+
+    /*
+     * Open and map a file.
+     *
+     * filename - The full path of the file to map
+     *
+     * Throw exception if the file cannot be opened or mapped.
+     */
+    cMappedFileAccesser(const cString& filename);
+
+    // Unmap the file
+    virtual ~cMappedFileAccesser();
+
+    /*
+     * See cVirtualMemoryAccesser::memread.
+     * Copy the bytes from the mapping. Return false if the range exceed the
+     * size of the file.
+     */
+    virtual bool memread(addressNumericValue address,
+                         void* buffer,
+                         uint length,
+                         cFragmentsDescriptor* fragments = NULL) const;
+
+    // The mapping is read-only. Throw exception.
+    virtual bool write(addressNumericValue address,
+                       const void* buffer,
+                       uint length);
+    // Return false.
+    virtual bool isWritableInterface() const;
+
+    /*
+     * Return the size of the mapped file, in bytes
+     */
+    uint getSize() const;
+
+    /*
+     * Return a direct pointer into the mapping for the range
+     * [address, address + length), or NULL if the range exceed the size of the
+     * file.
+     *
+     * NOTE: The pointer is valid only while this object is alive.
+     */
+    const uint8* getPointer(addressNumericValue address, uint length) const;
+
+private:
+    // Deny copy-constructor and operator =
+    cMappedFileAccesser(const cMappedFileAccesser& other);
+    cMappedFileAccesser& operator = (const cMappedFileAccesser& other);
+
+    // Release the mapping and the file handles
+    void unmap();
+
+    // The base of the mapping. NULL for empty files
+    const uint8* m_base;
+    // The size of the file
+    uint m_size;
+
+    #ifdef XSTL_WINDOWS
+    // The file and the section handles
+    HANDLE m_file;
+    HANDLE m_mapping;
+    #endif // XSTL_WINDOWS
+};
+
+// The reference countable object
+typedef cSmartPtr<cMappedFileAccesser> cMappedFileAccesserPtr;
+
+#endif // __TBA_PE_MAPPED_FILE_ACCESSER_H
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_BOUND_IMPORT_H
+#define __TBA_PE_NT_DIRECTORY_BOUND_IMPORT_H
+
+/*
+ * ntDirBoundImport.h
+ *
+ * Operation over PE bound import table.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirBoundImport;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirBoundImport& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the bound import directory: the IMAGE_BOUND_IMPORT_DESCRIPTOR
+ * records which the binder (bind.exe) writes for a prebound image. Each record
+ * holds the time-stamp of a module which the IAT was resolved against, and is
+ * followed by IMAGE_BOUND_FORWARDER_REF records for the modules which the
+ * module forwards to.
+ *
+ * The directory is stored in the header region (after the section table)
+ * rather than in a section. It's read out of the raw header bytes of the file,
+ * see cNtHeader::getDirectPointer.
+ *
+ * The records and the names are views over the raw bytes. When the header
+ * region cannot be accessed directly the table is copied once, and the views
+ * point into the copy. Either way, the views are valid as long as both the
+ * directory and the cNtHeader which it was read from are alive.
+ */
+class cNtDirBoundImport : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirBoundImport();
+
+    /*
+     * Read the bound import table of a PE image.
+     */
+    cNtDirBoundImport(const cNtHeader& header);
+
+    /*
+     * Parse a bound import table.
+     *
+     * table - The raw bytes of the directory. Must be alive as long as the
+     *         object refers to it.
+     * size - The size of the directory.
+     *
+     * Throw exception if the table is broken.
+     */
+    void read(const uint8* table, uint size);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // Returned by findModule
+    enum { NOT_FOUND = 0xFFFFFFFF };
+
+    /*
+     * A module which the image is bound to
+     */
+    struct BoundModule {
+        // The record
+        const IMAGE_BOUND_IMPORT_DESCRIPTOR* m_descriptor;
+        // The name of the module
+        const char* m_name;
+        // The modules which are forwarded to. The array holds
+        // m_descriptor->NumberOfModuleForwarderRefs records
+        const IMAGE_BOUND_FORWARDER_REF* m_forwarders;
+    };
+    typedef cArray<BoundModule> ModuleTable;
+
+    /*
+     * Returns the bound modules
+     */
+    const ModuleTable& getModules() const;
+
+    /*
+     * Returns the name of a forwarder reference
+     */
+    const char* getForwarderName(const IMAGE_BOUND_FORWARDER_REF& forwarder) const;
+
+    /*
+     * Returns the index of a bound module by its name (case insensitive), or
+     * NOT_FOUND if the image isn't bound to the module.
+     */
+    uint findModule(const char* name) const;
+
+    /*
+     * Returns true if the binding against a module is stale: the image was
+     * bound to a different version of the module (or of a module which it
+     * forwards to), and the loader must resolve the imports again.
+     *
+     * name - The name of the module (or of a forwarded module)
+     * timeDateStamp - The FileHeader.TimeDateStamp of the module which is
+     *                 actually loaded
+     *
+     * Returns false if the image isn't bound to the module.
+     */
+    bool isStale(const char* name, uint32 timeDateStamp) const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirBoundImport(const cNtDirBoundImport& other);
+    cNtDirBoundImport& operator = (const cNtDirBoundImport& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirBoundImport& object);
+    #endif //PE_TRACE
+
+    /*
+     * Returns the name at 'offset' from the beginning of the table. Throw
+     * exception if the name isn't terminated inside the table.
+     */
+    const char* getName(uint offset) const;
+
+    // The raw table, and its size
+    const uint8* m_table;
+    uint m_tableSize;
+    // A copy of the table, when it cannot be accessed directly
+    cBuffer m_copy;
+    // The modules
+    ModuleTable m_modules;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_BOUND_IMPORT_H
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_DEBUG_H
+#define __TBA_PE_NT_DIRECTORY_DEBUG_H
+
+/*
+ * ntDirDebug.h
+ *
+ * Operation over PE debug directory.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirDebug;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirDebug& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the debug directory: the array of IMAGE_DEBUG_DIRECTORY entries
+ * (CodeView, POGO, VC_FEATURE, repro, extended DLL characteristics etc.)
+ *
+ * The data of an entry is addressed by its AddressOfRawData. Entries which
+ * aren't mapped by the loader (AddressOfRawData is 0) are located by
+ * translating their PointerToRawData, so both work for file and for memory
+ * images.
+ *
+ * The CodeView record (the key of the symbol-server: the PDB GUID, age and
+ * path) is decoded by readCodeView, which costs two small reads: the entries
+ * and the record itself.
+ */
+class cNtDirDebug : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirDebug();
+
+    /*
+     * Read the debug directory of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirDebug(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_DEBUG
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // Sanity limits for broken directories
+    enum {
+        MAX_ENTRIES = 0x100,
+        MAX_PDB_PATH = 0x400
+    };
+
+    // The data of an entry which cannot be located inside the image
+    enum { INVALID_RVA = 0xFFFFFFFF };
+
+    /*
+     * A debug entry
+     */
+    struct DebugEntry {
+        // The entry, as stored in the image
+        IMAGE_DEBUG_DIRECTORY m_directory;
+        // The RVA of the data, or INVALID_RVA
+        uint32 m_rva;
+    };
+    typedef cArray<DebugEntry> EntryTable;
+
+    /*
+     * The decoded CodeView record
+     */
+    struct CodeViewInfo {
+        // CV_SIGNATURE_RSDS or CV_SIGNATURE_NB10
+        uint32 m_cvSignature;
+        // The PDB signature. For NB10 records only Data1 is used, it holds
+        // the time-stamp of the PDB
+        GUID m_guid;
+        uint32 m_age;
+        // The (null-terminated) path of the PDB, as stored in the image
+        char m_path[MAX_PDB_PATH];
+    };
+
+    /*
+     * Returns the entries
+     */
+    const EntryTable& getEntries() const;
+
+    /*
+     * Returns the index of the first entry of a type (IMAGE_DEBUG_TYPE_XXX),
+     * or MAX_ENTRIES if there is no such entry.
+     */
+    uint findEntry(uint32 type) const;
+
+    /*
+     * Returns a stream over the data of an entry. The stream refers to the PE
+     * memory, so it's valid as long as the cNtHeader is alive.
+     *
+     * Throw exception if the data cannot be located.
+     */
+    cMemoryAccesserStreamPtr getData(const DebugEntry& entry) const;
+
+    /*
+     * Decode the CodeView record of the image. Returns false if the image
+     * doesn't have one (or it's neither RSDS nor NB10).
+     */
+    bool getCodeView(CodeViewInfo& info) const;
+
+    /*
+     * Read the extended DLL characteristics
+     * (IMAGE_DEBUG_TYPE_EX_DLLCHARACTERISTICS). Returns false if the image
+     * doesn't have them.
+     */
+    bool getExDllCharacteristics(uint32& characteristics) const;
+
+    /*
+     * Decode the CodeView record of an image without reading the rest of the
+     * directory. See getCodeView
+     */
+    static bool readCodeView(const cNtHeader& header, CodeViewInfo& info);
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirDebug(const cNtDirDebug& other);
+    cNtDirDebug& operator = (const cNtDirDebug& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirDebug& object);
+    #endif //PE_TRACE
+
+    /*
+     * Read the raw entries of the directory. Returns the number of entries.
+     */
+    static uint readEntries(const cVirtualMemoryAccesser& memory,
+                            const IMAGE_DATA_DIRECTORY& debugDirectory,
+                            IMAGE_DEBUG_DIRECTORY* entries);
+
+    /*
+     * Returns the RVA of the data of an entry, or INVALID_RVA
+     */
+    static uint32 getDataRva(const cNtHeader& header,
+                             const IMAGE_DEBUG_DIRECTORY& entry);
+
+    /*
+     * Read and decode a CodeView record
+     */
+    static bool decodeCodeView(const cVirtualMemoryAccesser& memory,
+                               uint32 rva,
+                               uint size,
+                               CodeViewInfo& info);
+
+    // The PE memory
+    cVirtualMemoryAccesserPtr m_memory;
+    // The entries
+    EntryTable m_entries;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_DEBUG_H
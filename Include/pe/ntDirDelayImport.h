@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_DELAY_IMPORT_H
+#define __TBA_PE_NT_DIRECTORY_DELAY_IMPORT_H
+
+/*
+ * ntDirDelayImport.h
+ *
+ * Operation over PE delay-load import table.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/peArena.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirDelayImport;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirDelayImport& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the delay-load import directory: the IMAGE_DELAYLOAD_DESCRIPTOR
+ * array, the name table, the IAT and the optional bound IAT of each module.
+ *
+ * Both forms of the descriptor are decoded. Version 2 descriptors hold RVAs,
+ * old (Visual C++ 6) descriptors hold virtual addresses. The addresses are
+ * stored as RVAs either way.
+ *
+ * The names are views: they point directly into the image whenever the
+ * sections are stored in a contiguous memory block (a mapped file, the
+ * asynchronous reader), so the table is decoded without copying. Otherwise the
+ * names are copied into a private arena. Either way, the names are valid as
+ * long as both the directory and the cNtHeader which it was read from are
+ * alive.
+ */
+class cNtDirDelayImport : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirDelayImport();
+
+    /*
+     * Read the delay-load import table of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirDelayImport(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // Sanity limits for broken tables
+    enum {
+        MAX_MODULES = 0x1000,
+        MAX_MODULE_FUNCTIONS = 0x10000,
+        MAX_NAME_LENGTH = 0x1000
+    };
+
+    /*
+     * A module (DLL) which is loaded on first use
+     */
+    struct DelayModule {
+        // The descriptor, as stored in the image
+        IMAGE_DELAYLOAD_DESCRIPTOR m_descriptor;
+        // The name of the module
+        const char* m_name;
+        // The RVAs of the tables. Old descriptors are translated from virtual
+        // addresses. 0 for a missing table
+        uint32 m_moduleHandle;
+        uint32 m_importAddressTable;
+        uint32 m_importNameTable;
+        uint32 m_boundImportAddressTable;
+        uint32 m_unloadInformationTable;
+        // The functions of the module are
+        // [m_firstFunction, m_firstFunction + m_numberOfFunctions)
+        uint m_firstFunction;
+        uint m_numberOfFunctions;
+    };
+    typedef cArray<DelayModule> ModuleTable;
+
+    /*
+     * A single delay-loaded function
+     */
+    struct DelayFunction {
+        // The name of the function, or NULL for an import by ordinal
+        const char* m_name;
+        // The hint of a named import, or the ordinal
+        uint16 m_hint;
+        // The RVA of the IAT slot which receives the address of the function
+        uint32 m_iatAddress;
+        // The address from the bound IAT, or 0 if the module isn't bound (or
+        // the bound IAT cannot be read)
+        uint64 m_boundAddress;
+    };
+    typedef cArray<DelayFunction> FunctionTable;
+
+    /*
+     * Returns the delay-loaded modules
+     */
+    const ModuleTable& getModules() const;
+
+    /*
+     * Returns the delay-loaded functions of all the modules
+     */
+    const FunctionTable& getFunctions() const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirDelayImport(const cNtDirDelayImport& other);
+    cNtDirDelayImport& operator = (const cNtDirDelayImport& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirDelayImport& object);
+    #endif //PE_TRACE
+
+    /*
+     * Read the name table and the bound IAT of a single module. Instantiated
+     * for each flavour, see peTraits.h
+     */
+    template <class Traits>
+    void readFunctions(const cNtHeader& header,
+                       const cVirtualMemoryAccesser& memory,
+                       DelayModule& module);
+
+    /*
+     * Returns a null-terminated name out of the image. The name points into
+     * the image if possible, otherwise it's copied into m_names.
+     */
+    const char* readName(const cNtHeader& header,
+                         const cVirtualMemoryAccesser& memory,
+                         addressNumericValue address);
+
+    /*
+     * Append a function to the function table. Returns the new entry.
+     */
+    DelayFunction& appendFunction();
+
+    // The modules
+    ModuleTable m_modules;
+    // The functions. While reading, only m_numberOfFunctions entries are used
+    FunctionTable m_functions;
+    uint m_numberOfFunctions;
+    // The names which cannot be accessed directly
+    cPeArena m_names;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_DELAY_IMPORT_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_EXCEPTION_H
+#define __TBA_PE_NT_DIRECTORY_EXCEPTION_H
+
+/*
+ * ntDirException.h
+ *
+ * Operation over PE exception directory (.pdata).
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirException;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirException& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the exception directory: the table of RUNTIME_FUNCTION entries,
+ * sorted by the start address of the functions.
+ *
+ * The format of an entry depends on the machine:
+ *   AMD64, IA64  - IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY (begin, end, unwind)
+ *   ARM64, ARMNT - IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY (begin, unwind). The
+ *                  end of the function is encoded in the packed unwind data
+ *                  or in the header of the .xdata record.
+ *
+ * The table isn't converted into objects. It's a view which points directly
+ * into the image when possible, otherwise it's copied once; either way it's
+ * valid as long as both the directory and the cNtHeader which it was read
+ * from are alive. The table is validated once when it's read (in range and
+ * sorted), so functionForRva is a plain binary search.
+ */
+class cNtDirException : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirException();
+
+    /*
+     * Read the exception directory of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirException(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_EXCEPTION
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     *
+     * Throw exception if the machine has an unknown table format, or if the
+     * table isn't sorted.
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // Returned by functionForRva for an address outside of any function
+    enum { INVALID_INDEX = 0xFFFFFFFF };
+
+    /*
+     * A decoded entry
+     */
+    struct RuntimeFunction {
+        // The range of the function [m_begin, m_end)
+        uint32 m_begin;
+        uint32 m_end;
+        // The RVA of the unwind information, or the packed unwind data
+        uint32 m_unwindData;
+    };
+
+    /*
+     * Returns the number of entries
+     */
+    uint getCount() const;
+
+    /*
+     * Returns the start address (RVA) of a function
+     */
+    uint32 getBegin(uint index) const;
+
+    /*
+     * Returns the end address (RVA) of a function. For ARM images whose
+     * unwind data isn't packed, it costs a read of the .xdata header.
+     */
+    uint32 getEnd(uint index) const;
+
+    /*
+     * Returns the unwind data of a function, as stored in the table
+     */
+    uint32 getUnwindData(uint index) const;
+
+    /*
+     * Decode an entry
+     */
+    void getFunction(uint index, RuntimeFunction& function) const;
+
+    /*
+     * Returns the index of the function which contains an RVA, or
+     * INVALID_INDEX. O(log n)
+     */
+    uint functionForRva(uint32 rva) const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirException(const cNtDirException& other);
+    cNtDirException& operator = (const cNtDirException& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirException& object);
+    #endif //PE_TRACE
+
+    /*
+     * Validate the table: the functions are inside the image and sorted
+     */
+    void validate(uint32 sizeOfImage) const;
+
+    // Unchecked accessors
+    uint32 beginAt(uint index) const;
+    uint32 endAt(uint index) const;
+
+    // The PE memory, used to read the .xdata records of ARM images
+    cVirtualMemoryAccesserPtr m_memory;
+    // True for the (begin, end, unwind) format
+    bool m_hasEndAddress;
+    // The unit of the function length of ARM images (in bytes)
+    uint m_instructionSize;
+    // The table: 'm_count' entries of 'm_entrySize' bytes
+    const uint8* m_table;
+    uint m_count;
+    uint m_entrySize;
+    // The copy of the table, if it cannot be accessed directly
+    cBuffer m_copy;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_EXCEPTION_H
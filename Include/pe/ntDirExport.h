@@ -49,6 +49,7 @@
 #include "pe/section.h"
 #include "pe/datastruct.h"
 #include "pe/ntheader.h"
+#include "pe/peExportIndex.h"
 
 #define ENTRYPOINT_NAME (XSTL_STRING("EntryPoint"))
 
@@ -90,6 +91,16 @@ public:
      */
     cNtDirExport(const cNtHeader& header);
 
+    // How read() fetches the tables
+    enum ReadMode {
+        // The whole directory is read at once, the three arrays and the
+        // names are decoded from it. Arrays and names which are outside the
+        // directory cost a read each
+        READ_BULK,
+        // Each element is read by itself
+        READ_PER_ELEMENT
+    };
+
     /*
      * Reads the export table from a stream
      *
@@ -98,10 +109,17 @@ public:
      *             module is loaded on.
      * entryPoint - The address of the PE entry point, if not 0,
      *              for adding to the end of the export table.
+     * is64bit - Set for PE32+ images. Selects the encoding of the addresses.
+     * mode - See ReadMode.
+     *
+     * NOTE: The stream should hold the export directory only: functions whose
+     *       address falls inside it are forwarders.
      */
     void read(basicInput& stream,
               addressNumericValue imageBase = 0,
-              addressNumericValue entryPoint = 0);
+              addressNumericValue entryPoint = 0,
+              bool is64bit = false,
+              ReadMode mode = READ_BULK);
 
     /*
      * See cNtDirectory::isMyDir
@@ -139,6 +157,12 @@ public:
         remoteAddressNumericValue m_address;
         // The ordinal number
         uint16 m_ordinal;
+        // Set to true if the function is forwarded to another module. The
+        // address of a forwarder is the RVA of 'm_forwarder' inside the
+        // export directory, not code
+        bool m_isForwarder;
+        // The forwarder string: "DLL.Function" or "DLL.#ordinal"
+        cString m_forwarder;
 
         // See cSerializedObject::isValid.
         virtual bool isValid() const;
@@ -150,13 +174,112 @@ public:
     typedef cArray<cExportEntrie> ExportTable;
 
     /*
-     * Returns the export table
+     * Returns the export table.
+     *
+     * The exports are stored by the lookup index (see getIndex). The table is
+     * built out of it on the first call, and kept until the next read.
+     * NOTE: The first call isn't thread-safe.
      */
     const ExportTable& getExportArray() const;
 
+    /*
+     * Returns the lookup index of the export table. See cPeExportIndex.
+     * The entry point isn't part of the index.
+     */
+    const cPeExportIndex& getIndex() const;
+
+    /*
+     * Find an export by its name, or by its (biased) ordinal, in O(1).
+     * Return false if there is no such export.
+     */
+    bool findByName(const char* name, cPeExportIndex::Export& entry) const;
+    bool findByOrdinal(uint ordinal, cPeExportIndex::Export& entry) const;
+
 private:
     // Private members
 
+    /*
+     * Drop the exports of the previous read. See cNtDirExport::read
+     */
+    void clear(addressNumericValue entryPoint, bool is64bit);
+
+    /*
+     * Read the export table into the index, element by element. See
+     * cNtDirExport::read
+     */
+    void readTable(basicInput& stream, addressNumericValue imageBase);
+
+    /*
+     * Decode the export table out of the memory of the directory. See
+     * cNtDirExport::read. 'stream' is used for the parts which are outside
+     * the directory.
+     */
+    void readView(const uint8* view,
+                  uint viewSize,
+                  basicInput& stream,
+                  addressNumericValue imageBase,
+                  addressNumericValue entryPoint,
+                  bool is64bit);
+
+    /*
+     * Decode the export table into the index. See readView
+     */
+    void readBulk(const uint8* view,
+                  uint viewSize,
+                  basicInput& stream,
+                  addressNumericValue imageBase);
+
+    /*
+     * Build m_exportFunctions out of the index. See getExportArray
+     */
+    void buildExportArray() const;
+
+    /*
+     * Returns an array of 'size' bytes at 'offset' from the beginning of the
+     * directory: inside the view, or read into 'copy'.
+     *
+     * Throw exception if the array exceeds the stream.
+     */
+    static const uint8* readArray(const uint8* view,
+                                  uint viewSize,
+                                  basicInput& stream,
+                                  uint mpos,
+                                  addressNumericValue offset,
+                                  uint64 size,
+                                  cBuffer& copy);
+
+    /*
+     * Returns a count of the export directory limited to MAX_FUNCTIONS (see
+     * cPeExportIndex) and to the number of 'elementSize' bytes elements which
+     * 'available' bytes can hold.
+     */
+    static uint limitCount(uint32 count, uint elementSize, uint64 available);
+
+    /*
+     * Returns a string at 'offset' from the beginning of the directory:
+     * inside the view, or read into 'buffer'. The string isn't necessarily
+     * null-terminated, see 'length'.
+     */
+    static const char* readString(const uint8* view,
+                                  uint viewSize,
+                                  basicInput& stream,
+                                  uint mpos,
+                                  addressNumericValue offset,
+                                  cSArray<char>& buffer,
+                                  uint& length);
+
+    /*
+     * Convert a string into 'buffer'. Returns the length of the string.
+     */
+    static uint toAscii(const cString& string, cSArray<char>& buffer);
+
+    /*
+     * Convert an ASCII string into a cString, using 'buffer'
+     */
+    static cString toString(const char* string,
+                            uint length,
+                            cSArray<character>& buffer);
+
     // Deny copy-constructor and operator =
     cNtDirExport(const cNtDirExport& other);
     cNtDirExport& operator = (const cNtDirExport& other);
@@ -169,8 +292,15 @@ private:
 
     // The IMAGE_EXPORT_DIRECTORY header for the export table
     IMAGE_EXPORT_DIRECTORY m_exportDirectory;
-    // A list of all exported functions
-    ExportTable m_exportFunctions;
+    // The exports. See getExportArray
+    cPeExportIndex m_index;
+    // A list of all exported functions, built on demand out of m_index
+    mutable ExportTable m_exportFunctions;
+    mutable bool m_isExportArrayBuilt;
+    // The entry point which ends the table, or 0. See cNtDirExport::read
+    addressNumericValue m_entryPoint;
+    // Selects the encoding of the addresses of the table
+    bool m_is64bit;
     // The name of the module (this) which export these functions
     cString m_moduleName;
 };
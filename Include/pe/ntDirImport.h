@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_IMPORT_H
+#define __TBA_PE_NT_DIRECTORY_IMPORT_H
+
+/*
+ * ntDirImport.h
+ *
+ * Operation over PE import table.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirImport;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirImport& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the import directory: the IMAGE_IMPORT_DESCRIPTOR array and the
+ * import name table (INT) of each module.
+ *
+ * The table is stored flat. The modules and the functions are kept in two
+ * arrays, the functions of a module are a consecutive range of the functions
+ * array, and all the names (of modules and of functions) are null-terminated
+ * strings inside a single string pool. Entries refer to names by their offset
+ * in the pool. Reading a table costs a handful of allocations regardless of
+ * the number of imports.
+ */
+class cNtDirImport : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirImport();
+
+    /*
+     * Read the import table of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirImport(const cNtHeader& header);
+
+    /*
+     * Reads the import table from the memory of an image.
+     *
+     * memory - The memory of the image, addressed by RVA. See
+     *          cNtHeader::getPeMemory
+     * address - The RVA of the IMAGE_IMPORT_DESCRIPTOR array
+     * size - The size of the directory. Used as a hint only: like the loader,
+     *        the array ends with the null descriptor.
+     * is64bit - Set for PE32+ images. Selects the size of the thunks.
+     *
+     * Throw exception if the descriptors or the names cannot be read.
+     */
+    void read(const cVirtualMemoryAccesser& memory,
+              addressNumericValue address,
+              uint size,
+              bool is64bit = false);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_IMPORT
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // Marks an entry without a name (an import by ordinal)
+    enum { NO_NAME = 0xFFFFFFFF };
+
+    // Sanity limits for broken tables
+    enum {
+        MAX_MODULES = 0x1000,
+        MAX_MODULE_FUNCTIONS = 0x10000,
+        MAX_NAME_LENGTH = 0x1000
+    };
+
+    /*
+     * A module (DLL) which the image imports from
+     */
+    struct ImportModule {
+        // The descriptor, as stored in the image
+        IMAGE_IMPORT_DESCRIPTOR m_descriptor;
+        // The offset of the module name in the string pool
+        uint m_name;
+        // The functions of the module are
+        // [m_firstFunction, m_firstFunction + m_numberOfFunctions)
+        uint m_firstFunction;
+        uint m_numberOfFunctions;
+    };
+    typedef cArray<ImportModule> ModuleTable;
+
+    /*
+     * A single imported function
+     */
+    struct ImportFunction {
+        // The offset of the function name in the string pool, or NO_NAME for
+        // an import by ordinal
+        uint m_name;
+        // The hint of a named import, or the ordinal
+        uint16 m_hint;
+        // The RVA of the IAT slot which receives the address of the function
+        uint32 m_iatAddress;
+    };
+    typedef cArray<ImportFunction> FunctionTable;
+
+    /*
+     * Returns the imported modules
+     */
+    const ModuleTable& getModules() const;
+
+    /*
+     * Returns the imported functions of all the modules
+     */
+    const FunctionTable& getFunctions() const;
+
+    /*
+     * Returns a null-terminated name out of the string pool.
+     *
+     * name - ImportModule::m_name or ImportFunction::m_name. Must not be
+     *        NO_NAME.
+     */
+    const char* getName(uint name) const;
+
+    /*
+     * Returns the name of a module
+     */
+    const char* getModuleName(const ImportModule& module) const;
+
+    /*
+     * Returns the index of a module by its name (case insensitive), or
+     * NO_NAME if the module isn't imported.
+     */
+    uint findModule(const char* name) const;
+
+    /*
+     * Returns true if two module names are equal. Module names are case
+     * insensitive.
+     */
+    static bool isSameModuleName(const char* name, const char* other);
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirImport(const cNtDirImport& other);
+    cNtDirImport& operator = (const cNtDirImport& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirImport& object);
+    #endif //PE_TRACE
+
+    /*
+     * Read the thunks of a single module. Instantiated for each flavour, see
+     * peTraits.h
+     */
+    template <class Traits>
+    void readThunks(const cVirtualMemoryAccesser& memory,
+                    ImportModule& module);
+
+    /*
+     * Copy a null-terminated string from the image to the end of the string
+     * pool. Returns the offset of the string.
+     */
+    uint readName(const cVirtualMemoryAccesser& memory,
+                  addressNumericValue address);
+
+    /*
+     * Append a function to the function table. Returns the new entry.
+     */
+    ImportFunction& appendFunction();
+
+    /*
+     * Make room for 'size' bytes in the string pool
+     */
+    void reserveStringPool(uint size);
+
+    // The modules
+    ModuleTable m_modules;
+    // The functions. While reading, only m_numberOfFunctions entries are used
+    FunctionTable m_functions;
+    uint m_numberOfFunctions;
+    // The names. m_stringPoolSize bytes are used
+    cArray<char> m_stringPool;
+    uint m_stringPoolSize;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_IMPORT_H
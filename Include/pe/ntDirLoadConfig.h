@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_LOAD_CONFIG_H
+#define __TBA_PE_NT_DIRECTORY_LOAD_CONFIG_H
+
+/*
+ * ntDirLoadConfig.h
+ *
+ * Operation over PE load configuration directory.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirLoadConfig;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirLoadConfig& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the load configuration directory: the security cookie, the SafeSEH
+ * handlers, the control-flow-guard metadata and the dynamic relocations.
+ *
+ * The directory is size-versioned: its first field is the size of the
+ * structure, which grows with every Windows release. Only 'Size' bytes are
+ * read (up to the newest known layout), and the fields beyond it are zero.
+ *
+ * The tables (SafeSEH, guard CF functions etc.) are arrays of RVAs, each
+ * optionally followed by metadata bytes. They're views: they point directly
+ * into the image when possible, otherwise they're copied once. Either way,
+ * the tables are valid as long as both the directory and the cNtHeader which
+ * it was read from are alive.
+ */
+class cNtDirLoadConfig : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirLoadConfig();
+
+    /*
+     * Read the load configuration directory of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirLoadConfig(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // An address which cannot be translated into an RVA
+    enum { INVALID_RVA = 0xFFFFFFFF };
+
+    // The tables of the directory
+    enum {
+        // The SafeSEH handlers (PE32 only)
+        TABLE_SEHANDLERS,
+        // The valid targets of indirect calls
+        TABLE_GUARD_CF_FUNCTIONS,
+        // The IAT entries whose address is taken
+        TABLE_GUARD_ADDRESS_TAKEN_IAT,
+        // The valid targets of longjmp
+        TABLE_GUARD_LONGJUMP_TARGETS,
+        // The valid targets of exception-handling continuations
+        TABLE_GUARD_EH_CONTINUATIONS,
+        NUMBER_OF_TABLES
+    };
+
+    /*
+     * A table of RVAs
+     */
+    struct RvaTable {
+        // The raw table: 'm_count' entries of 'm_stride' bytes. Each entry is
+        // an RVA followed by 'm_stride - 4' bytes of metadata
+        const uint8* m_data;
+        uint m_count;
+        uint m_stride;
+
+        /*
+         * Returns the RVA of an entry
+         */
+        uint32 getRva(uint index) const;
+
+        /*
+         * Returns the first metadata byte of an entry (e.g.
+         * IMAGE_GUARD_FLAG_XXX), or 0 if the entries don't have metadata
+         */
+        uint8 getFlags(uint index) const;
+    };
+
+    /*
+     * Returns the directory, as stored in the image. The fields of a PE32
+     * directory are zero extended, and the fields beyond 'Size' are zero.
+     */
+    const IMAGE_LOAD_CONFIG_DIRECTORY64& getDirectory() const;
+
+    /*
+     * Returns the RVA of the security cookie, or INVALID_RVA if the image
+     * doesn't have one
+     */
+    uint32 getSecurityCookie() const;
+
+    /*
+     * Returns the guard flags (IMAGE_GUARD_XXX)
+     */
+    uint32 getGuardFlags() const;
+
+    /*
+     * Returns the RVA of the dynamic value relocation table, or INVALID_RVA
+     */
+    uint32 getDynamicRelocationTable() const;
+
+    /*
+     * Returns a table (TABLE_XXX). Missing tables are empty.
+     */
+    const RvaTable& getTable(uint table) const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirLoadConfig(const cNtDirLoadConfig& other);
+    cNtDirLoadConfig& operator = (const cNtDirLoadConfig& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirLoadConfig& object);
+    #endif //PE_TRACE
+
+    /*
+     * Read the directory, up to its size. Instantiated for each flavour, see
+     * peTraits.h
+     */
+    template <class Traits>
+    void readLoadConfig(const cVirtualMemoryAccesser& memory,
+                        addressNumericValue address);
+
+    /*
+     * Locate a table and fill m_tables[table]
+     */
+    void readTable(const cNtHeader& header,
+                   const cVirtualMemoryAccesser& memory,
+                   uint table,
+                   uint64 address,
+                   uint64 count,
+                   uint stride);
+
+    /*
+     * Translate a virtual address of the image into an RVA, or INVALID_RVA
+     */
+    static uint32 toRva(const cNtHeader& header, uint64 address);
+
+    // The directory
+    IMAGE_LOAD_CONFIG_DIRECTORY64 m_directory;
+    // The translated pointers
+    uint32 m_securityCookie;
+    uint32 m_dynamicRelocationTable;
+    // The tables, and the copies of the tables which cannot be accessed
+    // directly
+    RvaTable m_tables[NUMBER_OF_TABLES];
+    cBuffer m_copies[NUMBER_OF_TABLES];
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_LOAD_CONFIG_H
@@ -53,18 +53,25 @@
 /*
  * Forward declaration for output streams
  */
-/*
 #ifdef PE_TRACE
 class cNtDirReloc;
 cStringerStream& operator << (cStringerStream& out,
                               const cNtDirReloc& object);
 #endif // PE_TRACE
-*/
 
 /*
- * Handles the ".reloc" section - The relocation table section.
- * Read the section from stream. Provide a set of access utilities and allow
- * to write-back the reloc section.
+ * Handles the ".reloc" section - The base relocation table.
+ *
+ * The table is kept in its own compact form: one block for each relocated
+ * page, and a single array of the packed 16 bit entries of all the blocks
+ * (the type in the upper 4 bits, the offset inside the page in the lower 12
+ * bits). The IMAGE_REL_BASED_ABSOLUTE padding entries are dropped. So each
+ * relocation costs 2 bytes, and each page 12 bytes.
+ *
+ * All the relocation types are kept, whatever the machine. An
+ * IMAGE_REL_BASED_HIGHADJ entry is followed by its parameter (the low 16
+ * bits of the adjusted value), which is stored as the next entry of the
+ * block. The meaning of some types depends on the machine, see getPatchSize.
  */
 class cNtDirReloc : public cNtDirectory {
 public:
@@ -91,7 +98,10 @@ public:
     /*
      * Reads the reloc table from a stream
      *
-     * stream - The stream to read the information from.
+     * stream  - The stream to read the information from. The table ends at
+     *           the end of the stream, or at a block whose size is 0.
+     *
+     * Throw exception if a block is malformed.
      */
     void read(basicInput& stream);
 
@@ -109,57 +119,73 @@ public:
                                uint directoryTypeIndex = UNKNOWNDIR);
 
     /*
-     * Describe a single offset entry within the reloc directory.
-     *
-     * Author: Tal Harel
+     * The relocations of a single page
      */
-    class cRelocEntry : public cSerializedObject {
-    public:
-        // Constructor, copy-constructor, operator = will auto-generated by the
-        // compiler
-
-        /*
-         * Overrides the '>' operator for this class, to be able to sort
-         * reloc offsets according to their addresses
-         */
-        bool operator > (const cNtDirReloc::cRelocEntry &other) const;
-
-        // The virtual (relative) address of the reloc offset
-        remoteAddressNumericValue m_offsetAddress;
-        // The virtual (relative) address of the content the offset points to
-        //remoteAddressNumericValue m_contentAddress;
-
-        // See cSerializedObject::isValid.
-        virtual bool isValid() const;
-        // See cSerializedObject::serialize.
-        virtual void serialize(basicOutput& stream) const;
-        // See cSerializedObject::deserialize.
-        virtual void deserialize(basicInput& stream);
+    struct Block {
+        // The RVA of the page
+        uint32 m_pageRva;
+        // The entries of the block: 'm_count' entries starting at index
+        // 'm_first' of getEntries()
+        uint32 m_first;
+        uint32 m_count;
     };
-    typedef cArray<cRelocEntry> RelocTable;
+    typedef cArray<Block> BlockTable;
+    typedef cArray<uint16> EntryTable;
 
     /*
-     * Returns the export table
+     * Returns the blocks, in the order of the table
      */
-    const RelocTable& getRelocArray() const;
+    const BlockTable& getBlocks() const;
 
-private:
-    // Private members
+    /*
+     * Returns the packed entries of all the blocks
+     */
+    const EntryTable& getEntries() const;
+
+    /*
+     * Returns the number of relocations (the parameters of HIGHADJ entries
+     * aren't counted)
+     */
+    uint getNumberOfRelocations() const;
 
+    /*
+     * Returns the type (IMAGE_REL_BASED_XXX) of an entry, and its offset
+     * inside the page
+     */
+    static uint getType(uint16 entry);
+    static uint getOffset(uint16 entry);
+
+    /*
+     * Returns true if an entry of the type is followed by a parameter entry
+     */
+    static bool hasParameter(uint type);
+
+    /*
+     * Returns the number of bytes which are patched by a relocation type on a
+     * machine (IMAGE_FILE_MACHINE_XXX), or 0 for types which are unknown for
+     * the machine. E.g. IMAGE_REL_BASED_ARM_MOV32 patches a MOVW/MOVT pair (8
+     * bytes) while IMAGE_REL_BASED_MIPS_JMPADDR, of the same value, patches
+     * a single instruction.
+     */
+    static uint getPatchSize(uint16 machine, uint type);
+
+private:
     // Deny copy-constructor and operator =
     cNtDirReloc(const cNtDirReloc& other);
     cNtDirReloc& operator = (const cNtDirReloc& other);
 
     // The friendly trace
-    /*
     #ifdef PE_TRACE
     friend cStringerStream& operator << (cStringerStream& out,
                                          const cNtDirReloc& object);
     #endif //PE_TRACE
-    */
 
-    // A list of all relocated offsets
-    RelocTable m_relocOffsets;
+    // The blocks
+    BlockTable m_blocks;
+    // The entries of all the blocks
+    EntryTable m_entries;
+    // The number of relocations
+    uint m_numberOfRelocations;
 };
 
 #endif // __TBA_STL_PE_NT_DIRECTORY_RELOC_H
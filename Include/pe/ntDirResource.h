@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_RESOURCE_H
+#define __TBA_PE_NT_DIRECTORY_RESOURCE_H
+
+/*
+ * ntDirResource.h
+ *
+ * Operation over PE resource tree.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirResource;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirResource& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the resource directory: the tree of IMAGE_RESOURCE_DIRECTORY
+ * tables which is indexed by type, name and language.
+ *
+ * The tree is walked lazily. Nothing but the root table is read when the
+ * directory is opened, and a lookup reads only the entries which a binary
+ * search over each level touches. The entries of a table are sorted (names
+ * first, then ids), which is what the loader relies on as well.
+ *
+ * The payload of a resource is returned as a cMemoryAccesserStream over the
+ * PE memory, so it's never copied by the directory.
+ *
+ * The tree may be broken on purpose: every offset is checked against the
+ * directory size and the depth of a walk is limited to MAX_DEPTH levels, so
+ * a table which points back at one of its parents cannot loop.
+ */
+class cNtDirResource : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirResource();
+
+    /*
+     * Open the resource tree of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirResource(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_RESOURCE
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // The common resource types
+    enum {
+        TYPE_CURSOR = 1,
+        TYPE_BITMAP = 2,
+        TYPE_ICON = 3,
+        TYPE_MENU = 4,
+        TYPE_DIALOG = 5,
+        TYPE_STRING = 6,
+        TYPE_RCDATA = 10,
+        TYPE_MESSAGETABLE = 11,
+        TYPE_GROUP_CURSOR = 12,
+        TYPE_GROUP_ICON = 14,
+        TYPE_VERSION = 16,
+        TYPE_MANIFEST = 24
+    };
+
+    // Matches any language at find()
+    enum { ANY_LANGUAGE = 0xFFFFFFFF };
+
+    // The levels of a standard tree are type, name and language. Deeper trees
+    // are walked up to this limit
+    enum { MAX_DEPTH = 8 };
+
+    // The longest name which can be matched
+    enum { MAX_NAME_LENGTH = 0x100 };
+
+    /*
+     * Identifies an entry of a table: either an integer id or a name. Names
+     * are matched against the UTF-16 names of the tree case insensitively.
+     */
+    struct ResourceId {
+        ResourceId(uint16 id) : m_name(NULL), m_id(id) {}
+        ResourceId(const char* name) : m_name(name), m_id(0) {}
+
+        // The name, or NULL for an id
+        const char* m_name;
+        uint16 m_id;
+    };
+
+    /*
+     * A table of the tree
+     */
+    struct Table {
+        // The offset of the IMAGE_RESOURCE_DIRECTORY from the beginning of
+        // the directory
+        uint32 m_offset;
+        // The level of the table, 0 for the root
+        uint m_depth;
+        uint16 m_numberOfNamedEntries;
+        uint16 m_numberOfIdEntries;
+    };
+
+    /*
+     * Returns the root table
+     */
+    const Table& getRoot() const;
+
+    /*
+     * Returns the number of entries of a table
+     */
+    uint getEntriesCount(const Table& table) const;
+
+    /*
+     * Read an entry of a table.
+     *
+     * Throw exception if the entry cannot be read.
+     */
+    void getEntry(const Table& table,
+                  uint index,
+                  IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const;
+
+    /*
+     * Search an entry of a table. Returns false if the entry cannot be found.
+     */
+    bool findEntry(const Table& table,
+                   const ResourceId& id,
+                   IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const;
+
+    /*
+     * Open the table which an entry points to.
+     *
+     * Throw exception if the entry is a leaf, or if the table is out of the
+     * directory or too deep.
+     */
+    Table openTable(const Table& parent,
+                    const IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const;
+
+    /*
+     * Read the leaf which an entry points to.
+     *
+     * Throw exception if the entry is a table or cannot be read.
+     */
+    void readDataEntry(const IMAGE_RESOURCE_DIRECTORY_ENTRY& entry,
+                       IMAGE_RESOURCE_DATA_ENTRY& data) const;
+
+    /*
+     * Search a resource by its type, its name and its language. ANY_LANGUAGE
+     * prefers the neutral language, and takes the first language otherwise.
+     *
+     * Returns false if the resource cannot be found.
+     */
+    bool find(const ResourceId& type,
+              const ResourceId& name,
+              uint language,
+              IMAGE_RESOURCE_DATA_ENTRY& data) const;
+
+    /*
+     * Returns a stream over the payload of a resource. The stream refers to
+     * the PE memory, so it's valid as long as the cNtHeader is alive.
+     */
+    cMemoryAccesserStreamPtr getData(
+                                const IMAGE_RESOURCE_DATA_ENTRY& data) const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirResource(const cNtDirResource& other);
+    cNtDirResource& operator = (const cNtDirResource& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirResource& object);
+    #endif //PE_TRACE
+
+    /*
+     * Read a table header at 'offset' from the beginning of the directory
+     */
+    Table readTable(uint32 offset, uint depth) const;
+
+    /*
+     * Read 'length' bytes at 'offset' from the beginning of the directory.
+     * Throw exception if the bytes are out of the directory.
+     */
+    void readDirectoryBytes(uint32 offset, void* buffer, uint length) const;
+
+    /*
+     * Compare a name to the name of an entry, the way the loader sorts the
+     * names. Returns a negative number if 'name' comes before the entry name,
+     * 0 if they are equal, and a positive number otherwise.
+     */
+    int compareName(const char* name,
+                    const IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const;
+
+    // The PE memory
+    cVirtualMemoryAccesserPtr m_memory;
+    // The RVA and the size of the directory
+    uint32 m_address;
+    uint32 m_size;
+    // The root table
+    Table m_root;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_RESOURCE_H
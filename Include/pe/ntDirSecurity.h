@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_SECURITY_H
+#define __TBA_PE_NT_DIRECTORY_SECURITY_H
+
+/*
+ * ntDirSecurity.h
+ *
+ * Operation over PE security directory (the certificate table).
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirSecurity;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirSecurity& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the security directory: the WIN_CERTIFICATE entries which hold the
+ * Authenticode signatures (PKCS#7 SignedData blobs).
+ *
+ * Unlike any other directory, the VirtualAddress of the security directory is
+ * a file offset. The table isn't mapped by the loader and it's usually
+ * appended at the end of the file, outside of any section, so it cannot be
+ * read through the PE memory (cNtHeader::getPeMemory). It's read from the raw
+ * file instead, see cNtHeader::getFileStream.
+ *
+ * The certificates are views: they point directly into the file when the
+ * header has a direct pointer to the table (e.g. a mapped file), otherwise
+ * the table is copied once. Either way, the views are valid as long as both
+ * the directory and the cNtHeader which it was read from are alive.
+ */
+class cNtDirSecurity : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirSecurity();
+
+    /*
+     * Read the certificate table of a PE file.
+     *
+     * Throw exception if the header wasn't read from a file image.
+     */
+    cNtDirSecurity(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_SECURITY
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // Sanity limit for broken tables
+    enum { MAX_CERTIFICATES = 0x40 };
+
+    /*
+     * A certificate entry
+     */
+    struct Certificate {
+        // The file offset of the entry
+        uint32 m_offset;
+        // WIN_CERT_REVISION_XXX
+        uint16 m_revision;
+        // WIN_CERT_TYPE_XXX
+        uint16 m_type;
+        // The certificate itself (bCertificate). For the
+        // WIN_CERT_TYPE_PKCS_SIGNED_DATA type it's a DER encoded PKCS#7
+        // SignedData
+        const uint8* m_data;
+        uint m_length;
+    };
+    typedef cArray<Certificate> CertificateTable;
+
+    /*
+     * Returns the entries
+     */
+    const CertificateTable& getCertificates() const;
+
+    /*
+     * Returns the index of the first entry of a type (WIN_CERT_TYPE_XXX), or
+     * MAX_CERTIFICATES if there is no such entry.
+     */
+    uint findCertificate(uint16 type) const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirSecurity(const cNtDirSecurity& other);
+    cNtDirSecurity& operator = (const cNtDirSecurity& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirSecurity& object);
+    #endif //PE_TRACE
+
+    /*
+     * Split the table into its entries
+     */
+    void readEntries(const uint8* table, uint32 offset, uint size);
+
+    // The entries
+    CertificateTable m_certificates;
+    // The copy of the table, if it cannot be accessed directly
+    cBuffer m_copy;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_SECURITY_H
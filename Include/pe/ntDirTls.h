@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_NT_DIRECTORY_TLS_H
+#define __TBA_PE_NT_DIRECTORY_TLS_H
+
+/*
+ * ntDirTls.h
+ *
+ * Operation over PE thread-local-storage directory.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/ntdir.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * Forward deceleration for output streams
+ */
+#ifdef PE_TRACE
+class cNtDirTls;
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirTls& object);
+#endif // PE_TRACE
+
+/*
+ * Handles the TLS directory: the template of the thread-local data and the
+ * array of the TLS callbacks, which the loader invokes before the entry point.
+ *
+ * The directory holds virtual addresses. They are translated into RVAs
+ * according to the image base which the PE was loaded to (see
+ * cNtHeader::vaToRva). A callback which points outside the image is kept with
+ * an INVALID_RVA.
+ *
+ * The callback array is read at once: it's taken directly out of the image
+ * when possible, otherwise it's read with a single memread which is bounded by
+ * MAX_CALLBACKS and by the end of the image.
+ */
+class cNtDirTls : public cNtDirectory {
+public:
+    /*
+     * Default constructor.
+     */
+    cNtDirTls();
+
+    /*
+     * Read the TLS directory of a PE image.
+     *
+     * Throw exception if the header doesn't contain a reference for the memory
+     * of the PE file.
+     */
+    cNtDirTls(const cNtHeader& header);
+
+    /*
+     * See cNtDirectory::isMyDir
+     * Return true on the IMAGE_DIRECTORY_ENTRY_TLS
+     */
+    virtual bool isMyDir(uint directoryTypeIndex);
+
+    /*
+     * See cNtDirectory::readDirectory
+     * See cNtDirectory::cNtDirectory(const cNtHeader&)
+     */
+    virtual void readDirectory(const cNtHeader& image,
+                               uint directoryTypeIndex = UNKNOWNDIR);
+
+    // The maximum number of callbacks which are read. Longer arrays (or
+    // arrays without a terminator) are truncated
+    enum { MAX_CALLBACKS = 0x100 };
+
+    // An address which cannot be translated into an RVA
+    enum { INVALID_RVA = 0xFFFFFFFF };
+
+    /*
+     * A TLS callback
+     */
+    struct TlsCallback {
+        // The virtual address, as stored in the image
+        uint64 m_address;
+        // The RVA, or INVALID_RVA if the callback is outside the image
+        uint32 m_rva;
+    };
+    typedef cArray<TlsCallback> CallbackTable;
+
+    /*
+     * Returns the directory, as stored in the image. The fields of a PE32
+     * directory are zero extended.
+     */
+    const IMAGE_TLS_DIRECTORY64& getDirectory() const;
+
+    /*
+     * Returns the RVAs of the fields of the directory, or INVALID_RVA for a
+     * field which is 0 or outside the image
+     */
+    uint32 getRawDataStart() const;
+    uint32 getRawDataEnd() const;
+    uint32 getIndexAddress() const;
+    uint32 getCallbacksAddress() const;
+
+    /*
+     * Returns the TLS callbacks, in the order which they are invoked
+     */
+    const CallbackTable& getCallbacks() const;
+
+private:
+    // Deny copy-constructor and operator =
+    cNtDirTls(const cNtDirTls& other);
+    cNtDirTls& operator = (const cNtDirTls& other);
+
+    // The friendly trace
+    #ifdef PE_TRACE
+    friend cStringerStream& operator << (cStringerStream& out,
+                                         const cNtDirTls& object);
+    #endif //PE_TRACE
+
+    /*
+     * Read the directory and the callback array. Instantiated for each
+     * flavour, see peTraits.h
+     */
+    template <class Traits>
+    void readTls(const cNtHeader& header,
+                 const cVirtualMemoryAccesser& memory,
+                 addressNumericValue address);
+
+    /*
+     * Translate a virtual address of the image into an RVA, or INVALID_RVA
+     */
+    static uint32 toRva(const cNtHeader& header, uint64 address);
+
+    // The directory
+    IMAGE_TLS_DIRECTORY64 m_directory;
+    // The translated fields
+    uint32 m_rawDataStart;
+    uint32 m_rawDataEnd;
+    uint32 m_indexAddress;
+    uint32 m_callbacksAddress;
+    // The callbacks
+    CallbackTable m_callbacks;
+};
+
+#endif // __TBA_PE_NT_DIRECTORY_TLS_H
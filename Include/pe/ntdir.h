@@ -40,6 +40,7 @@
  * Author: Elad Raz <e@eladraz.com>
  */
 #include "xStl/types.h"
+#include "xStl/data/smartptr.h"
 #include "xStl/os/virtualMemoryAccesser.h"
 #include "pe/ntheader.h"
 
@@ -83,4 +84,7 @@ public:
     // TODO! Incase of chain-of-responsibilities implementation. add clone() API
 };
 
+// The reference-countable directory object
+typedef cSmartPtr<cNtDirectory> cNtDirectoryPtr;
+
 #endif // __TBA_PE_NT_DIR_H
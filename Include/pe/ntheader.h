@@ -45,6 +45,7 @@
 #include "xStl/data/list.h"
 #include "xStl/data/string.h"
 #include "xStl/data/smartptr.h"
+#include "xStl/remoteAddress.h"
 #include "xStl/os/virtualMemoryAccesser.h"
 #include "xStl/stream/basicIO.h"
 #include "xStl/stream/forkStream.h"
@@ -52,6 +53,7 @@
 #include "xStl/stream/memoryAccesserStream.h"
 #include "pe/section.h"
 #include "pe/ntsectionheader.h"
+#include "pe/peArena.h"
 
 /*
  * Forward deceleration for output streams
@@ -78,23 +80,40 @@ public:
     /*
      * Read the file-header from a file.
      *
-     * See cNtHeader::read for more information
+     * See cNtHeader::read for more information.
+     *
+     * The reading constructors accept an arena for the section headers. The
+     * sections keep the chunks of the arena until they are deleted, even if
+     * the arena is destroyed before them (e.g. through getSections). See
+     * peArena.h
      */
     cNtHeader(basicInput& stream,
               addressNumericValue trueImageBase = 0,
               bool shouldReadSections = true,
-              bool isMemory = false);
+              bool isMemory = false,
+              const cForkStream* lazyStream = NULL,
+              cPeArena* arena = NULL);
 
     /*
      * Read the file-header from a live PE image
-     * NOTE: In this version of implementation 'isMemory' must be true
      *
      * See cNtHeader::read for more information
      */
     cNtHeader(cMemoryAccesserStream& stream,
               addressNumericValue trueImageBase = 0,
               bool shouldReadSections = true,
-              bool isMemory = true);
+              bool isMemory = true,
+              cPeArena* arena = NULL);
+
+    /*
+     * Map a PE file from the disk and read it's file-header.
+     *
+     * See cNtHeader::readFile for more information
+     */
+    cNtHeader(const cString& filename,
+              addressNumericValue trueImageBase = 0,
+              bool shouldReadSections = true,
+              cPeArena* arena = NULL);
 
     // Operator = and copy-constructor will auto-generated by the compiler
 
@@ -125,6 +144,52 @@ public:
      */
     cNtHeader& operator = (const IMAGE_NT_HEADERS32& other);
 
+    /*
+     * Returns the arena which the sections are allocated from, or NULL for
+     * the heap. See cNtHeader::cNtHeader
+     */
+    cPeArena* getArena() const;
+
+    // PE32+ support. The object always exposes the IMAGE_NT_HEADERS32 layout.
+    // For PE32+ images the fields which are wider in the 64 bit optional
+    // header (ImageBase and the stack/heap sizes) and BaseOfData are zero.
+    // Use the accessors below, which are valid for both flavours.
+
+    /*
+     * Returns true for PE32+ (64 bit) images. See peTraits.h
+     */
+    bool is64bit() const;
+
+    /*
+     * Returns the preferred image base address of the image, for both PE32
+     * and PE32+ images.
+     */
+    uint64 getImageBase() const;
+
+    /*
+     * Returns the stack and the heap sizes of the image, for both PE32 and
+     * PE32+ images.
+     */
+    uint64 getSizeOfStackReserve() const;
+    uint64 getSizeOfStackCommit() const;
+    uint64 getSizeOfHeapReserve() const;
+    uint64 getSizeOfHeapCommit() const;
+
+    /*
+     * Returns the optional header of a PE32+ image.
+     *
+     * NOTE: Valid only if 'is64bit' returns true. The DataDirectory and
+     *       NumberOfRvaAndSizes of the OptionalHeader member are the
+     *       authoritative ones.
+     */
+    const IMAGE_OPTIONAL_HEADER64& getOptionalHeader64() const;
+
+    /*
+     * Returns the encoding of the virtual addresses of the image
+     * (REMOTE_ADDRESS_32BIT or REMOTE_ADDRESS_64BIT)
+     */
+    RemoteAddressEncodingType getAddressEncoding() const;
+
     /*
      * Read a NT-PE file from a stream. The stream must be pointed to the
      * beginning of the PE file header.
@@ -145,11 +210,18 @@ public:
      * 'image-base-address' and in-order to read the data, it will be seeked to
      * the 'VirtualAddress' locations, instead of the 'RawAddress' location.
      *
+     * If "lazyStream" isn't NULL only the section headers are parsed. The
+     * content of each section is read the first time the section is accessed,
+     * from a private fork of 'lazyStream' which the sections share and own.
+     * 'lazyStream' must hold the same image as 'stream' (usually it's the
+     * stream itself) and needn't outlive the call. See cNtLazySectionSource.
+     *
      * Throw exception in case of reading error
      */
     void read(basicInput& stream,
               bool shouldReadSections = true,
-              bool isMemory = false);
+              bool isMemory = false,
+              const cForkStream* lazyStream = NULL);
 
     /*
      * See cNtHeader::read.
@@ -157,12 +229,29 @@ public:
      * Read the NT-header file starting with the PE header. Instead of
      * snapshoting the image, this function uses live-image.
      *
-     * NOTE: In this version of implementation 'isMemory' must be true
+     * If "isMemory" is false the stream is treated as a file image and the
+     * sections are forked over their raw-data regions.
      */
     void read(cMemoryAccesserStream& stream,
               bool shouldReadSections = true,
               bool isMemory = true);
 
+    /*
+     * Map a PE file from the disk (mmap / MapViewOfFile) and read it. The DOS
+     * header is parsed in order to locate the PE header.
+     *
+     * The sections are not copied. Each section is a view into the mapping,
+     * which is kept alive for as long as this object (or any stream forked
+     * from a section) is alive.
+     *
+     * filename           - The full path of the PE file
+     * shouldReadSections - See cNtHeader::read
+     *
+     * Throw exception in case of reading error
+     */
+    void readFile(const cString& filename,
+                  bool shouldReadSections = true);
+
     /*
      * Write a NT-PE to a stream.
      *
@@ -203,6 +292,118 @@ public:
      */
     cVirtualMemoryAccesserPtr getPeMemory() const;
 
+    /*
+     * Returns a direct pointer to the memory of the range
+     * [rva, rva + length), or NULL if the range isn't entirely covered by a
+     * single section which is stored in a contiguous memory block.
+     *
+     * available - If not NULL, receives the number of bytes which can be
+     *             accessed through the returned pointer (at least 'length').
+     *
+     * NOTE: The pointer is valid only as long as the current object is alive.
+     */
+    const uint8* getDirectPointer(addressNumericValue rva,
+                                  uint length,
+                                  uint* available = NULL) const;
+
+    /*
+     * Sets a direct pointer to the header region of the file (the first
+     * 'SizeOfHeaders' bytes, which are mapped as-is at the image base). Used
+     * when the file was read out of a contiguous memory block (e.g. a mapped
+     * file). See getDirectPointer.
+     *
+     * NOTE: The caller must make sure that the block is at least
+     *       'SizeOfHeaders' bytes long and that it's alive as long as the
+     *       current object is alive.
+     */
+    void setDirectHeaders(const uint8* content);
+
+    // Access to the raw file. Used for the data which isn't mapped by the
+    // loader, e.g. the certificates, which are pointed by a file offset.
+
+    /*
+     * Returns a stream over the raw file which the header was read from, or
+     * an empty pointer if the header wasn't read through a memory-accesser
+     * stream of a file image.
+     */
+    cForkStreamPtr getFileStream() const;
+
+    /*
+     * Returns a direct pointer to the range [offset, offset + length) of the
+     * raw file, or NULL if the range isn't entirely covered by the block
+     * which was set by setDirectFile.
+     *
+     * NOTE: The pointer is valid only as long as the current object is alive.
+     */
+    const uint8* getDirectFilePointer(uint offset, uint length) const;
+
+    /*
+     * Sets a direct pointer to the range [offset, offset + length) of the raw
+     * file. readFile sets the entire mapping.
+     *
+     * NOTE: The caller must make sure that the block is alive as long as the
+     *       current object is alive.
+     */
+    void setDirectFile(const uint8* content, uint offset, uint length);
+
+    /*
+     * Compute the checksum of the file which the header was read from (see
+     * cPeChecksum). A direct pointer to the file is summed in place,
+     * otherwise the file is streamed through a buffer.
+     *
+     * Throw exception if the header wasn't read from a file image (see
+     * getFileStream).
+     */
+    uint32 computeChecksum() const;
+
+    /*
+     * Returns true if OptionalHeader.CheckSum matches the checksum of the
+     * file. Note that a zero CheckSum (not set) never matches.
+     *
+     * Throw exception if the header wasn't read from a file image.
+     */
+    bool verifyChecksum() const;
+
+    // Address translation. The translation follows the rules of the Windows
+    // loader: The raw-data pointer is rounded down to a 512 bytes boundary,
+    // the sizes are rounded up to the file/section alignment and the PE
+    // headers are mapped as-is at the beginning of the image.
+
+    /*
+     * Translate a relative-virtual-address into a file offset.
+     *
+     * rva    - The address to translate
+     * offset - Will be filled with the file offset
+     *
+     * Returns false if the address isn't backed by the file (not covered by
+     * any section, or inside the uninitialized tail of a section).
+     */
+    bool rvaToOffset(uint rva, uint& offset) const;
+
+    /*
+     * Translate a file offset into a relative-virtual-address.
+     *
+     * Returns false if the offset doesn't belong to the headers or to any
+     * section.
+     */
+    bool offsetToRva(uint offset, uint& rva) const;
+
+    /*
+     * Translate a virtual address into a relative-virtual-address, according
+     * to the image base the PE was loaded to.
+     *
+     * Returns false if the address is outside the image.
+     */
+    bool vaToRva(addressNumericValue va, uint& rva) const;
+
+    /*
+     * Returns the section which contains 'rva', or NULL if the address
+     * belongs to the headers or isn't inside any section.
+     *
+     * NOTE: The pointer is owned by the current object.
+     */
+    const cNtSectionHeader* sectionForRva(uint rva) const;
+
     /*
      * Scans all the virtual-address sections and return the highest possiable
      * virtual address which is in used by this PE file.
@@ -226,6 +427,38 @@ private:
                                          const cNtHeader& object);
     #endif // PE_TRACE
 
+    /*
+     * Reads the IMAGE_NT_HEADERS of a flavour (see peTraits.h) from the stream
+     * and the data directories which follow it. The stream is pointed to the
+     * PE signature.
+     */
+    template <class Traits>
+    void readHeaders(basicInput& stream);
+
+    /*
+     * Writes the IMAGE_NT_HEADERS of a flavour. See cNtHeader::write
+     */
+    template <class Traits>
+    void writeHeaders(basicIO& stream) const;
+
+    /*
+     * Copies the fields which are common to IMAGE_NT_HEADERS32 and
+     * IMAGE_NT_HEADERS64 into the object, or back from the object. The fields
+     * whose width depends on the flavour are left to the caller.
+     */
+    template <class NtHeaders>
+    void copyCommonFields(const NtHeaders& other);
+    template <class NtHeaders>
+    void exportCommonFields(NtHeaders& other) const;
+
+    /*
+     * Keeps the fields whose width depends on the flavour, widened, for the
+     * accessors (getImageBase, getSizeOfStackReserve...). Instantiated for
+     * each flavour's optional header once per parse.
+     */
+    template <class OptionalHeaderType>
+    void copyWideFields(const OptionalHeaderType& other);
+
     /*
      * After reading the sections, use this function inorder to read the memory
      * portions which aren't map to a section. This memory can usally be the
@@ -233,6 +466,49 @@ private:
      */
     void readPrivate(cMemoryAccesserStream& stream);
 
+    // An entry in the section index
+    struct SectionRange {
+        // The RVA of the section
+        addressNumericValue m_start;
+        // The RVA after the last byte of the section content
+        addressNumericValue m_end;
+        // The section itself. Owned by m_sections
+        const cNtSectionHeader* m_section;
+    };
+
+    // An entry in the address translation table
+    struct SectionMapping {
+        // The (aligned) RVA range of the section
+        uint m_virtualStart;
+        uint m_virtualEnd;
+        // The (aligned) file range of the section
+        uint m_rawStart;
+        uint m_rawEnd;
+        // The section itself. Owned by m_sections
+        const cNtSectionHeader* m_section;
+    };
+
+    /*
+     * Builds the section index out of m_sections. The index is left empty
+     * when the sections aren't sorted by their virtual address or when they
+     * overlap. In that case the memory is translated by scanning the list.
+     *
+     * The address translation table is built as well.
+     */
+    void buildSectionIndex();
+
+    /*
+     * Returns the translation entry of the section which contains 'rva', or
+     * NULL if there isn't any.
+     */
+    const SectionMapping* findSectionMapping(uint rva) const;
+
+    /*
+     * Returns the last section in the index which starts at or before 'rva',
+     * or NULL if there isn't any.
+     */
+    const SectionRange* findSectionRange(addressNumericValue rva) const;
+
     /*
      * Private PE memory mapper. Generated by the 'getPeMemory' subroutine.
      * The memory-accesser reads the memory using direct access to the content
@@ -264,6 +540,32 @@ private:
         virtual bool isWritableInterface() const;
 
     private:
+        /*
+         * Reads 'length' bytes starting at 'offset' inside the section
+         * content. Uses the direct pointer if it exists.
+         */
+        static void readSection(const cNtSectionHeader& section,
+                                addressNumericValue offset,
+                                uint8* buffer,
+                                uint length);
+
+        /*
+         * Fill memory which isn't covered by any section. The header region
+         * is read from the file when it's available (see m_headerImage), the
+         * rest is filled with IMAGE_RDATA_CELL_CODE.
+         */
+        void readGap(addressNumericValue address,
+                     uint8* buffer,
+                     uint length) const;
+
+        /*
+         * Translate the memory by scanning all the sections. Used when the
+         * section index is empty.
+         */
+        void memreadLinear(addressNumericValue address,
+                           uint8* buffer,
+                           uint length) const;
+
         // Only the cNtHeader can generate this object
         friend class cNtHeader;
         // Constructor
@@ -285,14 +587,51 @@ private:
     // The list of all sections. See cNtSection
     cList<cSectionPtr> m_sections;
 
+    // The sections sorted by their virtual address. See buildSectionIndex
+    cArray<SectionRange> m_sectionIndex;
+
     // A list of loaded DLL, undocumented!
     cForkStreamPtr m_fastImportDll;
 
     // The optimization PE stream, can be NULL
     cForkStreamPtr m_memoryImage;
 
+    // The file which the header was read from, when it was read through a
+    // memory-accesser stream. Holds the header region. Can be NULL
+    cForkStreamPtr m_headerImage;
+    // A direct pointer to the header region, or NULL. See setDirectHeaders
+    const uint8* m_directHeaders;
+    // A direct pointer to a range of the raw file, or NULL. See setDirectFile
+    const uint8* m_directFile;
+    uint m_directFileOffset;
+    uint m_directFileLength;
+
     // The true image base that the PE was loaded to
     addressNumericValue m_trueImageBase;
+
+    // The loader view of the sections. See rvaToOffset
+    cArray<SectionMapping> m_sectionMap;
+    // Whether m_sectionMap is sorted by the virtual address and by the
+    // raw-data pointer. When unsorted the table is scanned.
+    bool m_isVirtualMapSorted;
+    bool m_isRawMapSorted;
+
+    // Set for PE32+ images
+    bool m_is64bit;
+    // The optional header of a PE32+ image. See getOptionalHeader64
+    IMAGE_OPTIONAL_HEADER64 m_optionalHeader64;
+    // The widened fields of either flavour. See copyWideFields
+    struct WideFields {
+        uint64 m_imageBase;
+        uint64 m_sizeOfStackReserve;
+        uint64 m_sizeOfStackCommit;
+        uint64 m_sizeOfHeapReserve;
+        uint64 m_sizeOfHeapCommit;
+    };
+    WideFields m_wideFields;
+
+    // The arena of the sections, or NULL. See getArena
+    cPeArena* m_arena;
 };
 
 #endif // __TBA_PE_NT_HEADER_H
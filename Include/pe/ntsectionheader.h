@@ -48,9 +48,11 @@
 #include "xStl/stream/forkStream.h"
 #include "xStl/stream/memoryAccesserStream.h"
 #include "xStl/stream/stringerStream.h"
+#include "xStl/os/mutex.h"
 #include "pe/datastruct.h"
 #include "pe/section.h"
 #include "pe/sectionTypes.h"
+#include "pe/peArena.h"
 
 /*
  * Forward deceleration for output streams
@@ -61,11 +63,45 @@ cStringerStream& operator << (cStringerStream& out,
                               const cNtSectionHeader& object);
 #endif // PE_TRACE
 
+/*
+ * The stream which the content of lazy sections is read from.
+ *
+ * All the lazy sections of an image share a single source. The source owns
+ * its stream, so it stays valid for as long as any section holds it, and
+ * serializes the loads since they all move the same stream position.
+ */
+class cNtLazySectionSource {
+public:
+    /*
+     * Constructor. The source takes a private fork of 'stream'.
+     */
+    cNtLazySectionSource(const cForkStream& stream);
+
+private:
+    // Deny copy-constructor and operator =
+    cNtLazySectionSource(const cNtLazySectionSource& other);
+    cNtLazySectionSource& operator = (const cNtLazySectionSource& other);
+
+    friend class cNtSectionHeader;
+
+    // The private fork of the image stream
+    cForkStreamPtr m_stream;
+    // Serializes the loads over m_stream
+    cMutex m_lock;
+};
+
+// The reference-countable object
+typedef cSmartPtr<cNtLazySectionSource> cNtLazySectionSourcePtr;
+
 /*
  * Holds the information regarding to a NT section.
+ *
+ * The sections of a cNtHeader which has an arena are allocated from the
+ * arena. See cPeArenaObject.
  */
 class cNtSectionHeader : public IMAGE_SECTION_HEADER,
-                         public cSection
+                         public cSection,
+                         public cPeArenaObject
 {
 public:
     /*
@@ -78,6 +114,7 @@ public:
      * type           - The type of the section. See SectionType
      * shouldReadData - See cNtSectionHeader::read
      * isMemory       - See cNtSectionHeader::read
+     * lazySource     - See cNtSectionHeader::read
      *
      * Throw exception incase of reading error.
      */
@@ -85,7 +122,9 @@ public:
                      basicInput& stream,
                      SectionType type = SECTION_TYPE_WINDOWS_CODE,
                      bool shouldReadData = true,
-                     bool isMemory = false);
+                     bool isMemory = false,
+                     const cNtLazySectionSourcePtr& lazySource =
+                        cNtLazySectionSourcePtr(NULL));
 
     /*
      * Default forkable constructor.
@@ -128,6 +167,23 @@ public:
      */
     const cBuffer& getLinenumbers() const;
 
+    /*
+     * Returns a direct pointer to the content of the section, or NULL if the
+     * content isn't stored in a contiguous memory block. The pointer covers
+     * 'SizeOfRawData' bytes and is valid while the section content is alive.
+     */
+    const uint8* getDirectContent() const;
+
+    /*
+     * Sets the direct pointer of a section which was forked over a contiguous
+     * memory block (e.g. a mapped file). See getDirectContent.
+     *
+     * NOTE: The caller must make sure that the block is at least
+     *       'SizeOfRawData' bytes long and that it's alive as long as the
+     *       section content is alive.
+     */
+    void setDirectContent(const uint8* content);
+
     /*
      * Changes the content of the IMAGE_SECTION_HEADER.
      *
@@ -164,11 +220,19 @@ public:
      * 'image-base-address' and in-order to read the data, it will be seeked to
      * the 'VirtualAddress' locations, instead of the 'RawAddress' location.
      *
+     * If "lazySource" isn't NULL (and "shouldReadData" is true) only the
+     * section header is read from 'stream'. The content is snapshot from
+     * 'lazySource' on the first access to it (See
+     * cSection::getSectionContentAccesser), and the section releases the
+     * source afterwards. 'lazySource' must hold the same image as 'stream'.
+     *
      * Throw exception in case of reading error
      */
     void read(basicInput& stream,
               bool shouldReadData = true,
-              bool isMemory = false);
+              bool isMemory = false,
+              const cNtLazySectionSourcePtr& lazySource =
+                cNtLazySectionSourcePtr(NULL));
 
     /*
      * See cNtSectionHeader::read
@@ -214,12 +278,27 @@ public:
      */
     cNtSectionHeader& operator = (const IMAGE_SECTION_HEADER& other);
 
+protected:
+    /*
+     * See cSection::loadSectionContent.
+     * Snapshot the content of a lazy section from its lazy source. Several
+     * threads may access the section at once: the first one loads the content
+     * under the source lock and publishes it through m_isContentLoaded.
+     */
+    virtual void loadSectionContent() const;
+
 private:
     /*
      * Clears the section content, line-number and relocations.
      */
     void init();
 
+    /*
+     * Snapshot the content, relocations and line-numbers of the section from
+     * 'stream'. The position of the stream is restored at the end.
+     */
+    void readContent(basicInput& stream) const;
+
     /*
      * OUTSTREAM operator <<.
      * Used to dump the content of the section into human readable string
@@ -230,9 +309,19 @@ private:
     #endif // PE_TRACE
 
     // Holds the relocation of the section
-    cMemoryAccesserStreamPtr m_relocations;
+    mutable cMemoryAccesserStreamPtr m_relocations;
     // Holds the line-numbering of the section
-    cMemoryAccesserStreamPtr m_linenumbers;
+    mutable cMemoryAccesserStreamPtr m_linenumbers;
+
+    // Direct pointer to the content of the section, or NULL
+    mutable const uint8* m_directContent;
+
+    // For lazy sections, the source which the content should be read from.
+    // Doesn't change after read, since it's accessed without a lock
+    cNtLazySectionSourcePtr m_lazySource;
+    // For lazy sections, set (with release semantic) once m_data,
+    // m_directContent, m_relocations and m_linenumbers are all filled
+    mutable bool m_isContentLoaded;
 
     // Holds the address of the image base the PE was loaded to
     addressNumericValue m_imageBase;
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_ARENA_H
+#define __TBA_PE_ARENA_H
+
+/*
+ * peArena.h
+ *
+ * A bump allocator for the section headers of a single parse. Scanners which
+ * parse many short-lived images attach an arena to each parse and rewind it
+ * once the image is dropped, instead of returning every section to the heap.
+ *
+ * Only the cNtSectionHeader objects of a cNtHeader are allocated from its
+ * arena. The directories, the export index and the import pools use the heap
+ * (cNtDirDelayImport keeps a private arena for its names).
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+
+/*
+ * The arena allocates out of large chunks. Memory is never freed one object
+ * at a time; 'reset' rewinds the arena in O(1) and keeps the chunks for the
+ * next parse.
+ *
+ * NOTE: The arena isn't thread-safe. Use an arena per thread, and delete its
+ *       objects from that thread as well.
+ */
+class cPeArena {
+public:
+    // The default chunk size
+    enum { DEFAULT_CHUNK_SIZE = 64 * 1024 };
+
+    /*
+     * Constructor.
+     *
+     * chunkSize - The size of each chunk. Larger allocations get a chunk of
+     *             their own.
+     */
+    cPeArena(uint chunkSize = DEFAULT_CHUNK_SIZE);
+
+    /*
+     * Release all the chunks. If any cPeArenaObject which was allocated from
+     * the arena is still alive, the chunks are released once the last one is
+     * deleted.
+     */
+    ~cPeArena();
+
+    /*
+     * Allocate a block. The block is aligned to the size of a pointer (or to
+     * 'alignment', which must be a power of 2) and is valid until the next
+     * 'reset'.
+     */
+    void* allocate(uint size, uint alignment = sizeof(void*));
+
+    /*
+     * Copy a string into the arena and add a null terminator. Returns the
+     * copy.
+     */
+    const char* duplicate(const char* string, uint length);
+
+    /*
+     * Release all the blocks. The chunks are kept for later allocations.
+     *
+     * Returns false, and keeps all the blocks, if any cPeArenaObject which was
+     * allocated from the arena is still alive. The blocks are then released by
+     * the first reset after the last object is deleted.
+     */
+    bool reset();
+
+    /*
+     * Returns the number of bytes allocated since the last reset
+     */
+    uint getAllocatedSize() const;
+
+    /*
+     * Returns the number of bytes which are held by the arena chunks
+     */
+    uint getReservedSize() const;
+
+private:
+    // Deny copy-constructor and operator =
+    cPeArena(const cPeArena& other);
+    cPeArena& operator = (const cPeArena& other);
+
+    // cPeArenaObject tracks the live objects
+    friend class cPeArenaObject;
+
+    // A chunk of memory. The data follows the header
+    struct Chunk {
+        // The next chunk in the list
+        Chunk* m_next;
+        // The size of the data
+        uint m_size;
+    };
+
+    // Returns the size of the chunk header and the data of a chunk
+    static uint getChunkHeaderSize();
+    static uint8* getChunkData(Chunk* chunk);
+
+    // Move to the next chunk which can hold 'size' bytes, allocate it if
+    // needed
+    void nextChunk(uint size, uint alignment);
+
+    // The chunks and the live objects. Allocated apart from the arena, so a
+    // cPeArenaObject can outlive the arena
+    struct Pool {
+        // All the chunks, in allocation order
+        Chunk* m_firstChunk;
+        // The number of cPeArenaObject which are alive
+        uint m_liveObjects;
+        // Set once the arena is destroyed. The last object releases the pool
+        bool m_isOrphan;
+    };
+
+    // Free the chunks of 'pool' and the pool itself
+    static void releasePool(Pool* pool);
+
+    // See cPeArena::cPeArena
+    uint m_chunkSize;
+    // See Pool
+    Pool* m_pool;
+    // The chunk which is currently used
+    Chunk* m_currentChunk;
+    // The next free byte inside the current chunk
+    uint m_position;
+    // See getAllocatedSize / getReservedSize
+    uint m_allocatedSize;
+    uint m_reservedSize;
+};
+
+/*
+ * Inherit from this class in order to allow the objects to be allocated from
+ * an arena:
+ *     cNtSectionHeader* section = new (arena) cNtSectionHeader(...);
+ *
+ * A NULL arena allocates from the heap. The objects are deleted normally (by
+ * a smart-pointer for example); the destructor runs, and the memory of an
+ * arena object is reclaimed when the arena is reset. An object may be deleted
+ * after its arena, the chunks are kept until then.
+ */
+class cPeArenaObject {
+public:
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, cPeArena* arena);
+    static void operator delete(void* object);
+    static void operator delete(void* object, cPeArena* arena);
+
+private:
+    // Precedes every object. Keeps the allocation aligned
+    union Header {
+        // The pool of the arena of the object, or NULL for the heap
+        cPeArena::Pool* m_pool;
+        uint64 m_alignment;
+        void* m_alignmentPointer;
+    };
+};
+
+#endif // __TBA_PE_ARENA_H
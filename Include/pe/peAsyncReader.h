@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_ASYNC_READER_H
+#define __TBA_PE_ASYNC_READER_H
+
+/*
+ * peAsyncReader.h
+ *
+ * Asynchronous corpus reader. Parsing the headers of a PE file is a chain of
+ * small dependent reads: the first page (DOS header, e_lfanew and usually the
+ * NT header), then the section table, then the sections which hold the
+ * directories. cPeAsyncReader keeps the chains of many files in flight at
+ * once from a single thread, so a cold corpus is read at the device queue
+ * depth instead of at the disk latency.
+ *
+ * On Linux the reads are issued through io_uring. When io_uring isn't
+ * available (other operating systems, old kernels or a sandbox which denies
+ * the system calls) the same state machine runs over memory-mapped files.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/data/string.h"
+#include "xStl/data/smartptr.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/mappedFileAccesser.h"
+#include "pe/peBatchScanner.h"
+
+#if defined(__linux__) && !defined(_KERNEL)
+#define PE_ASYNC_IO_URING
+#endif
+
+// The sparse file image which is filled by the completed reads
+class cExtentMemoryAccesser;
+
+/*
+ * Usage:
+ *     cPeAsyncReader reader(mySink, 1 << IMAGE_DIRECTORY_ENTRY_EXPORT);
+ *     reader.addDirectory("/samples");
+ *     reader.run();
+ *
+ * The sink is the same as cPeBatchScanner's. All the calls are made from the
+ * thread which invoked 'run'. Only the sections which contain the requested
+ * directories are read; accessing any other section content from the
+ * cNtHeader passed to the sink throws an exception.
+ */
+class cPeAsyncReader {
+public:
+    /*
+     * Constructor.
+     *
+     * sink            - The results callback
+     * directoriesMask - The directories to parse, as a mask of
+     *                   (1 << IMAGE_DIRECTORY_ENTRY_XXX). See
+     *                   cPeBatchScanner::createDirectory
+     * queueDepth      - The number of files in flight
+     * maxSectionSize  - Sections larger than this aren't read
+     */
+    cPeAsyncReader(cPeBatchSink& sink,
+                   uint directoriesMask = 0,
+                   uint queueDepth = 64,
+                   uint maxSectionSize = 0x4000000);
+
+    // Destructor. Release the ring
+    ~cPeAsyncReader();
+
+    /*
+     * Add a single file to the scan.
+     *
+     * Returns false if the file doesn't exist or isn't a regular file.
+     */
+    bool addFile(const cString& filename);
+
+    /*
+     * Add all the files inside a directory.
+     *
+     * Throw exception if the directory cannot be opened.
+     */
+    void addDirectory(const cString& path, bool recursive = true);
+
+    /*
+     * Returns the number of files added
+     */
+    uint getNumberOfFiles() const;
+
+    /*
+     * Read and parse all the files which were added and wait for the
+     * completion. The list of files is cleared at the end.
+     */
+    void run();
+
+    /*
+     * Returns true if the reads are issued asynchronously (io_uring), false if
+     * the reader falls back to memory-mapped files.
+     */
+    bool isAsynchronous() const;
+
+    /*
+     * Returns the number of files which were parsed / failed at the last run
+     */
+    uint getNumberOfParsedFiles() const;
+    uint getNumberOfFailedFiles() const;
+
+private:
+    // Deny copy-constructor and operator =
+    cPeAsyncReader(const cPeAsyncReader& other);
+    cPeAsyncReader& operator = (const cPeAsyncReader& other);
+
+    // The maximum size of the headers and the section table
+    enum { MAX_HEADERS_SIZE = 0x10000 };
+
+    // The read chain of a file
+    enum Stage {
+        // Reading the first page
+        STAGE_PROBE,
+        // Reading the entire headers and the section table
+        STAGE_HEADERS,
+        // Reading the sections of the requested directories
+        STAGE_SECTIONS
+    };
+
+    // A file to scan
+    struct Job {
+        cString m_filename;
+        uint64 m_size;
+    };
+
+    // A single outstanding read
+    struct Read {
+        // The destination of the read. Empty for the fallback, which hands
+        // out views of the mapped file
+        cBufferPtr m_buffer;
+        uint m_offset;
+        uint m_length;
+        // The number of bytes which were already read
+        uint m_done;
+    };
+
+    // A file in flight
+    struct Slot {
+        // Index into m_jobs, or m_numberOfJobs for a free slot
+        uint m_job;
+        Stage m_stage;
+        // The outstanding reads of the current stage
+        cArray<Read> m_reads;
+        uint m_issuedReads;
+        uint m_pendingReads;
+        bool m_failed;
+        // The sparse file image. m_extents is owned by m_memory
+        cVirtualMemoryAccesserPtr m_memory;
+        cExtentMemoryAccesser* m_extents;
+        cNtHeaderPtr m_header;
+        #ifdef PE_ASYNC_IO_URING
+        int m_fd;
+        #endif
+        // The fallback file
+        cMappedFileAccesserPtr m_mapping;
+    };
+
+    /*
+     * Open the next job into a free slot and issue its first read. Return
+     * false if there are no more jobs.
+     */
+    bool startNextJob(uint slot);
+
+    /*
+     * Issue a read of [offset, offset + length) for a slot. The completion is
+     * reported to onReadComplete.
+     */
+    void submitRead(uint slot, uint offset, uint length);
+
+    /*
+     * Issue the part of a read which wasn't read yet. Called for new reads and
+     * for the remainder of short reads.
+     */
+    void issueRead(uint slot, uint read);
+
+    /*
+     * Wait for at least one completion and process all the available ones.
+     */
+    void processCompletions();
+
+    /*
+     * Handle a completed read. 'result' is the number of bytes read or a
+     * negative error code. A short read is resubmitted for the rest of the
+     * range, the read fails only on an error or on an unexpected end of file.
+     */
+    void onReadComplete(uint slot, uint read, int result);
+
+    /*
+     * Advance the read chain of a slot once all the reads of the current
+     * stage completed.
+     */
+    void advance(uint slot);
+    void onProbeComplete(uint slot);
+    void onHeadersComplete(uint slot);
+
+    /*
+     * Report the result of a slot to the sink, free the slot and start the
+     * next job in it
+     */
+    void finish(uint slot);
+
+    // Close the file and release the image of a slot
+    void releaseSlot(Slot& slot);
+
+    // The results callback
+    cPeBatchSink& m_sink;
+    // See cPeAsyncReader::cPeAsyncReader
+    uint m_directoriesMask;
+    uint m_queueDepth;
+    uint m_maxSectionSize;
+
+    // The files to scan
+    cArray<Job> m_jobs;
+    uint m_numberOfJobs;
+    uint m_nextJob;
+
+    // The files in flight
+    cArray<Slot> m_slots;
+    uint m_activeSlots;
+
+    // The statistics of the last run
+    uint m_parsed;
+    uint m_failed;
+
+    // A completed read of the synchronous fallback
+    struct Completion {
+        uint m_slot;
+        uint m_read;
+        int m_result;
+    };
+    cList<Completion> m_completions;
+
+    #ifdef PE_ASYNC_IO_URING
+    /*
+     * Create the ring. Return false if io_uring isn't available.
+     */
+    bool setupRing(uint entries);
+    // Release the ring
+    void destroyRing();
+
+    // The ring file descriptor, or -1 for the synchronous fallback
+    int m_ringFd;
+    // The mapped rings
+    void* m_sqRing;
+    uint m_sqRingSize;
+    void* m_cqRing;
+    uint m_cqRingSize;
+    void* m_sqes;
+    uint m_sqesSize;
+    // Pointers into the submission ring
+    uint32* m_sqHead;
+    uint32* m_sqTail;
+    uint32* m_sqMask;
+    uint32* m_sqEntries;
+    uint32* m_sqArray;
+    // Pointers into the completion ring
+    uint32* m_cqHead;
+    uint32* m_cqTail;
+    uint32* m_cqMask;
+    void* m_cqes;
+    // Submission entries which weren't passed to the kernel yet
+    uint m_unsubmitted;
+    // Reads which weren't completed yet
+    uint m_inFlight;
+    #endif // PE_ASYNC_IO_URING
+};
+
+#endif // __TBA_PE_ASYNC_READER_H
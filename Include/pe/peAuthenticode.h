@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_AUTHENTICODE_H
+#define __TBA_PE_AUTHENTICODE_H
+
+/*
+ * peAuthenticode.h
+ *
+ * Computes the Authenticode image hash of a PE file.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/enc/digest.h"
+#include "xStl/stream/basicIO.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+
+/*
+ * The Authenticode image hash is the digest of the whole file, excluding:
+ *   - The CheckSum field of the optional header
+ *   - The security entry of the data directories
+ *   - The certificate table (see cNtDirSecurity)
+ *
+ * The file is fed into the digest in a single sequential pass, in ascending
+ * file offsets, skipping the excluded ranges. The digest is pluggable: any
+ * cDigest (e.g. SHA-1 or SHA-256) can be used. The functions only call
+ * cDigest::update; resetting the digest and fetching the result are left to
+ * the caller, so the hash can be combined with other data.
+ *
+ * NOTE: This is the sequential form of the hash, which is what the signing
+ *       tools produce for well-formed files (the sections are laid out in
+ *       order and the certificate table is the last thing in the file).
+ */
+class cPeAuthenticode {
+public:
+    // The default size of the buffer of the streaming read
+    enum { DEFAULT_BUFFER_SIZE = 0x10000 };
+
+    /*
+     * Feed the image hash input of the file which the header was read from.
+     * A direct pointer to the file (e.g. a mapped file, see
+     * cNtHeader::getDirectFilePointer) is hashed in place, otherwise the file
+     * is streamed through a buffer of 'bufferSize' bytes.
+     *
+     * Throw exception if the header wasn't read from a file image (see
+     * cNtHeader::getFileStream) or if the file cannot be read.
+     */
+    static void hashImage(const cNtHeader& header,
+                          cDigest& digest,
+                          uint bufferSize = DEFAULT_BUFFER_SIZE);
+
+    /*
+     * Feed the image hash input of a file, which is read from a stream using
+     * a buffer of 'bufferSize' bytes. 'header' is the header of the file, it
+     * may be read from a different stream (e.g. only the headers).
+     *
+     * Throw exception if the file cannot be read.
+     */
+    static void hashImage(const cNtHeader& header,
+                          basicInput& file,
+                          cDigest& digest,
+                          uint bufferSize = DEFAULT_BUFFER_SIZE);
+
+private:
+    // A range of the file, [m_start, m_end)
+    struct Range {
+        uint m_start;
+        uint m_end;
+    };
+
+    // The CheckSum, the security entry and the certificate table
+    enum { MAX_EXCLUDED_RANGES = 3 };
+
+    /*
+     * Fill the excluded ranges of a file, sorted by their file offset.
+     *
+     * ntHeaderOffset - The file offset of the NT header (e_lfanew)
+     *
+     * Returns the number of ranges.
+     */
+    static uint getExcludedRanges(const cNtHeader& header,
+                                  uint ntHeaderOffset,
+                                  uint fileSize,
+                                  Range* ranges);
+
+    /*
+     * Fill the file ranges of the CheckSum field and of the security entry.
+     * Instantiated for each flavour, see peTraits.h
+     */
+    template <class Traits>
+    static void getHeaderFields(uint ntHeaderOffset,
+                                Range& checkSum,
+                                Range& securityEntry);
+
+    /*
+     * Feed [start, end) of a stream into the digest
+     */
+    static void hashStream(basicInput& file,
+                           uint start,
+                           uint end,
+                           cBuffer& buffer,
+                           cDigest& digest);
+
+    /*
+     * Returns the file offset of the NT header, out of the DOS header
+     */
+    static uint getNtHeaderOffset(const IMAGE_DOS_HEADER& dosHeader,
+                                  uint fileSize);
+};
+
+#endif // __TBA_PE_AUTHENTICODE_H
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_BATCH_SCANNER_H
+#define __TBA_PE_BATCH_SCANNER_H
+
+/*
+ * peBatchScanner.h
+ *
+ * Parse a large set of PE files in parallel. The files are scheduled by their
+ * size (largest first) over a pool of worker threads, and idle workers steal
+ * pending files from the other workers.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/data/string.h"
+#include "xStl/os/mutex.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntdir.h"
+#include "pe/peArena.h"
+
+/*
+ * Receives the results of cPeBatchScanner.
+ *
+ * The functions are invoked from the worker threads. Unless 'isConcurrent'
+ * returns true, the scanner serializes the calls, so a sink which doesn't
+ * care about threads is safe.
+ */
+class cPeBatchSink {
+public:
+    // You can inherit from me
+    virtual ~cPeBatchSink() {};
+
+    /*
+     * Return true if the sink can be called concurrently from several worker
+     * threads. The default implementation returns false.
+     */
+    virtual bool isConcurrent() const;
+
+    /*
+     * Called for each file which was parsed.
+     *
+     * filename    - The full path of the file
+     * size        - The size of the file
+     * header      - The parsed NT-header
+     * directories - An array of IMAGE_NUMBEROF_DIRECTORY_ENTRIES directories,
+     *               indexed by IMAGE_DIRECTORY_ENTRY_XXX. Entries which weren't
+     *               requested, aren't supported or failed to parse are empty.
+     *
+     * NOTE: All the objects are valid only during the call. The sections of
+     *       the header live in a per-worker arena which is reused for the
+     *       next file, so a sink mustn't keep them (e.g. a cSectionPtr) after
+     *       it returns.
+     */
+    virtual void onFile(const cString& filename,
+                        uint64 size,
+                        const cNtHeader& header,
+                        const cNtDirectoryPtr* directories) = 0;
+
+    /*
+     * Called for each file which isn't a PE file or which failed to parse.
+     * The default implementation does nothing.
+     */
+    virtual void onError(const cString& filename, uint64 size);
+};
+
+/*
+ * Parallel corpus scanner.
+ *
+ * Usage:
+ *     cPeBatchScanner scanner(mySink,
+ *                             1 << IMAGE_DIRECTORY_ENTRY_EXPORT);
+ *     scanner.addDirectory("/samples");
+ *     scanner.run();
+ */
+class cPeBatchScanner {
+public:
+    /*
+     * Constructor.
+     *
+     * sink             - The results callback
+     * directoriesMask  - The directories to parse, as a mask of
+     *                    (1 << IMAGE_DIRECTORY_ENTRY_XXX). See createDirectory
+     * numberOfThreads  - The number of worker threads. 0 means the number of
+     *                    processors
+     */
+    cPeBatchScanner(cPeBatchSink& sink,
+                    uint directoriesMask = 0,
+                    uint numberOfThreads = 0);
+
+    // Destructor
+    ~cPeBatchScanner();
+
+    /*
+     * Add a single file to the scan.
+     *
+     * Returns false if the file doesn't exist or isn't a regular file.
+     */
+    bool addFile(const cString& filename);
+
+    /*
+     * Add all the files inside a directory.
+     *
+     * Throw exception if the directory cannot be opened.
+     */
+    void addDirectory(const cString& path, bool recursive = true);
+
+    /*
+     * Returns the number of files added
+     */
+    uint getNumberOfFiles() const;
+
+    /*
+     * Scan all the files which were added and wait for the completion. The
+     * list of files is cleared at the end.
+     */
+    void run();
+
+    /*
+     * Returns the number of files which were parsed / failed at the last run
+     */
+    uint getNumberOfParsedFiles() const;
+    uint getNumberOfFailedFiles() const;
+
+    /*
+     * Construct an empty directory parser for a directory index, or return an
+     * empty pointer if the directory isn't supported.
+     */
+    static cNtDirectoryPtr createDirectory(uint directoryIndex);
+
+    /*
+     * Returns the number of processors in the system
+     */
+    static uint getNumberOfProcessors();
+
+private:
+    // Deny copy-constructor and operator =
+    cPeBatchScanner(const cPeBatchScanner& other);
+    cPeBatchScanner& operator = (const cPeBatchScanner& other);
+
+    // A file to scan
+    struct Job {
+        cString m_filename;
+        uint64 m_size;
+    };
+
+    // A worker thread and its queue
+    struct Worker {
+        // The owner
+        cPeBatchScanner* m_scanner;
+        // The index of the worker
+        uint m_index;
+        // Protects the queue
+        cMutex m_lock;
+        // Indexes into m_jobs, sorted by the file size (largest first)
+        cArray<uint> m_queue;
+        // The next job in m_queue
+        uint m_next;
+        // Statistics
+        uint m_parsed;
+        uint m_failed;
+        // The per-parse objects of the current job. Rewound between jobs
+        cPeArena m_arena;
+    };
+
+    /*
+     * The worker loop. Process the own queue and then steal from the others.
+     */
+    void workerLoop(Worker& worker);
+
+    /*
+     * Take the next (largest) job out of a queue. Return false if the queue is
+     * empty.
+     */
+    static bool popJob(Worker& worker, uint& job);
+
+    /*
+     * Returns the size of the next job of a queue without taking it. Return
+     * false if the queue is empty.
+     */
+    bool peekJobSize(Worker& worker, uint64& size) const;
+
+    /*
+     * Parse a single file and report it to the sink.
+     */
+    void processJob(Worker& worker, uint job);
+
+    /*
+     * Spread the jobs to the workers queues, by size.
+     */
+    void scheduleJobs(uint numberOfWorkers);
+
+    // The native thread entry point. 'parameter' is a Worker
+    #ifdef XSTL_WINDOWS
+    static unsigned long __stdcall threadMain(void* parameter);
+    #else
+    static void* threadMain(void* parameter);
+    #endif
+
+    // The results callback
+    cPeBatchSink& m_sink;
+    // Serialize the sink for non concurrent sinks
+    cMutex m_sinkLock;
+    // See cPeBatchScanner::cPeBatchScanner
+    uint m_directoriesMask;
+    uint m_numberOfThreads;
+
+    // The files to scan
+    cArray<Job> m_jobs;
+    uint m_numberOfJobs;
+
+    // The workers of the current run
+    Worker* m_workers;
+    uint m_numberOfWorkers;
+
+    // The statistics of the last run
+    uint m_parsed;
+    uint m_failed;
+};
+
+#endif // __TBA_PE_BATCH_SCANNER_H
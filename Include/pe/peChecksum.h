@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_CHECKSUM_H
+#define __TBA_PE_CHECKSUM_H
+
+/*
+ * peChecksum.h
+ *
+ * Computes the checksum of a PE file (OptionalHeader.CheckSum).
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+
+/*
+ * The PE checksum is the 16 bits one's-complement sum of the little-endian
+ * words of the file, with the CheckSum field itself taken as zero, plus the
+ * length of the file.
+ *
+ * The sum is accumulated in wide lanes (SSE2 or AVX2 when the CPU supports
+ * it, otherwise 32 bits words) and folded once at the end, so the data can be
+ * fed in arbitrary chunks (e.g. a mapped file, or a buffered stream).
+ *
+ * Usage:
+ *     cPeChecksum checksum;
+ *     checksum.update(data, length);
+ *     ...
+ *     uint32 value = checksum.getChecksum(checkSumOffset, storedCheckSum);
+ *
+ * See cNtHeader::computeChecksum
+ */
+class cPeChecksum {
+public:
+    /*
+     * Constructor. Start a new sum
+     */
+    cPeChecksum();
+
+    /*
+     * Add the next bytes of the file
+     */
+    void update(const void* buffer, uint length);
+
+    /*
+     * Returns the checksum of the bytes which were added so far.
+     *
+     * checkSumOffset - The file offset of the CheckSum field
+     * checkSum       - The value of the CheckSum field, as stored in the file.
+     *                  Its bytes are removed from the sum.
+     */
+    uint32 getChecksum(uint checkSumOffset, uint32 checkSum) const;
+
+    /*
+     * Compute the checksum of a file image which is stored in memory
+     */
+    static uint32 compute(const uint8* file, uint length, uint checkSumOffset);
+
+private:
+    /*
+     * Returns a value which is congruent (modulo 0xFFFF) to the sum of the
+     * little-endian words of a buffer. An odd trailing byte is taken as the
+     * low byte of a word.
+     */
+    static uint64 sumWords(const uint8* buffer, uint length);
+
+    // The sum so far, modulo 0xFFFF
+    uint32 m_sum;
+    // True if any of the bytes isn't zero
+    bool m_isNonZero;
+    // The number of bytes which were added
+    uint m_length;
+};
+
+#endif // __TBA_PE_CHECKSUM_H
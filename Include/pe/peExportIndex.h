@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_EXPORT_INDEX_H
+#define __TBA_PE_EXPORT_INDEX_H
+
+/*
+ * peExportIndex.h
+ *
+ * A compact lookup index over an export table.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+
+/*
+ * Indexes the exports of a module by name and by ordinal, in O(1).
+ *
+ * The index is made of plain arrays, without any per-export object:
+ *   - A function table, indexed by 'ordinal - Base', which holds the RVA of
+ *     each function, its (first) name and its forwarder string. Each slot,
+ *     used or not, costs 12 bytes.
+ *   - The names, in the order of the name table: 16 bytes each.
+ *   - A string pool which holds all the names, null-terminated.
+ *   - An open-addressing hash table over the names (FNV-1a, linear probing,
+ *     at most half full): 4 bytes per slot.
+ *
+ * The index is the storage of cNtDirExport, which builds its ExportTable out
+ * of it on demand.
+ *
+ * The index is filled by cNtDirExport while it reads the table:
+ *     index.reset(base, numberOfFunctions);
+ *     index.setFunction(...) / index.addName(...) / index.setForwarder(...)
+ *     index.build();
+ */
+class cPeExportIndex {
+public:
+    /*
+     * Constructor. Creates an empty index
+     */
+    cPeExportIndex();
+
+    // Sanity limit: ordinals are 16 bits
+    enum { MAX_FUNCTIONS = 0x10000 };
+
+    /*
+     * The result of a lookup
+     */
+    struct Export {
+        // The RVA of the function
+        uint32 m_rva;
+        // The (biased) ordinal of the function
+        uint32 m_ordinal;
+        // The name of the function, or NULL if it's exported by ordinal only.
+        // Points to the string pool of the index
+        const char* m_name;
+        // For forwarded exports, the forwarder string ("DLL.Function" or
+        // "DLL.#ordinal"), otherwise NULL. Points to the string pool
+        const char* m_forwarder;
+    };
+
+    /*
+     * Clear the index and prepare the function table
+     *
+     * Throw exception if 'numberOfFunctions' exceeds MAX_FUNCTIONS.
+     */
+    void reset(uint32 base, uint numberOfFunctions);
+
+    /*
+     * Sets the RVA of a function. 'index' is the ordinal minus the base.
+     */
+    void setFunction(uint index, uint32 rva);
+
+    /*
+     * Adds a name of a function. 'index' is the ordinal minus the base.
+     * Names of functions outside the function table are kept in the name
+     * order (see getName) but can't be looked up.
+     */
+    void addName(uint index, const char* name, uint length);
+
+    /*
+     * Marks a function as forwarded. 'index' is the ordinal minus the base.
+     */
+    void setForwarder(uint index, const char* forwarder, uint length);
+
+    /*
+     * Builds the hash table. Must be called after all the names were added
+     * and before any lookup.
+     */
+    void build();
+
+    /*
+     * Find an export by its name. Return false if there is no such export.
+     */
+    bool findByName(const char* name, Export& entry) const;
+    bool findByName(const char* name, uint length, Export& entry) const;
+
+    /*
+     * Find an export by its (biased) ordinal. Return false if there is no
+     * such export.
+     */
+    bool findByOrdinal(uint ordinal, Export& entry) const;
+
+    /*
+     * Returns the number of function slots, and the number of names
+     */
+    uint getNumberOfFunctions() const;
+    uint getNumberOfNames() const;
+
+    /*
+     * Returns a function slot. 'index' is the ordinal minus the base, below
+     * getNumberOfFunctions. An unused slot has a zero RVA.
+     */
+    void getFunction(uint index, Export& entry) const;
+
+    /*
+     * Returns the name at 'index' in the order of the name table, below
+     * getNumberOfNames, and its function (the ordinal minus the base, which
+     * may be outside the function table).
+     */
+    const char* getName(uint index, uint& length, uint& function) const;
+
+    /*
+     * Returns the FNV-1a hash of a name
+     */
+    static uint32 hash(const char* name, uint length);
+
+private:
+    // Deny copy-constructor and operator =
+    cPeExportIndex(const cPeExportIndex& other);
+    cPeExportIndex& operator = (const cPeExportIndex& other);
+
+    // Marks a function without a name, and an empty hash slot
+    enum { NO_NAME = 0xFFFFFFFF, EMPTY_SLOT = 0xFFFFFFFF };
+
+    // A function slot
+    struct Function {
+        uint32 m_rva;
+        // Offset of the name inside the pool, or NO_NAME
+        uint32 m_name;
+        // Offset of the forwarder string inside the pool, or NO_NAME
+        uint32 m_forwarder;
+    };
+
+    // A name
+    struct Name {
+        uint32 m_hash;
+        // Offset of the name inside the pool
+        uint32 m_offset;
+        uint32 m_length;
+        // Index into the function table
+        uint32 m_function;
+    };
+
+    /*
+     * Copy a string into the pool. Returns its offset
+     */
+    uint32 appendString(const char* string, uint length);
+
+    /*
+     * Fill an export out of a function slot
+     */
+    void fillExport(uint index, Export& entry) const;
+
+    // The ordinal of the first function
+    uint32 m_base;
+    // The function table
+    cArray<Function> m_functions;
+    // The names, and the used part of m_names
+    cArray<Name> m_names;
+    uint m_numberOfNames;
+    // The string pool, and the used part of it
+    cArray<char> m_pool;
+    uint m_poolSize;
+    // The hash table: indexes into m_names, or EMPTY_SLOT. The size is a power
+    // of two
+    cArray<uint32> m_slots;
+};
+
+#endif // __TBA_PE_EXPORT_INDEX_H
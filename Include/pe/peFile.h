@@ -41,6 +41,7 @@
  */
 #include "xStl/types.h"
 #include "xStl/os/virtualMemoryAccesser.h"
+#include "pe/datastruct.h"
 
 /*
  * Contains helper functions which easy the PE file-format parsing.
@@ -56,6 +57,117 @@ public:
      */
     static uint getImageSize(const cVirtualMemoryAccesserPtr& mem,
                              addressNumericValue offset);
+
+    // The maximum number of bytes which cPeFile::probe looks at
+    enum { PROBE_SIZE = 4096 };
+
+    // cPeFile::ProbeInfo::m_flags. What was recognized by cPeFile::probe
+    enum {
+        // The image starts with an 'MZ' header
+        PROBE_DOS_HEADER         = 0x0001,
+        // The 'PE\0\0' signature and the file-header are valid
+        PROBE_NT_HEADER          = 0x0002,
+        // The optional-header magic is either PE32 or PE32+
+        PROBE_OPTIONAL_HEADER    = 0x0004,
+        // The section table is entirely inside the probed bytes
+        PROBE_SECTION_TABLE      = 0x0008
+    };
+
+    // cPeFile::ProbeInfo::m_anomalies. Things the Windows loader would
+    // reject or which are unusual for a linker output
+    enum {
+        // The probed buffer ends before the headers
+        ANOMALY_TRUNCATED             = 0x0001,
+        // 'e_lfanew' is unaligned or points outside the probed bytes
+        ANOMALY_BAD_LFANEW            = 0x0002,
+        // The optional-header magic is unknown
+        ANOMALY_UNKNOWN_MAGIC         = 0x0004,
+        // 'SizeOfOptionalHeader' doesn't cover the data directories
+        ANOMALY_SHORT_OPTIONAL_HEADER = 0x0008,
+        // 'NumberOfRvaAndSizes' is larger than 16
+        ANOMALY_TOO_MANY_DIRECTORIES  = 0x0010,
+        // The file or section alignment isn't a power of two, or the file
+        // alignment is larger than the section alignment
+        ANOMALY_BAD_ALIGNMENT         = 0x0020,
+        // The entry point is outside 'SizeOfImage'
+        ANOMALY_ENTRY_OUTSIDE_IMAGE   = 0x0040,
+        // There are no sections
+        ANOMALY_NO_SECTIONS           = 0x0080,
+        // 'SizeOfHeaders' is smaller than the end of the section table
+        ANOMALY_SHORT_HEADERS         = 0x0100,
+        // A data directory points outside 'SizeOfImage'
+        ANOMALY_DIRECTORY_OUTSIDE     = 0x0200,
+        // The image isn't marked as executable
+        ANOMALY_NOT_EXECUTABLE        = 0x0400
+    };
+
+    /*
+     * A fixed size summary of the PE headers. See cPeFile::probe
+     */
+    struct ProbeInfo {
+        // See PROBE_XXX
+        uint32 m_flags;
+        // See ANOMALY_XXX
+        uint32 m_anomalies;
+
+        // The offset of the 'PE\0\0' signature
+        uint32 m_ntHeaderOffset;
+        // The offset of the section table
+        uint32 m_sectionTableOffset;
+
+        // IMAGE_FILE_HEADER
+        uint16 m_machine;
+        uint16 m_numberOfSections;
+        uint16 m_characteristics;
+
+        // IMAGE_OPTIONAL_HEADER32/64
+        uint16 m_magic;
+        bool m_is64bit;
+        uint16 m_subsystem;
+        uint16 m_dllCharacteristics;
+        uint32 m_entryPoint;
+        uint64 m_imageBase;
+        uint32 m_sectionAlignment;
+        uint32 m_fileAlignment;
+        uint32 m_sizeOfImage;
+        uint32 m_sizeOfHeaders;
+        uint32 m_checksum;
+
+        // The data directories. Entries above 'm_numberOfDirectories' are
+        // zeroed.
+        uint32 m_numberOfDirectories;
+        IMAGE_DATA_DIRECTORY m_directories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+    };
+
+    /*
+     * Summarize the PE headers out of the first bytes of an image, without
+     * constructing cDosHeader or cNtHeader objects. Only the first PROBE_SIZE
+     * bytes are examined.
+     *
+     * buffer - The beginning of the image (file or memory layout)
+     * length - The number of valid bytes in 'buffer'
+     * info   - Will be filled with the summary. Always initialized, even if
+     *          the function fails.
+     *
+     * Return true if the image is a PE file (DOS header, PE signature and a
+     * PE32/PE32+ optional header). The anomalies should be checked for the
+     * quality of the image.
+     *
+     * NOTE: This function doesn't allocate memory and doesn't throw.
+     */
+    static bool probe(const uint8* buffer,
+                      uint length,
+                      ProbeInfo& info);
+
+    /*
+     * See cPeFile::probe.
+     * Issues a single read of min(length, PROBE_SIZE) bytes from 'mem' at
+     * 'offset'. Return false if the read failed.
+     */
+    static bool probe(const cVirtualMemoryAccesserPtr& mem,
+                      addressNumericValue offset,
+                      uint length,
+                      ProbeInfo& info);
 };
 
 #endif // __TBA_PE_PEFILE_H
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_FILE_SYSTEM_H
+#define __TBA_PE_FILE_SYSTEM_H
+
+/*
+ * peFileSystem.h
+ *
+ * Thin wrappers over the native file-system API, used by the file based
+ * components of the library (file mapping, batch scanning).
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/data/string.h"
+
+/*
+ * Native file-system helpers. All the functions are static.
+ */
+class cPeFileSystem {
+public:
+    #ifndef XSTL_WINDOWS
+    /*
+     * Translate a filename into the native narrow (UTF-8) representation,
+     * which is expected by the POSIX API.
+     *
+     * filename - The filename to translate
+     * name     - Will be filled with the null-terminated native name
+     */
+    static void getNativeFilename(const cString& filename,
+                                  cSArray<char>& name);
+
+    /*
+     * Translate a native narrow (UTF-8) filename into a cString.
+     */
+    static cString fromNativeFilename(const char* name);
+    #endif // XSTL_WINDOWS
+
+    /*
+     * Query the size of a regular file.
+     *
+     * Returns false if the file doesn't exist or isn't a regular file.
+     */
+    static bool getFileSize(const cString& filename, uint64& size);
+
+    /*
+     * Returns true if 'path' is a directory.
+     */
+    static bool isDirectory(const cString& path);
+
+    /*
+     * Append the full path of all the regular files inside a directory.
+     *
+     * path      - The directory to scan
+     * recursive - Set to true in order to scan sub-directories as well.
+     *             Symbolic links to directories aren't followed.
+     * files     - The list to append the files to
+     *
+     * Throw exception if 'path' cannot be opened. Sub-directories which
+     * cannot be opened are skipped.
+     */
+    static void listFiles(const cString& path,
+                          bool recursive,
+                          cList<cString>& files);
+
+private:
+    // Static class
+    cPeFileSystem();
+};
+
+#endif // __TBA_PE_FILE_SYSTEM_H
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_FORWARDER_RESOLVER_H
+#define __TBA_PE_FORWARDER_RESOLVER_H
+
+/*
+ * peForwarderResolver.h
+ *
+ * Resolve forwarded exports across a set of modules.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "pe/peExportIndex.h"
+
+/*
+ * Follows forwarder chains (e.g. kernel32!HeapAlloc -> NTDLL.RtlAllocateHeap)
+ * over a set of registered modules, until a function which is implemented
+ * by a module.
+ *
+ * Modules are registered by their file name together with their export
+ * index (see cNtDirExport::getIndex). Forwarder strings name the module
+ * without its extension, the lookup ignores the case and the ".dll"
+ * extension. API-set contracts (api-ms-win-...) are resolved only if a
+ * module was registered under the contract name.
+ *
+ * Every resolved link is memoized, successes and failures alike, so
+ * repeated chains cost one hash lookup. Chains which loop back or are longer
+ * than MAX_CHAIN are failures. Registering a module drops the cache.
+ *
+ * The indices must stay alive as long as the resolver is used.
+ */
+class cPeForwarderResolver {
+public:
+    /*
+     * Constructor. Creates an empty resolver
+     */
+    cPeForwarderResolver();
+
+    // An unknown module
+    enum { INVALID_MODULE = 0xFFFFFFFF };
+    // The longest forwarder chain which is followed, and the longest module
+    // name
+    enum { MAX_CHAIN = 0x20, MAX_MODULE_NAME = 0x100 };
+
+    /*
+     * The implementation of an export
+     */
+    struct Target {
+        // The module which implements the function (see addModule)
+        uint m_module;
+        // The function, as exported by that module
+        cPeExportIndex::Export m_export;
+    };
+
+    /*
+     * Register a module. 'name' is the file name of the module (e.g.
+     * "KERNEL32.dll"). Returns the module handle.
+     */
+    uint addModule(const char* name, const cPeExportIndex& exports);
+
+    /*
+     * Returns the handle of a module, or INVALID_MODULE
+     */
+    uint findModule(const char* name) const;
+
+    /*
+     * Returns the number of registered modules
+     */
+    uint getNumberOfModules() const;
+
+    /*
+     * Resolve an export of a module, by name or by (biased) ordinal. Returns
+     * false if the function cannot be found, or the forwarder chain is broken
+     * or loops.
+     */
+    bool resolveName(uint module, const char* name, Target& target);
+    bool resolveOrdinal(uint module, uint ordinal, Target& target);
+
+    /*
+     * Resolve a forwarder string: "DLL.Function" or "DLL.#ordinal"
+     */
+    bool resolveForwarder(const char* forwarder, Target& target);
+
+    /*
+     * Drop all the memoized chains
+     */
+    void clearCache();
+
+private:
+    // Deny copy-constructor and operator =
+    cPeForwarderResolver(const cPeForwarderResolver& other);
+    cPeForwarderResolver& operator = (const cPeForwarderResolver& other);
+
+    // Marks an empty hash slot, and a key which is a name
+    enum { EMPTY_SLOT = 0xFFFFFFFF, NO_ORDINAL = 0xFFFFFFFF };
+
+    // A link in a chain: a function of a module
+    struct Key {
+        uint m_module;
+        // The name, or NULL for ordinals
+        const char* m_name;
+        uint m_length;
+        uint m_ordinal;
+    };
+
+    // A registered module
+    struct Module {
+        const cPeExportIndex* m_exports;
+        // The normalized name, inside m_pool
+        uint32 m_name;
+        uint32 m_length;
+        uint32 m_hash;
+    };
+
+    // A memoized link
+    struct CacheEntry {
+        uint32 m_hash;
+        uint32 m_module;
+        // The name inside m_pool, or NO_ORDINAL and the ordinal
+        uint32 m_name;
+        uint32 m_length;
+        uint32 m_ordinal;
+        // The result
+        bool m_isResolved;
+        Target m_target;
+    };
+
+    /*
+     * Follow a chain from a key
+     */
+    bool resolve(Key key, Target& target);
+
+    /*
+     * Split a forwarder string into a key. Returns false if the module isn't
+     * registered or the string is malformed.
+     */
+    bool parseForwarder(const char* forwarder, Key& key) const;
+
+    /*
+     * Returns the module of a name, ignoring the case and the ".dll"
+     * extension
+     */
+    uint findModule(const char* name, uint length) const;
+
+    /*
+     * Lower-case a module name and strip its ".dll" extension into 'buffer'
+     * (MAX_MODULE_NAME characters). Returns the length, or 0 if the name is
+     * too long
+     */
+    static uint normalizeModule(const char* name, uint length, char* buffer);
+
+    /*
+     * Returns the hash of a key
+     */
+    static uint32 hashKey(const Key& key);
+
+    /*
+     * Compare two keys, and a key to a memoized link
+     */
+    static bool isSameKey(const Key& a, const Key& b);
+    bool isSameKey(const CacheEntry& entry, uint32 hash, const Key& key) const;
+
+    /*
+     * Look up the cache. Returns the index of the entry or EMPTY_SLOT
+     */
+    uint findCache(const Key& key, uint32 hash) const;
+
+    /*
+     * Memoize a link
+     */
+    void addCache(const Key& key, bool isResolved, const Target& target);
+
+    /*
+     * Copy a string into the pool. Returns its offset
+     */
+    uint32 appendString(const char* string, uint length);
+
+    // The modules
+    cArray<Module> m_modules;
+    // The names of the modules and of the memoized links, and the used part
+    cArray<char> m_pool;
+    uint m_poolSize;
+    // The memoized links, and the used part
+    cArray<CacheEntry> m_cache;
+    uint m_cacheSize;
+    // The hash table of the cache: indexes into m_cache, or EMPTY_SLOT. The
+    // size is a power of two
+    cArray<uint32> m_slots;
+};
+
+#endif // __TBA_PE_FORWARDER_RESOLVER_H
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_STREAM_PARSER_H
+#define __TBA_PE_STREAM_PARSER_H
+
+/*
+ * peStreamParser.h
+ *
+ * Forward-only parser for PE files which arrive over a non-seekable input
+ * (pipe, socket, upload). The bytes are consumed in file order, only the
+ * headers and the small directories are buffered and the content is reported
+ * to a listener as it arrives.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/smartptr.h"
+#include "xStl/stream/basicIO.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntsectionheader.h"
+
+/*
+ * Callback interface for cPeStreamParser. The default implementation of all
+ * the events does nothing.
+ */
+class cPeStreamListener {
+public:
+    // You can inherit from me
+    virtual ~cPeStreamListener() {};
+
+    /*
+     * Called once the DOS header, the NT header and the section table were
+     * read. The sections of 'header' contain only the section headers; their
+     * content arrives through onSectionData.
+     *
+     * NOTE: 'header' is owned by the parser.
+     */
+    virtual void onHeaders(const cNtHeader& header);
+
+    /*
+     * Called for each chunk of section raw-data, in file order.
+     *
+     * index   - The index of the section in the section table
+     * section - The section header
+     * offset  - The offset of 'data' from the beginning of the section raw-data
+     * data    - The bytes. Valid only during the call
+     * length  - The number of bytes in 'data'
+     */
+    virtual void onSectionData(uint index,
+                               const cNtSectionHeader& section,
+                               uint offset,
+                               const uint8* data,
+                               uint length);
+
+    /*
+     * Called when all the bytes of a data directory arrived.
+     *
+     * index - The directory index (IMAGE_DIRECTORY_ENTRY_XXX)
+     * data  - The content of the directory, as stored in the file. Valid only
+     *         during the call
+     */
+    virtual void onDirectory(uint index, const cBuffer& data);
+
+    /*
+     * Called for each chunk of bytes which are located after the headers and
+     * after the raw-data of all the sections (The overlay).
+     *
+     * offset - The file offset of 'data'
+     */
+    virtual void onOverlayData(uint offset, const uint8* data, uint length);
+
+    /*
+     * Called once the input ended.
+     */
+    virtual void onEnd();
+};
+
+/*
+ * Forward-only PE parser. The input can be pushed with 'feed' or pulled from a
+ * stream with 'parse'. The parser never seeks.
+ *
+ * Usage:
+ *     cPeStreamParser parser(myListener);
+ *     parser.parse(socketStream);
+ *
+ * Memory usage is bounded by the size of the headers and the size of the
+ * directories which are buffered (See the constructor).
+ */
+class cPeStreamParser {
+public:
+    // Default limits. See cPeStreamParser::cPeStreamParser
+    enum {
+        DEFAULT_MAX_HEADERS_SIZE   = 0x10000,
+        DEFAULT_MAX_DIRECTORY_SIZE = 0x100000,
+        // The size of each read in cPeStreamParser::parse
+        READ_CHUNK_SIZE            = 0x10000
+    };
+
+    /*
+     * Constructor.
+     *
+     * listener         - The events callback. Must be alive as long as this
+     *                    object is alive
+     * maxHeadersSize   - The largest header region (DOS header up to the end
+     *                    of the section table) which is accepted
+     * maxDirectorySize - Directories larger than this value are not buffered
+     *                    and are not reported by onDirectory
+     */
+    cPeStreamParser(cPeStreamListener& listener,
+                    uint maxHeadersSize = DEFAULT_MAX_HEADERS_SIZE,
+                    uint maxDirectorySize = DEFAULT_MAX_DIRECTORY_SIZE);
+
+    /*
+     * Push the next bytes of the file.
+     *
+     * Throw exception if the headers are invalid or exceed the limit.
+     */
+    void feed(const uint8* data, uint length);
+
+    /*
+     * Mark the end of the input. Incomplete directories are dropped.
+     *
+     * Throw exception if the input ended before the headers.
+     */
+    void end();
+
+    /*
+     * Read 'stream' forward until it's exhausted, feeding the parser, and call
+     * 'end'. The stream isn't seeked.
+     */
+    void parse(basicInput& stream);
+
+    /*
+     * Returns the parsed header, or an empty pointer if the headers weren't
+     * read yet.
+     *
+     * NOTE: The sections of the header can't be accessed for content. The
+     *       content isn't stored.
+     */
+    const cNtHeaderPtr& getHeader() const;
+
+    /*
+     * Returns the number of bytes consumed so far
+     */
+    uint getPosition() const;
+
+private:
+    // Deny copy-constructor and operator =
+    cPeStreamParser(const cPeStreamParser& other);
+    cPeStreamParser& operator = (const cPeStreamParser& other);
+
+    /*
+     * Called whenever the buffered header bytes reach 'm_headersNeeded'.
+     * Decode what is known so far and update 'm_headersNeeded'. Once the
+     * section table is complete the headers are parsed.
+     */
+    void advanceHeaders();
+
+    /*
+     * Parse the buffered headers, prepare the directory buffers, notify the
+     * listener and replay the header bytes.
+     */
+    void parseHeaders();
+
+    /*
+     * Deliver the bytes at file offset [offset, offset + length) to the
+     * sections, the directories and the overlay. Must be called with
+     * ascending offsets.
+     */
+    void dispatch(uint offset, const uint8* data, uint length);
+
+    // A directory which is buffered until all its bytes arrive
+    struct PendingDirectory {
+        // The file offset of the directory
+        uint m_offset;
+        // The size of the directory
+        uint m_size;
+        // The number of bytes received
+        uint m_received;
+        // Set to true while the directory waits for bytes
+        bool m_isPending;
+        // The content
+        cBuffer m_data;
+    };
+
+    // The state of the parser
+    enum State {
+        STATE_DOS_HEADER,
+        STATE_FILE_HEADER,
+        STATE_SECTION_TABLE,
+        STATE_BODY
+    };
+
+    // The events callback
+    cPeStreamListener& m_listener;
+    // The limits
+    uint m_maxHeadersSize;
+    uint m_maxDirectorySize;
+
+    // See State
+    State m_state;
+    // The number of bytes consumed
+    uint m_position;
+
+    // The bytes of the header region
+    cBufferPtr m_headers;
+    // The number of header bytes required for the current state
+    uint m_headersNeeded;
+    // The offset of the PE header
+    uint m_ntHeaderOffset;
+    // The memory stream over 'm_headers', used by the header sections
+    cMemoryAccesserStreamPtr m_headerStream;
+
+    // The parsed header and its sections, in section table order
+    cNtHeaderPtr m_header;
+    cArray<const cNtSectionHeader*> m_sections;
+    // The directories waiting for their bytes
+    PendingDirectory m_directories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+    // The file offset in which the overlay starts
+    uint m_overlayStart;
+};
+
+#endif // __TBA_PE_STREAM_PARSER_H
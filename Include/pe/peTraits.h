@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#ifndef __TBA_PE_TRAITS_H
+#define __TBA_PE_TRAITS_H
+
+/*
+ * peTraits.h
+ *
+ * Compile-time description of the two PE flavours: PE32 and PE32+ (64 bit).
+ *
+ * Code which depends on the bitness of the image (the optional header and
+ * address sized fields such as thunks) is written once as a template over
+ * the traits. The header is read once, the flavour is selected by the
+ * optional header 'Magic' and the matching instantiation is invoked, so the
+ * parsing loops never test the bitness.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/remoteAddress.h"
+#include "pe/datastruct.h"
+
+/*
+ * PE32 images
+ */
+struct cPe32Traits {
+    // The headers
+    typedef IMAGE_NT_HEADERS32 NtHeaders;
+    typedef IMAGE_OPTIONAL_HEADER32 OptionalHeader;
+
+    // The TLS and the load configuration directories
+    typedef IMAGE_TLS_DIRECTORY32 TlsDirectory;
+    typedef IMAGE_LOAD_CONFIG_DIRECTORY32 LoadConfigDirectory;
+
+    // A virtual address inside the image (thunks, TLS and load-config fields)
+    typedef uint32 Address;
+
+    enum {
+        // See IMAGE_OPTIONAL_HEADER::Magic
+        MAGIC = IMAGE_NT_OPTIONAL_HDR32_MAGIC,
+        // The size of 'Address', in bytes
+        ADDRESS_SIZE = 4
+    };
+
+    // The encoding of the addresses of the image
+    static RemoteAddressEncodingType getAddressEncoding()
+    {
+        return REMOTE_ADDRESS_32BIT;
+    }
+
+    // Return true if an import thunk is an ordinal
+    static bool isOrdinal(Address thunk)
+    {
+        return (thunk & IMAGE_ORDINAL_FLAG32) != 0;
+    }
+};
+
+/*
+ * PE32+ images
+ */
+struct cPe64Traits {
+    // The headers
+    typedef IMAGE_NT_HEADERS64 NtHeaders;
+    typedef IMAGE_OPTIONAL_HEADER64 OptionalHeader;
+
+    // The TLS and the load configuration directories
+    typedef IMAGE_TLS_DIRECTORY64 TlsDirectory;
+    typedef IMAGE_LOAD_CONFIG_DIRECTORY64 LoadConfigDirectory;
+
+    // A virtual address inside the image (thunks, TLS and load-config fields)
+    typedef uint64 Address;
+
+    enum {
+        // See IMAGE_OPTIONAL_HEADER::Magic
+        MAGIC = IMAGE_NT_OPTIONAL_HDR64_MAGIC,
+        // The size of 'Address', in bytes
+        ADDRESS_SIZE = 8
+    };
+
+    // The encoding of the addresses of the image
+    static RemoteAddressEncodingType getAddressEncoding()
+    {
+        return REMOTE_ADDRESS_64BIT;
+    }
+
+    // Return true if an import thunk is an ordinal
+    static bool isOrdinal(Address thunk)
+    {
+        return (thunk & IMAGE_ORDINAL_FLAG64) != 0;
+    }
+};
+
+#endif // __TBA_PE_TRAITS_H
@@ -197,10 +197,24 @@ protected:
     // class.
     cSection(const cForkStreamPtr& data);
 
+    /*
+     * Called before every access to the content of the section. Sections which
+     * are read on-demand should fill m_data on the first call, and must
+     * synchronize it themselves since m_data isn't read under any lock.
+     * The default implementation does nothing.
+     */
+    virtual void loadSectionContent() const;
+
+    /*
+     * Make sure that m_data is filled before accessing it directly.
+     */
+    void touchSectionContent() const;
+
     // Private data members
 
-    // The raw data of the section (The content of the section)
-    cForkStreamPtr m_data;
+    // The raw data of the section (The content of the section). Can be filled
+    // on-demand by loadSectionContent
+    mutable cForkStreamPtr m_data;
     // A human description string of the section
     cString m_name;
     // The base address of the section
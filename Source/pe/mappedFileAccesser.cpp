@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * mappedFileAccesser.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/os/os.h"
+#include "xStl/data/array.h"
+#include "xStl/data/string.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "pe/peFileSystem.h"
+#include "pe/mappedFileAccesser.h"
+
+#ifndef XSTL_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // XSTL_WINDOWS
+
+cMappedFileAccesser::cMappedFileAccesser(const cString& filename) :
+    m_base(NULL),
+    m_size(0)
+    #ifdef XSTL_WINDOWS
+    ,m_file(INVALID_HANDLE_VALUE),
+    m_mapping(NULL)
+    #endif // XSTL_WINDOWS
+{
+    #if defined(_KERNEL)
+        // Kernel components should map the image using the section object
+        CHECK_FAIL();
+    #elif defined(XSTL_WINDOWS)
+        m_file = CreateFile(filename.getBuffer(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL);
+        CHECK_MSG(m_file != INVALID_HANDLE_VALUE, "Cannot open file");
+
+        LARGE_INTEGER size;
+        if ((!GetFileSizeEx(m_file, &size)) || (size.HighPart != 0))
+        {
+            unmap();
+            XSTL_THROW(cException, EXCEPTION_OUT_OF_RANGE);
+        }
+        m_size = size.LowPart;
+        if (m_size == 0)
+            return;
+
+        m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m_mapping != NULL)
+            m_base = (const uint8*)MapViewOfFile(m_mapping, FILE_MAP_READ,
+                                                 0, 0, 0);
+        if (m_base == NULL)
+        {
+            unmap();
+            XSTL_THROW(cException, EXCEPTION_FAILED);
+        }
+    #else
+        cSArray<char> name;
+        cPeFileSystem::getNativeFilename(filename, name);
+        int fd = open(name.getBuffer(), O_RDONLY);
+        CHECK_MSG(fd >= 0, "Cannot open file");
+
+        struct stat info;
+        if ((fstat(fd, &info) != 0) ||
+            ((uint64)info.st_size != (uint64)((uint)info.st_size)))
+        {
+            close(fd);
+            XSTL_THROW(cException, EXCEPTION_OUT_OF_RANGE);
+        }
+        m_size = (uint)info.st_size;
+        if (m_size == 0)
+        {
+            close(fd);
+            return;
+        }
+
+        void* base = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping holds its own reference to the file
+        close(fd);
+        CHECK_MSG(base != MAP_FAILED, "Cannot map file");
+        m_base = (const uint8*)base;
+    #endif
+}
+
+cMappedFileAccesser::~cMappedFileAccesser()
+{
+    unmap();
+}
+
+void cMappedFileAccesser::unmap()
+{
+    #if defined(_KERNEL)
+        // Nothing to release
+    #elif defined(XSTL_WINDOWS)
+        if (m_base != NULL)
+            UnmapViewOfFile((LPVOID)m_base);
+        if (m_mapping != NULL)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_mapping = NULL;
+        m_file = INVALID_HANDLE_VALUE;
+    #else
+        if (m_base != NULL)
+            munmap((void*)m_base, m_size);
+    #endif
+    m_base = NULL;
+    m_size = 0;
+}
+
+uint cMappedFileAccesser::getSize() const
+{
+    return m_size;
+}
+
+const uint8* cMappedFileAccesser::getPointer(addressNumericValue address,
+                                             uint length) const
+{
+    if ((address > m_size) || (length > (m_size - address)))
+        return NULL;
+    return m_base + address;
+}
+
+bool cMappedFileAccesser::memread(addressNumericValue address,
+                                  void* buffer,
+                                  uint length,
+                                  cFragmentsDescriptor*) const
+{
+    const uint8* data = getPointer(address, length);
+    if (data == NULL)
+        return false;
+    cOS::memcpy(buffer, data, length);
+    return true;
+}
+
+bool cMappedFileAccesser::write(addressNumericValue,
+                                const void*,
+                                uint)
+{
+    CHECK_FAIL();
+}
+
+bool cMappedFileAccesser::isWritableInterface() const
+{
+    return false;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirBoundImport.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirImport.h"
+#include "pe/ntDirBoundImport.h"
+
+cNtDirBoundImport::cNtDirBoundImport() :
+    m_table(NULL),
+    m_tableSize(0)
+{
+}
+
+cNtDirBoundImport::cNtDirBoundImport(const cNtHeader& header) :
+    m_table(NULL),
+    m_tableSize(0)
+{
+    readDirectory(header);
+}
+
+bool cNtDirBoundImport::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT;
+}
+
+void cNtDirBoundImport::readDirectory(const cNtHeader& header,
+                                      uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT;
+
+    const IMAGE_DATA_DIRECTORY& boundDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    uint size    = boundDirectory.Size;
+    uint address = boundDirectory.VirtualAddress;
+    CHECK_MSG((size != 0) && (address != 0),
+              "Bound import table cannot be found!!!");
+
+    // The table is usually a view over the header region of the file
+    const uint8* table = header.getDirectPointer(address, size);
+    if (table == NULL)
+    {
+        m_copy.changeSize(size, false);
+        cVirtualMemoryAccesserPtr mem = header.getPeMemory();
+        CHECK(mem->memread(address, m_copy.getBuffer(), size));
+        table = m_copy.getBuffer();
+    }
+    read(table, size);
+}
+
+void cNtDirBoundImport::read(const uint8* table, uint size)
+{
+    m_modules.changeSize(0);
+    m_table = table;
+    m_tableSize = size;
+
+    // The descriptors and the forwarder references share the record size
+    uint position = 0;
+    while (true)
+    {
+        CHECK(size - position >= sizeof(IMAGE_BOUND_IMPORT_DESCRIPTOR));
+        const IMAGE_BOUND_IMPORT_DESCRIPTOR* descriptor =
+            (const IMAGE_BOUND_IMPORT_DESCRIPTOR*)(table + position);
+        position+= sizeof(IMAGE_BOUND_IMPORT_DESCRIPTOR);
+
+        // The table ends with a null descriptor
+        if ((descriptor->TimeDateStamp == 0) &&
+            (descriptor->OffsetModuleName == 0))
+            break;
+
+        uint forwarders = descriptor->NumberOfModuleForwarderRefs;
+        CHECK((size - position) / sizeof(IMAGE_BOUND_FORWARDER_REF) >=
+              forwarders);
+
+        BoundModule module;
+        module.m_descriptor = descriptor;
+        module.m_name = getName(descriptor->OffsetModuleName);
+        module.m_forwarders =
+            (const IMAGE_BOUND_FORWARDER_REF*)(table + position);
+        for (uint i = 0; i < forwarders; i++)
+            getName(module.m_forwarders[i].OffsetModuleName);
+        position+= forwarders * sizeof(IMAGE_BOUND_FORWARDER_REF);
+
+        m_modules.append(module);
+    }
+}
+
+const char* cNtDirBoundImport::getName(uint offset) const
+{
+    CHECK(offset < m_tableSize);
+    for (uint i = offset; i < m_tableSize; i++)
+    {
+        if (m_table[i] == 0)
+            return (const char*)(m_table + offset);
+    }
+
+    // The name isn't terminated
+    XSTL_THROW(cException, EXCEPTION_FORMAT_ERROR);
+}
+
+const cNtDirBoundImport::ModuleTable& cNtDirBoundImport::getModules() const
+{
+    return m_modules;
+}
+
+const char* cNtDirBoundImport::getForwarderName(
+                            const IMAGE_BOUND_FORWARDER_REF& forwarder) const
+{
+    return getName(forwarder.OffsetModuleName);
+}
+
+uint cNtDirBoundImport::findModule(const char* name) const
+{
+    for (uint i = 0; i < m_modules.getSize(); i++)
+    {
+        if (cNtDirImport::isSameModuleName(m_modules[i].m_name, name))
+            return i;
+    }
+    return NOT_FOUND;
+}
+
+bool cNtDirBoundImport::isStale(const char* name, uint32 timeDateStamp) const
+{
+    for (uint i = 0; i < m_modules.getSize(); i++)
+    {
+        const BoundModule& module = m_modules[i];
+        if (cNtDirImport::isSameModuleName(module.m_name, name) &&
+            (module.m_descriptor->TimeDateStamp != timeDateStamp))
+            return true;
+
+        for (uint j = 0; j < module.m_descriptor->NumberOfModuleForwarderRefs;
+             j++)
+        {
+            const IMAGE_BOUND_FORWARDER_REF& forwarder = module.m_forwarders[j];
+            if (cNtDirImport::isSameModuleName(getForwarderName(forwarder),
+                                               name) &&
+                (forwarder.TimeDateStamp != timeDateStamp))
+                return true;
+        }
+    }
+    return false;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirBoundImport& bound)
+{
+    out << "Bound import table" << endl;
+    out << "==================" << endl << endl;
+
+    for (uint i = 0; i < bound.m_modules.getSize(); i++)
+    {
+        const cNtDirBoundImport::BoundModule& module = bound.m_modules[i];
+        out << "  " << HEXDWORD(module.m_descriptor->TimeDateStamp)
+            << "  " << module.m_name << endl;
+
+        for (uint j = 0; j < module.m_descriptor->NumberOfModuleForwarderRefs;
+             j++)
+        {
+            const IMAGE_BOUND_FORWARDER_REF& forwarder = module.m_forwarders[j];
+            out << "    " << HEXDWORD(forwarder.TimeDateStamp)
+                << "  " << bound.getForwarderName(forwarder) << endl;
+        }
+    }
+
+    return out;
+}
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirDebug.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirDebug.h"
+
+// The size of the fixed part of the CodeView records
+#define CV_PDB20_HEADER_SIZE (sizeof(CV_INFO_PDB20) - 1)
+#define CV_PDB70_HEADER_SIZE (sizeof(CV_INFO_PDB70) - 1)
+
+cNtDirDebug::cNtDirDebug()
+{
+}
+
+cNtDirDebug::cNtDirDebug(const cNtHeader& header)
+{
+    readDirectory(header);
+}
+
+bool cNtDirDebug::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_DEBUG;
+}
+
+void cNtDirDebug::readDirectory(const cNtHeader& header,
+                                uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_DEBUG;
+
+    m_entries.changeSize(0);
+    m_memory = header.getPeMemory();
+
+    IMAGE_DEBUG_DIRECTORY entries[MAX_ENTRIES];
+    uint count = readEntries(*m_memory,
+        header.OptionalHeader.DataDirectory[directoryTypeIndex],
+        entries);
+    m_entries.changeSize(count);
+    for (uint i = 0; i < count; i++)
+    {
+        m_entries[i].m_directory = entries[i];
+        m_entries[i].m_rva = getDataRva(header, entries[i]);
+    }
+}
+
+uint cNtDirDebug::readEntries(const cVirtualMemoryAccesser& memory,
+                              const IMAGE_DATA_DIRECTORY& debugDirectory,
+                              IMAGE_DEBUG_DIRECTORY* entries)
+{
+    CHECK_MSG((debugDirectory.Size != 0) &&
+              (debugDirectory.VirtualAddress != 0),
+              "Debug directory cannot be found!!!");
+
+    // The whole array is read at once
+    uint count = t_min((uint)(debugDirectory.Size /
+                              sizeof(IMAGE_DEBUG_DIRECTORY)),
+                       (uint)MAX_ENTRIES);
+    CHECK(memory.memread(debugDirectory.VirtualAddress,
+                         entries,
+                         count * sizeof(IMAGE_DEBUG_DIRECTORY)));
+    return count;
+}
+
+uint32 cNtDirDebug::getDataRva(const cNtHeader& header,
+                               const IMAGE_DEBUG_DIRECTORY& entry)
+{
+    if (entry.SizeOfData == 0)
+        return INVALID_RVA;
+    if (entry.AddressOfRawData != 0)
+        return entry.AddressOfRawData;
+
+    // The data isn't mapped by the loader. It may still be inside a section
+    uint rva;
+    if ((entry.PointerToRawData == 0) ||
+        (!header.offsetToRva(entry.PointerToRawData, rva)))
+        return INVALID_RVA;
+    return rva;
+}
+
+const cNtDirDebug::EntryTable& cNtDirDebug::getEntries() const
+{
+    return m_entries;
+}
+
+uint cNtDirDebug::findEntry(uint32 type) const
+{
+    for (uint i = 0; i < m_entries.getSize(); i++)
+    {
+        if (m_entries[i].m_directory.Type == type)
+            return i;
+    }
+    return MAX_ENTRIES;
+}
+
+cMemoryAccesserStreamPtr cNtDirDebug::getData(const DebugEntry& entry) const
+{
+    CHECK(entry.m_rva != INVALID_RVA);
+    return cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
+        m_memory,
+        entry.m_rva,
+        (addressNumericValue)entry.m_rva + entry.m_directory.SizeOfData));
+}
+
+bool cNtDirDebug::getCodeView(CodeViewInfo& info) const
+{
+    uint index = findEntry(IMAGE_DEBUG_TYPE_CODEVIEW);
+    if ((index == MAX_ENTRIES) || (m_entries[index].m_rva == INVALID_RVA))
+        return false;
+    return decodeCodeView(*m_memory,
+                          m_entries[index].m_rva,
+                          m_entries[index].m_directory.SizeOfData,
+                          info);
+}
+
+bool cNtDirDebug::getExDllCharacteristics(uint32& characteristics) const
+{
+    uint index = findEntry(IMAGE_DEBUG_TYPE_EX_DLLCHARACTERISTICS);
+    if ((index == MAX_ENTRIES) || (m_entries[index].m_rva == INVALID_RVA) ||
+        (m_entries[index].m_directory.SizeOfData < sizeof(characteristics)))
+        return false;
+    CHECK(m_memory->memread(m_entries[index].m_rva,
+                            &characteristics,
+                            sizeof(characteristics)));
+    return true;
+}
+
+bool cNtDirDebug::readCodeView(const cNtHeader& header, CodeViewInfo& info)
+{
+    cVirtualMemoryAccesserPtr mem = header.getPeMemory();
+
+    IMAGE_DEBUG_DIRECTORY entries[MAX_ENTRIES];
+    uint count = readEntries(*mem,
+        header.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG],
+        entries);
+    for (uint i = 0; i < count; i++)
+    {
+        if (entries[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW)
+            continue;
+        uint32 rva = getDataRva(header, entries[i]);
+        if (rva == INVALID_RVA)
+            return false;
+        return decodeCodeView(*mem, rva, entries[i].SizeOfData, info);
+    }
+    return false;
+}
+
+bool cNtDirDebug::decodeCodeView(const cVirtualMemoryAccesser& memory,
+                                 uint32 rva,
+                                 uint size,
+                                 CodeViewInfo& info)
+{
+    // The record, with a bounded path
+    uint8 record[CV_PDB70_HEADER_SIZE + MAX_PDB_PATH];
+    uint length = t_min(size, (uint)sizeof(record));
+    if (length < CV_PDB20_HEADER_SIZE)
+        return false;
+    CHECK(memory.memread(rva, record, length));
+
+    memset(&info, 0, sizeof(info));
+    uint headerSize;
+    cOS::memcpy(&info.m_cvSignature, record, sizeof(info.m_cvSignature));
+    if (info.m_cvSignature == CV_SIGNATURE_RSDS)
+    {
+        if (length < CV_PDB70_HEADER_SIZE)
+            return false;
+        const CV_INFO_PDB70* pdb70 = (const CV_INFO_PDB70*)record;
+        info.m_guid = pdb70->Signature;
+        info.m_age = pdb70->Age;
+        headerSize = CV_PDB70_HEADER_SIZE;
+    } else if (info.m_cvSignature == CV_SIGNATURE_NB10)
+    {
+        const CV_INFO_PDB20* pdb20 = (const CV_INFO_PDB20*)record;
+        info.m_guid.Data1 = pdb20->Signature;
+        info.m_age = pdb20->Age;
+        headerSize = CV_PDB20_HEADER_SIZE;
+    } else
+    {
+        return false;
+    }
+
+    // The path may be truncated, but it's always terminated
+    uint pathLength = t_min(length - headerSize, (uint)MAX_PDB_PATH - 1);
+    for (uint i = 0; (i < pathLength) && (record[headerSize + i] != 0); i++)
+        info.m_path[i] = (char)record[headerSize + i];
+    return true;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirDebug& debug)
+{
+    out << "Debug directory" << endl;
+    out << "===============" << endl << endl;
+
+    for (uint i = 0; i < debug.m_entries.getSize(); i++)
+    {
+        const cNtDirDebug::DebugEntry& entry = debug.m_entries[i];
+        out << "  Type " << HEXDWORD(entry.m_directory.Type)
+            << "  RVA "  << HEXDWORD(entry.m_rva)
+            << "  Size " << HEXDWORD(entry.m_directory.SizeOfData) << endl;
+    }
+
+    cNtDirDebug::CodeViewInfo info;
+    if (debug.getCodeView(info))
+    {
+        out << "  PDB: " << info.m_path << "  age " << info.m_age << endl;
+    }
+
+    return out;
+}
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirDelayImport.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/peTraits.h"
+#include "pe/peArena.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirDelayImport.h"
+
+// The number of name characters which are copied at once
+#define NAME_BLOCK (64)
+// The initial size of the function table
+#define FUNCTIONS_INITIAL_SIZE (64)
+// The chunk size of the private names arena
+#define NAMES_CHUNK_SIZE (4096)
+
+/*
+ * Copy 'length' bytes out of the image. The content of the sections is
+ * accessed directly when possible, and through the memory accesser otherwise.
+ * Return false if the memory cannot be read.
+ */
+static bool readImage(const cNtHeader& header,
+                      const cVirtualMemoryAccesser& memory,
+                      addressNumericValue address,
+                      void* buffer,
+                      uint length)
+{
+    const uint8* direct = header.getDirectPointer(address, length);
+    if (direct == NULL)
+        return memory.memread(address, buffer, length);
+    cOS::memcpy(buffer, direct, length);
+    return true;
+}
+
+/*
+ * Translate an address of a descriptor into an RVA. Old descriptors hold
+ * virtual addresses.
+ */
+static uint32 toRva(const IMAGE_DELAYLOAD_DESCRIPTOR& descriptor,
+                    uint64 imageBase,
+                    uint64 address)
+{
+    if ((address == 0) || (descriptor.Attributes.RvaBased))
+        return (uint32)address;
+    return (uint32)(address - imageBase);
+}
+
+cNtDirDelayImport::cNtDirDelayImport() :
+    m_numberOfFunctions(0),
+    m_names(NAMES_CHUNK_SIZE)
+{
+}
+
+cNtDirDelayImport::cNtDirDelayImport(const cNtHeader& header) :
+    m_numberOfFunctions(0),
+    m_names(NAMES_CHUNK_SIZE)
+{
+    readDirectory(header);
+}
+
+bool cNtDirDelayImport::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT;
+}
+
+void cNtDirDelayImport::readDirectory(const cNtHeader& header,
+                                      uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT;
+
+    const IMAGE_DATA_DIRECTORY& delayDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    uint size    = delayDirectory.Size;
+    uint address = delayDirectory.VirtualAddress;
+    CHECK_MSG((size != 0) && (address != 0),
+              "Delay import table cannot be found!!!");
+
+    // Delete the previous table
+    m_modules.changeSize(0);
+    m_functions.changeSize(FUNCTIONS_INITIAL_SIZE, false);
+    m_numberOfFunctions = 0;
+    m_names.reset();
+
+    cVirtualMemoryAccesserPtr mem = header.getPeMemory();
+    uint64 imageBase = header.getImageBase();
+    for (uint i = 0; i < MAX_MODULES; i++)
+    {
+        DelayModule module;
+        IMAGE_DELAYLOAD_DESCRIPTOR& descriptor = module.m_descriptor;
+        CHECK(readImage(header, *mem,
+                        address + i * sizeof(IMAGE_DELAYLOAD_DESCRIPTOR),
+                        &descriptor, sizeof(IMAGE_DELAYLOAD_DESCRIPTOR)));
+
+        // The table ends with a null descriptor
+        if (descriptor.DllNameRVA == 0)
+            break;
+
+        module.m_name = readName(header, *mem,
+            toRva(descriptor, imageBase, descriptor.DllNameRVA));
+        module.m_moduleHandle =
+            toRva(descriptor, imageBase, descriptor.ModuleHandleRVA);
+        module.m_importAddressTable =
+            toRva(descriptor, imageBase, descriptor.ImportAddressTableRVA);
+        module.m_importNameTable =
+            toRva(descriptor, imageBase, descriptor.ImportNameTableRVA);
+        module.m_boundImportAddressTable =
+            toRva(descriptor, imageBase, descriptor.BoundImportAddressTableRVA);
+        module.m_unloadInformationTable =
+            toRva(descriptor, imageBase, descriptor.UnloadInformationTableRVA);
+
+        if (header.is64bit())
+            readFunctions<cPe64Traits>(header, *mem, module);
+        else
+            readFunctions<cPe32Traits>(header, *mem, module);
+        m_modules.append(module);
+    }
+
+    // Drop the unused entries
+    m_functions.changeSize(m_numberOfFunctions);
+}
+
+template <class Traits>
+void cNtDirDelayImport::readFunctions(const cNtHeader& header,
+                                      const cVirtualMemoryAccesser& memory,
+                                      DelayModule& module)
+{
+    const IMAGE_DELAYLOAD_DESCRIPTOR& descriptor = module.m_descriptor;
+    uint64 imageBase = header.getImageBase();
+    module.m_firstFunction = m_numberOfFunctions;
+    module.m_numberOfFunctions = 0;
+    if (module.m_importNameTable == 0)
+        return;
+
+    // The bound IAT is optional, and usually isn't stored with the name table
+    bool isBound = (descriptor.TimeDateStamp != 0) &&
+                   (module.m_boundImportAddressTable != 0);
+
+    for (uint i = 0; i < MAX_MODULE_FUNCTIONS; i++)
+    {
+        typename Traits::Address thunk;
+        CHECK(readImage(header, memory,
+                        module.m_importNameTable + i * Traits::ADDRESS_SIZE,
+                        &thunk, Traits::ADDRESS_SIZE));
+        if (thunk == 0)
+            break;
+
+        DelayFunction& function = appendFunction();
+        function.m_iatAddress = module.m_importAddressTable +
+                                i * Traits::ADDRESS_SIZE;
+        function.m_boundAddress = 0;
+        if (Traits::isOrdinal(thunk))
+        {
+            function.m_name = NULL;
+            function.m_hint = (uint16)(thunk & 0xFFFF);
+        } else
+        {
+            // IMAGE_IMPORT_BY_NAME
+            addressNumericValue hintName = toRva(descriptor, imageBase, thunk);
+            uint16 hint;
+            CHECK(readImage(header, memory, hintName, &hint, sizeof(hint)));
+            function.m_hint = hint;
+            function.m_name = readName(header, memory, hintName + sizeof(hint));
+        }
+
+        if (isBound)
+        {
+            typename Traits::Address boundAddress;
+            if (readImage(header, memory,
+                          module.m_boundImportAddressTable +
+                              i * Traits::ADDRESS_SIZE,
+                          &boundAddress, Traits::ADDRESS_SIZE))
+            {
+                function.m_boundAddress = boundAddress;
+            }
+        }
+        module.m_numberOfFunctions++;
+    }
+}
+
+const char* cNtDirDelayImport::readName(const cNtHeader& header,
+                                        const cVirtualMemoryAccesser& memory,
+                                        addressNumericValue address)
+{
+    // Point into the image
+    uint available = 0;
+    const uint8* direct = header.getDirectPointer(address, 1, &available);
+    if (direct != NULL)
+    {
+        uint length = t_min(available, (uint)MAX_NAME_LENGTH);
+        for (uint i = 0; i < length; i++)
+            if (direct[i] == 0)
+                return (const char*)direct;
+    }
+
+    // Copy the name. A name which ends near the end of a section is read byte
+    // by byte
+    char name[MAX_NAME_LENGTH];
+    uint length = 0;
+    uint blockSize = NAME_BLOCK;
+    while (length + blockSize <= MAX_NAME_LENGTH)
+    {
+        if ((blockSize > 1) &&
+            (!memory.memread(address + length, name + length, blockSize)))
+        {
+            blockSize = 1;
+            continue;
+        }
+        if (blockSize == 1)
+        {
+            CHECK(memory.memread(address + length, name + length, 1));
+        }
+
+        for (uint i = 0; i < blockSize; i++)
+        {
+            if (name[length + i] == 0)
+                return m_names.duplicate(name, length + i);
+        }
+        length+= blockSize;
+    }
+
+    // The name is too long
+    XSTL_THROW(cException, EXCEPTION_FORMAT_ERROR);
+}
+
+cNtDirDelayImport::DelayFunction& cNtDirDelayImport::appendFunction()
+{
+    if (m_numberOfFunctions == m_functions.getSize())
+    {
+        m_functions.changeSize(t_max(m_numberOfFunctions * 2,
+                                     (uint)FUNCTIONS_INITIAL_SIZE));
+    }
+    return m_functions[m_numberOfFunctions++];
+}
+
+const cNtDirDelayImport::ModuleTable& cNtDirDelayImport::getModules() const
+{
+    return m_modules;
+}
+
+const cNtDirDelayImport::FunctionTable& cNtDirDelayImport::getFunctions() const
+{
+    return m_functions;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirDelayImport& import)
+{
+    out << "Delay import table" << endl;
+    out << "==================" << endl << endl;
+
+    for (uint i = 0; i < import.m_modules.getSize(); i++)
+    {
+        const cNtDirDelayImport::DelayModule& module = import.m_modules[i];
+        out << module.m_name << endl;
+        out << "  Attributes:              " << HEXDWORD(module.m_descriptor.Attributes.AllAttributes) << endl;
+        out << "  ModuleHandle:            " << HEXDWORD(module.m_moduleHandle) << endl;
+        out << "  ImportAddressTable:      " << HEXDWORD(module.m_importAddressTable) << endl;
+        out << "  ImportNameTable:         " << HEXDWORD(module.m_importNameTable) << endl;
+        out << "  BoundImportAddressTable: " << HEXDWORD(module.m_boundImportAddressTable) << endl;
+        out << "  UnloadInformationTable:  " << HEXDWORD(module.m_unloadInformationTable) << endl;
+        out << "  TimeDateStamp:           " << HEXDWORD(module.m_descriptor.TimeDateStamp) << endl;
+        out << endl;
+
+        for (uint j = 0; j < module.m_numberOfFunctions; j++)
+        {
+            const cNtDirDelayImport::DelayFunction& function =
+                import.m_functions[module.m_firstFunction + j];
+            out << "  " << HEXDWORD(function.m_iatAddress)
+                << "     " << HEXWORD(function.m_hint)
+                << "  ";
+            if (function.m_name != NULL)
+                out << function.m_name;
+            else
+                out << "Ordinal " << (uint)function.m_hint;
+            out << endl;
+        }
+        out << endl;
+    }
+
+    return out;
+}
+#endif
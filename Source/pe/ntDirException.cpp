@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirException.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirException.h"
+
+// The ARM unwind data. The low two bits are the format flag (0 for an .xdata
+// RVA), the function length is counted in instructions
+#define UNWIND_DATA_FLAG_MASK            (3)
+#define UNWIND_PACKED_FUNCTION_LENGTH(x) (((x) >> 2) & 0x7FF)
+#define UNWIND_XDATA_FUNCTION_LENGTH(x)  ((x) & 0x3FFFF)
+// The low bit of the begin address of ARM functions marks Thumb code
+#define THUMB_BIT                        (1)
+
+cNtDirException::cNtDirException() :
+    m_hasEndAddress(true),
+    m_instructionSize(0),
+    m_table(NULL),
+    m_count(0),
+    m_entrySize(sizeof(IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY))
+{
+}
+
+cNtDirException::cNtDirException(const cNtHeader& header) :
+    m_hasEndAddress(true),
+    m_instructionSize(0),
+    m_table(NULL),
+    m_count(0),
+    m_entrySize(sizeof(IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY))
+{
+    readDirectory(header);
+}
+
+bool cNtDirException::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_EXCEPTION;
+}
+
+void cNtDirException::readDirectory(const cNtHeader& header,
+                                    uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_EXCEPTION;
+
+    const IMAGE_DATA_DIRECTORY& exceptionDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    CHECK_MSG((exceptionDirectory.Size != 0) &&
+              (exceptionDirectory.VirtualAddress != 0),
+              ".pdata cannot be found!!!");
+
+    switch (header.FileHeader.Machine)
+    {
+    case IMAGE_FILE_MACHINE_AMD64:
+    case IMAGE_FILE_MACHINE_IA64:
+        m_hasEndAddress = true;
+        m_instructionSize = 0;
+        m_entrySize = sizeof(IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY);
+        break;
+    case IMAGE_FILE_MACHINE_ARM64:
+        m_hasEndAddress = false;
+        m_instructionSize = 4;
+        m_entrySize = sizeof(IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY);
+        break;
+    case IMAGE_FILE_MACHINE_ARMNT:
+        m_hasEndAddress = false;
+        m_instructionSize = 2;
+        m_entrySize = sizeof(IMAGE_ARM_RUNTIME_FUNCTION_ENTRY);
+        break;
+    default:
+        CHECK_FAIL();
+    }
+
+    m_table = NULL;
+    m_count = 0;
+    m_copy.changeSize(0);
+    m_memory = header.getPeMemory();
+
+    // The table must be inside the image
+    uint32 rva = exceptionDirectory.VirtualAddress;
+    uint32 sizeOfImage = header.OptionalHeader.SizeOfImage;
+    CHECK(rva < sizeOfImage);
+    uint count = t_min((uint)exceptionDirectory.Size,
+                       (uint)(sizeOfImage - rva)) / m_entrySize;
+    uint size = count * m_entrySize;
+    if (count == 0)
+        return;
+
+    const uint8* table = header.getDirectPointer(rva, size);
+    if (table == NULL)
+    {
+        m_copy.changeSize(size, false);
+        CHECK(m_memory->memread(rva, m_copy.getBuffer(), size));
+        table = m_copy.getBuffer();
+    }
+    m_table = table;
+    m_count = count;
+
+    validate(sizeOfImage);
+}
+
+void cNtDirException::validate(uint32 sizeOfImage) const
+{
+    uint32 previousEnd = 0;
+    for (uint i = 0; i < m_count; i++)
+    {
+        uint32 begin = beginAt(i);
+        CHECK_MSG(begin >= previousEnd, ".pdata isn't sorted");
+        CHECK(begin < sizeOfImage);
+        if (m_hasEndAddress)
+        {
+            // The functions cannot overlap
+            previousEnd = endAt(i);
+            CHECK((previousEnd > begin) && (previousEnd <= sizeOfImage));
+        } else
+        {
+            previousEnd = begin + 1;
+        }
+    }
+}
+
+uint32 cNtDirException::beginAt(uint index) const
+{
+    // All formats start with the begin address
+    uint32 begin = ((const IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY*)
+                    (m_table + index * m_entrySize))->BeginAddress;
+    if (m_instructionSize == 2)
+        begin&= ~(uint32)THUMB_BIT;
+    return begin;
+}
+
+uint32 cNtDirException::endAt(uint index) const
+{
+    const uint8* entry = m_table + index * m_entrySize;
+    if (m_hasEndAddress)
+        return ((const IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY*)entry)->EndAddress;
+
+    uint32 unwindData =
+        ((const IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY*)entry)->UnwindData;
+    uint32 length;
+    if ((unwindData & UNWIND_DATA_FLAG_MASK) != 0)
+    {
+        length = UNWIND_PACKED_FUNCTION_LENGTH(unwindData);
+    } else
+    {
+        uint32 xdataHeader;
+        CHECK(m_memory->memread(unwindData, &xdataHeader,
+                                sizeof(xdataHeader)));
+        length = UNWIND_XDATA_FUNCTION_LENGTH(xdataHeader);
+    }
+    return beginAt(index) + length * m_instructionSize;
+}
+
+uint cNtDirException::getCount() const
+{
+    return m_count;
+}
+
+uint32 cNtDirException::getBegin(uint index) const
+{
+    CHECK(index < m_count);
+    return beginAt(index);
+}
+
+uint32 cNtDirException::getEnd(uint index) const
+{
+    CHECK(index < m_count);
+    return endAt(index);
+}
+
+uint32 cNtDirException::getUnwindData(uint index) const
+{
+    CHECK(index < m_count);
+    const uint8* entry = m_table + index * m_entrySize;
+    if (m_hasEndAddress)
+        return ((const IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY*)entry)->
+                    UnwindInfoAddress;
+    return ((const IMAGE_ARM64_RUNTIME_FUNCTION_ENTRY*)entry)->UnwindData;
+}
+
+void cNtDirException::getFunction(uint index, RuntimeFunction& function) const
+{
+    function.m_begin = getBegin(index);
+    function.m_end = endAt(index);
+    function.m_unwindData = getUnwindData(index);
+}
+
+uint cNtDirException::functionForRva(uint32 rva) const
+{
+    // Find the last function which starts at or before the RVA
+    uint low = 0;
+    uint high = m_count;
+    while (low < high)
+    {
+        uint middle = low + (high - low) / 2;
+        if (beginAt(middle) <= rva)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if ((low == 0) || (rva >= endAt(low - 1)))
+        return INVALID_INDEX;
+    return low - 1;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirException& exception)
+{
+    out << "Exception directory" << endl;
+    out << "===================" << endl << endl;
+
+    out << "  Functions: " << exception.m_count << endl;
+    for (uint i = 0; i < exception.m_count; i++)
+    {
+        cNtDirException::RuntimeFunction function;
+        exception.getFunction(i, function);
+        out << "    " << HEXDWORD(function.m_begin)
+            << " - "  << HEXDWORD(function.m_end)
+            << "  "   << HEXDWORD(function.m_unwindData) << endl;
+    }
+
+    return out;
+}
+#endif
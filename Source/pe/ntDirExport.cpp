@@ -42,18 +42,27 @@
 #include "xStl/data/list.h"
 #include "xStl/data/string.h"
 #include "xStl/data/datastream.h"
+#include "xStl/os/os.h"
 #include "xStl/stream/basicIO.h"
 #include "xStl/stream/stringerStream.h"
 #include "pe/section.h"
 #include "pe/datastruct.h"
+#include "pe/peTraits.h"
 #include "pe/ntheader.h"
+#include "pe/peExportIndex.h"
 #include "pe/ntDirExport.h"
 
-cNtDirExport::cNtDirExport()
+cNtDirExport::cNtDirExport() :
+    m_isExportArrayBuilt(false),
+    m_entryPoint(0),
+    m_is64bit(false)
 {
 }
 
-cNtDirExport::cNtDirExport(const cNtHeader& header)
+cNtDirExport::cNtDirExport(const cNtHeader& header) :
+    m_isExportArrayBuilt(false),
+    m_entryPoint(0),
+    m_is64bit(false)
 {
     readDirectory(header);
 }
@@ -77,18 +86,210 @@ void cNtDirExport::readDirectory(const cNtHeader& header,
 
     cVirtualMemoryAccesserPtr mem = header.getPeMemory();
     cMemoryAccesserStream newStream(mem, address, address + size);
-    read(newStream, address, header.OptionalHeader.AddressOfEntryPoint);
+
+    // Decode the directory in-place when the image allows it
+    const uint8* view = header.getDirectPointer(address, size);
+    if (view != NULL)
+    {
+        readView(view, size, newStream, address,
+                 header.OptionalHeader.AddressOfEntryPoint, header.is64bit());
+        return;
+    }
+
+    read(newStream, address, header.OptionalHeader.AddressOfEntryPoint,
+         header.is64bit());
 }
 
 void cNtDirExport::read(basicInput& stream,
                         addressNumericValue imageBase,
-                        addressNumericValue entryPoint)
+                        addressNumericValue entryPoint,
+                        bool is64bit,
+                        ReadMode mode)
 {
-    // Save the root pointer
-    uint mpos = stream.getPointer();
+    if (mode == READ_BULK)
+    {
+        // The whole directory with a single read
+        uint mpos = stream.getPointer();
+        cBuffer view;
+        view.changeSize(stream.length() - mpos, false);
+        stream.pipeRead(view.getBuffer(), view.getSize());
+        stream.seek(mpos, basicInput::IO_SEEK_SET);
+        readView(view.getBuffer(), view.getSize(), stream, imageBase,
+                 entryPoint, is64bit);
+        return;
+    }
+
+    clear(entryPoint, is64bit);
+    readTable(stream, imageBase);
+}
 
-    // Delete all the previous functions
+void cNtDirExport::clear(addressNumericValue entryPoint, bool is64bit)
+{
     m_exportFunctions.changeSize(0);
+    m_isExportArrayBuilt = false;
+    m_entryPoint = entryPoint;
+    m_is64bit = is64bit;
+    m_index.reset(0, 0);
+}
+
+void cNtDirExport::readView(const uint8* view,
+                            uint viewSize,
+                            basicInput& stream,
+                            addressNumericValue imageBase,
+                            addressNumericValue entryPoint,
+                            bool is64bit)
+{
+    clear(entryPoint, is64bit);
+    readBulk(view, viewSize, stream, imageBase);
+}
+
+void cNtDirExport::readBulk(const uint8* view,
+                            uint viewSize,
+                            basicInput& stream,
+                            addressNumericValue imageBase)
+{
+    uint mpos = stream.getPointer();
+
+    CHECK(viewSize >= sizeof(m_exportDirectory));
+    cOS::memcpy(&m_exportDirectory, view, sizeof(m_exportDirectory));
+
+    cSArray<char> nameBuffer(0x100);
+    cSArray<character> stringBuffer(0x100);
+    const char* name;
+    uint length;
+    name = readString(view, viewSize, stream, mpos,
+                      m_exportDirectory.Name - imageBase, nameBuffer, length);
+    m_moduleName = toString(name, length, stringBuffer);
+
+    // The counts come from the file, bound them before reading anything
+    uint64 available = t_max((uint64)viewSize,
+                             (uint64)(stream.length() - mpos));
+    uint numberOfNames = limitCount(m_exportDirectory.NumberOfNames,
+                                    sizeof(uint32), available);
+    uint numberOfFunctions = limitCount(m_exportDirectory.NumberOfFunctions,
+                                        sizeof(uint32), available);
+
+    // The three arrays, each with a single read at most
+    cBuffer ordinalsCopy, namesCopy, functionsCopy;
+    const uint8* ordinals = readArray(view, viewSize, stream, mpos,
+        m_exportDirectory.AddressOfNameOrdinals - imageBase,
+        (uint64)numberOfNames * sizeof(uint16), ordinalsCopy);
+    const uint8* names = readArray(view, viewSize, stream, mpos,
+        m_exportDirectory.AddressOfNames - imageBase,
+        (uint64)numberOfNames * sizeof(uint32), namesCopy);
+    const uint8* functions = readArray(view, viewSize, stream, mpos,
+        m_exportDirectory.AddressOfFunctions - imageBase,
+        (uint64)numberOfFunctions * sizeof(uint32), functionsCopy);
+
+    m_index.reset(m_exportDirectory.Base, numberOfFunctions);
+
+    // The names
+    uint i;
+    for (i = 0; i < numberOfNames; i++)
+    {
+        uint16 oridinal;
+        uint32 namePointer;
+        cOS::memcpy(&oridinal, ordinals + i * sizeof(uint16),
+                    sizeof(oridinal));
+        cOS::memcpy(&namePointer, names + i * sizeof(uint32),
+                    sizeof(namePointer));
+        name = readString(view, viewSize, stream, mpos,
+                          namePointer - imageBase, nameBuffer, length);
+        m_index.addName(oridinal, name, length);
+    }
+
+    // The addresses. Forwarders point to a string inside the directory
+    numberOfFunctions = m_index.getNumberOfFunctions();
+    for (i = 0; i < numberOfFunctions; i++)
+    {
+        uint32 address;
+        cOS::memcpy(&address, functions + i * sizeof(uint32),
+                    sizeof(address));
+        m_index.setFunction(i, address);
+
+        if ((address >= imageBase) && ((address - imageBase) < viewSize))
+        {
+            name = readString(view, viewSize, stream, mpos,
+                              address - imageBase, nameBuffer, length);
+            m_index.setForwarder(i, name, length);
+        }
+    }
+    m_index.build();
+}
+
+const uint8* cNtDirExport::readArray(const uint8* view,
+                                     uint viewSize,
+                                     basicInput& stream,
+                                     uint mpos,
+                                     addressNumericValue offset,
+                                     uint64 size,
+                                     cBuffer& copy)
+{
+    if (((uint64)offset <= viewSize) && (size <= viewSize - (uint64)offset))
+        return view + offset;
+
+    // The array is outside the directory. It must be inside the stream
+    uint64 available = stream.length() - mpos;
+    CHECK(((uint64)offset <= available) &&
+          (size <= available - (uint64)offset));
+    copy.changeSize((uint)size, false);
+    stream.seek(mpos + offset, basicInput::IO_SEEK_SET);
+    stream.pipeRead(copy.getBuffer(), (uint)size);
+    return copy.getBuffer();
+}
+
+uint cNtDirExport::limitCount(uint32 count,
+                              uint elementSize,
+                              uint64 available)
+{
+    return (uint)t_min(t_min((uint64)count,
+                             (uint64)cPeExportIndex::MAX_FUNCTIONS),
+                       available / elementSize);
+}
+
+const char* cNtDirExport::readString(const uint8* view,
+                                     uint viewSize,
+                                     basicInput& stream,
+                                     uint mpos,
+                                     addressNumericValue offset,
+                                     cSArray<char>& buffer,
+                                     uint& length)
+{
+    if (offset < viewSize)
+    {
+        // Bounded by the end of the directory
+        const uint8* string = view + offset;
+        const uint8* end = (const uint8*)memchr(string, 0, viewSize - offset);
+        if (end != NULL)
+        {
+            length = (uint)(end - string);
+            return (const char*)string;
+        }
+    }
+
+    // The string is outside the directory, or isn't terminated inside it
+    stream.seek(mpos + offset, basicInput::IO_SEEK_SET);
+    length = toAscii(stream.readAsciiNullString(), buffer);
+    return buffer.getBuffer();
+}
+
+cString cNtDirExport::toString(const char* string,
+                               uint length,
+                               cSArray<character>& buffer)
+{
+    if (length + 1 > buffer.getSize())
+        buffer.changeSize(length + 1, false);
+    for (uint i = 0; i < length; i++)
+        buffer[i] = (character)((uint8)string[i]);
+    buffer[length] = 0;
+    return cString(buffer.getBuffer());
+}
+
+void cNtDirExport::readTable(basicInput& stream,
+                             addressNumericValue imageBase)
+{
+    // Save the root pointer
+    uint mpos = stream.getPointer();
 
     // Read the IMAGE_EXPORT_DIRECTORY data
     stream.pipeRead(&m_exportDirectory, sizeof(m_exportDirectory));
@@ -101,68 +302,175 @@ void cNtDirExport::read(basicInput& stream,
     // There are 3 components for each export enrty: Name, address and ordinal
     // value.
 
-    // Calculate the needed table size
-    uint tableSize = t_max(m_exportDirectory.NumberOfFunctions,
-                      m_exportDirectory.NumberOfNames);
-    if (entryPoint)
-        tableSize++;
-
-    // Read the function table and their names
-    m_exportFunctions.changeSize(tableSize);
-
-    // Read the ordinal values
+    // Read the ordinal values. There is one for each name, the table may end
+    // at the end of the directory. The counts come from the file, bound them
+    // before allocating anything
+    uint64 available = stream.length() - mpos;
+    uint numberOfNames = limitCount(m_exportDirectory.NumberOfNames,
+                                    sizeof(uint32), available);
+    cSArray<uint16> ordinals(numberOfNames);
     stream.seek(mpos + (m_exportDirectory.AddressOfNameOrdinals - imageBase),
                 basicInput::IO_SEEK_SET);
     uint i;
-    for (i = 0; i < m_exportFunctions.getSize(); i++)
-        stream.streamReadUint16((uint16&)m_exportFunctions[i].m_ordinal);
-
+    for (i = 0; i < numberOfNames; i++)
+        stream.streamReadUint16(ordinals[i]);
 
     // Read the name table
-   cSArray<uint32> namePointers(m_exportDirectory.NumberOfNames);
-   stream.seek(mpos + (m_exportDirectory.AddressOfNames - imageBase),
+    cSArray<uint32> namePointers(numberOfNames);
+    stream.seek(mpos + (m_exportDirectory.AddressOfNames - imageBase),
                 basicInput::IO_SEEK_SET);
 
-    for (i = 0; i < m_exportDirectory.NumberOfNames; ++i)
+    for (i = 0; i < numberOfNames; ++i)
         stream.streamReadUint32(namePointers[i]);
 
+    // The index holds a slot per ordinal, without the entry point
+    m_index.reset(m_exportDirectory.Base,
+                  limitCount(m_exportDirectory.NumberOfFunctions,
+                             sizeof(uint32), available));
+    cSArray<char> nameBuffer(0x100);
+
     // Read the real names
-    for (i = 0; i < m_exportDirectory.NumberOfNames; ++i)
+    for (i = 0; i < numberOfNames; ++i)
     {
         stream.seek(mpos + (namePointers[i] - imageBase),
                     basicInput::IO_SEEK_SET);
-
-        uint oridinal = m_exportFunctions[i].m_ordinal;
-        m_exportFunctions[oridinal].m_isName = true;
-        m_exportFunctions[oridinal].m_name = stream.readAsciiNullString();
+        uint length = toAscii(stream.readAsciiNullString(), nameBuffer);
+        m_index.addName(ordinals[i], nameBuffer.getBuffer(), length);
     }
 
     // Read the address for the functions
     stream.seek(mpos + (m_exportDirectory.AddressOfFunctions - imageBase),
                 basicInput::IO_SEEK_SET);
 
-    for (i = 0; i < m_exportDirectory.NumberOfFunctions; i++)
+    uint numberOfFunctions = m_index.getNumberOfFunctions();
+    for (i = 0; i < numberOfFunctions; i++)
     {
-        // TODO!
-        // The export directory is set for 32bit files only!
+        // The table holds RVAs for both flavours, only the address encoding
+        // of the image differs
         uint32 address = 0;
         stream.streamReadUint32(address);
+        m_index.setFunction(i, address);
+
+        // Forwarders point to a string inside the directory
+        if ((address >= imageBase) &&
+            ((address - imageBase) < (stream.length() - mpos)))
+        {
+            stream.seek(mpos + (address - imageBase), basicInput::IO_SEEK_SET);
+            uint length = toAscii(stream.readAsciiNullString(), nameBuffer);
+            m_index.setForwarder(i, nameBuffer.getBuffer(), length);
+
+            // Back to the table
+            stream.seek(mpos + (m_exportDirectory.AddressOfFunctions -
+                                imageBase) + (i + 1) * sizeof(uint32),
+                        basicInput::IO_SEEK_SET);
+        }
+    }
+    m_index.build();
+}
+
+uint cNtDirExport::toAscii(const cString& string, cSArray<char>& buffer)
+{
+    uint length = string.length();
+    if (length > buffer.getSize())
+        buffer.changeSize(length, false);
+    for (uint i = 0; i < length; i++)
+        buffer[i] = (char)string[i];
+    return length;
+}
+
+const cNtDirExport::ExportTable& cNtDirExport::getExportArray() const
+{
+    if (!m_isExportArrayBuilt)
+    {
+        buildExportArray();
+        m_isExportArrayBuilt = true;
+    }
+    return m_exportFunctions;
+}
+
+void cNtDirExport::buildExportArray() const
+{
+    RemoteAddressEncodingType encoding =
+        m_is64bit ? cPe64Traits::getAddressEncoding() :
+                    cPe32Traits::getAddressEncoding();
+    cSArray<character> stringBuffer(0x100);
+
+    // A slot for each function and for each name, and the entry point at the
+    // end
+    uint numberOfFunctions = m_index.getNumberOfFunctions();
+    uint numberOfNames = m_index.getNumberOfNames();
+    uint tableSize = t_max(numberOfFunctions, numberOfNames);
+    if (m_entryPoint)
+        tableSize++;
+    m_exportFunctions.changeSize(0);
+    m_exportFunctions.changeSize(tableSize);
+
+    uint i;
+    for (i = 0; i < tableSize; i++)
+    {
+        m_exportFunctions[i].m_ordinal = 0;
+        m_exportFunctions[i].m_isName = false;
+        m_exportFunctions[i].m_isForwarder = false;
+    }
+
+    // The addresses and the forwarders
+    cPeExportIndex::Export function;
+    for (i = 0; i < numberOfFunctions; i++)
+    {
+        m_index.getFunction(i, function);
         m_exportFunctions[i].m_address =
-                       remoteAddressNumericValue(address, REMOTE_ADDRESS_32BIT);
+            remoteAddressNumericValue(function.m_rva, encoding);
+        if (function.m_forwarder != NULL)
+        {
+            m_exportFunctions[i].m_isForwarder = true;
+            m_exportFunctions[i].m_forwarder = toString(function.m_forwarder,
+                (uint)strlen(function.m_forwarder), stringBuffer);
+        }
+    }
+
+    // The names. As the name-ordinal table, entry 'i' holds the ordinal of
+    // the i-th name
+    for (i = 0; i < numberOfNames; i++)
+    {
+        uint length;
+        uint oridinal;
+        const char* name = m_index.getName(i, length, oridinal);
+        m_exportFunctions[i].m_ordinal = (uint16)oridinal;
+
+        // A corrupted ordinal points outside the table, skip the name
+        if (oridinal >= tableSize)
+            continue;
+        m_exportFunctions[oridinal].m_isName = true;
+        m_exportFunctions[oridinal].m_name =
+            toString(name, length, stringBuffer);
     }
 
     // Add the entry point, if it exists
-    if (entryPoint)
+    if (m_entryPoint)
     {
         m_exportFunctions[tableSize - 1].m_isName = true;
         m_exportFunctions[tableSize - 1].m_name = ENTRYPOINT_NAME;
-        m_exportFunctions[tableSize - 1].m_address = entryPoint;
+        m_exportFunctions[tableSize - 1].m_isForwarder = false;
+        m_exportFunctions[tableSize - 1].m_address =
+            remoteAddressNumericValue(m_entryPoint, encoding);
     }
 }
 
-const cNtDirExport::ExportTable& cNtDirExport::getExportArray() const
+const cPeExportIndex& cNtDirExport::getIndex() const
 {
-    return m_exportFunctions;
+    return m_index;
+}
+
+bool cNtDirExport::findByName(const char* name,
+                              cPeExportIndex::Export& entry) const
+{
+    return m_index.findByName(name, entry);
+}
+
+bool cNtDirExport::findByOrdinal(uint ordinal,
+                                 cPeExportIndex::Export& entry) const
+{
+    return m_index.findByOrdinal(ordinal, entry);
 }
 
 bool cNtDirExport::cExportEntrie::isValid() const
@@ -200,6 +508,10 @@ void cNtDirExport::cExportEntrie::deserialize(basicInput& stream)
         // Remove the old name
         m_name = cString();
 
+    // Forwarders aren't serialized
+    m_isForwarder = false;
+    m_forwarder = cString();
+
     // Decode the oridinal
     stream.streamReadUint16(m_ordinal);
 }
@@ -231,14 +543,17 @@ cStringerStream& operator << (cStringerStream& out,
     out << endl << endl;
 
     /* Print all the functions at the _export directory */
-    for (uint i = 0; i < _export.m_exportFunctions.getSize(); i++)
+    const cNtDirExport::ExportTable& functions = _export.getExportArray();
+    for (uint i = 0; i < functions.getSize(); i++)
     {
-        out << "  "    << HEXREMOTEADDRESS(_export.m_exportFunctions[i].m_address)
-            << "     " << HEXWORD (_export.m_exportFunctions[i].m_ordinal)
+        out << "  "    << HEXREMOTEADDRESS(functions[i].m_address)
+            << "     " << HEXWORD (functions[i].m_ordinal)
             << "  ";
 
-        if (_export.m_exportFunctions[i].m_isName)
-            out << _export.m_exportFunctions[i].m_name;
+        if (functions[i].m_isName)
+            out << functions[i].m_name;
+        if (functions[i].m_isForwarder)
+            out << " -> " << functions[i].m_forwarder;
 
         out << endl;
     }
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirImport.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/peTraits.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirImport.h"
+
+// The number of thunks which are read at once
+#define THUNKS_BLOCK (64)
+// The number of name characters which are read at once
+#define NAME_BLOCK (64)
+// The initial size of the function table
+#define FUNCTIONS_INITIAL_SIZE (256)
+
+cNtDirImport::cNtDirImport() :
+    m_numberOfFunctions(0),
+    m_stringPoolSize(0)
+{
+}
+
+cNtDirImport::cNtDirImport(const cNtHeader& header) :
+    m_numberOfFunctions(0),
+    m_stringPoolSize(0)
+{
+    readDirectory(header);
+}
+
+bool cNtDirImport::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_IMPORT;
+}
+
+void cNtDirImport::readDirectory(const cNtHeader& header,
+                                 uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_IMPORT;
+
+    const IMAGE_DATA_DIRECTORY& importDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    uint size    = importDirectory.Size;
+    uint address = importDirectory.VirtualAddress;
+    CHECK_MSG((size != 0) && (address != 0), ".idata cannot be found!!!");
+
+    cVirtualMemoryAccesserPtr mem = header.getPeMemory();
+    read(*mem, address, size, header.is64bit());
+}
+
+void cNtDirImport::read(const cVirtualMemoryAccesser& memory,
+                        addressNumericValue address,
+                        uint size,
+                        bool is64bit)
+{
+    // Delete the previous table
+    m_modules.changeSize(0);
+    m_functions.changeSize(0);
+    m_numberOfFunctions = 0;
+    m_stringPool.changeSize(0);
+    m_stringPoolSize = 0;
+
+    // Guess the sizes out of the directory: a module name and a few function
+    // names per descriptor
+    uint expectedModules = size / sizeof(IMAGE_IMPORT_DESCRIPTOR);
+    m_functions.changeSize(FUNCTIONS_INITIAL_SIZE, false);
+    reserveStringPool(t_min(expectedModules, (uint)MAX_MODULES) * 256);
+
+    for (uint i = 0; i < MAX_MODULES; i++)
+    {
+        ImportModule module;
+        CHECK(memory.memread(address + i * sizeof(IMAGE_IMPORT_DESCRIPTOR),
+                             &module.m_descriptor,
+                             sizeof(IMAGE_IMPORT_DESCRIPTOR)));
+
+        // The table ends with a null descriptor
+        if ((module.m_descriptor.Name == 0) &&
+            (module.m_descriptor.FirstThunk == 0))
+            break;
+
+        module.m_name = readName(memory, module.m_descriptor.Name);
+        if (is64bit)
+            readThunks<cPe64Traits>(memory, module);
+        else
+            readThunks<cPe32Traits>(memory, module);
+        m_modules.append(module);
+    }
+
+    // Drop the unused entries
+    m_functions.changeSize(m_numberOfFunctions);
+}
+
+template <class Traits>
+void cNtDirImport::readThunks(const cVirtualMemoryAccesser& memory,
+                              ImportModule& module)
+{
+    const IMAGE_IMPORT_DESCRIPTOR& descriptor = module.m_descriptor;
+    module.m_firstFunction = m_numberOfFunctions;
+    module.m_numberOfFunctions = 0;
+
+    // Old linkers don't emit the INT. The IAT of an unbound image is a copy of
+    // it
+    addressNumericValue thunks = descriptor.OriginalFirstThunk;
+    if (thunks == 0)
+        thunks = descriptor.FirstThunk;
+    if (thunks == 0)
+        return;
+
+    typename Traits::Address block[THUNKS_BLOCK];
+    uint blockSize = THUNKS_BLOCK;
+    uint count = 0;
+    uint index = 0;
+    for (uint i = 0; i < MAX_MODULE_FUNCTIONS; i++)
+    {
+        if (index == count)
+        {
+            // Read a block of thunks. A table which ends near the end of a
+            // section is read thunk by thunk.
+            addressNumericValue position = thunks + i * Traits::ADDRESS_SIZE;
+            if ((blockSize > 1) &&
+                (!memory.memread(position, block,
+                                 blockSize * Traits::ADDRESS_SIZE)))
+            {
+                blockSize = 1;
+            }
+            if (blockSize == 1)
+            {
+                CHECK(memory.memread(position, block, Traits::ADDRESS_SIZE));
+            }
+            count = blockSize;
+            index = 0;
+        }
+
+        typename Traits::Address thunk = block[index++];
+        if (thunk == 0)
+            break;
+
+        ImportFunction& function = appendFunction();
+        function.m_iatAddress = descriptor.FirstThunk +
+                                i * Traits::ADDRESS_SIZE;
+        if (Traits::isOrdinal(thunk))
+        {
+            function.m_name = NO_NAME;
+            function.m_hint = (uint16)(thunk & 0xFFFF);
+        } else
+        {
+            // IMAGE_IMPORT_BY_NAME
+            addressNumericValue hintName =
+                (addressNumericValue)(thunk & 0x7FFFFFFF);
+            uint16 hint;
+            CHECK(memory.memread(hintName, &hint, sizeof(hint)));
+            function.m_hint = hint;
+            function.m_name = readName(memory, hintName + sizeof(hint));
+        }
+        module.m_numberOfFunctions++;
+    }
+}
+
+uint cNtDirImport::readName(const cVirtualMemoryAccesser& memory,
+                            addressNumericValue address)
+{
+    uint offset = m_stringPoolSize;
+    uint length = 0;
+    uint blockSize = NAME_BLOCK;
+    while (length < MAX_NAME_LENGTH)
+    {
+        reserveStringPool(offset + length + blockSize);
+        char* buffer = m_stringPool.getBuffer() + offset + length;
+
+        // A name which ends near the end of a section is read byte by byte
+        if ((blockSize > 1) &&
+            (!memory.memread(address + length, buffer, blockSize)))
+        {
+            blockSize = 1;
+            continue;
+        }
+        if (blockSize == 1)
+        {
+            CHECK(memory.memread(address + length, buffer, 1));
+        }
+
+        for (uint i = 0; i < blockSize; i++)
+        {
+            if (buffer[i] == 0)
+            {
+                m_stringPoolSize = offset + length + i + 1;
+                return offset;
+            }
+        }
+        length+= blockSize;
+    }
+
+    // The name is too long
+    XSTL_THROW(cException, EXCEPTION_FORMAT_ERROR);
+}
+
+cNtDirImport::ImportFunction& cNtDirImport::appendFunction()
+{
+    if (m_numberOfFunctions == m_functions.getSize())
+    {
+        m_functions.changeSize(t_max(m_numberOfFunctions * 2,
+                                     (uint)FUNCTIONS_INITIAL_SIZE));
+    }
+    return m_functions[m_numberOfFunctions++];
+}
+
+void cNtDirImport::reserveStringPool(uint size)
+{
+    if (size <= m_stringPool.getSize())
+        return;
+    m_stringPool.changeSize(t_max(size, m_stringPool.getSize() * 2));
+}
+
+const cNtDirImport::ModuleTable& cNtDirImport::getModules() const
+{
+    return m_modules;
+}
+
+const cNtDirImport::FunctionTable& cNtDirImport::getFunctions() const
+{
+    return m_functions;
+}
+
+const char* cNtDirImport::getName(uint name) const
+{
+    CHECK(name < m_stringPoolSize);
+    return m_stringPool.getBuffer() + name;
+}
+
+const char* cNtDirImport::getModuleName(const ImportModule& module) const
+{
+    return getName(module.m_name);
+}
+
+uint cNtDirImport::findModule(const char* name) const
+{
+    for (uint i = 0; i < m_modules.getSize(); i++)
+    {
+        if (isSameModuleName(getModuleName(m_modules[i]), name))
+            return i;
+    }
+    return NO_NAME;
+}
+
+bool cNtDirImport::isSameModuleName(const char* name, const char* other)
+{
+    for (uint i = 0; ; i++)
+    {
+        char a = name[i];
+        char b = other[i];
+        if ((a >= 'A') && (a <= 'Z'))
+            a = a - 'A' + 'a';
+        if ((b >= 'A') && (b <= 'Z'))
+            b = b - 'A' + 'a';
+        if (a != b)
+            return false;
+        if (a == 0)
+            return true;
+    }
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirImport& import)
+{
+    out << "Import table" << endl;
+    out << "============" << endl << endl;
+
+    for (uint i = 0; i < import.m_modules.getSize(); i++)
+    {
+        const cNtDirImport::ImportModule& module = import.m_modules[i];
+        out << import.getModuleName(module) << endl;
+        out << "  OriginalFirstThunk: " << HEXDWORD(module.m_descriptor.OriginalFirstThunk) << endl;
+        out << "  TimeDateStamp:      " << HEXDWORD(module.m_descriptor.TimeDateStamp) << endl;
+        out << "  ForwarderChain:     " << HEXDWORD(module.m_descriptor.ForwarderChain) << endl;
+        out << "  FirstThunk:         " << HEXDWORD(module.m_descriptor.FirstThunk) << endl;
+        out << endl;
+
+        for (uint j = 0; j < module.m_numberOfFunctions; j++)
+        {
+            const cNtDirImport::ImportFunction& function =
+                import.m_functions[module.m_firstFunction + j];
+            out << "  " << HEXDWORD(function.m_iatAddress)
+                << "     " << HEXWORD(function.m_hint)
+                << "  ";
+            if (function.m_name != cNtDirImport::NO_NAME)
+                out << import.getName(function.m_name);
+            else
+                out << "Ordinal " << (uint)function.m_hint;
+            out << endl;
+        }
+        out << endl;
+    }
+
+    return out;
+}
+#endif
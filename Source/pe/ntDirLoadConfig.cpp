@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirLoadConfig.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/peTraits.h"
+#include "pe/ntheader.h"
+#include "pe/ntsectionheader.h"
+#include "pe/ntDirLoadConfig.h"
+
+// The size of an RVA inside the tables
+#define TABLE_RVA_SIZE (sizeof(uint32))
+
+cNtDirLoadConfig::cNtDirLoadConfig() :
+    m_securityCookie(INVALID_RVA),
+    m_dynamicRelocationTable(INVALID_RVA)
+{
+    memset(&m_directory, 0, sizeof(m_directory));
+    memset(m_tables, 0, sizeof(m_tables));
+}
+
+cNtDirLoadConfig::cNtDirLoadConfig(const cNtHeader& header) :
+    m_securityCookie(INVALID_RVA),
+    m_dynamicRelocationTable(INVALID_RVA)
+{
+    memset(&m_directory, 0, sizeof(m_directory));
+    memset(m_tables, 0, sizeof(m_tables));
+    readDirectory(header);
+}
+
+bool cNtDirLoadConfig::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG;
+}
+
+void cNtDirLoadConfig::readDirectory(const cNtHeader& header,
+                                     uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG;
+
+    const IMAGE_DATA_DIRECTORY& loadConfigDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    CHECK_MSG((loadConfigDirectory.Size != 0) &&
+              (loadConfigDirectory.VirtualAddress != 0),
+              "Load configuration directory cannot be found!!!");
+
+    memset(m_tables, 0, sizeof(m_tables));
+    cVirtualMemoryAccesserPtr mem = header.getPeMemory();
+    if (header.is64bit())
+        readLoadConfig<cPe64Traits>(*mem, loadConfigDirectory.VirtualAddress);
+    else
+        readLoadConfig<cPe32Traits>(*mem, loadConfigDirectory.VirtualAddress);
+
+    m_securityCookie = toRva(header, m_directory.SecurityCookie);
+
+    // The dynamic relocations are either pointed by a VA, or by an offset
+    // inside a section (1 based)
+    m_dynamicRelocationTable = toRva(header,
+                                     m_directory.DynamicValueRelocTable);
+    uint sectionIndex = m_directory.DynamicValueRelocTableSection;
+    if ((m_dynamicRelocationTable == INVALID_RVA) && (sectionIndex != 0))
+    {
+        cList<cSectionPtr> sections;
+        header.getSections(sections);
+        cList<cSectionPtr>::iterator i = sections.begin();
+        for (uint j = 1; (i != sections.end()) && (j < sectionIndex); j++)
+            ++i;
+        if (i != sections.end())
+        {
+            const cNtSectionHeader* section =
+                (const cNtSectionHeader*)((*i).getPointer());
+            m_dynamicRelocationTable = section->VirtualAddress +
+                m_directory.DynamicValueRelocTableOffset;
+        }
+    }
+
+    // The guard tables share the stride of the guard CF function table
+    uint stride = TABLE_RVA_SIZE +
+        ((m_directory.GuardFlags & IMAGE_GUARD_CF_FUNCTION_TABLE_SIZE_MASK) >>
+         IMAGE_GUARD_CF_FUNCTION_TABLE_SIZE_SHIFT);
+    readTable(header, *mem, TABLE_SEHANDLERS,
+              m_directory.SEHandlerTable,
+              m_directory.SEHandlerCount,
+              TABLE_RVA_SIZE);
+    readTable(header, *mem, TABLE_GUARD_CF_FUNCTIONS,
+              m_directory.GuardCFFunctionTable,
+              m_directory.GuardCFFunctionCount,
+              stride);
+    readTable(header, *mem, TABLE_GUARD_ADDRESS_TAKEN_IAT,
+              m_directory.GuardAddressTakenIatEntryTable,
+              m_directory.GuardAddressTakenIatEntryCount,
+              stride);
+    readTable(header, *mem, TABLE_GUARD_LONGJUMP_TARGETS,
+              m_directory.GuardLongJumpTargetTable,
+              m_directory.GuardLongJumpTargetCount,
+              stride);
+    readTable(header, *mem, TABLE_GUARD_EH_CONTINUATIONS,
+              m_directory.GuardEHContinuationTable,
+              m_directory.GuardEHContinuationCount,
+              stride);
+}
+
+template <class Traits>
+void cNtDirLoadConfig::readLoadConfig(const cVirtualMemoryAccesser& memory,
+                                      addressNumericValue address)
+{
+    // Read only the fields which exist in the image
+    typename Traits::LoadConfigDirectory directory;
+    memset(&directory, 0, sizeof(directory));
+    CHECK(memory.memread(address, &directory.Size, sizeof(directory.Size)));
+    CHECK(directory.Size >= sizeof(directory.Size));
+    uint size = t_min((uint)directory.Size, (uint)sizeof(directory));
+    CHECK(memory.memread(address, &directory, size));
+
+    IMAGE_LOAD_CONFIG_DIRECTORY64& wide = m_directory;
+    wide.Size = directory.Size;
+    wide.TimeDateStamp = directory.TimeDateStamp;
+    wide.MajorVersion = directory.MajorVersion;
+    wide.MinorVersion = directory.MinorVersion;
+    wide.GlobalFlagsClear = directory.GlobalFlagsClear;
+    wide.GlobalFlagsSet = directory.GlobalFlagsSet;
+    wide.CriticalSectionDefaultTimeout = directory.CriticalSectionDefaultTimeout;
+    wide.DeCommitFreeBlockThreshold = directory.DeCommitFreeBlockThreshold;
+    wide.DeCommitTotalFreeThreshold = directory.DeCommitTotalFreeThreshold;
+    wide.LockPrefixTable = directory.LockPrefixTable;
+    wide.MaximumAllocationSize = directory.MaximumAllocationSize;
+    wide.VirtualMemoryThreshold = directory.VirtualMemoryThreshold;
+    wide.ProcessAffinityMask = directory.ProcessAffinityMask;
+    wide.ProcessHeapFlags = directory.ProcessHeapFlags;
+    wide.CSDVersion = directory.CSDVersion;
+    wide.DependentLoadFlags = directory.DependentLoadFlags;
+    wide.EditList = directory.EditList;
+    wide.SecurityCookie = directory.SecurityCookie;
+    wide.SEHandlerTable = directory.SEHandlerTable;
+    wide.SEHandlerCount = directory.SEHandlerCount;
+    wide.GuardCFCheckFunctionPointer = directory.GuardCFCheckFunctionPointer;
+    wide.GuardCFDispatchFunctionPointer = directory.GuardCFDispatchFunctionPointer;
+    wide.GuardCFFunctionTable = directory.GuardCFFunctionTable;
+    wide.GuardCFFunctionCount = directory.GuardCFFunctionCount;
+    wide.GuardFlags = directory.GuardFlags;
+    wide.CodeIntegrity = directory.CodeIntegrity;
+    wide.GuardAddressTakenIatEntryTable = directory.GuardAddressTakenIatEntryTable;
+    wide.GuardAddressTakenIatEntryCount = directory.GuardAddressTakenIatEntryCount;
+    wide.GuardLongJumpTargetTable = directory.GuardLongJumpTargetTable;
+    wide.GuardLongJumpTargetCount = directory.GuardLongJumpTargetCount;
+    wide.DynamicValueRelocTable = directory.DynamicValueRelocTable;
+    wide.CHPEMetadataPointer = directory.CHPEMetadataPointer;
+    wide.GuardRFFailureRoutine = directory.GuardRFFailureRoutine;
+    wide.GuardRFFailureRoutineFunctionPointer =
+        directory.GuardRFFailureRoutineFunctionPointer;
+    wide.DynamicValueRelocTableOffset = directory.DynamicValueRelocTableOffset;
+    wide.DynamicValueRelocTableSection = directory.DynamicValueRelocTableSection;
+    wide.Reserved2 = directory.Reserved2;
+    wide.GuardRFVerifyStackPointerFunctionPointer =
+        directory.GuardRFVerifyStackPointerFunctionPointer;
+    wide.HotPatchTableOffset = directory.HotPatchTableOffset;
+    wide.Reserved3 = directory.Reserved3;
+    wide.EnclaveConfigurationPointer = directory.EnclaveConfigurationPointer;
+    wide.VolatileMetadataPointer = directory.VolatileMetadataPointer;
+    wide.GuardEHContinuationTable = directory.GuardEHContinuationTable;
+    wide.GuardEHContinuationCount = directory.GuardEHContinuationCount;
+}
+
+void cNtDirLoadConfig::readTable(const cNtHeader& header,
+                                 const cVirtualMemoryAccesser& memory,
+                                 uint table,
+                                 uint64 address,
+                                 uint64 count,
+                                 uint stride)
+{
+    RvaTable& rvaTable = m_tables[table];
+    m_copies[table].changeSize(0);
+    if ((address == 0) || (count == 0))
+        return;
+
+    // The table must be inside the image
+    uint32 rva = toRva(header, address);
+    CHECK(rva != INVALID_RVA);
+    CHECK(count <= (header.OptionalHeader.SizeOfImage - rva) / stride);
+    uint size = (uint)count * stride;
+
+    const uint8* data = header.getDirectPointer(rva, size);
+    if (data == NULL)
+    {
+        m_copies[table].changeSize(size, false);
+        CHECK(memory.memread(rva, m_copies[table].getBuffer(), size));
+        data = m_copies[table].getBuffer();
+    }
+
+    rvaTable.m_data = data;
+    rvaTable.m_count = (uint)count;
+    rvaTable.m_stride = stride;
+}
+
+uint32 cNtDirLoadConfig::toRva(const cNtHeader& header, uint64 address)
+{
+    uint rva;
+    if ((address == 0) ||
+        (!header.vaToRva((addressNumericValue)address, rva)))
+        return INVALID_RVA;
+    return rva;
+}
+
+uint32 cNtDirLoadConfig::RvaTable::getRva(uint index) const
+{
+    CHECK(index < m_count);
+    uint32 rva;
+    cOS::memcpy(&rva, m_data + index * m_stride, sizeof(rva));
+    return rva;
+}
+
+uint8 cNtDirLoadConfig::RvaTable::getFlags(uint index) const
+{
+    CHECK(index < m_count);
+    if (m_stride <= TABLE_RVA_SIZE)
+        return 0;
+    return m_data[index * m_stride + TABLE_RVA_SIZE];
+}
+
+const IMAGE_LOAD_CONFIG_DIRECTORY64& cNtDirLoadConfig::getDirectory() const
+{
+    return m_directory;
+}
+
+uint32 cNtDirLoadConfig::getSecurityCookie() const
+{
+    return m_securityCookie;
+}
+
+uint32 cNtDirLoadConfig::getGuardFlags() const
+{
+    return m_directory.GuardFlags;
+}
+
+uint32 cNtDirLoadConfig::getDynamicRelocationTable() const
+{
+    return m_dynamicRelocationTable;
+}
+
+const cNtDirLoadConfig::RvaTable& cNtDirLoadConfig::getTable(uint table) const
+{
+    CHECK(table < NUMBER_OF_TABLES);
+    return m_tables[table];
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirLoadConfig& loadConfig)
+{
+    out << "Load configuration directory" << endl;
+    out << "============================" << endl << endl;
+
+    out << "  Size:            " << HEXDWORD(loadConfig.m_directory.Size) << endl;
+    out << "  Security cookie: " << HEXDWORD(loadConfig.m_securityCookie) << endl;
+    out << "  Guard flags:     " << HEXDWORD(loadConfig.m_directory.GuardFlags) << endl;
+    out << "  SafeSEH:         " << loadConfig.m_tables[cNtDirLoadConfig::TABLE_SEHANDLERS].m_count << endl;
+    out << "  CF functions:    " << loadConfig.m_tables[cNtDirLoadConfig::TABLE_GUARD_CF_FUNCTIONS].m_count << endl;
+    out << "  Dynamic relocs:  " << HEXDWORD(loadConfig.m_dynamicRelocationTable) << endl;
+
+    return out;
+}
+#endif
@@ -42,6 +42,7 @@
 #include "xStl/data/list.h"
 #include "xStl/data/string.h"
 #include "xStl/data/datastream.h"
+#include "xStl/except/exception.h"
 #include "xStl/stream/basicIO.h"
 #include "xStl/stream/stringerStream.h"
 #include "pe/section.h"
@@ -49,13 +50,13 @@
 #include "pe/ntheader.h"
 #include "pe/ntDirReloc.h"
 
-#include "xStl/stream/traceStream.h"
-
-cNtDirReloc::cNtDirReloc()
+cNtDirReloc::cNtDirReloc() :
+    m_numberOfRelocations(0)
 {
 }
 
-cNtDirReloc::cNtDirReloc(cNtHeader& header)
+cNtDirReloc::cNtDirReloc(cNtHeader& header) :
+    m_numberOfRelocations(0)
 {
     readDirectory(header);
 }
@@ -84,140 +85,160 @@ void cNtDirReloc::readDirectory(const cNtHeader& header,
 
 void cNtDirReloc::read(basicInput& stream)
 {
-    // Delete all the previous functions
-    m_relocOffsets.changeSize(0);
-
-    // Set the initial relocation table size
-    m_relocOffsets.changeSize(stream.length() / 2);
-
-    // Start reading the relocation blocks
-    IMAGE_BASE_RELOCATION currReloc;
-    WORD relocItem;
-    int totalRelocs = 0;
-    while(!stream.isEOS())
+    // Delete all the previous relocations
+    m_blocks.changeSize(0);
+    m_entries.changeSize(0);
+    m_numberOfRelocations = 0;
+
+    // Upper bounds, the tables are trimmed at the end
+    uint length = stream.length() - stream.getPointer();
+    m_blocks.changeSize(length / sizeof(IMAGE_BASE_RELOCATION), false);
+    m_entries.changeSize(length / sizeof(uint16), false);
+
+    uint numberOfBlocks = 0;
+    uint numberOfEntries = 0;
+    IMAGE_BASE_RELOCATION header;
+    while (stream.length() - stream.getPointer() >= sizeof(header))
     {
         // Read the current block header
-        stream.pipeRead(&currReloc, sizeof(currReloc));
-
-        // Calculate the number of items in the block
-        DWORD numItems = (currReloc.SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
-
-        for (uint i = 0; i < numItems; i++)
+        uint position = stream.getPointer();
+        stream.pipeRead(&header, sizeof(header));
+        if (header.SizeOfBlock == 0)
+            break;
+        CHECK_MSG(header.SizeOfBlock >= sizeof(header),
+                  "bad relocation table");
+
+        // Read the entries straight into the table, and compact them
+        uint count = (header.SizeOfBlock - sizeof(header)) / sizeof(uint16);
+        uint16* entries = m_entries.getBuffer() + numberOfEntries;
+        stream.pipeRead(entries, count * sizeof(uint16));
+
+        uint first = numberOfEntries;
+        for (uint i = 0; i < count; i++)
         {
-            // Read the current item
-            stream.streamReadUint16(relocItem);
-
-            switch (relocItem >> 12)
+            uint type = getType(entries[i]);
+            if (type == IMAGE_REL_BASED_ABSOLUTE)
+                continue;
+            m_entries[numberOfEntries++] = entries[i];
+            m_numberOfRelocations++;
+            if (hasParameter(type))
             {
-            case IMAGE_REL_BASED_ABSOLUTE:
-                break;
-            case IMAGE_REL_BASED_HIGHLOW:
-                // Calculate and set the offset address
-                m_relocOffsets[totalRelocs].m_offsetAddress = currReloc.VirtualAddress + (relocItem & 0xFFF);
-                totalRelocs++;
-                break;
-            default:
-                CHECK_MSG(false, "bad relocation table");
+                CHECK_MSG(i + 1 < count, "bad relocation table");
+                m_entries[numberOfEntries++] = entries[++i];
             }
         }
+
+        if (numberOfEntries != first)
+        {
+            Block& block = m_blocks[numberOfBlocks++];
+            block.m_pageRva = header.VirtualAddress;
+            block.m_first = first;
+            block.m_count = numberOfEntries - first;
+        }
+
+        // Blocks of an odd size
+        stream.seek(position + header.SizeOfBlock, basicInput::IO_SEEK_SET);
     }
 
-    // Set the final relocation table size
-    m_relocOffsets.changeSize(totalRelocs);
+    // Set the final table sizes
+    m_blocks.changeSize(numberOfBlocks);
+    m_entries.changeSize(numberOfEntries);
 }
 
-const cNtDirReloc::RelocTable& cNtDirReloc::getRelocArray() const
+const cNtDirReloc::BlockTable& cNtDirReloc::getBlocks() const
 {
-    return m_relocOffsets;
+    return m_blocks;
 }
 
-bool cNtDirReloc::cRelocEntry::isValid() const
+const cNtDirReloc::EntryTable& cNtDirReloc::getEntries() const
 {
-    return true;
+    return m_entries;
 }
 
-void cNtDirReloc::cRelocEntry::serialize(basicOutput& stream) const
+uint cNtDirReloc::getNumberOfRelocations() const
 {
-    // TODO
-    /*
-    stream.streamWriteRemoteAddress(m_address);
-    if (m_isName)
-    {
-        // isname = true
-        stream.streamWriteUint8(1);
-        stream.writeAsciiNullString(m_name);
-    } else
-        // isname = false
-        stream.streamWriteUint8(0);
-
-    // Encode the oridinal number
-    stream.streamWriteUint16(m_ordinal);
-    */
+    return m_numberOfRelocations;
 }
 
-void cNtDirReloc::cRelocEntry::deserialize(basicInput& stream)
+uint cNtDirReloc::getType(uint16 entry)
 {
-    // TODO
-    /*
-    m_address = stream.streamReadRemoteAddress();
-    uint8 isName;
-    stream.streamReadUint8(isName);
-    m_isName = (isName == 1);
-    if (m_isName)
-    {
-        // Read a string
-        m_name = stream.readAsciiNullString();
-    } else
-        // Remove the old name
-        m_name = cString();
-
-    // Decode the oridinal
-    stream.streamReadUint16(m_ordinal);
-    */
+    return entry >> 12;
 }
 
-bool cNtDirReloc::cRelocEntry::operator > (const cNtDirReloc::cRelocEntry &other) const
+uint cNtDirReloc::getOffset(uint16 entry)
 {
-    //return (this->m_contentAddress > other.m_contentAddress);
-    return (this->m_offsetAddress > other.m_offsetAddress);
+    return entry & 0xFFF;
 }
 
-/*
-#ifdef PE_TRACE
-cStringerStream& operator << (cStringerStream& out,
-                              const cNtDirExport& _export)
+bool cNtDirReloc::hasParameter(uint type)
 {
-    out << "_export table for " << _export.m_moduleName << endl;
-    out << "=================" << cString::dup(cString("="), _export.m_moduleName.length())
-        << endl << endl;
-
-    out << "Characteristics:       " << HEXDWORD(_export.m_exportDirectory.Characteristics) << endl;
-    out << "TimeDateStamp:         " << HEXDWORD(_export.m_exportDirectory.TimeDateStamp)   << endl;
-    out << "Version:               " << (uint)_export.m_exportDirectory.MajorVersion << '.' << (uint)_export.m_exportDirectory.MinorVersion << endl;
-    out << "Name:                  " << HEXDWORD(_export.m_exportDirectory.Name) << endl;
-    out << "Base:                  " << HEXDWORD(_export.m_exportDirectory.Base) << endl;
-    out << "NumberOfFunctions:     " << (uint)_export.m_exportDirectory.NumberOfFunctions << endl;
-    out << "NumberOfNames:         " << (uint)_export.m_exportDirectory.NumberOfNames << endl;
-    out << "AddressOfFunctions:    " << HEXDWORD(_export.m_exportDirectory.AddressOfFunctions)    << endl;
-    out << "AddressOfNames:        " << HEXDWORD(_export.m_exportDirectory.AddressOfNames)        << endl;
-    out << "AddressOfNameOrdinals: " << HEXDWORD(_export.m_exportDirectory.AddressOfNameOrdinals) << endl;
-
-    out << endl << endl;
-
-    //Print all the functions at the _export directory
-    for (uint i = 0; i < _export.m_exportFunctions.getSize(); i++)
+    return type == IMAGE_REL_BASED_HIGHADJ;
+}
+
+uint cNtDirReloc::getPatchSize(uint16 machine, uint type)
+{
+    bool isArm = (machine == IMAGE_FILE_MACHINE_ARM) ||
+                 (machine == IMAGE_FILE_MACHINE_THUMB) ||
+                 (machine == IMAGE_FILE_MACHINE_ARMNT);
+    bool isMips = (machine == IMAGE_FILE_MACHINE_R3000) ||
+                  (machine == IMAGE_FILE_MACHINE_R4000) ||
+                  (machine == IMAGE_FILE_MACHINE_R10000) ||
+                  (machine == IMAGE_FILE_MACHINE_WCEMIPSV2) ||
+                  (machine == IMAGE_FILE_MACHINE_MIPS16) ||
+                  (machine == IMAGE_FILE_MACHINE_MIPSFPU) ||
+                  (machine == IMAGE_FILE_MACHINE_MIPSFPU16);
+
+    switch (type)
     {
-        out << "  "    << HEXREMOTEADDRESS(_export.m_exportFunctions[i].m_address)
-            << "     " << HEXWORD (_export.m_exportFunctions[i].m_ordinal)
-            << "  ";
+    case IMAGE_REL_BASED_HIGH:
+    case IMAGE_REL_BASED_LOW:
+    case IMAGE_REL_BASED_HIGHADJ:
+        return sizeof(uint16);
+    case IMAGE_REL_BASED_HIGHLOW:
+        return sizeof(uint32);
+    case IMAGE_REL_BASED_DIR64:
+        return sizeof(uint64);
+    case IMAGE_REL_BASED_ARM_MOV32:
+        // Also IMAGE_REL_BASED_MIPS_JMPADDR
+        if (isArm)
+            return 2 * sizeof(uint32);
+        return isMips ? sizeof(uint32) : 0;
+    case IMAGE_REL_BASED_THUMB_MOV32:
+        return (machine == IMAGE_FILE_MACHINE_ARMNT) ? 2 * sizeof(uint32) : 0;
+    case IMAGE_REL_BASED_MIPS_JMPADDR16:
+        // Also IMAGE_REL_BASED_IA64_IMM64, which patches a whole bundle
+        if (machine == IMAGE_FILE_MACHINE_IA64)
+            return 16;
+        return isMips ? sizeof(uint32) : 0;
+    default:
+        return 0;
+    }
+}
 
-        if (_export.m_exportFunctions[i].m_isName)
-            out << _export.m_exportFunctions[i].m_name;
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirReloc& reloc)
+{
+    out << "Relocation table" << endl;
+    out << "================" << endl << endl;
 
-        out << endl;
+    for (uint i = 0; i < reloc.m_blocks.getSize(); i++)
+    {
+        const cNtDirReloc::Block& block = reloc.m_blocks[i];
+        out << "  Page " << HEXDWORD(block.m_pageRva)
+            << "  " << block.m_count << " entries" << endl;
+        for (uint j = 0; j < block.m_count; j++)
+        {
+            uint16 entry = reloc.m_entries[block.m_first + j];
+            uint type = cNtDirReloc::getType(entry);
+            out << "    " << HEXDWORD(block.m_pageRva +
+                                      cNtDirReloc::getOffset(entry))
+                << "  type " << type << endl;
+            if (cNtDirReloc::hasParameter(type))
+                j++;
+        }
     }
 
     return out;
 }
 #endif
-*/
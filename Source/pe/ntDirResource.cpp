@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirResource.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirResource.h"
+
+// The neutral language, preferred for ANY_LANGUAGE
+#define LANGUAGE_NEUTRAL (0)
+
+cNtDirResource::cNtDirResource() :
+    m_address(0),
+    m_size(0)
+{
+    memset(&m_root, 0, sizeof(m_root));
+}
+
+cNtDirResource::cNtDirResource(const cNtHeader& header) :
+    m_address(0),
+    m_size(0)
+{
+    memset(&m_root, 0, sizeof(m_root));
+    readDirectory(header);
+}
+
+bool cNtDirResource::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_RESOURCE;
+}
+
+void cNtDirResource::readDirectory(const cNtHeader& header,
+                                   uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_RESOURCE;
+
+    const IMAGE_DATA_DIRECTORY& resourceDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    CHECK_MSG((resourceDirectory.Size != 0) &&
+              (resourceDirectory.VirtualAddress != 0),
+              ".rsrc cannot be found!!!");
+
+    m_memory = header.getPeMemory();
+    m_address = resourceDirectory.VirtualAddress;
+    m_size = resourceDirectory.Size;
+
+    // Only the root table is read. The rest of the tree is read on demand
+    m_root = readTable(0, 0);
+}
+
+const cNtDirResource::Table& cNtDirResource::getRoot() const
+{
+    return m_root;
+}
+
+uint cNtDirResource::getEntriesCount(const Table& table) const
+{
+    return table.m_numberOfNamedEntries + table.m_numberOfIdEntries;
+}
+
+void cNtDirResource::getEntry(const Table& table,
+                              uint index,
+                              IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const
+{
+    CHECK(index < getEntriesCount(table));
+    readDirectoryBytes(table.m_offset + sizeof(IMAGE_RESOURCE_DIRECTORY) +
+                       index * sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY),
+                       &entry,
+                       sizeof(entry));
+}
+
+bool cNtDirResource::findEntry(const Table& table,
+                               const ResourceId& id,
+                               IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const
+{
+    // The named entries come first, and the id entries follow. Both are sorted
+    uint low, high;
+    if (id.m_name != NULL)
+    {
+        low = 0;
+        high = table.m_numberOfNamedEntries;
+    } else
+    {
+        low = table.m_numberOfNamedEntries;
+        high = low + table.m_numberOfIdEntries;
+    }
+
+    while (low < high)
+    {
+        uint middle = low + (high - low) / 2;
+        getEntry(table, middle, entry);
+
+        int compare;
+        if (id.m_name != NULL)
+        {
+            compare = compareName(id.m_name, entry);
+        } else
+        {
+            uint16 entryId = (uint16)(entry.Name & 0xFFFF);
+            compare = (id.m_id < entryId) ? -1 : ((id.m_id > entryId) ? 1 : 0);
+        }
+
+        if (compare == 0)
+            return true;
+        if (compare < 0)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return false;
+}
+
+cNtDirResource::Table cNtDirResource::openTable(
+                        const Table& parent,
+                        const IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const
+{
+    CHECK((entry.OffsetToData & IMAGE_RESOURCE_DATA_IS_DIRECTORY) != 0);
+    CHECK(parent.m_depth < MAX_DEPTH);
+    return readTable(entry.OffsetToData & ~IMAGE_RESOURCE_DATA_IS_DIRECTORY,
+                     parent.m_depth + 1);
+}
+
+void cNtDirResource::readDataEntry(const IMAGE_RESOURCE_DIRECTORY_ENTRY& entry,
+                                   IMAGE_RESOURCE_DATA_ENTRY& data) const
+{
+    CHECK((entry.OffsetToData & IMAGE_RESOURCE_DATA_IS_DIRECTORY) == 0);
+    readDirectoryBytes(entry.OffsetToData, &data, sizeof(data));
+}
+
+bool cNtDirResource::find(const ResourceId& type,
+                          const ResourceId& name,
+                          uint language,
+                          IMAGE_RESOURCE_DATA_ENTRY& data) const
+{
+    IMAGE_RESOURCE_DIRECTORY_ENTRY entry;
+    if (!findEntry(m_root, type, entry))
+        return false;
+    Table names = openTable(m_root, entry);
+
+    if (!findEntry(names, name, entry))
+        return false;
+    Table languages = openTable(names, entry);
+
+    if (language != ANY_LANGUAGE)
+    {
+        if (!findEntry(languages, ResourceId((uint16)language), entry))
+            return false;
+    } else if (!findEntry(languages, ResourceId((uint16)LANGUAGE_NEUTRAL), entry))
+    {
+        if (getEntriesCount(languages) == 0)
+            return false;
+        getEntry(languages, 0, entry);
+    }
+
+    readDataEntry(entry, data);
+    return true;
+}
+
+cMemoryAccesserStreamPtr cNtDirResource::getData(
+                                const IMAGE_RESOURCE_DATA_ENTRY& data) const
+{
+    // The payload is addressed by an RVA, not by an offset of the directory
+    return cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
+        m_memory,
+        data.OffsetToData,
+        (addressNumericValue)data.OffsetToData + data.Size));
+}
+
+cNtDirResource::Table cNtDirResource::readTable(uint32 offset,
+                                                uint depth) const
+{
+    IMAGE_RESOURCE_DIRECTORY directory;
+    readDirectoryBytes(offset, &directory, sizeof(directory));
+
+    Table table;
+    table.m_offset = offset;
+    table.m_depth = depth;
+    table.m_numberOfNamedEntries = directory.NumberOfNamedEntries;
+    table.m_numberOfIdEntries = directory.NumberOfIdEntries;
+
+    // The entries must be inside the directory
+    uint entriesSize = getEntriesCount(table) *
+                       sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY);
+    CHECK(m_size - offset - sizeof(directory) >= entriesSize);
+    return table;
+}
+
+void cNtDirResource::readDirectoryBytes(uint32 offset,
+                                        void* buffer,
+                                        uint length) const
+{
+    CHECK(!m_memory.isEmpty());
+    CHECK((offset <= m_size) && (length <= m_size - offset));
+    CHECK(m_memory->memread(m_address + offset, buffer, length));
+}
+
+int cNtDirResource::compareName(const char* name,
+                                const IMAGE_RESOURCE_DIRECTORY_ENTRY& entry) const
+{
+    CHECK((entry.Name & IMAGE_RESOURCE_NAME_IS_STRING) != 0);
+    uint32 offset = entry.Name & ~IMAGE_RESOURCE_NAME_IS_STRING;
+
+    // IMAGE_RESOURCE_DIR_STRING_U
+    uint16 length;
+    readDirectoryBytes(offset, &length, sizeof(length));
+    uint16 string[MAX_NAME_LENGTH];
+    uint readLength = t_min((uint)length, (uint)MAX_NAME_LENGTH);
+    readDirectoryBytes(offset + sizeof(length), string,
+                       readLength * sizeof(uint16));
+
+    // The loader compares the names in upper case
+    for (uint i = 0; i < readLength; i++)
+    {
+        uint16 a = (uint8)name[i];
+        uint16 b = string[i];
+        if (a == 0)
+            return -1;
+        if ((a >= 'a') && (a <= 'z'))
+            a = a - 'a' + 'A';
+        if ((b >= 'a') && (b <= 'z'))
+            b = b - 'a' + 'A';
+        if (a != b)
+            return (a < b) ? -1 : 1;
+    }
+
+    if (name[readLength] != 0)
+        return 1;
+    // Names longer than MAX_NAME_LENGTH are never matched
+    return (readLength < length) ? -1 : 0;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirResource& resource)
+{
+    out << "Resource table" << endl;
+    out << "==============" << endl << endl;
+
+    // Only the types are listed, the tree isn't walked
+    const cNtDirResource::Table& root = resource.getRoot();
+    for (uint i = 0; i < resource.getEntriesCount(root); i++)
+    {
+        IMAGE_RESOURCE_DIRECTORY_ENTRY entry;
+        resource.getEntry(root, i, entry);
+        if ((entry.Name & IMAGE_RESOURCE_NAME_IS_STRING) != 0)
+            out << "  Named type at " << HEXDWORD(entry.Name & ~IMAGE_RESOURCE_NAME_IS_STRING);
+        else
+            out << "  Type " << (uint)(entry.Name & 0xFFFF);
+
+        if ((entry.OffsetToData & IMAGE_RESOURCE_DATA_IS_DIRECTORY) != 0)
+        {
+            cNtDirResource::Table names = resource.openTable(root, entry);
+            out << ": " << resource.getEntriesCount(names) << " entries";
+        }
+        out << endl;
+    }
+
+    return out;
+}
+#endif
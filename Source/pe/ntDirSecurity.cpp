@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirSecurity.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/stream/basicIO.h"
+#include "xStl/stream/forkStream.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirSecurity.h"
+
+// The size of the fixed part of an entry
+#define WIN_CERTIFICATE_HEADER_SIZE (sizeof(WIN_CERTIFICATE) - 1)
+// The alignment of the entries
+#define WIN_CERTIFICATE_ALIGNMENT (8)
+
+cNtDirSecurity::cNtDirSecurity()
+{
+}
+
+cNtDirSecurity::cNtDirSecurity(const cNtHeader& header)
+{
+    readDirectory(header);
+}
+
+bool cNtDirSecurity::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_SECURITY;
+}
+
+void cNtDirSecurity::readDirectory(const cNtHeader& header,
+                                   uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_SECURITY;
+
+    const IMAGE_DATA_DIRECTORY& securityDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    CHECK_MSG((securityDirectory.Size != 0) &&
+              (securityDirectory.VirtualAddress != 0),
+              "Certificate table cannot be found!!!");
+
+    m_certificates.changeSize(0);
+    m_copy.changeSize(0);
+
+    // The VirtualAddress is a file offset
+    uint32 offset = securityDirectory.VirtualAddress;
+    uint size = securityDirectory.Size;
+    const uint8* table = header.getDirectFilePointer(offset, size);
+    if (table == NULL)
+    {
+        cForkStreamPtr file = header.getFileStream();
+        CHECK_MSG(!file.isEmpty(), "The raw file isn't available");
+        uint fileSize = file->length();
+        CHECK((offset <= fileSize) && (size <= fileSize - offset));
+
+        m_copy.changeSize(size, false);
+        file->seek(offset, basicInput::IO_SEEK_SET);
+        file->pipeRead(m_copy.getBuffer(), size);
+        table = m_copy.getBuffer();
+    }
+
+    readEntries(table, offset, size);
+}
+
+void cNtDirSecurity::readEntries(const uint8* table, uint32 offset, uint size)
+{
+    uint position = 0;
+    while ((position < size) &&
+           (size - position >= WIN_CERTIFICATE_HEADER_SIZE) &&
+           (m_certificates.getSize() < MAX_CERTIFICATES))
+    {
+        const WIN_CERTIFICATE* entry = (const WIN_CERTIFICATE*)
+                                       (table + position);
+        uint length = entry->dwLength;
+        // Zero padding at the end of the table
+        if (length == 0)
+            break;
+        CHECK((length >= WIN_CERTIFICATE_HEADER_SIZE) &&
+              (length <= size - position));
+
+        Certificate certificate;
+        certificate.m_offset = offset + position;
+        certificate.m_revision = entry->wRevision;
+        certificate.m_type = entry->wCertificateType;
+        certificate.m_data = table + position + WIN_CERTIFICATE_HEADER_SIZE;
+        certificate.m_length = length - WIN_CERTIFICATE_HEADER_SIZE;
+        m_certificates.append(certificate);
+
+        // The entries are aligned
+        position+= length;
+        position = (position + WIN_CERTIFICATE_ALIGNMENT - 1) &
+                   ~(WIN_CERTIFICATE_ALIGNMENT - 1);
+    }
+}
+
+const cNtDirSecurity::CertificateTable& cNtDirSecurity::getCertificates() const
+{
+    return m_certificates;
+}
+
+uint cNtDirSecurity::findCertificate(uint16 type) const
+{
+    for (uint i = 0; i < m_certificates.getSize(); i++)
+    {
+        if (m_certificates[i].m_type == type)
+            return i;
+    }
+    return MAX_CERTIFICATES;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirSecurity& security)
+{
+    out << "Security directory" << endl;
+    out << "==================" << endl << endl;
+
+    for (uint i = 0; i < security.m_certificates.getSize(); i++)
+    {
+        const cNtDirSecurity::Certificate& certificate =
+            security.m_certificates[i];
+        out << "  Offset "    << HEXDWORD(certificate.m_offset)
+            << "  Revision "  << HEXWORD(certificate.m_revision)
+            << "  Type "      << HEXWORD(certificate.m_type)
+            << "  Length "    << HEXDWORD(certificate.m_length) << endl;
+    }
+
+    return out;
+}
+#endif
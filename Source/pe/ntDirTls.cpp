@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * ntDirTls.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/stringerStream.h"
+#include "pe/datastruct.h"
+#include "pe/peTraits.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirTls.h"
+
+cNtDirTls::cNtDirTls() :
+    m_rawDataStart(INVALID_RVA),
+    m_rawDataEnd(INVALID_RVA),
+    m_indexAddress(INVALID_RVA),
+    m_callbacksAddress(INVALID_RVA)
+{
+    memset(&m_directory, 0, sizeof(m_directory));
+}
+
+cNtDirTls::cNtDirTls(const cNtHeader& header) :
+    m_rawDataStart(INVALID_RVA),
+    m_rawDataEnd(INVALID_RVA),
+    m_indexAddress(INVALID_RVA),
+    m_callbacksAddress(INVALID_RVA)
+{
+    memset(&m_directory, 0, sizeof(m_directory));
+    readDirectory(header);
+}
+
+bool cNtDirTls::isMyDir(uint directoryTypeIndex)
+{
+    return directoryTypeIndex == IMAGE_DIRECTORY_ENTRY_TLS;
+}
+
+void cNtDirTls::readDirectory(const cNtHeader& header,
+                              uint directoryTypeIndex)
+{
+    if (directoryTypeIndex == UNKNOWNDIR)
+        directoryTypeIndex = IMAGE_DIRECTORY_ENTRY_TLS;
+
+    const IMAGE_DATA_DIRECTORY& tlsDirectory =
+        header.OptionalHeader.DataDirectory[directoryTypeIndex];
+    CHECK_MSG((tlsDirectory.Size != 0) && (tlsDirectory.VirtualAddress != 0),
+              ".tls cannot be found!!!");
+
+    cVirtualMemoryAccesserPtr mem = header.getPeMemory();
+    if (header.is64bit())
+        readTls<cPe64Traits>(header, *mem, tlsDirectory.VirtualAddress);
+    else
+        readTls<cPe32Traits>(header, *mem, tlsDirectory.VirtualAddress);
+}
+
+template <class Traits>
+void cNtDirTls::readTls(const cNtHeader& header,
+                        const cVirtualMemoryAccesser& memory,
+                        addressNumericValue address)
+{
+    m_callbacks.changeSize(0);
+
+    typename Traits::TlsDirectory directory;
+    CHECK(memory.memread(address, &directory, sizeof(directory)));
+    m_directory.StartAddressOfRawData = directory.StartAddressOfRawData;
+    m_directory.EndAddressOfRawData = directory.EndAddressOfRawData;
+    m_directory.AddressOfIndex = directory.AddressOfIndex;
+    m_directory.AddressOfCallBacks = directory.AddressOfCallBacks;
+    m_directory.SizeOfZeroFill = directory.SizeOfZeroFill;
+    m_directory.Characteristics = directory.Characteristics;
+
+    m_rawDataStart = toRva(header, m_directory.StartAddressOfRawData);
+    m_rawDataEnd = toRva(header, m_directory.EndAddressOfRawData);
+    m_indexAddress = toRva(header, m_directory.AddressOfIndex);
+    m_callbacksAddress = toRva(header, m_directory.AddressOfCallBacks);
+    if (m_callbacksAddress == INVALID_RVA)
+        return;
+
+    // Read the entire array at once. The read is bounded by the end of the
+    // image, so it cannot fail on a short array near the end of the image
+    uint length = t_min((uint)(MAX_CALLBACKS * Traits::ADDRESS_SIZE),
+                        (uint)(header.OptionalHeader.SizeOfImage -
+                               m_callbacksAddress));
+    length-= length % Traits::ADDRESS_SIZE;
+    typename Traits::Address callbacks[MAX_CALLBACKS];
+    uint available = 0;
+    const uint8* direct = header.getDirectPointer(m_callbacksAddress,
+                                                  Traits::ADDRESS_SIZE,
+                                                  &available);
+    if (direct != NULL)
+    {
+        length = t_min(length, available - available % Traits::ADDRESS_SIZE);
+        cOS::memcpy(callbacks, direct, length);
+    } else
+    {
+        CHECK(memory.memread(m_callbacksAddress, callbacks, length));
+    }
+
+    // The array ends with a null pointer
+    uint count = length / Traits::ADDRESS_SIZE;
+    for (uint i = 0; (i < count) && (callbacks[i] != 0); i++)
+    {
+        TlsCallback callback;
+        callback.m_address = callbacks[i];
+        callback.m_rva = toRva(header, callback.m_address);
+        m_callbacks.append(callback);
+    }
+}
+
+uint32 cNtDirTls::toRva(const cNtHeader& header, uint64 address)
+{
+    uint rva;
+    if ((address == 0) ||
+        (!header.vaToRva((addressNumericValue)address, rva)))
+        return INVALID_RVA;
+    return rva;
+}
+
+const IMAGE_TLS_DIRECTORY64& cNtDirTls::getDirectory() const
+{
+    return m_directory;
+}
+
+uint32 cNtDirTls::getRawDataStart() const
+{
+    return m_rawDataStart;
+}
+
+uint32 cNtDirTls::getRawDataEnd() const
+{
+    return m_rawDataEnd;
+}
+
+uint32 cNtDirTls::getIndexAddress() const
+{
+    return m_indexAddress;
+}
+
+uint32 cNtDirTls::getCallbacksAddress() const
+{
+    return m_callbacksAddress;
+}
+
+const cNtDirTls::CallbackTable& cNtDirTls::getCallbacks() const
+{
+    return m_callbacks;
+}
+
+#ifdef PE_TRACE
+cStringerStream& operator << (cStringerStream& out,
+                              const cNtDirTls& tls)
+{
+    out << "TLS directory" << endl;
+    out << "=============" << endl << endl;
+
+    out << "  Raw data:   " << HEXDWORD(tls.m_rawDataStart) << " - "
+                            << HEXDWORD(tls.m_rawDataEnd) << endl;
+    out << "  Index:      " << HEXDWORD(tls.m_indexAddress) << endl;
+    out << "  Zero fill:  " << HEXDWORD(tls.m_directory.SizeOfZeroFill) << endl;
+    out << "  Callbacks:  " << HEXDWORD(tls.m_callbacksAddress) << endl;
+    for (uint i = 0; i < tls.m_callbacks.getSize(); i++)
+    {
+        out << "    " << HEXDWORD(tls.m_callbacks[i].m_rva) << endl;
+    }
+
+    return out;
+}
+#endif
@@ -38,6 +38,7 @@
  * Author: Elad Raz <e@eladraz.com>
  */
 #include "xStl/types.h"
+#include "xStl/os/os.h"
 #include "xStl/data/list.h"
 #include "xStl/data/array.h"
 #include "xStl/data/string.h"
@@ -46,44 +47,23 @@
 #include "xStl/except/exception.h"
 #include "pe/section.h"
 #include "pe/datastruct.h"
+#include "pe/peTraits.h"
 #include "pe/sectionTypes.h"
 #include "pe/ntheader.h"
 #include "pe/ntsectionheader.h"
+#include "pe/mappedFileAccesser.h"
+#include "pe/peChecksum.h"
 #include "pe/humanStringTranslation.h"
 
-cNtHeader::cNtHeader(basicInput& stream,
-                     addressNumericValue trueImageBase,
-                     bool shouldReadSections,
-                     bool isMemory) :
-    m_shouldReadSections(shouldReadSections),
-    m_fastImportDll(NULL),
-    m_memoryImage(NULL),
-    m_trueImageBase(trueImageBase)
-{
-    read(stream, shouldReadSections, isMemory);
-}
+// The size of the buffer which is used to stream the file. See
+// cNtHeader::computeChecksum
+#define CHECKSUM_BUFFER_SIZE (0x10000)
 
-cNtHeader::cNtHeader(cMemoryAccesserStream& stream,
-                     addressNumericValue trueImageBase,
-                     bool shouldReadSections,
-                     bool isMemory) :
-    m_shouldReadSections(shouldReadSections),
-    m_fastImportDll(NULL),
-    m_memoryImage(NULL),
-    m_trueImageBase(trueImageBase)
-{
-    read(stream, shouldReadSections, isMemory);
-}
-
-cNtHeader::cNtHeader(const IMAGE_NT_HEADERS32& other) :
-    m_fastImportDll(NULL),
-    m_memoryImage(NULL)
-{
-    changeNtHeader(other);
-}
-
-void cNtHeader::changeNtHeader(const IMAGE_NT_HEADERS32& other)
+template <class NtHeaders>
+void cNtHeader::copyCommonFields(const NtHeaders& other)
 {
+    // NOTE: ImageBase, BaseOfData and the stack/heap sizes are set by the
+    //       caller, since their width depends on the flavour
     this->Signature                       = other.Signature;
     this->FileHeader.Machine              = other.FileHeader.Machine;
     this->FileHeader.NumberOfSections     = other.FileHeader.NumberOfSections;
@@ -100,8 +80,6 @@ void cNtHeader::changeNtHeader(const IMAGE_NT_HEADERS32& other)
     this->OptionalHeader.SizeOfUninitializedData      = other.OptionalHeader.SizeOfUninitializedData;
     this->OptionalHeader.AddressOfEntryPoint          = other.OptionalHeader.AddressOfEntryPoint;
     this->OptionalHeader.BaseOfCode                   = other.OptionalHeader.BaseOfCode;
-    this->OptionalHeader.BaseOfData                   = other.OptionalHeader.BaseOfData;
-    this->OptionalHeader.ImageBase                    = other.OptionalHeader.ImageBase;
     this->OptionalHeader.SectionAlignment             = other.OptionalHeader.SectionAlignment;
     this->OptionalHeader.FileAlignment                = other.OptionalHeader.FileAlignment;
     this->OptionalHeader.MajorOperatingSystemVersion  = other.OptionalHeader.MajorOperatingSystemVersion;
@@ -116,10 +94,6 @@ void cNtHeader::changeNtHeader(const IMAGE_NT_HEADERS32& other)
     this->OptionalHeader.CheckSum                     = other.OptionalHeader.CheckSum;
     this->OptionalHeader.Subsystem                    = other.OptionalHeader.Subsystem;
     this->OptionalHeader.DllCharacteristics           = other.OptionalHeader.DllCharacteristics;
-    this->OptionalHeader.SizeOfStackReserve           = other.OptionalHeader.SizeOfStackReserve;
-    this->OptionalHeader.SizeOfStackCommit            = other.OptionalHeader.SizeOfStackCommit;
-    this->OptionalHeader.SizeOfHeapReserve            = other.OptionalHeader.SizeOfHeapReserve;
-    this->OptionalHeader.SizeOfHeapCommit             = other.OptionalHeader.SizeOfHeapCommit;
     this->OptionalHeader.LoaderFlags                  = other.OptionalHeader.LoaderFlags;
     this->OptionalHeader.NumberOfRvaAndSizes          = other.OptionalHeader.NumberOfRvaAndSizes;
 
@@ -131,23 +105,226 @@ void cNtHeader::changeNtHeader(const IMAGE_NT_HEADERS32& other)
     }
 }
 
+template <class OptionalHeaderType>
+void cNtHeader::copyWideFields(const OptionalHeaderType& other)
+{
+    m_wideFields.m_imageBase          = other.ImageBase;
+    m_wideFields.m_sizeOfStackReserve = other.SizeOfStackReserve;
+    m_wideFields.m_sizeOfStackCommit  = other.SizeOfStackCommit;
+    m_wideFields.m_sizeOfHeapReserve  = other.SizeOfHeapReserve;
+    m_wideFields.m_sizeOfHeapCommit   = other.SizeOfHeapCommit;
+}
+
+template <class NtHeaders>
+void cNtHeader::exportCommonFields(NtHeaders& other) const
+{
+    // NOTE: ImageBase, BaseOfData and the stack/heap sizes are set by the
+    //       caller, since their width depends on the flavour
+    other.Signature                       = this->Signature;
+    other.FileHeader.Machine              = this->FileHeader.Machine;
+    other.FileHeader.NumberOfSections     = this->FileHeader.NumberOfSections;
+    other.FileHeader.TimeDateStamp        = this->FileHeader.TimeDateStamp;
+    other.FileHeader.PointerToSymbolTable = this->FileHeader.PointerToSymbolTable;
+    other.FileHeader.NumberOfSymbols      = this->FileHeader.NumberOfSymbols;
+    other.FileHeader.SizeOfOptionalHeader = this->FileHeader.SizeOfOptionalHeader;
+    other.FileHeader.Characteristics      = this->FileHeader.Characteristics;
+    other.OptionalHeader.Magic                        = this->OptionalHeader.Magic;
+    other.OptionalHeader.MajorLinkerVersion           = this->OptionalHeader.MajorLinkerVersion;
+    other.OptionalHeader.MinorLinkerVersion           = this->OptionalHeader.MinorLinkerVersion;
+    other.OptionalHeader.SizeOfCode                   = this->OptionalHeader.SizeOfCode;
+    other.OptionalHeader.SizeOfInitializedData        = this->OptionalHeader.SizeOfInitializedData;
+    other.OptionalHeader.SizeOfUninitializedData      = this->OptionalHeader.SizeOfUninitializedData;
+    other.OptionalHeader.AddressOfEntryPoint          = this->OptionalHeader.AddressOfEntryPoint;
+    other.OptionalHeader.BaseOfCode                   = this->OptionalHeader.BaseOfCode;
+    other.OptionalHeader.SectionAlignment             = this->OptionalHeader.SectionAlignment;
+    other.OptionalHeader.FileAlignment                = this->OptionalHeader.FileAlignment;
+    other.OptionalHeader.MajorOperatingSystemVersion  = this->OptionalHeader.MajorOperatingSystemVersion;
+    other.OptionalHeader.MinorOperatingSystemVersion  = this->OptionalHeader.MinorOperatingSystemVersion;
+    other.OptionalHeader.MajorImageVersion            = this->OptionalHeader.MajorImageVersion;
+    other.OptionalHeader.MinorImageVersion            = this->OptionalHeader.MinorImageVersion;
+    other.OptionalHeader.MajorSubsystemVersion        = this->OptionalHeader.MajorSubsystemVersion;
+    other.OptionalHeader.MinorSubsystemVersion        = this->OptionalHeader.MinorSubsystemVersion;
+    other.OptionalHeader.Win32VersionValue            = this->OptionalHeader.Win32VersionValue;
+    other.OptionalHeader.SizeOfImage                  = this->OptionalHeader.SizeOfImage;
+    other.OptionalHeader.SizeOfHeaders                = this->OptionalHeader.SizeOfHeaders;
+    other.OptionalHeader.CheckSum                     = this->OptionalHeader.CheckSum;
+    other.OptionalHeader.Subsystem                    = this->OptionalHeader.Subsystem;
+    other.OptionalHeader.DllCharacteristics           = this->OptionalHeader.DllCharacteristics;
+    other.OptionalHeader.LoaderFlags                  = this->OptionalHeader.LoaderFlags;
+    other.OptionalHeader.NumberOfRvaAndSizes          = this->OptionalHeader.NumberOfRvaAndSizes;
+
+    /* Copy the directories entries */
+    for (uint i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; i++)
+    {
+        other.OptionalHeader.DataDirectory[i].Size           = this->OptionalHeader.DataDirectory[i].Size;
+        other.OptionalHeader.DataDirectory[i].VirtualAddress = this->OptionalHeader.DataDirectory[i].VirtualAddress;
+    }
+}
+
+cNtHeader::cNtHeader(basicInput& stream,
+                     addressNumericValue trueImageBase,
+                     bool shouldReadSections,
+                     bool isMemory,
+                     const cForkStream* lazyStream,
+                     cPeArena* arena) :
+    m_shouldReadSections(shouldReadSections),
+    m_fastImportDll(NULL),
+    m_memoryImage(NULL),
+    m_headerImage(NULL),
+    m_directHeaders(NULL),
+    m_directFile(NULL),
+    m_directFileOffset(0),
+    m_directFileLength(0),
+    m_trueImageBase(trueImageBase),
+    m_isVirtualMapSorted(true),
+    m_isRawMapSorted(true),
+    m_is64bit(false),
+    m_arena(arena)
+{
+    memset(&m_optionalHeader64, 0, sizeof(m_optionalHeader64));
+    memset(&m_wideFields, 0, sizeof(m_wideFields));
+    read(stream, shouldReadSections, isMemory, lazyStream);
+}
+
+cNtHeader::cNtHeader(cMemoryAccesserStream& stream,
+                     addressNumericValue trueImageBase,
+                     bool shouldReadSections,
+                     bool isMemory,
+                     cPeArena* arena) :
+    m_shouldReadSections(shouldReadSections),
+    m_fastImportDll(NULL),
+    m_memoryImage(NULL),
+    m_headerImage(NULL),
+    m_directHeaders(NULL),
+    m_directFile(NULL),
+    m_directFileOffset(0),
+    m_directFileLength(0),
+    m_trueImageBase(trueImageBase),
+    m_isVirtualMapSorted(true),
+    m_isRawMapSorted(true),
+    m_is64bit(false),
+    m_arena(arena)
+{
+    memset(&m_optionalHeader64, 0, sizeof(m_optionalHeader64));
+    memset(&m_wideFields, 0, sizeof(m_wideFields));
+    read(stream, shouldReadSections, isMemory);
+}
+
+cNtHeader::cNtHeader(const cString& filename,
+                     addressNumericValue trueImageBase,
+                     bool shouldReadSections,
+                     cPeArena* arena) :
+    m_shouldReadSections(shouldReadSections),
+    m_fastImportDll(NULL),
+    m_memoryImage(NULL),
+    m_headerImage(NULL),
+    m_directHeaders(NULL),
+    m_directFile(NULL),
+    m_directFileOffset(0),
+    m_directFileLength(0),
+    m_trueImageBase(trueImageBase),
+    m_isVirtualMapSorted(true),
+    m_isRawMapSorted(true),
+    m_is64bit(false),
+    m_arena(arena)
+{
+    memset(&m_optionalHeader64, 0, sizeof(m_optionalHeader64));
+    memset(&m_wideFields, 0, sizeof(m_wideFields));
+    readFile(filename, shouldReadSections);
+}
+
+cNtHeader::cNtHeader(const IMAGE_NT_HEADERS32& other) :
+    m_fastImportDll(NULL),
+    m_memoryImage(NULL),
+    m_headerImage(NULL),
+    m_directHeaders(NULL),
+    m_directFile(NULL),
+    m_directFileOffset(0),
+    m_directFileLength(0),
+    m_isVirtualMapSorted(true),
+    m_isRawMapSorted(true),
+    m_is64bit(false),
+    m_arena(NULL)
+{
+    memset(&m_optionalHeader64, 0, sizeof(m_optionalHeader64));
+    memset(&m_wideFields, 0, sizeof(m_wideFields));
+    changeNtHeader(other);
+}
+
+void cNtHeader::changeNtHeader(const IMAGE_NT_HEADERS32& other)
+{
+    copyCommonFields(other);
+    this->OptionalHeader.BaseOfData         = other.OptionalHeader.BaseOfData;
+    this->OptionalHeader.ImageBase          = other.OptionalHeader.ImageBase;
+    this->OptionalHeader.SizeOfStackReserve = other.OptionalHeader.SizeOfStackReserve;
+    this->OptionalHeader.SizeOfStackCommit  = other.OptionalHeader.SizeOfStackCommit;
+    this->OptionalHeader.SizeOfHeapReserve  = other.OptionalHeader.SizeOfHeapReserve;
+    this->OptionalHeader.SizeOfHeapCommit   = other.OptionalHeader.SizeOfHeapCommit;
+    copyWideFields(other.OptionalHeader);
+    m_is64bit = false;
+}
+
 cNtHeader& cNtHeader::operator = (const IMAGE_NT_HEADERS32& other)
 {
     m_sections.removeAll();
+    m_sectionIndex.changeSize(0);
+    m_sectionMap.changeSize(0);
     changeNtHeader(other);
 
     return *this;
 }
 
-void cNtHeader::read(basicInput& stream,
-                     bool shouldReadSections,
-                     bool isMemory)
+cPeArena* cNtHeader::getArena() const
 {
-    // Remove all old componentes
-    m_memoryImage = cForkStreamPtr(NULL);
-    m_fastImportDll = cForkStreamPtr(NULL);
+    return m_arena;
+}
+
+bool cNtHeader::is64bit() const
+{
+    return m_is64bit;
+}
+
+uint64 cNtHeader::getImageBase() const
+{
+    return m_wideFields.m_imageBase;
+}
+
+uint64 cNtHeader::getSizeOfStackReserve() const
+{
+    return m_wideFields.m_sizeOfStackReserve;
+}
+
+uint64 cNtHeader::getSizeOfStackCommit() const
+{
+    return m_wideFields.m_sizeOfStackCommit;
+}
+
+uint64 cNtHeader::getSizeOfHeapReserve() const
+{
+    return m_wideFields.m_sizeOfHeapReserve;
+}
 
-    IMAGE_NT_HEADERS32 newHeader;
+uint64 cNtHeader::getSizeOfHeapCommit() const
+{
+    return m_wideFields.m_sizeOfHeapCommit;
+}
+
+const IMAGE_OPTIONAL_HEADER64& cNtHeader::getOptionalHeader64() const
+{
+    CHECK(m_is64bit);
+    return m_optionalHeader64;
+}
+
+RemoteAddressEncodingType cNtHeader::getAddressEncoding() const
+{
+    return m_is64bit ? cPe64Traits::getAddressEncoding() :
+                       cPe32Traits::getAddressEncoding();
+}
+
+template <class Traits>
+void cNtHeader::readHeaders(basicInput& stream)
+{
+    typename Traits::NtHeaders newHeader;
     memset(&newHeader, 0, sizeof(newHeader));
     // Read all header, except RVA
     stream.pipeRead(&newHeader,
@@ -155,30 +332,119 @@ void cNtHeader::read(basicInput& stream,
                         (IMAGE_NUMBEROF_DIRECTORY_ENTRIES *
                         sizeof(IMAGE_DATA_DIRECTORY)));
 
-    CHECK(newHeader.Signature == IMAGE_NT_SIGNATURE);
-    changeNtHeader(newHeader);
-
-    // Read DATA_DIRCTORIES. Limited by the number of RVA
-    uint i;
-    for (i = 0; i < this->OptionalHeader.NumberOfRvaAndSizes; i++)
-        stream.pipeRead(&this->OptionalHeader.DataDirectory[i],
+    // Read DATA_DIRCTORIES. Limited by the number of RVA. Only the known
+    // directories are kept, the rest are skipped with the optional header
+    newHeader.OptionalHeader.NumberOfRvaAndSizes =
+        t_min((uint)newHeader.OptionalHeader.NumberOfRvaAndSizes,
+              (uint)IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    for (uint i = 0; i < newHeader.OptionalHeader.NumberOfRvaAndSizes; i++)
+        stream.pipeRead(&newHeader.OptionalHeader.DataDirectory[i],
                         sizeof(IMAGE_DATA_DIRECTORY));
 
+    copyCommonFields(newHeader);
+    copyWideFields(newHeader.OptionalHeader);
+    m_is64bit = (Traits::MAGIC == IMAGE_NT_OPTIONAL_HDR64_MAGIC);
+    if (m_is64bit)
+    {
+        // The wide fields don't fit, see copyWideFields
+        this->OptionalHeader.BaseOfData         = 0;
+        this->OptionalHeader.ImageBase          = 0;
+        this->OptionalHeader.SizeOfStackReserve = 0;
+        this->OptionalHeader.SizeOfStackCommit  = 0;
+        this->OptionalHeader.SizeOfHeapReserve  = 0;
+        this->OptionalHeader.SizeOfHeapCommit   = 0;
+        memcpy(&m_optionalHeader64, &newHeader.OptionalHeader,
+               sizeof(m_optionalHeader64));
+    } else
+    {
+        // Same layout, takes the BaseOfData
+        memcpy(&this->OptionalHeader, &newHeader.OptionalHeader,
+               sizeof(this->OptionalHeader));
+    }
+}
+
+template <class Traits>
+void cNtHeader::writeHeaders(basicIO& stream) const
+{
+    // The flavour matches m_is64bit, take the wide fields from the header
+    // which holds them
+    typename Traits::NtHeaders header;
+    const void* optionalHeader = m_is64bit ?
+                                    (const void*)&m_optionalHeader64 :
+                                    (const void*)&this->OptionalHeader;
+    memcpy(&header.OptionalHeader, optionalHeader,
+           sizeof(header.OptionalHeader));
+    exportCommonFields(header);
+
+    stream.pipeWrite(&header,
+                     sizeof(header) -
+                        ((IMAGE_NUMBEROF_DIRECTORY_ENTRIES - this->OptionalHeader.NumberOfRvaAndSizes) *
+                         sizeof(IMAGE_DATA_DIRECTORY)));
+}
+
+void cNtHeader::read(basicInput& stream,
+                     bool shouldReadSections,
+                     bool isMemory,
+                     const cForkStream* lazyStream)
+{
+    // Remove all old componentes
+    m_sections.removeAll();
+    m_sectionIndex.changeSize(0);
+    m_sectionMap.changeSize(0);
+    m_memoryImage = cForkStreamPtr(NULL);
+    m_headerImage = cForkStreamPtr(NULL);
+    m_directHeaders = NULL;
+    m_directFile = NULL;
+    m_directFileOffset = 0;
+    m_directFileLength = 0;
+    m_fastImportDll = cForkStreamPtr(NULL);
+    m_shouldReadSections = shouldReadSections;
+
+    // Read the signature, the file header and the optional header magic, and
+    // select the flavour of the rest of the header
+    uint start = stream.getPointer();
+    IMAGE_NT_HEADERS32 prefix;
+    stream.pipeRead(&prefix, sizeof(prefix.Signature) +
+                             sizeof(prefix.FileHeader) +
+                             sizeof(prefix.OptionalHeader.Magic));
+    CHECK(prefix.Signature == IMAGE_NT_SIGNATURE);
+    stream.seek(start, basicInput::IO_SEEK_SET);
+
+    switch (prefix.OptionalHeader.Magic)
+    {
+    case IMAGE_NT_OPTIONAL_HDR32_MAGIC: readHeaders<cPe32Traits>(stream); break;
+    case IMAGE_NT_OPTIONAL_HDR64_MAGIC: readHeaders<cPe64Traits>(stream); break;
+    default:
+        XSTL_THROW(cException, EXCEPTION_FORMAT_ERROR);
+    }
+
+    // The section table follows the optional header, whose size is given by
+    // the file header (not by the number of the data directories)
+    stream.seek(start + sizeof(uint32) + sizeof(IMAGE_FILE_HEADER) +
+                    this->FileHeader.SizeOfOptionalHeader,
+                basicInput::IO_SEEK_SET);
+
     // Test whether we should read sections
     if (!shouldReadSections)
         return;
 
+    // The lazy sections share a single source for their content
+    cNtLazySectionSourcePtr lazySource(NULL);
+    if (lazyStream != NULL)
+        lazySource = cNtLazySectionSourcePtr(new cNtLazySectionSource(*lazyStream));
+
     // Start reading sections
-    for (i = 0; i < this->FileHeader.NumberOfSections; i++)
+    for (uint i = 0; i < this->FileHeader.NumberOfSections; i++)
     {
         // Read section
-        cNtSectionHeader* appenedSection = new cNtSectionHeader(
+        cNtSectionHeader* appenedSection = new (m_arena) cNtSectionHeader(
                             // If we wanted to specifiy the image base for ourselves, use it
-                            m_trueImageBase ? m_trueImageBase : this->OptionalHeader.ImageBase,
+                            m_trueImageBase ? m_trueImageBase : (addressNumericValue)getImageBase(),
                             stream,
                             SECTION_TYPE_WINDOWS_CODE,
                             true,
-                            isMemory);
+                            isMemory,
+                            lazySource);
         cSectionPtr newSection(appenedSection);
 
         // Test whether we know what is the type of the section...
@@ -196,6 +462,8 @@ void cNtHeader::read(basicInput& stream,
         m_sections.append(newSection);
     }
 
+    buildSectionIndex();
+
     // TODO! readPrivate
 }
 
@@ -205,20 +473,19 @@ void cNtHeader::read(cMemoryAccesserStream& stream,
 {
     // Read the header
     read((basicInput&)(stream), false, isMemory);
+    m_shouldReadSections = shouldReadSections;
 
     // Test whether we should read sections
     if (!shouldReadSections)
         return;
 
-    // TODO!
-    CHECK(isMemory);
-
     // Start reading sections
     for (uint i = 0; i < this->FileHeader.NumberOfSections; i++)
     {
         // Read section
-        cNtSectionHeader* appenedSection = new cNtSectionHeader(
-            this->OptionalHeader.ImageBase,
+        cNtSectionHeader* appenedSection = new (m_arena) cNtSectionHeader(
+            // If we wanted to specifiy the image base for ourselves, use it
+            m_trueImageBase ? m_trueImageBase : (addressNumericValue)getImageBase(),
             stream,
             SECTION_TYPE_WINDOWS_CODE,
             true,
@@ -240,13 +507,409 @@ void cNtHeader::read(cMemoryAccesserStream& stream,
         m_sections.append(newSection);
     }
 
-    // Get a fast source
-    m_memoryImage = stream.fork();
+    buildSectionIndex();
+
+    // Get a fast source. A file image cannot be accessed as a memory image,
+    // the section table is used instead. The header region is still mapped
+    // as-is.
+    if (isMemory)
+        m_memoryImage = stream.fork();
+    else
+        m_headerImage = stream.fork();
 
     // And read the private dll sections.
     // TODO! readPrivate(stream);
 }
 
+void cNtHeader::readFile(const cString& filename,
+                         bool shouldReadSections)
+{
+    cMappedFileAccesser* file = new cMappedFileAccesser(filename);
+    cVirtualMemoryAccesserPtr memory(file);
+    cMemoryAccesserStream stream(memory, 0, file->getSize());
+
+    // Locate the PE header
+    IMAGE_DOS_HEADER dosHeader;
+    stream.pipeRead(&dosHeader, sizeof(dosHeader));
+    CHECK(dosHeader.e_magic == IMAGE_DOS_SIGNATURE);
+    stream.seek(dosHeader.e_lfanew, basicInput::IO_SEEK_SET);
+
+    read(stream, shouldReadSections, false);
+
+    // The mapping is kept alive by the streams which were forked out of it
+    if (m_headerImage.isEmpty())
+        return;
+    setDirectHeaders(file->getPointer(0, this->OptionalHeader.SizeOfHeaders));
+    setDirectFile(file->getPointer(0, file->getSize()), 0, file->getSize());
+
+    // The sections are views into the mapping. Let the memory translation
+    // access the mapping directly.
+    cList<cSectionPtr>::iterator i = m_sections.begin();
+    for (; i != m_sections.end(); ++i)
+    {
+        cNtSectionHeader* section = (cNtSectionHeader*)((*i).getPointer());
+        section->setDirectContent(file->getPointer(section->PointerToRawData,
+                                                   section->SizeOfRawData));
+    }
+}
+
+/*
+ * Round 'value' down/up to a multiple of 'alignment'. The alignment isn't
+ * trusted to be a power of two.
+ */
+static uint alignDown(uint value, uint alignment)
+{
+    if (alignment <= 1)
+        return value;
+    return value - (value % alignment);
+}
+
+static uint alignUp(uint value, uint alignment)
+{
+    if (alignment <= 1)
+        return value;
+    uint rest = value % alignment;
+    if (rest == 0)
+        return value;
+    // Saturate instead of wrapping around
+    if (value > 0xFFFFFFFF - (alignment - rest))
+        return 0xFFFFFFFF;
+    return value + (alignment - rest);
+}
+
+void cNtHeader::buildSectionIndex()
+{
+    uint count = m_sections.length();
+    m_sectionIndex.changeSize(count);
+    m_sectionMap.changeSize(count);
+    m_isVirtualMapSorted = true;
+    m_isRawMapSorted = true;
+
+    // The loader rules for the alignment. Images with section alignment lower
+    // than a page are mapped with the file alignment.
+    enum { PAGE_SIZE = 0x1000, RAW_SECTOR_SIZE = 0x200 };
+    uint fileAlignment = this->OptionalHeader.FileAlignment;
+    uint sectionAlignment = this->OptionalHeader.SectionAlignment;
+    if (sectionAlignment < PAGE_SIZE)
+        sectionAlignment = fileAlignment;
+    uint rawAlignment = (fileAlignment < RAW_SECTOR_SIZE) ? 1 : RAW_SECTOR_SIZE;
+
+    bool isIndexValid = true;
+    uint j = 0;
+    cList<cSectionPtr>::iterator i = m_sections.begin();
+    for (; i != m_sections.end(); ++i, ++j)
+    {
+        const cNtSectionHeader* section =
+            (const cNtSectionHeader*)((*i).getPointer());
+        SectionRange& range = m_sectionIndex[j];
+        range.m_start = section->VirtualAddress;
+        range.m_end = range.m_start + section->SizeOfRawData;
+        range.m_section = section;
+
+        // The loader requires ascending, non-overlapped sections. Anything
+        // else is translated by the slow path, which keep the "last section
+        // wins" behaviour.
+        if ((j > 0) && (m_sectionIndex[j - 1].m_end > range.m_start))
+            isIndexValid = false;
+
+        // The loader view of the section
+        SectionMapping& mapping = m_sectionMap[j];
+        uint virtualSize = section->Misc.VirtualSize;
+        if (virtualSize == 0)
+            virtualSize = section->SizeOfRawData;
+        uint rawSize = alignUp(section->SizeOfRawData, fileAlignment);
+        rawSize = t_min(rawSize, alignUp(virtualSize, sectionAlignment));
+
+        mapping.m_virtualStart = alignDown(section->VirtualAddress,
+                                           sectionAlignment);
+        mapping.m_virtualEnd = alignUp(section->VirtualAddress + virtualSize,
+                                       sectionAlignment);
+        mapping.m_rawStart = alignDown(section->PointerToRawData,
+                                       rawAlignment);
+        mapping.m_rawEnd = mapping.m_rawStart + rawSize;
+        if (mapping.m_rawEnd < mapping.m_rawStart)
+            mapping.m_rawEnd = 0xFFFFFFFF;
+        mapping.m_section = section;
+
+        if (j > 0)
+        {
+            SectionMapping& previous = m_sectionMap[j - 1];
+            if (previous.m_virtualStart >= mapping.m_virtualStart)
+                m_isVirtualMapSorted = false;
+            if ((previous.m_rawStart > mapping.m_rawStart) ||
+                (previous.m_rawEnd > mapping.m_rawStart))
+                m_isRawMapSorted = false;
+        }
+    }
+
+    if (!isIndexValid)
+        m_sectionIndex.changeSize(0);
+
+    // A section is extended up to the next one
+    if (m_isVirtualMapSorted)
+    {
+        for (j = 1; j < count; j++)
+        {
+            m_sectionMap[j - 1].m_virtualEnd =
+                t_min(m_sectionMap[j - 1].m_virtualEnd,
+                      m_sectionMap[j].m_virtualStart);
+        }
+    }
+}
+
+const cNtHeader::SectionMapping* cNtHeader::findSectionMapping(uint rva) const
+{
+    uint count = m_sectionMap.getSize();
+    if (!m_isVirtualMapSorted)
+    {
+        for (uint i = 0; i < count; i++)
+        {
+            if ((rva >= m_sectionMap[i].m_virtualStart) &&
+                (rva < m_sectionMap[i].m_virtualEnd))
+                return &m_sectionMap[i];
+        }
+        return NULL;
+    }
+
+    // Find the first mapping which starts after 'rva'
+    uint low = 0;
+    uint high = count;
+    while (low < high)
+    {
+        uint middle = (low + high) / 2;
+        if (m_sectionMap[middle].m_virtualStart <= rva)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if ((low == 0) || (rva >= m_sectionMap[low - 1].m_virtualEnd))
+        return NULL;
+    return &m_sectionMap[low - 1];
+}
+
+bool cNtHeader::rvaToOffset(uint rva, uint& offset) const
+{
+    const SectionMapping* mapping = findSectionMapping(rva);
+    if (mapping == NULL)
+    {
+        // The headers are mapped as-is
+        if (rva < this->OptionalHeader.SizeOfHeaders)
+        {
+            offset = rva;
+            return true;
+        }
+        return false;
+    }
+
+    uint delta = rva - mapping->m_virtualStart;
+    if (delta >= mapping->m_rawEnd - mapping->m_rawStart)
+        return false;
+    offset = mapping->m_rawStart + delta;
+    return true;
+}
+
+bool cNtHeader::offsetToRva(uint offset, uint& rva) const
+{
+    uint count = m_sectionMap.getSize();
+    const SectionMapping* mapping = NULL;
+    if (m_isRawMapSorted)
+    {
+        // Find the last section which starts at or before 'offset'
+        uint low = 0;
+        uint high = count;
+        while (low < high)
+        {
+            uint middle = (low + high) / 2;
+            if (m_sectionMap[middle].m_rawStart <= offset)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        // Skip empty sections which share the same raw pointer
+        while ((low > 0) && (m_sectionMap[low - 1].m_rawEnd <= offset) &&
+               (m_sectionMap[low - 1].m_rawStart ==
+                    m_sectionMap[low - 1].m_rawEnd))
+            low--;
+        if ((low > 0) && (offset < m_sectionMap[low - 1].m_rawEnd))
+            mapping = &m_sectionMap[low - 1];
+    } else
+    {
+        for (uint i = 0; i < count; i++)
+        {
+            if ((offset >= m_sectionMap[i].m_rawStart) &&
+                (offset < m_sectionMap[i].m_rawEnd))
+            {
+                mapping = &m_sectionMap[i];
+                break;
+            }
+        }
+    }
+
+    if (mapping == NULL)
+    {
+        // The headers are mapped as-is
+        if (offset < this->OptionalHeader.SizeOfHeaders)
+        {
+            rva = offset;
+            return true;
+        }
+        return false;
+    }
+
+    uint delta = offset - mapping->m_rawStart;
+    if (delta >= mapping->m_virtualEnd - mapping->m_virtualStart)
+        return false;
+    rva = mapping->m_virtualStart + delta;
+    return true;
+}
+
+bool cNtHeader::vaToRva(addressNumericValue va, uint& rva) const
+{
+    addressNumericValue imageBase = m_trueImageBase ? m_trueImageBase :
+                                        (addressNumericValue)getImageBase();
+    if ((va < imageBase) ||
+        (va - imageBase >= this->OptionalHeader.SizeOfImage))
+        return false;
+    rva = (uint)(va - imageBase);
+    return true;
+}
+
+const cNtSectionHeader* cNtHeader::sectionForRva(uint rva) const
+{
+    const SectionMapping* mapping = findSectionMapping(rva);
+    if (mapping == NULL)
+        return NULL;
+    return mapping->m_section;
+}
+
+const cNtHeader::SectionRange* cNtHeader::findSectionRange(
+                                        addressNumericValue rva) const
+{
+    // Find the first range which starts after 'rva'
+    uint low = 0;
+    uint high = m_sectionIndex.getSize();
+    while (low < high)
+    {
+        uint middle = (low + high) / 2;
+        if (m_sectionIndex[middle].m_start <= rva)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low == 0)
+        return NULL;
+    return &m_sectionIndex[low - 1];
+}
+
+const uint8* cNtHeader::getDirectPointer(addressNumericValue rva,
+                                         uint length,
+                                         uint* available) const
+{
+    // The header region
+    addressNumericValue headersSize = this->OptionalHeader.SizeOfHeaders;
+    if ((m_directHeaders != NULL) && (rva < headersSize))
+    {
+        if (length > headersSize - rva)
+            return NULL;
+        if (available != NULL)
+            *available = (uint)(headersSize - rva);
+        return m_directHeaders + rva;
+    }
+
+    const SectionRange* range = findSectionRange(rva);
+    if ((range == NULL) ||
+        (rva >= range->m_end) ||
+        (length > range->m_end - rva))
+        return NULL;
+
+    const uint8* content = range->m_section->getDirectContent();
+    if (content == NULL)
+        return NULL;
+    if (available != NULL)
+        *available = (uint)(range->m_end - rva);
+    return content + (rva - range->m_start);
+}
+
+void cNtHeader::setDirectHeaders(const uint8* content)
+{
+    m_directHeaders = content;
+}
+
+cForkStreamPtr cNtHeader::getFileStream() const
+{
+    if (m_headerImage.isEmpty())
+        return cForkStreamPtr(NULL);
+    return m_headerImage->fork();
+}
+
+const uint8* cNtHeader::getDirectFilePointer(uint offset, uint length) const
+{
+    if ((m_directFile == NULL) ||
+        (offset < m_directFileOffset) ||
+        (offset - m_directFileOffset > m_directFileLength) ||
+        (length > m_directFileLength - (offset - m_directFileOffset)))
+        return NULL;
+    return m_directFile + (offset - m_directFileOffset);
+}
+
+void cNtHeader::setDirectFile(const uint8* content, uint offset, uint length)
+{
+    m_directFile = content;
+    m_directFileOffset = offset;
+    m_directFileLength = (content == NULL) ? 0 : length;
+}
+
+uint32 cNtHeader::computeChecksum() const
+{
+    cForkStreamPtr file = getFileStream();
+    CHECK_MSG(!file.isEmpty(), "The raw file isn't available");
+    uint fileSize = file->length();
+    const uint8* image = getDirectFilePointer(0, fileSize);
+
+    // Locate the CheckSum field, which is at the same place for both PE32
+    // and PE32+
+    IMAGE_DOS_HEADER dosHeader;
+    CHECK(fileSize >= sizeof(dosHeader));
+    if (image != NULL)
+    {
+        cOS::memcpy(&dosHeader, image, sizeof(dosHeader));
+    } else
+    {
+        file->seek(0, basicInput::IO_SEEK_SET);
+        file->pipeRead(&dosHeader, sizeof(dosHeader));
+    }
+    CHECK(dosHeader.e_magic == IMAGE_DOS_SIGNATURE);
+    IMAGE_NT_HEADERS32 layout;
+    uint checkSumOffset = (uint)dosHeader.e_lfanew +
+        (uint)((const uint8*)&layout.OptionalHeader.CheckSum -
+               (const uint8*)&layout);
+
+    if (image != NULL)
+        return cPeChecksum::compute(image, fileSize, checkSumOffset);
+
+    cPeChecksum checksum;
+    cBuffer buffer(CHECKSUM_BUFFER_SIZE);
+    file->seek(0, basicInput::IO_SEEK_SET);
+    uint length = fileSize;
+    while (length > 0)
+    {
+        uint chunk = t_min(length, (uint)CHECKSUM_BUFFER_SIZE);
+        file->pipeRead(buffer.getBuffer(), chunk);
+        checksum.update(buffer.getBuffer(), chunk);
+        length-= chunk;
+    }
+    return checksum.getChecksum(checkSumOffset,
+                                this->OptionalHeader.CheckSum);
+}
+
+bool cNtHeader::verifyChecksum() const
+{
+    return (this->OptionalHeader.CheckSum != 0) &&
+           (computeChecksum() == this->OptionalHeader.CheckSum);
+}
+
 void cNtHeader::readPrivate(cMemoryAccesserStream& stream)
 {
     /*
@@ -275,11 +938,10 @@ void cNtHeader::write(basicIO& stream,
                       bool isMemory)
 {
     // Start writing all the fields of the IMAGE_NT_HEADERS struct
-    IMAGE_NT_HEADERS* imageNtHeaders = (IMAGE_NT_HEADERS*)(&this->Signature);
-    stream.pipeWrite(imageNtHeaders,
-                     sizeof(IMAGE_NT_HEADERS) -
-                        ((IMAGE_NUMBEROF_DIRECTORY_ENTRIES - this->OptionalHeader.NumberOfRvaAndSizes) *
-                         sizeof(IMAGE_DATA_DIRECTORY)));
+    if (m_is64bit)
+        writeHeaders<cPe64Traits>(stream);
+    else
+        writeHeaders<cPe32Traits>(stream);
 
     // Test for section storage
     if (!shouldWriteSections)
@@ -319,6 +981,8 @@ cStringerStream& operator << (cStringerStream& out,
     {
     case IMAGE_FILE_MACHINE_I386:    out << "Intel 32 bit" << endl; break;
     case IMAGE_FILE_MACHINE_IA64:    out << "Intel 64 bit" << endl; break;
+    case IMAGE_FILE_MACHINE_AMD64:   out << "AMD64"        << endl; break;
+    case IMAGE_FILE_MACHINE_ARM64:   out << "ARM64"        << endl; break;
     case IMAGE_FILE_MACHINE_ALPHA:   out << "DEC Alpha "   << endl; break;
     case IMAGE_FILE_MACHINE_POWERPC: out << "Power PC"     << endl; break;
     default: out << "Unknown - " << HEXWORD(object.FileHeader.Machine) << endl; break;
@@ -349,10 +1013,14 @@ cStringerStream& operator << (cStringerStream& out,
     out << "     Size of code:        " << (uint)object.OptionalHeader.SizeOfCode << endl;
     out << "     SzInitializedData:   " << (uint)object.OptionalHeader.SizeOfInitializedData << endl;
     out << "     SzUninitialiezdData: " << (uint)object.OptionalHeader.SizeOfUninitializedData << endl;
-    out << "     AddressOfEntryPoint: " << HEXDWORD(object.OptionalHeader.AddressOfEntryPoint + object.OptionalHeader.ImageBase) << endl;
-    out << "     BaseOfCode:          " << HEXDWORD(object.OptionalHeader.BaseOfCode          + object.OptionalHeader.ImageBase) << endl;
-    out << "     BaseOfData:          " << HEXDWORD(object.OptionalHeader.BaseOfData          + object.OptionalHeader.ImageBase) << endl;
-    out << "     ImageBase:           " << HEXDWORD(object.OptionalHeader.ImageBase) << endl;
+    // The wide fields are taken from the flavour-aware accessors
+    uint64 imageBase = object.getImageBase();
+    RemoteAddressEncodingType encoding = object.getAddressEncoding();
+    out << "     AddressOfEntryPoint: " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.OptionalHeader.AddressOfEntryPoint + imageBase, encoding)) << endl;
+    out << "     BaseOfCode:          " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.OptionalHeader.BaseOfCode + imageBase, encoding)) << endl;
+    if (!object.is64bit())
+        out << "     BaseOfData:          " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.OptionalHeader.BaseOfData + imageBase, encoding)) << endl;
+    out << "     ImageBase:           " << HEXREMOTEADDRESS(remoteAddressNumericValue(imageBase, encoding)) << endl;
     out << "     SectionAlignment:    " << (uint)object.OptionalHeader.SectionAlignment  << endl;
     out << "     FileAlignment:       " << (uint)object.OptionalHeader.FileAlignment << endl;
     out << "     OS version:          " << (uint)object.OptionalHeader.MajorOperatingSystemVersion << "." << (uint)object.OptionalHeader.MinorOperatingSystemVersion << endl;
@@ -374,10 +1042,11 @@ cStringerStream& operator << (cStringerStream& out,
     default: out << "Unkwon subsystem: " << HEXWORD(object.OptionalHeader.Subsystem);
     }
     out << endl;
-    out << "     SizeOfStackReserve:  " << HEXDWORD(object.OptionalHeader.SizeOfStackReserve)  << endl;
-    out << "     SizeOfStackCommit:   " << HEXDWORD(object.OptionalHeader.SizeOfStackCommit)   << endl;
-    out << "     SizeOfHeapReserve:   " << HEXDWORD(object.OptionalHeader.SizeOfHeapReserve)   << endl;
-    out << "     SizeOfHeapCommit:    " << HEXDWORD(object.OptionalHeader.SizeOfHeapCommit)    << endl;
+    // The stack/heap sizes are as wide as the addresses of the image
+    out << "     SizeOfStackReserve:  " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.getSizeOfStackReserve(), encoding)) << endl;
+    out << "     SizeOfStackCommit:   " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.getSizeOfStackCommit(), encoding))  << endl;
+    out << "     SizeOfHeapReserve:   " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.getSizeOfHeapReserve(), encoding))  << endl;
+    out << "     SizeOfHeapCommit:    " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.getSizeOfHeapCommit(), encoding))   << endl;
     out << "     LoaderFlags:         " << (uint)object.OptionalHeader.LoaderFlags         << endl;
     out << "     NumberOfRvaAndSizes: " << (uint)object.OptionalHeader.NumberOfRvaAndSizes << endl;
 
@@ -388,7 +1057,7 @@ cStringerStream& operator << (cStringerStream& out,
             /* Print only the active directories */
             out << "Dir#" << HEXBYTE(i) << " size: "<<
                 HEXDWORD(object.OptionalHeader.DataDirectory[i].Size) <<
-                " location: " << HEXDWORD(object.OptionalHeader.DataDirectory[i].VirtualAddress + object.OptionalHeader.ImageBase) <<
+                " location: " << HEXREMOTEADDRESS(remoteAddressNumericValue(object.OptionalHeader.DataDirectory[i].VirtualAddress + imageBase, encoding)) <<
                 " - " << cHumanStringTranslation::getWindowsDirectoryName(i) << endl;
         }
     }
@@ -460,8 +1129,102 @@ bool cNtHeader::cNtPeFileMapping::memread(addressNumericValue address,
         return true;
     }
 
+    const cArray<SectionRange>& index = m_parent->m_sectionIndex;
+    if (index.getSize() != m_parent->m_sections.length())
+    {
+        memreadLinear(address, (uint8*)buffer, length);
+        return true;
+    }
+
+    // Start with the section which contains 'address' or the one after it
+    const SectionRange* range = m_parent->findSectionRange(address);
+    uint i = (range == NULL) ? 0 : (uint)(range - index.getBuffer());
+    addressNumericValue position = address;
+    addressNumericValue end = address + length;
+    uint8* output = (uint8*)buffer;
+
+    for (; (i < index.getSize()) && (position < end); i++)
+    {
+        const SectionRange& current = index[i];
+        if (current.m_end <= position)
+            continue;
+        if (current.m_start >= end)
+            break;
+
+        // Fill the gap before the section
+        if (current.m_start > position)
+        {
+            readGap(position, output + (position - address),
+                    (uint)(current.m_start - position));
+            position = current.m_start;
+        }
+
+        addressNumericValue sectionEnd = t_min(current.m_end, end);
+        readSection(*current.m_section,
+                    position - current.m_start,
+                    output + (position - address),
+                    (uint)(sectionEnd - position));
+        position = sectionEnd;
+    }
+
+    // Fill the tail which isn't covered by any section
+    if (position < end)
+        readGap(position, output + (position - address),
+                (uint)(end - position));
+
+    return true;
+}
+
+void cNtHeader::cNtPeFileMapping::readSection(const cNtSectionHeader& section,
+                                              addressNumericValue offset,
+                                              uint8* buffer,
+                                              uint length)
+{
+    const uint8* content = section.getDirectContent();
+    if (content != NULL)
+    {
+        cOS::memcpy(buffer, content + offset, length);
+        return;
+    }
+
+    cForkStreamPtr stream = section.getSectionContentAccesser();
+    stream->seek((uint)offset, basicInput::IO_SEEK_SET);
+    stream->pipeRead(buffer, length);
+}
+
+void cNtHeader::cNtPeFileMapping::readGap(addressNumericValue address,
+                                          uint8* buffer,
+                                          uint length) const
+{
+    // The part which falls inside the header region
+    addressNumericValue headersSize = m_parent->OptionalHeader.SizeOfHeaders;
+    uint headerLength = 0;
+    if ((address < headersSize) && (!m_parent->m_headerImage.isEmpty()))
+    {
+        headerLength = (uint)t_min((addressNumericValue)length,
+                                   headersSize - address);
+        if (m_parent->m_directHeaders != NULL)
+        {
+            cOS::memcpy(buffer, m_parent->m_directHeaders + address,
+                        headerLength);
+        } else
+        {
+            cForkStreamPtr stream = m_parent->m_headerImage->fork();
+            stream->seek((uint)address, basicInput::IO_SEEK_SET);
+            headerLength = stream->read(buffer, headerLength);
+        }
+    }
+
+    memset(buffer + headerLength, IMAGE_RDATA_CELL_CODE,
+           length - headerLength);
+}
+
+void cNtHeader::cNtPeFileMapping::memreadLinear(addressNumericValue address,
+                                                uint8* buffer,
+                                                uint length) const
+{
     // Reset buffer
-    memset(buffer, IMAGE_RDATA_CELL_CODE , length);
+    readGap(address, buffer, length);
 
     cList<cSectionPtr>::iterator i = m_parent->m_sections.begin();
     for (; i != m_parent->m_sections.end(); ++i)
@@ -478,15 +1241,10 @@ bool cNtHeader::cNtPeFileMapping::memread(addressNumericValue address,
             addressNumericValue cBegin = t_max(SectionAddress, address);
             addressNumericValue cEnd   = t_min(SectionEnd, (address + length));
 
-            cForkStreamPtr stream =
-                ntSection.getSectionContentAccesser()->fork();
-
-            stream->seek(cBegin - SectionAddress, basicInput::IO_SEEK_SET);
-            stream->pipeRead((uint8*)buffer + (cBegin - address), cEnd - cBegin);
+            readSection(ntSection, cBegin - SectionAddress,
+                        buffer + (cBegin - address), (uint)(cEnd - cBegin));
         }
     }
-
-    return true;
 }
 
 bool cNtHeader::cNtPeFileMapping::write(addressNumericValue,
@@ -46,6 +46,7 @@
 #include "xStl/os/virtualMemoryAccesser.h"
 #include "xStl/os/threadUnsafeMemoryAccesser.h"
 #include "xStl/os/streamMemoryAccesser.h"
+#include "xStl/os/lock.h"
 #include "xStl/stream/basicIO.h"
 #include "xStl/stream/stringerStream.h"
 #include "pe/datastruct.h"
@@ -54,10 +55,18 @@
 #include "pe/humanStringTranslation.h"
 #include "pe/ntsectionheader.h"
 
+cNtLazySectionSource::cNtLazySectionSource(const cForkStream& stream) :
+    m_stream(stream.fork())
+{
+}
+
 cNtSectionHeader::cNtSectionHeader(const IMAGE_SECTION_HEADER& other) :
     cSection("", cForkStreamPtr(NULL)),
     m_relocations(NULL),
-    m_linenumbers(NULL)
+    m_linenumbers(NULL),
+    m_directContent(NULL),
+    m_lazySource(NULL),
+    m_isContentLoaded(false)
 {
     // Change the header
     changeNtSection(other);
@@ -67,13 +76,17 @@ cNtSectionHeader::cNtSectionHeader(addressNumericValue imageBase,
                                    basicInput& stream,
                                    SectionType type,
                                    bool shouldReadData,
-                                   bool isMemory) :
+                                   bool isMemory,
+                                   const cNtLazySectionSourcePtr& lazySource) :
     cSection("", cForkStreamPtr(NULL)),
     m_relocations(NULL),
     m_linenumbers(NULL),
+    m_directContent(NULL),
+    m_lazySource(NULL),
+    m_isContentLoaded(false),
     m_imageBase(imageBase)
 {
-    read(stream, shouldReadData, isMemory);
+    read(stream, shouldReadData, isMemory, lazySource);
     // Soft relocation
     m_base+= imageBase;
     // Change image type
@@ -88,6 +101,9 @@ cNtSectionHeader::cNtSectionHeader(addressNumericValue imageBase,
     cSection("", cForkStreamPtr(NULL)),
     m_relocations(NULL),
     m_linenumbers(NULL),
+    m_directContent(NULL),
+    m_lazySource(NULL),
+    m_isContentLoaded(false),
     m_imageBase(imageBase)
 {
     read(stream, shouldReadData, isMemory);
@@ -183,11 +199,15 @@ void cNtSectionHeader::init()
     m_data = cForkStreamPtr(NULL);
     m_relocations = cMemoryAccesserStreamPtr(NULL);
     m_linenumbers = cMemoryAccesserStreamPtr(NULL);
+    m_directContent = NULL;
+    m_lazySource = cNtLazySectionSourcePtr(NULL);
+    m_isContentLoaded = false;
 }
 
 void cNtSectionHeader::read(basicInput& stream,
                             bool shouldReadData,
-                            bool isMemory)
+                            bool isMemory,
+                            const cNtLazySectionSourcePtr& lazySource)
 {
     init();
     // Reads the IMAGE_SECTION_HEADER
@@ -199,73 +219,110 @@ void cNtSectionHeader::read(basicInput& stream,
 
     if (shouldReadData)
     {
-        uint oldPointer = stream.getPointer();
-
-        // Snapshot the file image
-        cBufferPtr data(new cBuffer());
-
-        // Read section data
-        if (!isMemory)
+        if (isMemory)
         {
-            // Seek to the file postion
-            stream.seek(this->PointerToRawData, basicInput::IO_SEEK_SET);
-            data->changeSize(this->SizeOfRawData, false);
-        } else
-        {
-            // Seek to memory location
-            // Notice that the VirtualAddress is relative to the base... So the
-            // calculation should be OK.
-            stream.seek(this->VirtualAddress, basicInput::IO_SEEK_SET);
-            data->changeSize(this->Misc.VirtualSize, false);
-
             // Relocate the section data. The section must be correct, so now
             // the physical contains a larger information.
             PointerToRawData = VirtualAddress;
             SizeOfRawData = Misc.VirtualSize;
         }
 
-        // Read the data
-        stream.pipeRead(data->getBuffer(), data->getSize());
+        if (!lazySource.isEmpty())
+        {
+            // The content will be read on the first access
+            m_lazySource = lazySource;
+        } else
+        {
+            readContent(stream);
+        }
+    }
+}
 
-        // Change the m_data
-        cVirtualMemoryAccesserPtr memory(new cStreamMemoryAccesser(data));
-        m_data = cForkStreamPtr(new cMemoryAccesserStream(
-            memory,
-            0,
-            data->getSize()));
+void cNtSectionHeader::loadSectionContent() const
+{
+    if (m_lazySource.isEmpty())
+        return;
+    if (__atomic_load_n(&m_isContentLoaded, __ATOMIC_ACQUIRE))
+        return;
+
+    // The other sections of the image share the stream of the source, so the
+    // loads are serialized
+    cLock lock(m_lazySource->m_lock);
+    if (m_isContentLoaded)
+        return;
+
+    readContent(*m_lazySource->m_stream);
+    __atomic_store_n(&m_isContentLoaded, true, __ATOMIC_RELEASE);
+}
 
-        // Read relocation table if needed
-        if (this->PointerToRelocations != 0)
-        {
-            stream.seek(this->PointerToRelocations - m_imageBase, basicInput::IO_SEEK_SET);
-            cBufferPtr relocationData(new cBuffer());
-            stream.pipeRead(*relocationData,
-                this->NumberOfRelocations * sizeof(IMAGE_RELOCATION));
+void cNtSectionHeader::readContent(basicInput& stream) const
+{
+    uint oldPointer = stream.getPointer();
 
-            // Creates the relocation snapshot
-            cVirtualMemoryAccesserPtr memory(new
-                cStreamMemoryAccesser(relocationData));
-            m_relocations = cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
-                memory, 0, relocationData->getSize()));
-        }
+    // Snapshot the file image
+    cBufferPtr data(new cBuffer());
 
-        // Read linenumber table if needed
-        if (this->PointerToLinenumbers != 0)
-        {
-            stream.seek(this->PointerToLinenumbers, basicInput::IO_SEEK_SET);
-            cBufferPtr linenumberData(new cBuffer());
-            stream.pipeRead(*linenumberData,
-                this->NumberOfLinenumbers * sizeof(IMAGE_LINENUMBER));
+    // Read section data
+    // NOTE: For memory images the PointerToRawData and the SizeOfRawData were
+    //       already relocated to the VirtualAddress and the VirtualSize.
+    //       Notice that the VirtualAddress is relative to the base... So the
+    //       calculation should be OK.
+    stream.seek(this->PointerToRawData, basicInput::IO_SEEK_SET);
+    data->changeSize(this->SizeOfRawData, false);
 
-            // Creates the relocation snapshot
-            cVirtualMemoryAccesserPtr memory(new
-                cStreamMemoryAccesser(linenumberData));
-            m_linenumbers = cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
-                memory, 0, linenumberData->getSize()));
-        }
+    // Read the data
+    stream.pipeRead(data->getBuffer(), data->getSize());
 
-        stream.seek(oldPointer, basicInput::IO_SEEK_SET);
+    // Read relocation table if needed
+    if (this->PointerToRelocations != 0)
+    {
+        stream.seek(this->PointerToRelocations - m_imageBase, basicInput::IO_SEEK_SET);
+        cBufferPtr relocationData(new cBuffer());
+        stream.pipeRead(*relocationData,
+            this->NumberOfRelocations * sizeof(IMAGE_RELOCATION));
+
+        // Creates the relocation snapshot
+        cVirtualMemoryAccesserPtr memory(new
+            cStreamMemoryAccesser(relocationData));
+        m_relocations = cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
+            memory, 0, relocationData->getSize()));
+    }
+
+    // Read linenumber table if needed
+    if (this->PointerToLinenumbers != 0)
+    {
+        stream.seek(this->PointerToLinenumbers, basicInput::IO_SEEK_SET);
+        cBufferPtr linenumberData(new cBuffer());
+        stream.pipeRead(*linenumberData,
+            this->NumberOfLinenumbers * sizeof(IMAGE_LINENUMBER));
+
+        // Creates the relocation snapshot
+        cVirtualMemoryAccesserPtr memory(new
+            cStreamMemoryAccesser(linenumberData));
+        m_linenumbers = cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
+            memory, 0, linenumberData->getSize()));
     }
+
+    // The buffer is kept alive by the memory accesser
+    m_directContent = data->getBuffer();
+    cVirtualMemoryAccesserPtr memory(new cStreamMemoryAccesser(data));
+    m_data = cForkStreamPtr(new cMemoryAccesserStream(
+        memory,
+        0,
+        data->getSize()));
+
+    stream.seek(oldPointer, basicInput::IO_SEEK_SET);
+}
+
+const uint8* cNtSectionHeader::getDirectContent() const
+{
+    touchSectionContent();
+    return m_directContent;
+}
+
+void cNtSectionHeader::setDirectContent(const uint8* content)
+{
+    m_directContent = content;
 }
 
 void cNtSectionHeader::read(cMemoryAccesserStream& stream,
@@ -338,6 +395,7 @@ void cNtSectionHeader::write(basicIO& stream,
             stream.seek(this->VirtualAddress, basicInput::IO_SEEK_SET);
         }
 
+        touchSectionContent();
         basicIO::copyStream(stream, (basicInput&)*m_data);
 
         if (this->PointerToRelocations != 0)
@@ -385,6 +443,7 @@ cStringerStream& operator << (cStringerStream& out,
     out << endl;
 
     // Print the content of the class
+    object.touchSectionContent();
     if (!object.m_data.isEmpty())
     {
         cBuffer data;
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peArena.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/os/os.h"
+#include "xStl/except/exception.h"
+#include "pe/peArena.h"
+
+cPeArena::cPeArena(uint chunkSize) :
+    m_chunkSize(chunkSize),
+    m_pool(new Pool),
+    m_currentChunk(NULL),
+    m_position(0),
+    m_allocatedSize(0),
+    m_reservedSize(0)
+{
+    m_pool->m_firstChunk = NULL;
+    m_pool->m_liveObjects = 0;
+    m_pool->m_isOrphan = false;
+}
+
+cPeArena::~cPeArena()
+{
+    // A live object still references its block, it releases the pool
+    if (m_pool->m_liveObjects != 0)
+    {
+        m_pool->m_isOrphan = true;
+        return;
+    }
+
+    releasePool(m_pool);
+}
+
+void cPeArena::releasePool(Pool* pool)
+{
+    Chunk* chunk = pool->m_firstChunk;
+    while (chunk != NULL)
+    {
+        Chunk* next = chunk->m_next;
+        delete[] ((uint8*)chunk);
+        chunk = next;
+    }
+    delete pool;
+}
+
+uint cPeArena::getChunkHeaderSize()
+{
+    // Keep the data aligned as the largest scalar
+    return (sizeof(Chunk) + 15) & ~15;
+}
+
+uint8* cPeArena::getChunkData(Chunk* chunk)
+{
+    return ((uint8*)chunk) + getChunkHeaderSize();
+}
+
+void* cPeArena::allocate(uint size, uint alignment)
+{
+    if (m_currentChunk != NULL)
+    {
+        uint position = (m_position + alignment - 1) & ~(alignment - 1);
+        if ((position >= m_position) &&
+            (position <= m_currentChunk->m_size) &&
+            (size <= m_currentChunk->m_size - position))
+        {
+            m_position = position + size;
+            m_allocatedSize+= size;
+            return getChunkData(m_currentChunk) + position;
+        }
+    }
+
+    // A chunk starts aligned
+    nextChunk(size, alignment);
+    m_position = size;
+    m_allocatedSize+= size;
+    return getChunkData(m_currentChunk);
+}
+
+void cPeArena::nextChunk(uint size, uint alignment)
+{
+    // The data of a chunk is aligned to 16 bytes
+    CHECK(alignment <= 16);
+
+    // Reuse the chunks which were kept by 'reset'
+    Chunk* previous = m_currentChunk;
+    Chunk* chunk = (previous == NULL) ? m_pool->m_firstChunk : previous->m_next;
+    while ((chunk != NULL) && (chunk->m_size < size))
+    {
+        previous = chunk;
+        chunk = chunk->m_next;
+    }
+
+    if (chunk == NULL)
+    {
+        uint dataSize = t_max(size, m_chunkSize);
+        CHECK(dataSize + getChunkHeaderSize() > dataSize);
+        chunk = (Chunk*)(new uint8[dataSize + getChunkHeaderSize()]);
+        chunk->m_size = dataSize;
+        chunk->m_next = NULL;
+        m_reservedSize+= dataSize;
+
+        // Append to the end of the list
+        if (previous == NULL)
+            m_pool->m_firstChunk = chunk;
+        else
+            previous->m_next = chunk;
+    }
+
+    m_currentChunk = chunk;
+    m_position = 0;
+}
+
+const char* cPeArena::duplicate(const char* string, uint length)
+{
+    CHECK(length + 1 > length);
+    char* ret = (char*)allocate(length + 1, 1);
+    cOS::memcpy(ret, string, length);
+    ret[length] = 0;
+    return ret;
+}
+
+bool cPeArena::reset()
+{
+    // A live object still references its block
+    if (m_pool->m_liveObjects != 0)
+        return false;
+
+    m_currentChunk = NULL;
+    m_position = 0;
+    m_allocatedSize = 0;
+    return true;
+}
+
+uint cPeArena::getAllocatedSize() const
+{
+    return m_allocatedSize;
+}
+
+uint cPeArena::getReservedSize() const
+{
+    return m_reservedSize;
+}
+
+void* cPeArenaObject::operator new(size_t size)
+{
+    return operator new(size, (cPeArena*)NULL);
+}
+
+void* cPeArenaObject::operator new(size_t size, cPeArena* arena)
+{
+    Header* header;
+    if (arena == NULL)
+    {
+        header = (Header*)(::operator new(size + sizeof(Header)));
+    } else
+    {
+        header = (Header*)(arena->allocate((uint)(size + sizeof(Header))));
+        arena->m_pool->m_liveObjects++;
+    }
+
+    header->m_pool = (arena == NULL) ? NULL : arena->m_pool;
+    return header + 1;
+}
+
+void cPeArenaObject::operator delete(void* object)
+{
+    if (object == NULL)
+        return;
+
+    Header* header = ((Header*)object) - 1;
+    cPeArena::Pool* pool = header->m_pool;
+    if (pool == NULL)
+    {
+        ::operator delete(header);
+        return;
+    }
+
+    // The memory is reclaimed by cPeArena::reset, or here if the arena is
+    // already destroyed
+    pool->m_liveObjects--;
+    if ((pool->m_liveObjects == 0) && (pool->m_isOrphan))
+        cPeArena::releasePool(pool);
+}
+
+void cPeArenaObject::operator delete(void* object, cPeArena*)
+{
+    // Called when a constructor throws
+    operator delete(object);
+}
@@ -0,0 +1,798 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peAsyncReader.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/data/string.h"
+#include "xStl/except/exception.h"
+#include "xStl/except/trace.h"
+#include "xStl/os/os.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/datastruct.h"
+#include "pe/peFile.h"
+#include "pe/ntheader.h"
+#include "pe/ntsectionheader.h"
+#include "pe/ntdir.h"
+#include "pe/peFileSystem.h"
+#include "pe/peBatchScanner.h"
+#include "pe/peAsyncReader.h"
+
+#ifdef PE_ASYNC_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * The file image which is known so far: a set of extents, each one is the
+ * result of a completed read. Reads outside the extents fail.
+ */
+class cExtentMemoryAccesser : public cVirtualMemoryAccesser {
+public:
+    defaultEndianImpl;
+
+    // Add the content of [offset, offset + data.getSize())
+    void addExtent(uint offset, const cBufferPtr& data)
+    {
+        Extent extent;
+        extent.m_offset = offset;
+        extent.m_length = data->getSize();
+        extent.m_data = data->getBuffer();
+        extent.m_buffer = data;
+        m_extents.append(extent);
+    }
+
+    // Add a view of [offset, offset + length) of a mapped file
+    void addView(uint offset, uint length, const cMappedFileAccesserPtr& file)
+    {
+        Extent extent;
+        extent.m_offset = offset;
+        extent.m_length = length;
+        extent.m_data = file->getPointer(offset, length);
+        extent.m_file = file;
+        CHECK(extent.m_data != NULL);
+        m_extents.append(extent);
+    }
+
+    /*
+     * Return a pointer to [address, address + length) or NULL if the range
+     * isn't contained in a single extent.
+     */
+    const uint8* getPointer(addressNumericValue address, uint length) const
+    {
+        cList<Extent>::iterator i = m_extents.begin();
+        for (; i != m_extents.end(); ++i)
+        {
+            const Extent& extent = *i;
+            if ((address >= extent.m_offset) &&
+                ((address - extent.m_offset) <= extent.m_length) &&
+                (length <= (extent.m_length - (address - extent.m_offset))))
+            {
+                return extent.m_data + (uint)(address - extent.m_offset);
+            }
+        }
+        return NULL;
+    }
+
+    // See cVirtualMemoryAccesser::memread
+    virtual bool memread(addressNumericValue address,
+                         void* buffer,
+                         uint length,
+                         cFragmentsDescriptor* = NULL) const
+    {
+        const uint8* data = getPointer(address, length);
+        if (data == NULL)
+            return false;
+        cOS::memcpy(buffer, data, length);
+        return true;
+    }
+
+    // The image is read-only
+    virtual bool write(addressNumericValue, const void*, uint)
+    {
+        CHECK_FAIL();
+    }
+
+    virtual bool isWritableInterface() const
+    {
+        return false;
+    }
+
+private:
+    struct Extent {
+        uint m_offset;
+        uint m_length;
+        const uint8* m_data;
+        // Keep the storage of m_data alive: a read buffer or a mapped file
+        cBufferPtr m_buffer;
+        cMappedFileAccesserPtr m_file;
+    };
+    cList<Extent> m_extents;
+};
+
+cPeAsyncReader::cPeAsyncReader(cPeBatchSink& sink,
+                               uint directoriesMask,
+                               uint queueDepth,
+                               uint maxSectionSize) :
+    m_sink(sink),
+    m_directoriesMask(directoriesMask),
+    m_queueDepth(t_max(queueDepth, 1U)),
+    m_maxSectionSize(maxSectionSize),
+    m_numberOfJobs(0),
+    m_nextJob(0),
+    m_activeSlots(0),
+    m_parsed(0),
+    m_failed(0)
+    #ifdef PE_ASYNC_IO_URING
+    ,m_ringFd(-1),
+    m_sqRing(NULL),
+    m_sqRingSize(0),
+    m_cqRing(NULL),
+    m_cqRingSize(0),
+    m_sqes(NULL),
+    m_sqesSize(0),
+    m_unsubmitted(0),
+    m_inFlight(0)
+    #endif
+{
+    #ifdef PE_ASYNC_IO_URING
+    // Each file has at most one read per directory in flight
+    uint entries = 1;
+    while ((entries < m_queueDepth * IMAGE_NUMBEROF_DIRECTORY_ENTRIES) &&
+           (entries < 4096))
+        entries <<= 1;
+    setupRing(entries);
+    #endif
+}
+
+cPeAsyncReader::~cPeAsyncReader()
+{
+    #ifdef PE_ASYNC_IO_URING
+    destroyRing();
+    #endif
+}
+
+bool cPeAsyncReader::addFile(const cString& filename)
+{
+    uint64 size;
+    if (!cPeFileSystem::getFileSize(filename, size))
+        return false;
+
+    // Grow by doubling, the corpus may contain many files
+    if (m_numberOfJobs == m_jobs.getSize())
+        m_jobs.changeSize(t_max(m_numberOfJobs * 2, 64U));
+
+    Job& job = m_jobs[m_numberOfJobs++];
+    job.m_filename = filename;
+    job.m_size = size;
+    return true;
+}
+
+void cPeAsyncReader::addDirectory(const cString& path, bool recursive)
+{
+    cList<cString> files;
+    cPeFileSystem::listFiles(path, recursive, files);
+
+    cList<cString>::iterator i = files.begin();
+    for (; i != files.end(); ++i)
+        addFile(*i);
+}
+
+uint cPeAsyncReader::getNumberOfFiles() const
+{
+    return m_numberOfJobs;
+}
+
+uint cPeAsyncReader::getNumberOfParsedFiles() const
+{
+    return m_parsed;
+}
+
+uint cPeAsyncReader::getNumberOfFailedFiles() const
+{
+    return m_failed;
+}
+
+bool cPeAsyncReader::isAsynchronous() const
+{
+    #ifdef PE_ASYNC_IO_URING
+    return m_ringFd >= 0;
+    #else
+    return false;
+    #endif
+}
+
+void cPeAsyncReader::run()
+{
+    m_parsed = 0;
+    m_failed = 0;
+    if (m_numberOfJobs == 0)
+        return;
+
+    uint numberOfSlots = t_min(m_queueDepth, m_numberOfJobs);
+    m_slots.changeSize(numberOfSlots, false);
+    for (uint i = 0; i < numberOfSlots; i++)
+    {
+        m_slots[i].m_job = m_numberOfJobs;
+        m_slots[i].m_extents = NULL;
+        #ifdef PE_ASYNC_IO_URING
+        m_slots[i].m_fd = -1;
+        #endif
+        m_slots[i].m_reads.changeSize(IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    }
+    m_nextJob = 0;
+    m_activeSlots = 0;
+
+    // Fill the queue and pump the completions
+    for (uint i = 0; i < numberOfSlots; i++)
+        startNextJob(i);
+    while (m_activeSlots > 0)
+        processCompletions();
+
+    m_slots.changeSize(0);
+    m_jobs.changeSize(0);
+    m_numberOfJobs = 0;
+    m_nextJob = 0;
+}
+
+bool cPeAsyncReader::startNextJob(uint index)
+{
+    Slot& slot = m_slots[index];
+    while (m_nextJob < m_numberOfJobs)
+    {
+        uint job = m_nextJob++;
+        const Job& file = m_jobs[job];
+
+        slot.m_job = job;
+        slot.m_stage = STAGE_PROBE;
+        slot.m_issuedReads = 0;
+        slot.m_pendingReads = 0;
+        slot.m_failed = false;
+        #ifdef PE_ASYNC_IO_URING
+        slot.m_fd = -1;
+        #endif
+
+        bool started = false;
+        XSTL_TRY
+        {
+            CHECK(file.m_size >= sizeof(IMAGE_DOS_HEADER));
+            #ifdef PE_ASYNC_IO_URING
+            if (m_ringFd >= 0)
+            {
+                cSArray<char> name;
+                cPeFileSystem::getNativeFilename(file.m_filename, name);
+                slot.m_fd = open(name.getBuffer(), O_RDONLY | O_CLOEXEC);
+                CHECK(slot.m_fd >= 0);
+            } else
+            #endif
+            {
+                slot.m_mapping = cMappedFileAccesserPtr(
+                    new cMappedFileAccesser(file.m_filename));
+            }
+
+            slot.m_extents = new cExtentMemoryAccesser();
+            slot.m_memory = cVirtualMemoryAccesserPtr(slot.m_extents);
+
+            submitRead(index, 0, (uint)t_min(file.m_size,
+                                             (uint64)cPeFile::PROBE_SIZE));
+            started = true;
+        }
+        XSTL_CATCH_ALL
+        {
+        }
+
+        if (started)
+        {
+            m_activeSlots++;
+            return true;
+        }
+
+        // The file cannot be opened
+        m_failed++;
+        m_sink.onError(file.m_filename, file.m_size);
+        releaseSlot(slot);
+    }
+
+    return false;
+}
+
+void cPeAsyncReader::releaseSlot(Slot& slot)
+{
+    slot.m_job = m_numberOfJobs;
+    slot.m_header = cNtHeaderPtr();
+    slot.m_memory = cVirtualMemoryAccesserPtr();
+    slot.m_extents = NULL;
+    slot.m_mapping = cMappedFileAccesserPtr();
+    #ifdef PE_ASYNC_IO_URING
+    if (slot.m_fd >= 0)
+        close(slot.m_fd);
+    slot.m_fd = -1;
+    #endif
+}
+
+void cPeAsyncReader::submitRead(uint index, uint offset, uint length)
+{
+    Slot& slot = m_slots[index];
+    CHECK(slot.m_issuedReads < slot.m_reads.getSize());
+    uint readIndex = slot.m_issuedReads++;
+    Read& read = slot.m_reads[readIndex];
+    read.m_buffer = cBufferPtr();
+    read.m_offset = offset;
+    read.m_length = length;
+    read.m_done = 0;
+    #ifdef PE_ASYNC_IO_URING
+    if (m_ringFd >= 0)
+        read.m_buffer = cBufferPtr(new cBuffer(length));
+    #endif
+
+    slot.m_pendingReads++;
+    issueRead(index, readIndex);
+}
+
+void cPeAsyncReader::issueRead(uint index, uint readIndex)
+{
+    Slot& slot = m_slots[index];
+    Read& read = slot.m_reads[readIndex];
+
+    #ifdef PE_ASYNC_IO_URING
+    if (m_ringFd >= 0)
+    {
+        uint32 tail = *m_sqTail;
+        if ((tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) >=
+            *m_sqEntries)
+        {
+            // The submission ring is full, pass it to the kernel
+            int ret = (int)syscall(__NR_io_uring_enter, m_ringFd,
+                                   m_unsubmitted, 0, 0, NULL, 0);
+            CHECK(ret >= 0);
+            m_unsubmitted -= ret;
+            CHECK((tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) <
+                  *m_sqEntries);
+        }
+
+        uint32 position = tail & *m_sqMask;
+        struct io_uring_sqe* sqe =
+            ((struct io_uring_sqe*)m_sqes) + position;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot.m_fd;
+        sqe->off = read.m_offset + read.m_done;
+        sqe->addr = (uint64)(read.m_buffer->getBuffer() + read.m_done);
+        sqe->len = read.m_length - read.m_done;
+        sqe->user_data = ((uint64)index << 32) | readIndex;
+        m_sqArray[position] = position;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        m_unsubmitted++;
+        m_inFlight++;
+        return;
+    }
+    #endif
+
+    // Synchronous fallback. The mapped file is handed out as-is, without a
+    // copy. The completion is delivered from the pump, as the asynchronous
+    // completions are
+    Completion completion;
+    completion.m_slot = index;
+    completion.m_read = readIndex;
+    completion.m_result = -1;
+    if (slot.m_mapping->getPointer(read.m_offset, read.m_length) != NULL)
+    {
+        slot.m_extents->addView(read.m_offset, read.m_length, slot.m_mapping);
+        completion.m_result = (int)read.m_length;
+    }
+    m_completions.append(completion);
+}
+
+void cPeAsyncReader::processCompletions()
+{
+    #ifdef PE_ASYNC_IO_URING
+    if (m_ringFd >= 0)
+    {
+        if ((m_unsubmitted > 0) ||
+            (*m_cqHead == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)))
+        {
+            CHECK(m_inFlight > 0);
+            int ret = (int)syscall(__NR_io_uring_enter, m_ringFd,
+                                   m_unsubmitted, 1,
+                                   IORING_ENTER_GETEVENTS, NULL, 0);
+            if (ret < 0)
+            {
+                CHECK(errno == EINTR);
+                return;
+            }
+            m_unsubmitted -= ret;
+        }
+
+        uint32 head = *m_cqHead;
+        while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe& cqe =
+                ((const struct io_uring_cqe*)m_cqes)[head & *m_cqMask];
+            uint64 userData = cqe.user_data;
+            int result = cqe.res;
+            head++;
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+            m_inFlight--;
+
+            onReadComplete((uint)(userData >> 32), (uint)userData, result);
+            head = *m_cqHead;
+        }
+        return;
+    }
+    #endif
+
+    // The completions may queue new ones
+    while (!m_completions.isEmpty())
+    {
+        cList<Completion>::iterator i = m_completions.begin();
+        Completion completion = *i;
+        m_completions.remove(i);
+        onReadComplete(completion.m_slot, completion.m_read,
+                       completion.m_result);
+    }
+}
+
+void cPeAsyncReader::onReadComplete(uint index, uint readIndex, int result)
+{
+    Slot& slot = m_slots[index];
+    Read& read = slot.m_reads[readIndex];
+
+    // The reads never pass the end of the file, so only an error or an empty
+    // read (the file was truncated meanwhile) stops a partial one
+    if (result > 0)
+    {
+        read.m_done += t_min((uint)result, read.m_length - read.m_done);
+        if (read.m_done < read.m_length)
+        {
+            XSTL_TRY
+            {
+                issueRead(index, readIndex);
+                return;
+            }
+            XSTL_CATCH_ALL
+            {
+            }
+        }
+    }
+    slot.m_pendingReads--;
+
+    if (read.m_done == read.m_length)
+    {
+        // The fallback views were already added
+        if (!read.m_buffer.isEmpty())
+            slot.m_extents->addExtent(read.m_offset, read.m_buffer);
+    } else if (slot.m_stage != STAGE_SECTIONS)
+    {
+        // Without the headers there is nothing to parse. A missing section
+        // only fails the directories inside it.
+        slot.m_failed = true;
+    }
+    read.m_buffer = cBufferPtr();
+
+    if (slot.m_pendingReads == 0)
+        advance(index);
+}
+
+void cPeAsyncReader::advance(uint index)
+{
+    Slot& slot = m_slots[index];
+    if (!slot.m_failed)
+    {
+        XSTL_TRY
+        {
+            slot.m_issuedReads = 0;
+            switch (slot.m_stage)
+            {
+            case STAGE_PROBE:   onProbeComplete(index); break;
+            case STAGE_HEADERS: onHeadersComplete(index); break;
+            default: break;
+            }
+        }
+        XSTL_CATCH_ALL
+        {
+            slot.m_failed = true;
+        }
+    }
+
+    // The chain is over once a stage didn't issue any read
+    if (slot.m_pendingReads == 0)
+        finish(index);
+}
+
+void cPeAsyncReader::onProbeComplete(uint index)
+{
+    Slot& slot = m_slots[index];
+    const Job& file = m_jobs[slot.m_job];
+    uint length = (uint)t_min(file.m_size, (uint64)cPeFile::PROBE_SIZE);
+
+    cPeFile::ProbeInfo info;
+    CHECK(cPeFile::probe(slot.m_extents->getPointer(0, length), length, info));
+
+    // The NT header (the largest one) and the section table
+    uint headersEnd = t_max(
+        info.m_sectionTableOffset +
+            info.m_numberOfSections * (uint)sizeof(IMAGE_SECTION_HEADER),
+        info.m_ntHeaderOffset + (uint)sizeof(IMAGE_NT_HEADERS64));
+    headersEnd = (uint)t_min((uint64)headersEnd, file.m_size);
+    CHECK(headersEnd <= MAX_HEADERS_SIZE);
+
+    slot.m_stage = STAGE_HEADERS;
+    if (headersEnd > length)
+        submitRead(index, 0, headersEnd);
+    else
+        onHeadersComplete(index);
+}
+
+void cPeAsyncReader::onHeadersComplete(uint index)
+{
+    Slot& slot = m_slots[index];
+    const Job& file = m_jobs[slot.m_job];
+    uint fileSize = (uint)t_min(file.m_size, (uint64)0xFFFFFFFF);
+
+    // Parse the NT header over the sparse image. The sections are forked over
+    // their raw regions, and become readable once their extent is read.
+    cMemoryAccesserStream stream(slot.m_memory, 0, fileSize);
+    IMAGE_DOS_HEADER dosHeader;
+    stream.pipeRead(&dosHeader, sizeof(dosHeader));
+    CHECK(dosHeader.e_magic == IMAGE_DOS_SIGNATURE);
+    stream.seek(dosHeader.e_lfanew, basicInput::IO_SEEK_SET);
+    slot.m_header = cNtHeaderPtr(new cNtHeader(stream, 0, true, false));
+    const cNtHeader& header = *slot.m_header;
+
+    // Read the sections which hold the requested directories
+    slot.m_stage = STAGE_SECTIONS;
+    uint count = t_min((uint)header.OptionalHeader.NumberOfRvaAndSizes,
+                       (uint)IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    for (uint i = 0; i < count; i++)
+    {
+        const IMAGE_DATA_DIRECTORY& directory =
+            header.OptionalHeader.DataDirectory[i];
+        if (((m_directoriesMask & (1 << i)) == 0) ||
+            (directory.VirtualAddress == 0) || (directory.Size == 0))
+            continue;
+
+        uint offset;
+        uint size;
+        uint headersSize = t_min((uint)header.OptionalHeader.SizeOfHeaders,
+                                 fileSize);
+        if (i == IMAGE_DIRECTORY_ENTRY_SECURITY)
+        {
+            // The certificate table is pointed by a file offset, not an RVA
+            offset = directory.VirtualAddress;
+            if (offset >= fileSize)
+                continue;
+            size = t_min((uint)directory.Size, fileSize - offset);
+            if (size > m_maxSectionSize)
+                continue;
+        } else if (directory.VirtualAddress < headersSize)
+        {
+            // Some directories (e.g. the bound imports) live in the header
+            // region, which is mapped as-is
+            offset = 0;
+            size = headersSize;
+            if ((size > MAX_HEADERS_SIZE) ||
+                (slot.m_extents->getPointer(offset, size) != NULL))
+                continue;
+        } else
+        {
+            const cNtSectionHeader* section =
+                header.sectionForRva(directory.VirtualAddress);
+            if ((section == NULL) || (section->PointerToRawData >= fileSize))
+                continue;
+
+            offset = section->PointerToRawData;
+            size = t_min((uint)section->SizeOfRawData, fileSize - offset);
+            if ((size == 0) || (size > m_maxSectionSize))
+                continue;
+        }
+
+        // Several directories usually share a section
+        bool isRead = false;
+        for (uint j = 0; j < slot.m_issuedReads; j++)
+            if (slot.m_reads[j].m_offset == offset)
+                isRead = true;
+        if (!isRead)
+            submitRead(index, offset, size);
+    }
+}
+
+void cPeAsyncReader::finish(uint index)
+{
+    Slot& slot = m_slots[index];
+    const Job& file = m_jobs[slot.m_job];
+    bool parsed = false;
+
+    if ((!slot.m_failed) && (!slot.m_header.isEmpty()))
+    {
+        XSTL_TRY
+        {
+            const cNtHeader& header = *slot.m_header;
+
+            // Let the memory translation access the extents directly
+            slot.m_header->setDirectHeaders(slot.m_extents->getPointer(0,
+                header.OptionalHeader.SizeOfHeaders));
+            cList<cSectionPtr> sections;
+            header.getSections(sections);
+            cList<cSectionPtr>::iterator i = sections.begin();
+            for (; i != sections.end(); ++i)
+            {
+                cNtSectionHeader* section =
+                    (cNtSectionHeader*)((*i).getPointer());
+                const uint8* content = slot.m_extents->getPointer(
+                    section->PointerToRawData, section->SizeOfRawData);
+                if (content != NULL)
+                    section->setDirectContent(content);
+            }
+
+            // The certificate table, which isn't part of any section
+            if (header.OptionalHeader.NumberOfRvaAndSizes >
+                IMAGE_DIRECTORY_ENTRY_SECURITY)
+            {
+                const IMAGE_DATA_DIRECTORY& security = header.OptionalHeader.
+                    DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
+                slot.m_header->setDirectFile(
+                    slot.m_extents->getPointer(security.VirtualAddress,
+                                               security.Size),
+                    security.VirtualAddress,
+                    security.Size);
+            }
+
+            cNtDirectoryPtr directories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+            for (uint j = 0; j < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; j++)
+            {
+                if ((m_directoriesMask & (1 << j)) == 0)
+                    continue;
+
+                cNtDirectoryPtr directory =
+                    cPeBatchScanner::createDirectory(j);
+                if (directory.isEmpty())
+                    continue;
+
+                // A broken (or unread) directory doesn't fail the whole file
+                XSTL_TRY
+                {
+                    directory->readDirectory(header, j);
+                    directories[j] = directory;
+                }
+                XSTL_CATCH_ALL
+                {
+                }
+            }
+
+            parsed = true;
+            m_sink.onFile(file.m_filename, file.m_size, header, directories);
+        }
+        XSTL_CATCH_ALL
+        {
+            TRACE(TRACE_LOW,
+                  XSTL_STRING("cPeAsyncReader: Cannot parse file\n"));
+        }
+    }
+
+    if (parsed)
+    {
+        m_parsed++;
+    } else
+    {
+        m_failed++;
+        m_sink.onError(file.m_filename, file.m_size);
+    }
+
+    releaseSlot(slot);
+    m_activeSlots--;
+
+    startNextJob(index);
+}
+
+#ifdef PE_ASYNC_IO_URING
+bool cPeAsyncReader::setupRing(uint entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+    {
+        TRACE(TRACE_LOW, XSTL_STRING("cPeAsyncReader: io_uring isn't "
+                                     "available, using mapped files\n"));
+        return false;
+    }
+
+    // IORING_OP_READ and non-dropping completions (Linux 5.6)
+    if (((params.features & IORING_FEAT_NODROP) == 0) ||
+        ((params.features & IORING_FEAT_RW_CUR_POS) == 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+    m_cqRingSize = params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe);
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    m_sqes = mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    m_ringFd = fd;
+    if ((m_sqRing == MAP_FAILED) || (m_cqRing == MAP_FAILED) ||
+        (m_sqes == MAP_FAILED))
+    {
+        destroyRing();
+        return false;
+    }
+
+    uint8* sq = (uint8*)m_sqRing;
+    m_sqHead    = (uint32*)(sq + params.sq_off.head);
+    m_sqTail    = (uint32*)(sq + params.sq_off.tail);
+    m_sqMask    = (uint32*)(sq + params.sq_off.ring_mask);
+    m_sqEntries = (uint32*)(sq + params.sq_off.ring_entries);
+    m_sqArray   = (uint32*)(sq + params.sq_off.array);
+    uint8* cq = (uint8*)m_cqRing;
+    m_cqHead    = (uint32*)(cq + params.cq_off.head);
+    m_cqTail    = (uint32*)(cq + params.cq_off.tail);
+    m_cqMask    = (uint32*)(cq + params.cq_off.ring_mask);
+    m_cqes      = cq + params.cq_off.cqes;
+    return true;
+}
+
+void cPeAsyncReader::destroyRing()
+{
+    if ((m_sqes != NULL) && (m_sqes != MAP_FAILED))
+        munmap(m_sqes, m_sqesSize);
+    if ((m_cqRing != NULL) && (m_cqRing != MAP_FAILED))
+        munmap(m_cqRing, m_cqRingSize);
+    if ((m_sqRing != NULL) && (m_sqRing != MAP_FAILED))
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_ringFd >= 0)
+        close(m_ringFd);
+    m_sqes = NULL;
+    m_cqRing = NULL;
+    m_sqRing = NULL;
+    m_ringFd = -1;
+}
+#endif // PE_ASYNC_IO_URING
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peAuthenticode.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/enc/digest.h"
+#include "xStl/stream/basicIO.h"
+#include "xStl/stream/forkStream.h"
+#include "pe/datastruct.h"
+#include "pe/peTraits.h"
+#include "pe/ntheader.h"
+#include "pe/peAuthenticode.h"
+
+void cPeAuthenticode::hashImage(const cNtHeader& header,
+                                cDigest& digest,
+                                uint bufferSize)
+{
+    cForkStreamPtr file = header.getFileStream();
+    CHECK_MSG(!file.isEmpty(), "The raw file isn't available");
+    uint fileSize = file->length();
+
+    const uint8* image = header.getDirectFilePointer(0, fileSize);
+    if (image == NULL)
+    {
+        hashImage(header, *file, digest, bufferSize);
+        return;
+    }
+
+    // Hash the file in place
+    CHECK(fileSize >= sizeof(IMAGE_DOS_HEADER));
+    IMAGE_DOS_HEADER dosHeader;
+    cOS::memcpy(&dosHeader, image, sizeof(dosHeader));
+    Range ranges[MAX_EXCLUDED_RANGES];
+    uint count = getExcludedRanges(header,
+                                   getNtHeaderOffset(dosHeader, fileSize),
+                                   fileSize,
+                                   ranges);
+
+    uint position = 0;
+    for (uint i = 0; i < count; i++)
+    {
+        if (ranges[i].m_start > position)
+            digest.update(image + position, ranges[i].m_start - position);
+        position = t_max(position, ranges[i].m_end);
+    }
+    if (position < fileSize)
+        digest.update(image + position, fileSize - position);
+}
+
+void cPeAuthenticode::hashImage(const cNtHeader& header,
+                                basicInput& file,
+                                cDigest& digest,
+                                uint bufferSize)
+{
+    CHECK(bufferSize > 0);
+    uint fileSize = file.length();
+
+    // Locate the NT header. The DOS header is read again by the first chunk
+    CHECK(fileSize >= sizeof(IMAGE_DOS_HEADER));
+    IMAGE_DOS_HEADER dosHeader;
+    file.seek(0, basicInput::IO_SEEK_SET);
+    file.pipeRead(&dosHeader, sizeof(dosHeader));
+    Range ranges[MAX_EXCLUDED_RANGES];
+    uint count = getExcludedRanges(header,
+                                   getNtHeaderOffset(dosHeader, fileSize),
+                                   fileSize,
+                                   ranges);
+
+    // A single pass over the file. The stream is seeked only over the
+    // excluded ranges
+    cBuffer buffer(bufferSize);
+    file.seek(0, basicInput::IO_SEEK_SET);
+    uint position = 0;
+    for (uint i = 0; i < count; i++)
+    {
+        if (ranges[i].m_start > position)
+            hashStream(file, position, ranges[i].m_start, buffer, digest);
+        position = t_max(position, ranges[i].m_end);
+    }
+    if (position < fileSize)
+        hashStream(file, position, fileSize, buffer, digest);
+}
+
+void cPeAuthenticode::hashStream(basicInput& file,
+                                 uint start,
+                                 uint end,
+                                 cBuffer& buffer,
+                                 cDigest& digest)
+{
+    if (file.getPointer() != start)
+        file.seek(start, basicInput::IO_SEEK_SET);
+
+    uint length = end - start;
+    while (length > 0)
+    {
+        uint chunk = t_min(length, buffer.getSize());
+        file.pipeRead(buffer.getBuffer(), chunk);
+        digest.update(buffer.getBuffer(), chunk);
+        length-= chunk;
+    }
+}
+
+uint cPeAuthenticode::getExcludedRanges(const cNtHeader& header,
+                                        uint ntHeaderOffset,
+                                        uint fileSize,
+                                        Range* ranges)
+{
+    uint count = 0;
+    Range securityEntry;
+    if (header.is64bit())
+        getHeaderFields<cPe64Traits>(ntHeaderOffset, ranges[count++],
+                                     securityEntry);
+    else
+        getHeaderFields<cPe32Traits>(ntHeaderOffset, ranges[count++],
+                                     securityEntry);
+
+    // Images with a short data directory don't have a security entry
+    if (header.OptionalHeader.NumberOfRvaAndSizes >
+        IMAGE_DIRECTORY_ENTRY_SECURITY)
+    {
+        ranges[count++] = securityEntry;
+
+        // The certificate table is pointed by a file offset
+        const IMAGE_DATA_DIRECTORY& security =
+            header.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
+        if ((security.VirtualAddress != 0) && (security.Size != 0) &&
+            (security.VirtualAddress < fileSize))
+        {
+            ranges[count].m_start = security.VirtualAddress;
+            ranges[count].m_end = security.VirtualAddress +
+                t_min((uint)security.Size, fileSize - security.VirtualAddress);
+            count++;
+        }
+    }
+
+    // Clip the ranges into the file and sort them
+    for (uint i = 0; i < count; i++)
+    {
+        ranges[i].m_start = t_min(ranges[i].m_start, fileSize);
+        ranges[i].m_end = t_min(ranges[i].m_end, fileSize);
+        for (uint j = i; (j > 0) && (ranges[j].m_start < ranges[j - 1].m_start);
+             j--)
+        {
+            Range temp = ranges[j];
+            ranges[j] = ranges[j - 1];
+            ranges[j - 1] = temp;
+        }
+    }
+    return count;
+}
+
+template <class Traits>
+void cPeAuthenticode::getHeaderFields(uint ntHeaderOffset,
+                                      Range& checkSum,
+                                      Range& securityEntry)
+{
+    // The location of the fields inside the optional header
+    typename Traits::NtHeaders layout;
+    const uint8* base = (const uint8*)&layout;
+    uint checkSumOffset = (uint)((const uint8*)
+        &layout.OptionalHeader.CheckSum - base);
+    uint securityOffset = (uint)((const uint8*)
+        &layout.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY] -
+        base);
+
+    checkSum.m_start = ntHeaderOffset + checkSumOffset;
+    checkSum.m_end = checkSum.m_start + sizeof(layout.OptionalHeader.CheckSum);
+    securityEntry.m_start = ntHeaderOffset + securityOffset;
+    securityEntry.m_end = securityEntry.m_start + sizeof(IMAGE_DATA_DIRECTORY);
+}
+
+uint cPeAuthenticode::getNtHeaderOffset(const IMAGE_DOS_HEADER& dosHeader,
+                                        uint fileSize)
+{
+    CHECK(dosHeader.e_magic == IMAGE_DOS_SIGNATURE);
+    uint offset = (uint)dosHeader.e_lfanew;
+    CHECK(offset < fileSize);
+    return offset;
+}
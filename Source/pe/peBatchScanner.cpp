@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peBatchScanner.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/data/string.h"
+#include "xStl/except/exception.h"
+#include "xStl/except/trace.h"
+#include "xStl/os/lock.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntdir.h"
+#include "pe/ntDirExport.h"
+#include "pe/ntDirImport.h"
+#include "pe/ntDirDelayImport.h"
+#include "pe/ntDirBoundImport.h"
+#include "pe/ntDirDebug.h"
+#include "pe/ntDirLoadConfig.h"
+#include "pe/ntDirException.h"
+#include "pe/ntDirSecurity.h"
+#include "pe/ntDirResource.h"
+#include "pe/ntDirTls.h"
+#include "pe/ntDirReloc.h"
+#include "pe/ntDirCli.h"
+#include "pe/peArena.h"
+#include "pe/peFileSystem.h"
+#include "pe/peBatchScanner.h"
+
+#ifndef _KERNEL
+#ifdef XSTL_WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+bool cPeBatchSink::isConcurrent() const
+{
+    return false;
+}
+
+void cPeBatchSink::onError(const cString&, uint64)
+{
+}
+
+cPeBatchScanner::cPeBatchScanner(cPeBatchSink& sink,
+                                 uint directoriesMask,
+                                 uint numberOfThreads) :
+    m_sink(sink),
+    m_directoriesMask(directoriesMask),
+    m_numberOfThreads(numberOfThreads),
+    m_numberOfJobs(0),
+    m_workers(NULL),
+    m_numberOfWorkers(0),
+    m_parsed(0),
+    m_failed(0)
+{
+}
+
+cPeBatchScanner::~cPeBatchScanner()
+{
+    delete[] m_workers;
+}
+
+bool cPeBatchScanner::addFile(const cString& filename)
+{
+    uint64 size;
+    if (!cPeFileSystem::getFileSize(filename, size))
+        return false;
+
+    // Grow by doubling, the corpus may contain many files
+    if (m_numberOfJobs == m_jobs.getSize())
+        m_jobs.changeSize(t_max(m_numberOfJobs * 2, 64U));
+
+    Job& job = m_jobs[m_numberOfJobs++];
+    job.m_filename = filename;
+    job.m_size = size;
+    return true;
+}
+
+void cPeBatchScanner::addDirectory(const cString& path, bool recursive)
+{
+    cList<cString> files;
+    cPeFileSystem::listFiles(path, recursive, files);
+
+    cList<cString>::iterator i = files.begin();
+    for (; i != files.end(); ++i)
+        addFile(*i);
+}
+
+uint cPeBatchScanner::getNumberOfFiles() const
+{
+    return m_numberOfJobs;
+}
+
+uint cPeBatchScanner::getNumberOfParsedFiles() const
+{
+    return m_parsed;
+}
+
+uint cPeBatchScanner::getNumberOfFailedFiles() const
+{
+    return m_failed;
+}
+
+cNtDirectoryPtr cPeBatchScanner::createDirectory(uint directoryIndex)
+{
+    switch (directoryIndex)
+    {
+    case IMAGE_DIRECTORY_ENTRY_EXPORT:
+        return cNtDirectoryPtr(new cNtDirExport());
+    case IMAGE_DIRECTORY_ENTRY_IMPORT:
+        return cNtDirectoryPtr(new cNtDirImport());
+    case IMAGE_DIRECTORY_ENTRY_RESOURCE:
+        return cNtDirectoryPtr(new cNtDirResource());
+    case IMAGE_DIRECTORY_ENTRY_SECURITY:
+        return cNtDirectoryPtr(new cNtDirSecurity());
+    case IMAGE_DIRECTORY_ENTRY_EXCEPTION:
+        return cNtDirectoryPtr(new cNtDirException());
+    case IMAGE_DIRECTORY_ENTRY_BASERELOC:
+        return cNtDirectoryPtr(new cNtDirReloc());
+    case IMAGE_DIRECTORY_ENTRY_DEBUG:
+        return cNtDirectoryPtr(new cNtDirDebug());
+    case IMAGE_DIRECTORY_ENTRY_TLS:
+        return cNtDirectoryPtr(new cNtDirTls());
+    case IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG:
+        return cNtDirectoryPtr(new cNtDirLoadConfig());
+    case IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT:
+        return cNtDirectoryPtr(new cNtDirBoundImport());
+    case IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT:
+        return cNtDirectoryPtr(new cNtDirDelayImport());
+    case IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR:
+        return cNtDirectoryPtr(new cNtDirCli());
+    default:
+        return cNtDirectoryPtr();
+    }
+}
+
+uint cPeBatchScanner::getNumberOfProcessors()
+{
+    #ifdef _KERNEL
+    return 1;
+    #elif defined(XSTL_WINDOWS)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return t_max((uint)info.dwNumberOfProcessors, 1U);
+    #else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (uint)count : 1;
+    #endif
+}
+
+/*
+ * Restore the heap property below 'root'. The heap is a min-heap over the
+ * file sizes, so the sort below yields the largest files first.
+ */
+static void siftDown(const cArray<uint64>& sizes,
+                     cArray<uint>& order,
+                     uint root,
+                     uint count)
+{
+    while (true)
+    {
+        uint child = root * 2 + 1;
+        if (child >= count)
+            return;
+        if ((child + 1 < count) &&
+            (sizes[order[child + 1]] < sizes[order[child]]))
+            child++;
+        if (sizes[order[root]] <= sizes[order[child]])
+            return;
+        uint temp = order[root];
+        order[root] = order[child];
+        order[child] = temp;
+        root = child;
+    }
+}
+
+void cPeBatchScanner::scheduleJobs(uint numberOfWorkers)
+{
+    // Sort the jobs indexes by their size, largest first (heap-sort, so no
+    // strings are copied)
+    cArray<uint64> sizes(m_numberOfJobs);
+    cArray<uint> order(m_numberOfJobs);
+    uint i;
+    for (i = 0; i < m_numberOfJobs; i++)
+    {
+        sizes[i] = m_jobs[i].m_size;
+        order[i] = i;
+    }
+    for (i = m_numberOfJobs / 2; i > 0; i--)
+        siftDown(sizes, order, i - 1, m_numberOfJobs);
+    for (i = m_numberOfJobs; i > 1; i--)
+    {
+        uint temp = order[0];
+        order[0] = order[i - 1];
+        order[i - 1] = temp;
+        siftDown(sizes, order, 0, i - 1);
+    }
+
+    // Deal the jobs round-robin, so each queue is sorted as well and all the
+    // workers start with a large file
+    for (i = 0; i < numberOfWorkers; i++)
+    {
+        Worker& worker = m_workers[i];
+        worker.m_scanner = this;
+        worker.m_index = i;
+        worker.m_queue.changeSize(
+            (m_numberOfJobs / numberOfWorkers) +
+            ((i < (m_numberOfJobs % numberOfWorkers)) ? 1 : 0), false);
+        worker.m_next = 0;
+        worker.m_parsed = 0;
+        worker.m_failed = 0;
+    }
+    for (i = 0; i < m_numberOfJobs; i++)
+        m_workers[i % numberOfWorkers].m_queue[i / numberOfWorkers] = order[i];
+}
+
+bool cPeBatchScanner::popJob(Worker& worker, uint& job)
+{
+    cLock lock(worker.m_lock);
+    if (worker.m_next >= worker.m_queue.getSize())
+        return false;
+    job = worker.m_queue[worker.m_next++];
+    return true;
+}
+
+bool cPeBatchScanner::peekJobSize(Worker& worker, uint64& size) const
+{
+    cLock lock(worker.m_lock);
+    if (worker.m_next >= worker.m_queue.getSize())
+        return false;
+    size = m_jobs[worker.m_queue[worker.m_next]].m_size;
+    return true;
+}
+
+void cPeBatchScanner::workerLoop(Worker& worker)
+{
+    uint job;
+    while (true)
+    {
+        if (popJob(worker, job))
+        {
+            processJob(worker, job);
+            continue;
+        }
+
+        // The own queue is empty, steal the largest pending job from the
+        // others: the queues are sorted, so it's the largest of their heads.
+        // Since no jobs are added during the run, an empty round means that
+        // the scan is over.
+        bool found = false;
+        while (!found)
+        {
+            Worker* victim = NULL;
+            uint64 largest = 0;
+            for (uint i = 1; i < m_numberOfWorkers; i++)
+            {
+                Worker& other =
+                    m_workers[(worker.m_index + i) % m_numberOfWorkers];
+                uint64 size;
+                if (peekJobSize(other, size) &&
+                    ((victim == NULL) || (size > largest)))
+                {
+                    victim = &other;
+                    largest = size;
+                }
+            }
+            if (victim == NULL)
+                return;
+
+            // The head may have been taken meanwhile, then look again
+            found = popJob(*victim, job);
+        }
+        processJob(worker, job);
+    }
+}
+
+void cPeBatchScanner::processJob(Worker& worker, uint job)
+{
+    const Job& file = m_jobs[job];
+    bool parsed = false;
+
+    XSTL_TRY
+    {
+        {
+            cNtHeader header(file.m_filename, 0, true, &worker.m_arena);
+
+            cNtDirectoryPtr directories[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+            for (uint i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; i++)
+            {
+                if ((m_directoriesMask & (1 << i)) == 0)
+                    continue;
+
+                cNtDirectoryPtr directory = createDirectory(i);
+                if (directory.isEmpty())
+                    continue;
+
+                // A broken directory doesn't fail the whole file
+                XSTL_TRY
+                {
+                    directory->readDirectory(header, i);
+                    directories[i] = directory;
+                }
+                XSTL_CATCH_ALL
+                {
+                }
+            }
+
+            parsed = true;
+            if (m_sink.isConcurrent())
+            {
+                m_sink.onFile(file.m_filename, file.m_size, header, directories);
+            } else
+            {
+                cLock lock(m_sinkLock);
+                m_sink.onFile(file.m_filename, file.m_size, header, directories);
+            }
+        }
+
+        // The header and its sections are gone by now
+        worker.m_arena.reset();
+    }
+    XSTL_CATCH_ALL
+    {
+        TRACE(TRACE_LOW, XSTL_STRING("cPeBatchScanner: Cannot parse file\n"));
+        worker.m_arena.reset();
+    }
+
+    if (parsed)
+    {
+        worker.m_parsed++;
+        return;
+    }
+
+    worker.m_failed++;
+    if (m_sink.isConcurrent())
+    {
+        m_sink.onError(file.m_filename, file.m_size);
+    } else
+    {
+        cLock lock(m_sinkLock);
+        m_sink.onError(file.m_filename, file.m_size);
+    }
+}
+
+#ifdef XSTL_WINDOWS
+unsigned long __stdcall cPeBatchScanner::threadMain(void* parameter)
+{
+    Worker* worker = (Worker*)parameter;
+    worker->m_scanner->workerLoop(*worker);
+    return 0;
+}
+#else
+void* cPeBatchScanner::threadMain(void* parameter)
+{
+    Worker* worker = (Worker*)parameter;
+    worker->m_scanner->workerLoop(*worker);
+    return NULL;
+}
+#endif
+
+void cPeBatchScanner::run()
+{
+    m_parsed = 0;
+    m_failed = 0;
+    if (m_numberOfJobs == 0)
+        return;
+
+    uint numberOfWorkers = m_numberOfThreads;
+    if (numberOfWorkers == 0)
+        numberOfWorkers = getNumberOfProcessors();
+    #ifdef _KERNEL
+    // No worker threads in kernel mode, scan on the calling thread
+    numberOfWorkers = 1;
+    #endif
+    numberOfWorkers = t_min(numberOfWorkers, m_numberOfJobs);
+
+    delete[] m_workers;
+    m_workers = new Worker[numberOfWorkers];
+    m_numberOfWorkers = numberOfWorkers;
+    scheduleJobs(numberOfWorkers);
+
+    // The calling thread serves as the first worker
+    uint started = 1;
+    #ifndef _KERNEL
+    #ifdef XSTL_WINDOWS
+    cArray<HANDLE> threads(numberOfWorkers);
+    for (; started < numberOfWorkers; started++)
+    {
+        threads[started] = CreateThread(NULL, 0, threadMain,
+                                        &m_workers[started], 0, NULL);
+        if (threads[started] == NULL)
+            break;
+    }
+    #else
+    cArray<pthread_t> threads(numberOfWorkers);
+    for (; started < numberOfWorkers; started++)
+    {
+        if (pthread_create(&threads[started], NULL, threadMain,
+                           &m_workers[started]) != 0)
+            break;
+    }
+    #endif
+    #endif
+
+    // Workers which couldn't be created are drained by stealing
+    workerLoop(m_workers[0]);
+
+    #ifndef _KERNEL
+    for (uint i = 1; i < started; i++)
+    {
+        #ifdef XSTL_WINDOWS
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+        #else
+        pthread_join(threads[i], NULL);
+        #endif
+    }
+    #endif
+
+    for (uint i = 0; i < numberOfWorkers; i++)
+    {
+        m_parsed += m_workers[i].m_parsed;
+        m_failed += m_workers[i].m_failed;
+    }
+
+    // All the jobs are consumed
+    delete[] m_workers;
+    m_workers = NULL;
+    m_numberOfWorkers = 0;
+    m_jobs.changeSize(0);
+    m_numberOfJobs = 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peChecksum.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "pe/peChecksum.h"
+
+// The vector implementations. The kernel build doesn't touch the vector
+// registers. AVX2 is used when the compiler targets it, or (with GCC/clang)
+// when the CPU supports it at runtime
+#if !defined(_KERNEL) && (defined(__x86_64__) || defined(__i386__) || \
+                          defined(_M_X64) || defined(_M_IX86))
+    #if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+        #define PE_CHECKSUM_SSE2
+        #include <emmintrin.h>
+    #endif
+    #if defined(__AVX2__)
+        #define PE_CHECKSUM_AVX2
+        #define PE_CHECKSUM_AVX2_FUNCTION
+        #include <immintrin.h>
+    #elif defined(__GNUC__)
+        #define PE_CHECKSUM_AVX2
+        #define PE_CHECKSUM_AVX2_FUNCTION __attribute__((target("avx2")))
+        #include <immintrin.h>
+    #endif
+#endif
+
+// The modulo of the one's-complement sum
+#define CHECKSUM_MODULO (0xFFFF)
+
+#ifdef PE_CHECKSUM_SSE2
+/*
+ * Sum the dwords of a buffer whose length is a multiple of 16 bytes
+ */
+static uint64 sumDwordsSse2(const uint8* buffer, uint length)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i low = zero;
+    __m128i high = zero;
+    for (uint i = 0; i < length; i+= 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buffer + i));
+        low = _mm_add_epi64(low, _mm_unpacklo_epi32(data, zero));
+        high = _mm_add_epi64(high, _mm_unpackhi_epi32(data, zero));
+    }
+
+    uint64 lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(low, high));
+    return lanes[0] + lanes[1];
+}
+#endif // PE_CHECKSUM_SSE2
+
+#ifdef PE_CHECKSUM_AVX2
+/*
+ * Sum the dwords of a buffer whose length is a multiple of 32 bytes
+ */
+PE_CHECKSUM_AVX2_FUNCTION
+static uint64 sumDwordsAvx2(const uint8* buffer, uint length)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i low = zero;
+    __m256i high = zero;
+    for (uint i = 0; i < length; i+= 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(buffer + i));
+        low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(data, zero));
+        high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(data, zero));
+    }
+
+    uint64 lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low, high));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/*
+ * Returns true if the AVX2 implementation can be used
+ */
+static bool isAvx2Supported()
+{
+    #ifdef __AVX2__
+    return true;
+    #else
+    static const bool isSupported = (__builtin_cpu_supports("avx2") != 0);
+    return isSupported;
+    #endif
+}
+#endif // PE_CHECKSUM_AVX2
+
+cPeChecksum::cPeChecksum() :
+    m_sum(0),
+    m_isNonZero(false),
+    m_length(0)
+{
+}
+
+uint64 cPeChecksum::sumWords(const uint8* buffer, uint length)
+{
+    // Each dword is congruent to the sum of its two words, since
+    // 0x10000 = 1 (modulo 0xFFFF). So the dwords are summed instead
+    uint64 sum = 0;
+    uint i = 0;
+    #ifdef PE_CHECKSUM_AVX2
+    if (isAvx2Supported())
+    {
+        i = length - (length % 32);
+        sum+= sumDwordsAvx2(buffer, i);
+    }
+    #endif
+    #ifdef PE_CHECKSUM_SSE2
+    uint vectorLength = (length - i) - ((length - i) % 16);
+    sum+= sumDwordsSse2(buffer + i, vectorLength);
+    i+= vectorLength;
+    #endif
+
+    for (; i + sizeof(uint32) <= length; i+= sizeof(uint32))
+    {
+        uint32 dword;
+        cOS::memcpy(&dword, buffer + i, sizeof(dword));
+        sum+= dword;
+    }
+    // The trailing bytes. The odd ones are the high byte of their word
+    for (; i < length; i++)
+        sum+= (uint64)buffer[i] << ((i & 1) * 8);
+
+    return sum;
+}
+
+void cPeChecksum::update(const void* buffer, uint length)
+{
+    uint64 sum = sumWords((const uint8*)buffer, length);
+    if (sum != 0)
+        m_isNonZero = true;
+
+    // A chunk which starts at an odd offset is shifted by a byte. Shifting is
+    // multiplying by 0x100, which swaps the bytes of a folded value
+    uint32 folded = (uint32)(sum % CHECKSUM_MODULO);
+    if ((m_length & 1) != 0)
+        folded = ((folded << 8) | (folded >> 8)) & 0xFFFF;
+
+    m_sum = (m_sum + folded) % CHECKSUM_MODULO;
+    m_length+= length;
+}
+
+uint32 cPeChecksum::getChecksum(uint checkSumOffset, uint32 checkSum) const
+{
+    // The folded 16 bits sum. Zero only if all the words are zero
+    uint32 sum = m_sum;
+    if ((sum == 0) && m_isNonZero)
+        sum = CHECKSUM_MODULO;
+
+    // Remove the words of the CheckSum field, with the borrow wrapped around
+    // (this is the way the Windows image-help does it)
+    if ((uint64)checkSumOffset + sizeof(checkSum) <= m_length)
+    {
+        uint32 words[3];
+        uint count;
+        if ((checkSumOffset & 1) == 0)
+        {
+            words[0] = checkSum & 0xFFFF;
+            words[1] = checkSum >> 16;
+            count = 2;
+        } else
+        {
+            words[0] = (checkSum & 0xFF) << 8;
+            words[1] = (checkSum >> 8) & 0xFFFF;
+            words[2] = checkSum >> 24;
+            count = 3;
+        }
+
+        for (uint i = 0; i < count; i++)
+        {
+            if (sum >= words[i])
+                sum-= words[i];
+            else
+                sum = ((sum - words[i]) & 0xFFFF) - 1;
+        }
+    }
+
+    return sum + m_length;
+}
+
+uint32 cPeChecksum::compute(const uint8* file, uint length, uint checkSumOffset)
+{
+    cPeChecksum checksum;
+    checksum.update(file, length);
+
+    uint32 storedCheckSum = 0;
+    if ((uint64)checkSumOffset + sizeof(storedCheckSum) <= length)
+        cOS::memcpy(&storedCheckSum, file + checkSumOffset,
+                    sizeof(storedCheckSum));
+    return checksum.getChecksum(checkSumOffset, storedCheckSum);
+}
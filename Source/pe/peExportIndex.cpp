@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peExportIndex.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "pe/peExportIndex.h"
+
+// FNV-1a parameters
+#define FNV_OFFSET_BASIS (0x811C9DC5)
+#define FNV_PRIME        (0x01000193)
+
+cPeExportIndex::cPeExportIndex() :
+    m_base(0),
+    m_numberOfNames(0),
+    m_poolSize(0)
+{
+}
+
+void cPeExportIndex::reset(uint32 base, uint numberOfFunctions)
+{
+    CHECK(numberOfFunctions <= MAX_FUNCTIONS);
+    m_base = base;
+    m_functions.changeSize(numberOfFunctions, false);
+    for (uint i = 0; i < numberOfFunctions; i++)
+    {
+        m_functions[i].m_rva = 0;
+        m_functions[i].m_name = NO_NAME;
+        m_functions[i].m_forwarder = NO_NAME;
+    }
+    m_names.changeSize(0);
+    m_numberOfNames = 0;
+    m_pool.changeSize(0);
+    m_poolSize = 0;
+    m_slots.changeSize(0);
+}
+
+void cPeExportIndex::setFunction(uint index, uint32 rva)
+{
+    if (index < m_functions.getSize())
+        m_functions[index].m_rva = rva;
+}
+
+void cPeExportIndex::addName(uint index, const char* name, uint length)
+{
+    // Grow the array geometrically
+    if (m_numberOfNames == m_names.getSize())
+        m_names.changeSize(t_max(m_numberOfNames * 2, 0x40U));
+
+    Name& entry = m_names[m_numberOfNames++];
+    entry.m_hash = hash(name, length);
+    entry.m_offset = appendString(name, length);
+    entry.m_length = length;
+    entry.m_function = index;
+
+    // Aliases: the first name is the name of the function
+    if ((index < m_functions.getSize()) &&
+        (m_functions[index].m_name == NO_NAME))
+        m_functions[index].m_name = entry.m_offset;
+}
+
+void cPeExportIndex::setForwarder(uint index,
+                                  const char* forwarder,
+                                  uint length)
+{
+    if (index < m_functions.getSize())
+        m_functions[index].m_forwarder = appendString(forwarder, length);
+}
+
+uint32 cPeExportIndex::appendString(const char* string, uint length)
+{
+    // Grow the pool geometrically
+    uint required = m_poolSize + length + 1;
+    if (required > m_pool.getSize())
+        m_pool.changeSize(t_max(required, m_pool.getSize() * 2));
+
+    uint32 offset = m_poolSize;
+    cOS::memcpy(m_pool.getBuffer() + offset, string, length);
+    m_pool[offset + length] = 0;
+    m_poolSize = required;
+    return offset;
+}
+
+void cPeExportIndex::build()
+{
+    // At most half full
+    uint size = 1;
+    while (size < m_numberOfNames * 2)
+        size*= 2;
+    m_slots.changeSize(size, false);
+    for (uint i = 0; i < size; i++)
+        m_slots[i] = EMPTY_SLOT;
+
+    uint mask = size - 1;
+    for (uint i = 0; i < m_numberOfNames; i++)
+    {
+        // A name of a function outside the table
+        if (m_names[i].m_function >= m_functions.getSize())
+            continue;
+
+        uint slot = m_names[i].m_hash & mask;
+        while (m_slots[slot] != EMPTY_SLOT)
+        {
+            // Keep the first of duplicated names
+            const Name& other = m_names[m_slots[slot]];
+            if ((other.m_hash == m_names[i].m_hash) &&
+                (other.m_length == m_names[i].m_length) &&
+                (memcmp(m_pool.getBuffer() + other.m_offset,
+                        m_pool.getBuffer() + m_names[i].m_offset,
+                        other.m_length) == 0))
+                break;
+            slot = (slot + 1) & mask;
+        }
+        if (m_slots[slot] == EMPTY_SLOT)
+            m_slots[slot] = i;
+    }
+}
+
+bool cPeExportIndex::findByName(const char* name, Export& entry) const
+{
+    return findByName(name, (uint)strlen(name), entry);
+}
+
+bool cPeExportIndex::findByName(const char* name,
+                                uint length,
+                                Export& entry) const
+{
+    if (m_slots.getSize() == 0)
+        return false;
+
+    uint32 nameHash = hash(name, length);
+    uint mask = m_slots.getSize() - 1;
+    const uint32* slots = m_slots.getBuffer();
+    const Name* names = m_names.getBuffer();
+    for (uint slot = nameHash & mask; slots[slot] != EMPTY_SLOT;
+         slot = (slot + 1) & mask)
+    {
+        const Name& candidate = names[slots[slot]];
+        if ((candidate.m_hash == nameHash) &&
+            (candidate.m_length == length) &&
+            (memcmp(m_pool.getBuffer() + candidate.m_offset, name,
+                    length) == 0))
+        {
+            fillExport(candidate.m_function, entry);
+            entry.m_name = m_pool.getBuffer() + candidate.m_offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cPeExportIndex::findByOrdinal(uint ordinal, Export& entry) const
+{
+    if ((ordinal < m_base) ||
+        (ordinal - m_base >= m_functions.getSize()) ||
+        (m_functions[ordinal - m_base].m_rva == 0))
+        return false;
+
+    fillExport(ordinal - m_base, entry);
+    return true;
+}
+
+void cPeExportIndex::fillExport(uint index, Export& entry) const
+{
+    const Function& function = m_functions.getBuffer()[index];
+    entry.m_rva = function.m_rva;
+    entry.m_ordinal = m_base + index;
+    entry.m_name = (function.m_name == NO_NAME) ? NULL :
+                   (m_pool.getBuffer() + function.m_name);
+    entry.m_forwarder = (function.m_forwarder == NO_NAME) ? NULL :
+                        (m_pool.getBuffer() + function.m_forwarder);
+}
+
+uint cPeExportIndex::getNumberOfFunctions() const
+{
+    return m_functions.getSize();
+}
+
+uint cPeExportIndex::getNumberOfNames() const
+{
+    return m_numberOfNames;
+}
+
+void cPeExportIndex::getFunction(uint index, Export& entry) const
+{
+    CHECK(index < m_functions.getSize());
+    fillExport(index, entry);
+}
+
+const char* cPeExportIndex::getName(uint index,
+                                    uint& length,
+                                    uint& function) const
+{
+    CHECK(index < m_numberOfNames);
+    const Name& name = m_names[index];
+    length = name.m_length;
+    function = name.m_function;
+    return m_pool.getBuffer() + name.m_offset;
+}
+
+uint32 cPeExportIndex::hash(const char* name, uint length)
+{
+    uint32 value = FNV_OFFSET_BASIS;
+    for (uint i = 0; i < length; i++)
+    {
+        value^= (uint8)name[i];
+        value*= FNV_PRIME;
+    }
+    return value;
+}
@@ -38,6 +38,9 @@
  * Author: Elad Raz <e@eladraz.com>
  */
 #include "xStl/types.h"
+#include "xStl/os/os.h"
+#include "xStl/except/exception.h"
+#include "pe/datastruct.h"
 #include "pe/peFile.h"
 #include "pe/dosheader.h"
 #include "pe/ntheader.h"
@@ -56,3 +59,203 @@ uint cPeFile::getImageSize(const cVirtualMemoryAccesserPtr& mem,
     return ntHeader.OptionalHeader.SizeOfImage;
 }
 
+/*
+ * Return true if 'value' is a power of two
+ */
+static bool isPowerOfTwo(uint32 value)
+{
+    return (value != 0) && ((value & (value - 1)) == 0);
+}
+
+bool cPeFile::probe(const uint8* buffer,
+                    uint length,
+                    ProbeInfo& info)
+{
+    memset(&info, 0, sizeof(info));
+    length = t_min(length, (uint)PROBE_SIZE);
+
+    // The DOS header
+    IMAGE_DOS_HEADER dosHeader;
+    if (length < sizeof(dosHeader))
+    {
+        info.m_anomalies|= ANOMALY_TRUNCATED;
+        return false;
+    }
+    cOS::memcpy(&dosHeader, buffer, sizeof(dosHeader));
+    if (dosHeader.e_magic != IMAGE_DOS_SIGNATURE)
+        return false;
+    info.m_flags|= PROBE_DOS_HEADER;
+
+    // The NT header. The signature and the file-header
+    uint32 ntOffset = (uint32)dosHeader.e_lfanew;
+    info.m_ntHeaderOffset = ntOffset;
+    if ((ntOffset & 3) != 0)
+        info.m_anomalies|= ANOMALY_BAD_LFANEW;
+    uint fileHeaderEnd = sizeof(uint32) + sizeof(IMAGE_FILE_HEADER);
+    if ((ntOffset >= length) || (length - ntOffset < fileHeaderEnd))
+    {
+        info.m_anomalies|= ANOMALY_BAD_LFANEW | ANOMALY_TRUNCATED;
+        return false;
+    }
+    uint32 signature;
+    cOS::memcpy(&signature, buffer + ntOffset, sizeof(signature));
+    if (signature != IMAGE_NT_SIGNATURE)
+        return false;
+    IMAGE_FILE_HEADER fileHeader;
+    cOS::memcpy(&fileHeader, buffer + ntOffset + sizeof(uint32),
+                sizeof(fileHeader));
+    info.m_flags|= PROBE_NT_HEADER;
+    info.m_machine = fileHeader.Machine;
+    info.m_numberOfSections = fileHeader.NumberOfSections;
+    info.m_characteristics = fileHeader.Characteristics;
+    if (fileHeader.NumberOfSections == 0)
+        info.m_anomalies|= ANOMALY_NO_SECTIONS;
+    if ((fileHeader.Characteristics & IMAGE_FILE_EXECUTABLE_IMAGE) == 0)
+        info.m_anomalies|= ANOMALY_NOT_EXECUTABLE;
+
+    // The section table location. It's relative to the optional header
+    // regardless of the number of directories.
+    uint optionalOffset = ntOffset + fileHeaderEnd;
+    uint optionalSize = fileHeader.SizeOfOptionalHeader;
+    info.m_sectionTableOffset = optionalOffset + optionalSize;
+    uint sectionTableEnd = info.m_sectionTableOffset +
+                           fileHeader.NumberOfSections *
+                           sizeof(IMAGE_SECTION_HEADER);
+    if (sectionTableEnd <= length)
+        info.m_flags|= PROBE_SECTION_TABLE;
+
+    // The optional header. Read only the bytes which are really there.
+    uint16 magic;
+    if (length - optionalOffset < sizeof(magic))
+    {
+        info.m_anomalies|= ANOMALY_TRUNCATED;
+        return false;
+    }
+    cOS::memcpy(&magic, buffer + optionalOffset, sizeof(magic));
+    info.m_magic = magic;
+
+    uint directoriesOffset;
+    uint headerSize;
+    if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        IMAGE_OPTIONAL_HEADER32 header;
+        headerSize = sizeof(header);
+        memset(&header, 0, sizeof(header));
+        cOS::memcpy(&header, buffer + optionalOffset,
+                    t_min(headerSize, length - optionalOffset));
+        directoriesOffset = (uint)((uint8*)&header.DataDirectory -
+                                   (uint8*)&header);
+        info.m_is64bit = false;
+        info.m_subsystem = header.Subsystem;
+        info.m_dllCharacteristics = header.DllCharacteristics;
+        info.m_entryPoint = header.AddressOfEntryPoint;
+        info.m_imageBase = header.ImageBase;
+        info.m_sectionAlignment = header.SectionAlignment;
+        info.m_fileAlignment = header.FileAlignment;
+        info.m_sizeOfImage = header.SizeOfImage;
+        info.m_sizeOfHeaders = header.SizeOfHeaders;
+        info.m_checksum = header.CheckSum;
+        info.m_numberOfDirectories = header.NumberOfRvaAndSizes;
+    } else if (magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        IMAGE_OPTIONAL_HEADER64 header;
+        headerSize = sizeof(header);
+        memset(&header, 0, sizeof(header));
+        cOS::memcpy(&header, buffer + optionalOffset,
+                    t_min(headerSize, length - optionalOffset));
+        directoriesOffset = (uint)((uint8*)&header.DataDirectory -
+                                   (uint8*)&header);
+        info.m_is64bit = true;
+        info.m_subsystem = header.Subsystem;
+        info.m_dllCharacteristics = header.DllCharacteristics;
+        info.m_entryPoint = header.AddressOfEntryPoint;
+        info.m_imageBase = header.ImageBase;
+        info.m_sectionAlignment = header.SectionAlignment;
+        info.m_fileAlignment = header.FileAlignment;
+        info.m_sizeOfImage = header.SizeOfImage;
+        info.m_sizeOfHeaders = header.SizeOfHeaders;
+        info.m_checksum = header.CheckSum;
+        info.m_numberOfDirectories = header.NumberOfRvaAndSizes;
+    } else
+    {
+        info.m_anomalies|= ANOMALY_UNKNOWN_MAGIC;
+        return false;
+    }
+    info.m_flags|= PROBE_OPTIONAL_HEADER;
+
+    if (length - optionalOffset < directoriesOffset)
+        info.m_anomalies|= ANOMALY_TRUNCATED;
+
+    // The data directories. Limited by the declared number, the size of the
+    // optional header and the probed bytes.
+    if (info.m_numberOfDirectories > IMAGE_NUMBEROF_DIRECTORY_ENTRIES)
+    {
+        info.m_anomalies|= ANOMALY_TOO_MANY_DIRECTORIES;
+        info.m_numberOfDirectories = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    }
+    uint count = info.m_numberOfDirectories;
+    if (optionalSize < directoriesOffset + count * sizeof(IMAGE_DATA_DIRECTORY))
+    {
+        info.m_anomalies|= ANOMALY_SHORT_OPTIONAL_HEADER;
+        count = (optionalSize < directoriesOffset) ? 0 :
+            ((optionalSize - directoriesOffset) / sizeof(IMAGE_DATA_DIRECTORY));
+    }
+    uint available = length - optionalOffset;
+    available = (available < directoriesOffset) ? 0 :
+        ((available - directoriesOffset) / sizeof(IMAGE_DATA_DIRECTORY));
+    if (count > available)
+    {
+        info.m_anomalies|= ANOMALY_TRUNCATED;
+        count = available;
+    }
+    info.m_numberOfDirectories = count;
+    cOS::memcpy(info.m_directories,
+                buffer + optionalOffset + directoriesOffset,
+                count * sizeof(IMAGE_DATA_DIRECTORY));
+
+    // Sanity of the values
+    if ((!isPowerOfTwo(info.m_fileAlignment)) ||
+        (!isPowerOfTwo(info.m_sectionAlignment)) ||
+        (info.m_fileAlignment > info.m_sectionAlignment))
+        info.m_anomalies|= ANOMALY_BAD_ALIGNMENT;
+    if (info.m_entryPoint >= info.m_sizeOfImage)
+        info.m_anomalies|= ANOMALY_ENTRY_OUTSIDE_IMAGE;
+    if (info.m_sizeOfHeaders < sectionTableEnd)
+        info.m_anomalies|= ANOMALY_SHORT_HEADERS;
+    for (uint i = 0; i < count; i++)
+    {
+        const IMAGE_DATA_DIRECTORY& dir = info.m_directories[i];
+        // The security directory is a file offset
+        if ((i == IMAGE_DIRECTORY_ENTRY_SECURITY) || (dir.Size == 0))
+            continue;
+        if ((dir.VirtualAddress >= info.m_sizeOfImage) ||
+            (dir.Size > info.m_sizeOfImage - dir.VirtualAddress))
+            info.m_anomalies|= ANOMALY_DIRECTORY_OUTSIDE;
+    }
+
+    return true;
+}
+
+bool cPeFile::probe(const cVirtualMemoryAccesserPtr& mem,
+                    addressNumericValue offset,
+                    uint length,
+                    ProbeInfo& info)
+{
+    memset(&info, 0, sizeof(info));
+    uint8 buffer[PROBE_SIZE];
+    length = t_min(length, (uint)PROBE_SIZE);
+
+    bool isRead = false;
+    XSTL_TRY
+    {
+        isRead = mem->memread(offset, buffer, length, NULL);
+    }
+    XSTL_CATCH_ALL
+    {
+        isRead = false;
+    }
+
+    if (!isRead)
+        return false;
+    return probe(buffer, length, info);
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peFileSystem.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/data/string.h"
+#include "xStl/except/exception.h"
+#include "pe/peFileSystem.h"
+
+#ifndef XSTL_WINDOWS
+#include <dirent.h>
+#include <sys/stat.h>
+
+void cPeFileSystem::getNativeFilename(const cString& filename,
+                                      cSArray<char>& name)
+{
+    const character* buffer = filename.getBuffer();
+    uint length = filename.length();
+    #ifndef XSTL_UNICODE
+    // Already in the native encoding
+    name.changeSize(length + 1);
+    for (uint i = 0; i < length; i++)
+        name[i] = buffer[i];
+    name[length] = 0;
+    #else
+    // Worst case is 4 bytes for each character
+    name.changeSize(length * 4 + 1);
+    uint j = 0;
+    for (uint i = 0; i < length; i++)
+    {
+        uint32 ch = (uint32)buffer[i];
+        if (ch < 0x80)
+        {
+            name[j++] = (char)ch;
+        } else if (ch < 0x800)
+        {
+            name[j++] = (char)(0xC0 | (ch >> 6));
+            name[j++] = (char)(0x80 | (ch & 0x3F));
+        } else if (ch < 0x10000)
+        {
+            name[j++] = (char)(0xE0 | (ch >> 12));
+            name[j++] = (char)(0x80 | ((ch >> 6) & 0x3F));
+            name[j++] = (char)(0x80 | (ch & 0x3F));
+        } else
+        {
+            name[j++] = (char)(0xF0 | ((ch >> 18) & 0x07));
+            name[j++] = (char)(0x80 | ((ch >> 12) & 0x3F));
+            name[j++] = (char)(0x80 | ((ch >> 6) & 0x3F));
+            name[j++] = (char)(0x80 | (ch & 0x3F));
+        }
+    }
+    name[j] = 0;
+    #endif
+}
+
+cString cPeFileSystem::fromNativeFilename(const char* name)
+{
+    #ifndef XSTL_UNICODE
+    return cString(name);
+    #else
+    const uint8* input = (const uint8*)name;
+    uint length = 0;
+    while (input[length] != 0)
+        length++;
+
+    cSArray<character> output(length + 1);
+    uint j = 0;
+    for (uint i = 0; i < length;)
+    {
+        uint32 ch = input[i];
+        uint extra = 0;
+        if ((ch & 0xE0) == 0xC0)      { ch&= 0x1F; extra = 1; }
+        else if ((ch & 0xF0) == 0xE0) { ch&= 0x0F; extra = 2; }
+        else if ((ch & 0xF8) == 0xF0) { ch&= 0x07; extra = 3; }
+
+        // Invalid sequences are copied byte by byte
+        uint k = 1;
+        for (; (k <= extra) && (i + k < length) &&
+               ((input[i + k] & 0xC0) == 0x80); k++)
+            ch = (ch << 6) | (input[i + k] & 0x3F);
+        if (k != extra + 1)
+        {
+            ch = input[i];
+            k = 1;
+        }
+
+        output[j++] = (character)ch;
+        i+= k;
+    }
+    output[j] = 0;
+    return cString(output.getBuffer());
+    #endif
+}
+
+bool cPeFileSystem::getFileSize(const cString& filename, uint64& size)
+{
+    cSArray<char> name;
+    getNativeFilename(filename, name);
+    struct stat info;
+    if ((stat(name.getBuffer(), &info) != 0) || (!S_ISREG(info.st_mode)))
+        return false;
+    size = (uint64)info.st_size;
+    return true;
+}
+
+bool cPeFileSystem::isDirectory(const cString& path)
+{
+    cSArray<char> name;
+    getNativeFilename(path, name);
+    struct stat info;
+    return (stat(name.getBuffer(), &info) == 0) && (S_ISDIR(info.st_mode));
+}
+
+void cPeFileSystem::listFiles(const cString& path,
+                              bool recursive,
+                              cList<cString>& files)
+{
+    cSArray<char> name;
+    getNativeFilename(path, name);
+    DIR* directory = opendir(name.getBuffer());
+    CHECK_MSG(directory != NULL, "Cannot open directory");
+
+    cList<cString> subDirectories;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        const char* entryName = entry->d_name;
+        if ((entryName[0] == '.') &&
+            ((entryName[1] == 0) ||
+             ((entryName[1] == '.') && (entryName[2] == 0))))
+            continue;
+
+        cString fullPath(path);
+        if ((path.length() == 0) || (path[path.length() - 1] != '/'))
+            fullPath+= "/";
+        fullPath+= fromNativeFilename(entryName);
+
+        // lstat, don't follow symbolic links
+        cSArray<char> entryNative;
+        getNativeFilename(fullPath, entryNative);
+        struct stat info;
+        if (lstat(entryNative.getBuffer(), &info) != 0)
+            continue;
+        if (S_ISREG(info.st_mode))
+            files.append(fullPath);
+        else if ((recursive) && (S_ISDIR(info.st_mode)))
+            subDirectories.append(fullPath);
+    }
+    closedir(directory);
+
+    cList<cString>::iterator i = subDirectories.begin();
+    for (; i != subDirectories.end(); ++i)
+    {
+        XSTL_TRY
+        {
+            listFiles(*i, recursive, files);
+        }
+        XSTL_CATCH_ALL
+        {
+            // Skip directories without permission
+        }
+    }
+}
+
+#else // XSTL_WINDOWS
+
+bool cPeFileSystem::getFileSize(const cString& filename, uint64& size)
+{
+    #ifdef _KERNEL
+    return false;
+    #else
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if ((!GetFileAttributesEx(filename.getBuffer(), GetFileExInfoStandard,
+                              &info)) ||
+        ((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0))
+        return false;
+    size = ((uint64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    return true;
+    #endif
+}
+
+bool cPeFileSystem::isDirectory(const cString& path)
+{
+    #ifdef _KERNEL
+    return false;
+    #else
+    DWORD attributes = GetFileAttributes(path.getBuffer());
+    return (attributes != INVALID_FILE_ATTRIBUTES) &&
+           ((attributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    #endif
+}
+
+void cPeFileSystem::listFiles(const cString& path,
+                              bool recursive,
+                              cList<cString>& files)
+{
+    #ifdef _KERNEL
+    CHECK_FAIL();
+    #else
+    cString pattern(path);
+    pattern+= XSTL_STRING("\\*");
+    WIN32_FIND_DATA entry;
+    HANDLE find = FindFirstFile(pattern.getBuffer(), &entry);
+    CHECK_MSG(find != INVALID_HANDLE_VALUE, "Cannot open directory");
+
+    cList<cString> subDirectories;
+    do
+    {
+        cString entryName(entry.cFileName);
+        if ((entryName == XSTL_STRING(".")) || (entryName == XSTL_STRING("..")))
+            continue;
+
+        cString fullPath(path);
+        fullPath+= XSTL_STRING("\\");
+        fullPath+= entryName;
+
+        if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            files.append(fullPath);
+        else if ((recursive) &&
+                 ((entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0))
+            subDirectories.append(fullPath);
+    } while (FindNextFile(find, &entry));
+    FindClose(find);
+
+    cList<cString>::iterator i = subDirectories.begin();
+    for (; i != subDirectories.end(); ++i)
+    {
+        XSTL_TRY
+        {
+            listFiles(*i, recursive, files);
+        }
+        XSTL_CATCH_ALL
+        {
+            // Skip directories without permission
+        }
+    }
+    #endif
+}
+
+#endif // XSTL_WINDOWS
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peForwarderResolver.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/array.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "pe/peExportIndex.h"
+#include "pe/peForwarderResolver.h"
+
+// The initial size of the cache hash table
+#define CACHE_INITIAL_SLOTS (0x100)
+// Mixes the module into the hash of a link
+#define MODULE_HASH_MULTIPLIER (0x9E3779B9)
+
+cPeForwarderResolver::cPeForwarderResolver() :
+    m_poolSize(0),
+    m_cacheSize(0)
+{
+}
+
+uint cPeForwarderResolver::addModule(const char* name,
+                                     const cPeExportIndex& exports)
+{
+    char buffer[MAX_MODULE_NAME];
+    uint length = normalizeModule(name, (uint)strlen(name), buffer);
+    CHECK(length != 0);
+
+    // The cache may hold failures which the new module resolves
+    clearCache();
+
+    // Modules which are registered twice are replaced
+    uint module = findModule(name);
+    if (module != INVALID_MODULE)
+    {
+        m_modules[module].m_exports = &exports;
+        return module;
+    }
+
+    module = m_modules.getSize();
+    m_modules.changeSize(module + 1);
+    m_modules[module].m_exports = &exports;
+    m_modules[module].m_length = length;
+    m_modules[module].m_hash = cPeExportIndex::hash(buffer, length);
+    m_modules[module].m_name = appendString(buffer, length);
+    return module;
+}
+
+uint cPeForwarderResolver::findModule(const char* name) const
+{
+    return findModule(name, (uint)strlen(name));
+}
+
+uint cPeForwarderResolver::findModule(const char* name, uint length) const
+{
+    char buffer[MAX_MODULE_NAME];
+    length = normalizeModule(name, length, buffer);
+    if (length == 0)
+        return INVALID_MODULE;
+
+    uint32 nameHash = cPeExportIndex::hash(buffer, length);
+    for (uint i = 0; i < m_modules.getSize(); i++)
+    {
+        const Module& module = m_modules[i];
+        if ((module.m_hash == nameHash) && (module.m_length == length) &&
+            (memcmp(m_pool.getBuffer() + module.m_name, buffer, length) == 0))
+            return i;
+    }
+    return INVALID_MODULE;
+}
+
+uint cPeForwarderResolver::getNumberOfModules() const
+{
+    return m_modules.getSize();
+}
+
+uint cPeForwarderResolver::normalizeModule(const char* name,
+                                           uint length,
+                                           char* buffer)
+{
+    if (length > MAX_MODULE_NAME)
+        return 0;
+
+    for (uint i = 0; i < length; i++)
+    {
+        char c = name[i];
+        if ((c >= 'A') && (c <= 'Z'))
+            c = c - 'A' + 'a';
+        buffer[i] = c;
+    }
+
+    // Strip the extension
+    if ((length > 4) && (memcmp(buffer + length - 4, ".dll", 4) == 0))
+        length-= 4;
+    return length;
+}
+
+bool cPeForwarderResolver::resolveName(uint module,
+                                       const char* name,
+                                       Target& target)
+{
+    if (module >= m_modules.getSize())
+        return false;
+
+    Key key;
+    key.m_module = module;
+    key.m_name = name;
+    key.m_length = (uint)strlen(name);
+    key.m_ordinal = NO_ORDINAL;
+    return resolve(key, target);
+}
+
+bool cPeForwarderResolver::resolveOrdinal(uint module,
+                                          uint ordinal,
+                                          Target& target)
+{
+    if (module >= m_modules.getSize())
+        return false;
+
+    Key key;
+    key.m_module = module;
+    key.m_name = NULL;
+    key.m_length = 0;
+    key.m_ordinal = ordinal;
+    return resolve(key, target);
+}
+
+bool cPeForwarderResolver::resolveForwarder(const char* forwarder,
+                                            Target& target)
+{
+    Key key;
+    if (!parseForwarder(forwarder, key))
+        return false;
+    return resolve(key, target);
+}
+
+bool cPeForwarderResolver::parseForwarder(const char* forwarder,
+                                          Key& key) const
+{
+    // The module name may contain dots, the function name cannot
+    const char* dot = strrchr(forwarder, '.');
+    if ((dot == NULL) || (dot == forwarder) || (dot[1] == 0))
+        return false;
+
+    key.m_module = findModule(forwarder, (uint)(dot - forwarder));
+    if (key.m_module == INVALID_MODULE)
+        return false;
+
+    const char* function = dot + 1;
+    if (function[0] != '#')
+    {
+        key.m_name = function;
+        key.m_length = (uint)strlen(function);
+        key.m_ordinal = NO_ORDINAL;
+        return true;
+    }
+
+    // Forwarded by ordinal
+    uint ordinal = 0;
+    for (const char* digit = function + 1; *digit != 0; digit++)
+    {
+        if ((*digit < '0') || (*digit > '9') || (ordinal > 0xFFFF))
+            return false;
+        ordinal = ordinal * 10 + (*digit - '0');
+    }
+    if (function[1] == 0)
+        return false;
+    key.m_name = NULL;
+    key.m_length = 0;
+    key.m_ordinal = ordinal;
+    return true;
+}
+
+bool cPeForwarderResolver::resolve(Key key, Target& target)
+{
+    // The links which were followed, all are memoized with the result
+    Key chain[MAX_CHAIN];
+    uint chainLength = 0;
+    bool isResolved = false;
+    Target result;
+    memset(&result, 0, sizeof(result));
+    result.m_module = INVALID_MODULE;
+
+    while (true)
+    {
+        uint cached = findCache(key, hashKey(key));
+        if (cached != EMPTY_SLOT)
+        {
+            isResolved = m_cache[cached].m_isResolved;
+            result = m_cache[cached].m_target;
+            break;
+        }
+
+        // Loops and endless chains are failures
+        bool isLoop = false;
+        for (uint i = 0; (i < chainLength) && (!isLoop); i++)
+            isLoop = isSameKey(chain[i], key);
+        if (isLoop || (chainLength == MAX_CHAIN))
+            break;
+        chain[chainLength++] = key;
+
+        const cPeExportIndex& exports = *m_modules[key.m_module].m_exports;
+        cPeExportIndex::Export entry;
+        bool isFound = (key.m_name != NULL) ?
+            exports.findByName(key.m_name, key.m_length, entry) :
+            exports.findByOrdinal(key.m_ordinal, entry);
+        if (!isFound)
+            break;
+
+        if (entry.m_forwarder == NULL)
+        {
+            isResolved = true;
+            result.m_module = key.m_module;
+            result.m_export = entry;
+            break;
+        }
+
+        // Next link
+        if (!parseForwarder(entry.m_forwarder, key))
+            break;
+    }
+
+    for (uint i = 0; i < chainLength; i++)
+        addCache(chain[i], isResolved, result);
+
+    if (isResolved)
+        target = result;
+    return isResolved;
+}
+
+void cPeForwarderResolver::clearCache()
+{
+    m_cacheSize = 0;
+    m_cache.changeSize(0);
+    m_slots.changeSize(0);
+
+    // Only the names of the modules are kept
+    m_poolSize = 0;
+    for (uint i = 0; i < m_modules.getSize(); i++)
+        m_poolSize = t_max(m_poolSize,
+                           (uint)(m_modules[i].m_name +
+                                  m_modules[i].m_length + 1));
+}
+
+uint32 cPeForwarderResolver::hashKey(const Key& key)
+{
+    uint32 value;
+    if (key.m_name != NULL)
+        value = cPeExportIndex::hash(key.m_name, key.m_length);
+    else
+        value = cPeExportIndex::hash((const char*)&key.m_ordinal,
+                                     sizeof(key.m_ordinal));
+    return value ^ (key.m_module * MODULE_HASH_MULTIPLIER);
+}
+
+bool cPeForwarderResolver::isSameKey(const Key& a, const Key& b)
+{
+    if ((a.m_module != b.m_module) || (a.m_ordinal != b.m_ordinal) ||
+        (a.m_length != b.m_length) ||
+        ((a.m_name == NULL) != (b.m_name == NULL)))
+        return false;
+    return (a.m_name == NULL) ||
+           (memcmp(a.m_name, b.m_name, a.m_length) == 0);
+}
+
+bool cPeForwarderResolver::isSameKey(const CacheEntry& entry,
+                                     uint32 hash,
+                                     const Key& key) const
+{
+    if ((entry.m_hash != hash) || (entry.m_module != key.m_module))
+        return false;
+    if (key.m_name == NULL)
+        return (entry.m_name == NO_ORDINAL) &&
+               (entry.m_ordinal == key.m_ordinal);
+    return (entry.m_name != NO_ORDINAL) &&
+           (entry.m_length == key.m_length) &&
+           (memcmp(m_pool.getBuffer() + entry.m_name, key.m_name,
+                   key.m_length) == 0);
+}
+
+uint cPeForwarderResolver::findCache(const Key& key, uint32 hash) const
+{
+    if (m_slots.getSize() == 0)
+        return EMPTY_SLOT;
+
+    uint mask = m_slots.getSize() - 1;
+    for (uint slot = hash & mask; m_slots[slot] != EMPTY_SLOT;
+         slot = (slot + 1) & mask)
+    {
+        if (isSameKey(m_cache[m_slots[slot]], hash, key))
+            return m_slots[slot];
+    }
+    return EMPTY_SLOT;
+}
+
+void cPeForwarderResolver::addCache(const Key& key,
+                                    bool isResolved,
+                                    const Target& target)
+{
+    uint32 hash = hashKey(key);
+    if (findCache(key, hash) != EMPTY_SLOT)
+        return;
+
+    // Grow the entries, and keep the hash table at most half full
+    if (m_cacheSize == m_cache.getSize())
+        m_cache.changeSize(t_max(m_cacheSize * 2,
+                                 (uint)CACHE_INITIAL_SLOTS / 2));
+    if ((m_cacheSize + 1) * 2 > m_slots.getSize())
+    {
+        uint size = t_max(m_slots.getSize() * 2, (uint)CACHE_INITIAL_SLOTS);
+        m_slots.changeSize(size, false);
+        for (uint i = 0; i < size; i++)
+            m_slots[i] = EMPTY_SLOT;
+        for (uint i = 0; i < m_cacheSize; i++)
+        {
+            uint slot = m_cache[i].m_hash & (size - 1);
+            while (m_slots[slot] != EMPTY_SLOT)
+                slot = (slot + 1) & (size - 1);
+            m_slots[slot] = i;
+        }
+    }
+
+    CacheEntry& entry = m_cache[m_cacheSize];
+    entry.m_hash = hash;
+    entry.m_module = key.m_module;
+    entry.m_length = key.m_length;
+    entry.m_ordinal = key.m_ordinal;
+    entry.m_name = (key.m_name == NULL) ? (uint32)NO_ORDINAL :
+                   appendString(key.m_name, key.m_length);
+    entry.m_isResolved = isResolved;
+    entry.m_target = target;
+
+    uint mask = m_slots.getSize() - 1;
+    uint slot = hash & mask;
+    while (m_slots[slot] != EMPTY_SLOT)
+        slot = (slot + 1) & mask;
+    m_slots[slot] = m_cacheSize++;
+}
+
+uint32 cPeForwarderResolver::appendString(const char* string, uint length)
+{
+    // Grow the pool geometrically
+    uint required = m_poolSize + length + 1;
+    if (required > m_pool.getSize())
+        m_pool.changeSize(t_max(required, m_pool.getSize() * 2));
+
+    uint32 offset = m_poolSize;
+    cOS::memcpy(m_pool.getBuffer() + offset, string, length);
+    m_pool[offset + length] = 0;
+    m_poolSize = required;
+    return offset;
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+#include "pe/pePrecompiledHeaders.h"
+/*
+ * peStreamParser.cpp
+ *
+ * Implementation file
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/os/os.h"
+#include "xStl/data/array.h"
+#include "xStl/data/list.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/virtualMemoryAccesser.h"
+#include "xStl/os/streamMemoryAccesser.h"
+#include "xStl/stream/basicIO.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntsectionheader.h"
+#include "pe/peStreamParser.h"
+
+//////////////////////////////////////////////////////////////////////////
+// cPeStreamListener
+
+void cPeStreamListener::onHeaders(const cNtHeader&)
+{
+}
+
+void cPeStreamListener::onSectionData(uint,
+                                      const cNtSectionHeader&,
+                                      uint,
+                                      const uint8*,
+                                      uint)
+{
+}
+
+void cPeStreamListener::onDirectory(uint, const cBuffer&)
+{
+}
+
+void cPeStreamListener::onOverlayData(uint, const uint8*, uint)
+{
+}
+
+void cPeStreamListener::onEnd()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+// cPeStreamParser
+
+cPeStreamParser::cPeStreamParser(cPeStreamListener& listener,
+                                 uint maxHeadersSize,
+                                 uint maxDirectorySize) :
+    m_listener(listener),
+    m_maxHeadersSize(maxHeadersSize),
+    m_maxDirectorySize(maxDirectorySize),
+    m_state(STATE_DOS_HEADER),
+    m_position(0),
+    m_headers(new cBuffer()),
+    m_headersNeeded(sizeof(IMAGE_DOS_HEADER)),
+    m_ntHeaderOffset(0),
+    m_headerStream(NULL),
+    m_header(NULL),
+    m_overlayStart(0)
+{
+    for (uint i = 0; i < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; i++)
+    {
+        m_directories[i].m_isPending = false;
+        m_directories[i].m_offset = 0;
+        m_directories[i].m_size = 0;
+        m_directories[i].m_received = 0;
+    }
+}
+
+const cNtHeaderPtr& cPeStreamParser::getHeader() const
+{
+    return m_header;
+}
+
+uint cPeStreamParser::getPosition() const
+{
+    return m_position;
+}
+
+void cPeStreamParser::feed(const uint8* data, uint length)
+{
+    while ((length > 0) && (m_state != STATE_BODY))
+    {
+        // Collect the header bytes
+        uint size = m_headers->getSize();
+        uint count = t_min(length, m_headersNeeded - size);
+        m_headers->changeSize(size + count);
+        cOS::memcpy(m_headers->getBuffer() + size, data, count);
+        m_position+= count;
+        data+= count;
+        length-= count;
+
+        if (m_headers->getSize() == m_headersNeeded)
+            advanceHeaders();
+    }
+
+    if (length > 0)
+    {
+        dispatch(m_position, data, length);
+        m_position+= length;
+    }
+}
+
+void cPeStreamParser::end()
+{
+    // The input ended before the section table
+    CHECK(m_state == STATE_BODY);
+    m_listener.onEnd();
+}
+
+void cPeStreamParser::parse(basicInput& stream)
+{
+    cBuffer chunk(READ_CHUNK_SIZE);
+    while (true)
+    {
+        uint length = stream.read(chunk.getBuffer(), chunk.getSize());
+        if (length == 0)
+            break;
+        feed(chunk.getBuffer(), length);
+    }
+    end();
+}
+
+void cPeStreamParser::advanceHeaders()
+{
+    const uint8* headers = m_headers->getBuffer();
+    switch (m_state)
+    {
+    case STATE_DOS_HEADER:
+        {
+            IMAGE_DOS_HEADER dosHeader;
+            cOS::memcpy(&dosHeader, headers, sizeof(dosHeader));
+            CHECK(dosHeader.e_magic == IMAGE_DOS_SIGNATURE);
+            m_ntHeaderOffset = dosHeader.e_lfanew;
+            CHECK(m_ntHeaderOffset <= m_maxHeadersSize);
+            m_headersNeeded = t_max((uint)m_headers->getSize(),
+                                    (uint)(m_ntHeaderOffset + sizeof(uint32) +
+                                           sizeof(IMAGE_FILE_HEADER)));
+            m_state = STATE_FILE_HEADER;
+        }
+        break;
+
+    case STATE_FILE_HEADER:
+        {
+            uint32 signature;
+            cOS::memcpy(&signature, headers + m_ntHeaderOffset,
+                        sizeof(signature));
+            CHECK(signature == IMAGE_NT_SIGNATURE);
+            IMAGE_FILE_HEADER fileHeader;
+            cOS::memcpy(&fileHeader,
+                        headers + m_ntHeaderOffset + sizeof(uint32),
+                        sizeof(fileHeader));
+
+            // The section table must be buffered completely. Make sure that
+            // the complete optional header is there as well.
+            uint optionalHeader = m_ntHeaderOffset + sizeof(uint32) +
+                                  sizeof(IMAGE_FILE_HEADER);
+            uint sectionTableEnd = optionalHeader +
+                                   fileHeader.SizeOfOptionalHeader +
+                                   fileHeader.NumberOfSections *
+                                       sizeof(IMAGE_SECTION_HEADER);
+            m_headersNeeded = t_max(sectionTableEnd,
+                                    (uint)(m_ntHeaderOffset +
+                                           sizeof(IMAGE_NT_HEADERS64)));
+            CHECK(m_headersNeeded <= m_maxHeadersSize);
+            m_state = STATE_SECTION_TABLE;
+        }
+        break;
+
+    case STATE_SECTION_TABLE:
+        parseHeaders();
+        break;
+
+    default:
+        CHECK_FAIL();
+    }
+}
+
+void cPeStreamParser::parseHeaders()
+{
+    // Parse the NT header over the buffered bytes. The sections are lazy and
+    // their content is never read through the header.
+    cVirtualMemoryAccesserPtr memory(new cStreamMemoryAccesser(m_headers));
+    m_headerStream = cMemoryAccesserStreamPtr(new cMemoryAccesserStream(
+        memory, 0, m_headers->getSize()));
+    m_headerStream->seek(m_ntHeaderOffset, basicInput::IO_SEEK_SET);
+    m_header = cNtHeaderPtr(new cNtHeader((basicInput&)(*m_headerStream),
+                                          0, true, false,
+                                          m_headerStream.getPointer()));
+
+    // The sections in the order of the section table
+    cList<cSectionPtr> sections;
+    m_header->getSections(sections);
+    m_sections.changeSize(sections.length());
+    m_overlayStart = m_headers->getSize();
+    uint count = 0;
+    cList<cSectionPtr>::iterator i = sections.begin();
+    for (; i != sections.end(); ++i, ++count)
+    {
+        const cNtSectionHeader* section =
+            (const cNtSectionHeader*)((*i).getPointer());
+        m_sections[count] = section;
+        if (section->SizeOfRawData != 0)
+            m_overlayStart = (uint)t_max((uint64)m_overlayStart,
+                t_min((uint64)section->PointerToRawData +
+                          section->SizeOfRawData,
+                      (uint64)0xFFFFFFFF));
+    }
+
+    // Prepare the directories which can be buffered
+    for (uint j = 0; j < m_header->OptionalHeader.NumberOfRvaAndSizes; j++)
+    {
+        const IMAGE_DATA_DIRECTORY& dir = m_header->OptionalHeader.DataDirectory[j];
+        PendingDirectory& pending = m_directories[j];
+        pending.m_isPending = false;
+        if ((dir.Size == 0) || (dir.Size > m_maxDirectorySize))
+            continue;
+
+        uint offset;
+        if (j == IMAGE_DIRECTORY_ENTRY_SECURITY)
+        {
+            // The security directory is pointed by a file offset
+            offset = dir.VirtualAddress;
+        } else if (!m_header->rvaToOffset(dir.VirtualAddress, offset))
+        {
+            // Not stored in the file
+            continue;
+        }
+
+        // The range must fit the 32 bit file offsets, see dispatch
+        if (dir.Size > 0xFFFFFFFF - offset)
+            continue;
+
+        pending.m_offset = offset;
+        pending.m_size = dir.Size;
+        pending.m_received = 0;
+        pending.m_isPending = true;
+        pending.m_data.changeSize(dir.Size, false);
+    }
+
+    m_state = STATE_BODY;
+    m_listener.onHeaders(*m_header);
+
+    // Sections and directories may overlap the headers. Replay them.
+    dispatch(0, m_headers->getBuffer(), m_headers->getSize());
+}
+
+void cPeStreamParser::dispatch(uint offset, const uint8* data, uint length)
+{
+    uint end = offset + length;
+    if (end < offset)
+        end = 0xFFFFFFFF;
+
+    // The sections raw-data
+    uint count = m_sections.getSize();
+    for (uint i = 0; i < count; i++)
+    {
+        const cNtSectionHeader& section = *m_sections[i];
+        uint start = section.PointerToRawData;
+        uint sectionEnd = start + section.SizeOfRawData;
+        if (sectionEnd < start)
+            sectionEnd = 0xFFFFFFFF;
+
+        uint first = t_max(start, offset);
+        uint last = t_min(sectionEnd, end);
+        if (first < last)
+            m_listener.onSectionData(i, section, first - start,
+                                     data + (first - offset), last - first);
+    }
+
+    // The directories
+    for (uint j = 0; j < IMAGE_NUMBEROF_DIRECTORY_ENTRIES; j++)
+    {
+        PendingDirectory& pending = m_directories[j];
+        if (!pending.m_isPending)
+            continue;
+
+        // The bytes arrive in order, continue from the last received byte
+        uint start = pending.m_offset + pending.m_received;
+        uint first = t_max(start, offset);
+        uint last = t_min(pending.m_offset + pending.m_size, end);
+        if (first >= last)
+            continue;
+
+        cOS::memcpy(pending.m_data.getBuffer() + (first - pending.m_offset),
+                    data + (first - offset),
+                    last - first);
+        pending.m_received = last - pending.m_offset;
+        if (pending.m_received == pending.m_size)
+        {
+            pending.m_isPending = false;
+            m_listener.onDirectory(j, pending.m_data);
+            // Release the memory
+            pending.m_data.changeSize(0, false);
+        }
+    }
+
+    // The overlay
+    if (end > m_overlayStart)
+    {
+        uint first = t_max(m_overlayStart, offset);
+        m_listener.onOverlayData(first, data + (first - offset), end - first);
+    }
+}
@@ -65,13 +65,24 @@ cSection::cSection(const cString& name,
 {
 }
 
+void cSection::loadSectionContent() const
+{
+}
+
+void cSection::touchSectionContent() const
+{
+    loadSectionContent();
+}
+
 cForkStreamPtr cSection::getSectionContentAccesser() const
 {
+    touchSectionContent();
     return m_data->fork();
 }
 
 uint cSection::getSectionContentSize() const
 {
+    touchSectionContent();
     return m_data->length();
 }
 
@@ -136,6 +147,7 @@ cStringerStream& operator << (cStringerStream& out, const cSection& object)
     out << endl << endl;
 
     // Get the content of the stream
+    object.touchSectionContent();
     if (!object.m_data.isEmpty())
     {
         cBuffer content;
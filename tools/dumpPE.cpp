@@ -52,6 +52,8 @@
 #include "pe/dosheader.h"
 #include "pe/ntheader.h"
 #include "pe/ntDirExport.h"
+#include "pe/ntDirImport.h"
+#include "pe/ntDirDelayImport.h"
 
 /*
  * The main entry point. Captures all unexpected exceptions and make sure
@@ -100,21 +102,24 @@ int main(const int argc, const char** argv)
         cNtHeader ntFile(peFileStream);
 
         // Read the export-table
-        cNtDirExport export_dir(ntFile);
-        //cout << export_dir;
-
-        /**/
-        addressNumericValue lib = 0x400000;
-        for (uint i = 0; i < export_dir.getExportArray().getSize(); i++)
+        if (ntFile.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size != 0)
         {
-            cout << "  "    << HEXADDRESS(NR_ADDRESS(export_dir.getExportArray()[i].m_address) + lib)
-                 << "     " << HEXWORD (export_dir.getExportArray()[i].m_ordinal)
-                 << "  ";
+            cNtDirExport export_dir(ntFile);
+            //cout << export_dir;
+
+            /**/
+            addressNumericValue lib = 0x400000;
+            for (uint i = 0; i < export_dir.getExportArray().getSize(); i++)
+            {
+                cout << "  "    << HEXADDRESS(NR_ADDRESS(export_dir.getExportArray()[i].m_address) + lib)
+                     << "     " << HEXWORD (export_dir.getExportArray()[i].m_ordinal)
+                     << "  ";
 
-            if (export_dir.getExportArray()[i].m_isName)
-                cout << export_dir.getExportArray()[i].m_name;
+                if (export_dir.getExportArray()[i].m_isName)
+                    cout << export_dir.getExportArray()[i].m_name;
 
-            cout << endl;
+                cout << endl;
+            }
         }
 
         #ifdef XSTL_WINDOWS
@@ -124,6 +129,56 @@ int main(const int argc, const char** argv)
         /**/
 
         // Read the import-table
+        if (ntFile.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].Size != 0)
+        {
+            cNtDirImport import_dir(ntFile);
+            const cNtDirImport::ModuleTable& modules = import_dir.getModules();
+            for (uint i = 0; i < modules.getSize(); i++)
+            {
+                cout << endl << import_dir.getModuleName(modules[i]) << endl;
+                for (uint j = 0; j < modules[i].m_numberOfFunctions; j++)
+                {
+                    const cNtDirImport::ImportFunction& function =
+                        import_dir.getFunctions()[modules[i].m_firstFunction + j];
+                    cout << "  "    << HEXDWORD(function.m_iatAddress)
+                         << "     " << HEXWORD (function.m_hint)
+                         << "  ";
+
+                    if (function.m_name != cNtDirImport::NO_NAME)
+                        cout << import_dir.getName(function.m_name);
+                    else
+                        cout << "Ordinal " << (uint)function.m_hint;
+
+                    cout << endl;
+                }
+            }
+        }
+
+        // Read the delay-load import-table
+        if (ntFile.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT].Size != 0)
+        {
+            cNtDirDelayImport delay_dir(ntFile);
+            const cNtDirDelayImport::ModuleTable& modules = delay_dir.getModules();
+            for (uint i = 0; i < modules.getSize(); i++)
+            {
+                cout << endl << modules[i].m_name << " (delay-load)" << endl;
+                for (uint j = 0; j < modules[i].m_numberOfFunctions; j++)
+                {
+                    const cNtDirDelayImport::DelayFunction& function =
+                        delay_dir.getFunctions()[modules[i].m_firstFunction + j];
+                    cout << "  "    << HEXDWORD(function.m_iatAddress)
+                         << "     " << HEXWORD (function.m_hint)
+                         << "  ";
+
+                    if (function.m_name != NULL)
+                        cout << function.m_name;
+                    else
+                        cout << "Ordinal " << (uint)function.m_hint;
+
+                    cout << endl;
+                }
+            }
+        }
 
         return RC_OK;
     }
@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+/*
+ * peBatchScan.cpp
+ *
+ * Scan a corpus of PE files in parallel and print a line for each file.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/char.h"
+#include "xStl/data/array.h"
+#include "xStl/data/string.h"
+#include "xStl/except/trace.h"
+#include "xStl/except/exception.h"
+#include "xStl/stream/fileStream.h"
+#include "xStl/stream/ioStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntheader.h"
+#include "pe/ntDirExport.h"
+#include "pe/ntDirImport.h"
+#include "pe/ntDirDelayImport.h"
+#include "pe/ntDirBoundImport.h"
+#include "pe/ntDirDebug.h"
+#include "pe/ntDirLoadConfig.h"
+#include "pe/ntDirException.h"
+#include "pe/ntDirSecurity.h"
+#include "pe/ntDirResource.h"
+#include "pe/ntDirTls.h"
+#include "pe/ntDirReloc.h"
+#include "pe/peFileSystem.h"
+#include "pe/peBatchScanner.h"
+#include "pe/peAsyncReader.h"
+
+/*
+ * Print the summary of each file. The scanner serializes the calls.
+ */
+class cPrintSink : public cPeBatchSink {
+public:
+    virtual void onFile(const cString& filename,
+                        uint64,
+                        const cNtHeader& header,
+                        const cNtDirectoryPtr* directories)
+    {
+        cout << filename
+             << "  machine "  << HEXWORD(header.FileHeader.Machine)
+             << "  sections " << header.FileHeader.NumberOfSections;
+
+        const cNtDirectoryPtr& exports =
+            directories[IMAGE_DIRECTORY_ENTRY_EXPORT];
+        if (!exports.isEmpty())
+        {
+            // The index is enough, don't build the export table
+            const cPeExportIndex& exportIndex =
+                ((const cNtDirExport&)(*exports)).getIndex();
+            cout << "  exports " << exportIndex.getNumberOfFunctions()
+                 << "/" << exportIndex.getNumberOfNames();
+        }
+
+        const cNtDirectoryPtr& imports =
+            directories[IMAGE_DIRECTORY_ENTRY_IMPORT];
+        if (!imports.isEmpty())
+        {
+            const cNtDirImport& importDirectory =
+                (const cNtDirImport&)(*imports);
+            cout << "  imports " << importDirectory.getModules().getSize()
+                 << "/" << importDirectory.getFunctions().getSize();
+        }
+
+        const cNtDirectoryPtr& delayImports =
+            directories[IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT];
+        if (!delayImports.isEmpty())
+        {
+            const cNtDirDelayImport& delayDirectory =
+                (const cNtDirDelayImport&)(*delayImports);
+            cout << "  delay " << delayDirectory.getModules().getSize()
+                 << "/" << delayDirectory.getFunctions().getSize();
+        }
+
+        const cNtDirectoryPtr& boundImports =
+            directories[IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT];
+        if (!boundImports.isEmpty())
+        {
+            cout << "  bound " << ((const cNtDirBoundImport&)(*boundImports)).
+                                      getModules().getSize();
+        }
+
+        const cNtDirectoryPtr& resources =
+            directories[IMAGE_DIRECTORY_ENTRY_RESOURCE];
+        if (!resources.isEmpty())
+        {
+            const cNtDirResource& resourceDirectory =
+                (const cNtDirResource&)(*resources);
+            cout << "  resources " << resourceDirectory.getEntriesCount(
+                                        resourceDirectory.getRoot());
+
+            // Only the version resource is looked up
+            IMAGE_RESOURCE_DATA_ENTRY version;
+            if (resourceDirectory.find(cNtDirResource::TYPE_VERSION, 1,
+                                       cNtDirResource::ANY_LANGUAGE, version))
+            {
+                cout << "  version " << version.Size;
+            }
+        }
+
+        const cNtDirectoryPtr& debug =
+            directories[IMAGE_DIRECTORY_ENTRY_DEBUG];
+        if (!debug.isEmpty())
+        {
+            cNtDirDebug::CodeViewInfo codeView;
+            if (((const cNtDirDebug&)(*debug)).getCodeView(codeView))
+                cout << "  pdb " << codeView.m_path << " age " << codeView.m_age;
+        }
+
+        const cNtDirectoryPtr& tls = directories[IMAGE_DIRECTORY_ENTRY_TLS];
+        if (!tls.isEmpty())
+        {
+            cout << "  tls-callbacks " << ((const cNtDirTls&)(*tls)).
+                                              getCallbacks().getSize();
+        }
+
+        const cNtDirectoryPtr& loadConfig =
+            directories[IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG];
+        if (!loadConfig.isEmpty())
+        {
+            const cNtDirLoadConfig& loadConfigDirectory =
+                (const cNtDirLoadConfig&)(*loadConfig);
+            cout << "  guard " << HEXDWORD(loadConfigDirectory.getGuardFlags())
+                 << "  cf-functions " << loadConfigDirectory.getTable(
+                        cNtDirLoadConfig::TABLE_GUARD_CF_FUNCTIONS).m_count
+                 << "  safeseh " << loadConfigDirectory.getTable(
+                        cNtDirLoadConfig::TABLE_SEHANDLERS).m_count;
+        }
+
+        const cNtDirectoryPtr& exceptions =
+            directories[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+        if (!exceptions.isEmpty())
+        {
+            cout << "  functions " << ((const cNtDirException&)(*exceptions)).
+                                          getCount();
+        }
+
+        const cNtDirectoryPtr& security =
+            directories[IMAGE_DIRECTORY_ENTRY_SECURITY];
+        if (!security.isEmpty())
+        {
+            cout << "  certificates " << ((const cNtDirSecurity&)(*security)).
+                                             getCertificates().getSize();
+        }
+
+        const cNtDirectoryPtr& relocations =
+            directories[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+        if (!relocations.isEmpty())
+        {
+            cout << "  relocations " << ((const cNtDirReloc&)(*relocations)).
+                                            getNumberOfRelocations();
+        }
+        cout << endl;
+    }
+
+    virtual void onError(const cString& filename, uint64)
+    {
+        cout << filename << "  error" << endl;
+    }
+};
+
+/*
+ * Add all the files listed (one per line) in a text file
+ */
+template <class T>
+static void addListFile(T& scanner, const char* listFilename)
+{
+    cFileStream list(listFilename);
+    uint length = list.length();
+    cSArray<char> data(length + 1);
+    list.pipeRead(data.getBuffer(), length);
+    data[length] = 0;
+
+    uint start = 0;
+    for (uint i = 0; i <= length; i++)
+    {
+        if ((data[i] != '\n') && (data[i] != '\r') && (data[i] != 0))
+            continue;
+        data[i] = 0;
+        if (i > start)
+            scanner.addFile(cString(data.getBuffer() + start));
+        start = i + 1;
+    }
+}
+
+/*
+ * Add the files and the directories and scan them. 'T' is cPeBatchScanner or
+ * cPeAsyncReader.
+ */
+template <class T>
+static int scan(T& scanner,
+                const char* listFilename,
+                const char** paths,
+                int numberOfPaths)
+{
+    if (listFilename != NULL)
+        addListFile(scanner, listFilename);
+    for (int i = 0; i < numberOfPaths; i++)
+    {
+        cString path(paths[i]);
+        if (cPeFileSystem::isDirectory(path))
+            scanner.addDirectory(path);
+        else if (!scanner.addFile(path))
+            cout << path << "  not found" << endl;
+    }
+
+    scanner.run();
+    cout << "Parsed " << scanner.getNumberOfParsedFiles()
+         << " files, failed " << scanner.getNumberOfFailedFiles()
+         << endl;
+    return RC_OK;
+}
+
+/*
+ * The main entry point. Captures all unexpected exceptions and make sure
+ * that the application will notify the programmer.
+ */
+int main(const int argc, const char** argv)
+{
+    XSTL_TRY
+    {
+        uint threads = 0;
+        uint mask = 0;
+        bool isAsync = false;
+        const char* listFilename = NULL;
+        int i = 1;
+        for (; i < argc; i++)
+        {
+            if (argv[i][0] != '-')
+                break;
+            if ((argv[i][1] == 'j') && (i + 1 < argc))
+                threads = (uint)atoi(argv[++i]);
+            else if ((argv[i][1] == 'l') && (i + 1 < argc))
+                listFilename = argv[++i];
+            else if (argv[i][1] == 'e')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_EXPORT;
+            else if (argv[i][1] == 'i')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_IMPORT;
+            else if (argv[i][1] == 'd')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT;
+            else if (argv[i][1] == 'b')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT;
+            else if (argv[i][1] == 's')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_RESOURCE;
+            else if (argv[i][1] == 'g')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_DEBUG;
+            else if (argv[i][1] == 'c')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG;
+            else if (argv[i][1] == 't')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_TLS;
+            else if (argv[i][1] == 'x')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_SECURITY;
+            else if (argv[i][1] == 'p')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_EXCEPTION;
+            else if (argv[i][1] == 'r')
+                mask|= 1 << IMAGE_DIRECTORY_ENTRY_BASERELOC;
+            else if (argv[i][1] == 'a')
+                isAsync = true;
+            else
+                break;
+        }
+
+        if ((i == argc) && (listFilename == NULL))
+        {
+            cout << "Usage: peBatchScan [-j threads | -a] [-e] [-i] [-d] [-b] [-s] [-g] [-t] [-c] [-p] [-x] [-r] "
+                    "[-l listfile] <file|directory>..." << endl;
+            cout << "   -a   Read the files asynchronously from a single "
+                    "thread" << endl;
+            cout << "   -e   Parse the export table" << endl;
+            cout << "   -i   Parse the import table" << endl;
+            cout << "   -d   Parse the delay-load import table" << endl;
+            cout << "   -b   Parse the bound import table" << endl;
+            cout << "   -s   Parse the resource tree" << endl;
+            cout << "   -g   Parse the debug directory" << endl;
+            cout << "   -t   Parse the TLS directory" << endl;
+            cout << "   -c   Parse the load configuration directory" << endl;
+            cout << "   -p   Parse the exception directory (.pdata)" << endl;
+            cout << "   -x   Parse the certificate table" << endl;
+            cout << "   -r   Parse the relocation table" << endl;
+            return RC_ERROR;
+        }
+
+        cPrintSink sink;
+        if (isAsync)
+        {
+            cPeAsyncReader reader(sink, mask);
+            return scan(reader, listFilename, argv + i, argc - i);
+        }
+        cPeBatchScanner scanner(sink, mask, threads);
+        return scan(scanner, listFilename, argv + i, argc - i);
+    }
+    XSTL_CATCH(cException& e)
+    {
+        // Print the exception
+        e.print();
+        return RC_ERROR;
+    }
+    XSTL_CATCH_ALL
+    {
+        TRACE(TRACE_VERY_HIGH,
+                XSTL_STRING("Unknwon exceptions caught at main()..."));
+        return RC_ERROR;
+    }
+}
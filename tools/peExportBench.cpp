@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2008-2016, Integrity Project Ltd. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * Neither the name of the Integrity Project nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE
+ */
+
+/*
+ * peExportBench.cpp
+ *
+ * Measure the export table reading modes (see cNtDirExport::ReadMode) over a
+ * synthetic DLL with many exports.
+ *
+ * Author: Elad Raz <e@eladraz.com>
+ */
+#include "xStl/types.h"
+#include "xStl/data/char.h"
+#include "xStl/data/array.h"
+#include "xStl/data/string.h"
+#include "xStl/except/trace.h"
+#include "xStl/except/exception.h"
+#include "xStl/os/os.h"
+#include "xStl/os/streamMemoryAccesser.h"
+#include "xStl/stream/ioStream.h"
+#include "xStl/stream/memoryAccesserStream.h"
+#include "pe/datastruct.h"
+#include "pe/ntDirExport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The default number of exports and of iterations
+#define DEFAULT_EXPORTS    (30000)
+#define DEFAULT_ITERATIONS (20)
+// The RVA of the synthetic export directory
+#define DIRECTORY_RVA      (0x1000)
+// The RVA of the synthetic code
+#define CODE_RVA           (0x100000)
+
+/*
+ * Build the memory of a DLL which exports 'count' functions by name. The
+ * export directory is at DIRECTORY_RVA, laid out the way linkers do: the
+ * header, the three arrays and the (sorted) names. Returns the size of the
+ * directory.
+ */
+static uint buildImage(uint count, cBuffer& image)
+{
+    char name[0x20];
+    uint namesSize = sizeof("bench.dll");
+    for (uint i = 0; i < count; i++)
+        namesSize+= sprintf(name, "BenchFunction%06u", i) + 1;
+
+    uint functions = sizeof(IMAGE_EXPORT_DIRECTORY);
+    uint names = functions + count * sizeof(uint32);
+    uint ordinals = names + count * sizeof(uint32);
+    uint strings = ordinals + count * sizeof(uint16);
+    uint size = strings + namesSize;
+    image.changeSize(DIRECTORY_RVA + size, false);
+    memset(image.getBuffer(), 0, image.getSize());
+    uint8* directory = image.getBuffer() + DIRECTORY_RVA;
+
+    IMAGE_EXPORT_DIRECTORY header;
+    memset(&header, 0, sizeof(header));
+    header.Name = DIRECTORY_RVA + strings;
+    header.Base = 1;
+    header.NumberOfFunctions = count;
+    header.NumberOfNames = count;
+    header.AddressOfFunctions = DIRECTORY_RVA + functions;
+    header.AddressOfNames = DIRECTORY_RVA + names;
+    header.AddressOfNameOrdinals = DIRECTORY_RVA + ordinals;
+    cOS::memcpy(directory, &header, sizeof(header));
+
+    uint position = strings;
+    cOS::memcpy(directory + position, "bench.dll", sizeof("bench.dll"));
+    position+= sizeof("bench.dll");
+    for (uint i = 0; i < count; i++)
+    {
+        uint32 address = CODE_RVA + i * 0x10;
+        uint32 namePointer = DIRECTORY_RVA + position;
+        uint16 ordinal = (uint16)i;
+        cOS::memcpy(directory + functions + i * sizeof(uint32), &address,
+                    sizeof(address));
+        cOS::memcpy(directory + names + i * sizeof(uint32), &namePointer,
+                    sizeof(namePointer));
+        cOS::memcpy(directory + ordinals + i * sizeof(uint16), &ordinal,
+                    sizeof(ordinal));
+        position+= sprintf((char*)directory + position,
+                           "BenchFunction%06u", i) + 1;
+    }
+    return size;
+}
+
+/*
+ * Read the export table 'iterations' times. Returns the average time of a
+ * read, in microseconds.
+ */
+static uint measure(const cVirtualMemoryAccesserPtr& memory,
+                    uint size,
+                    uint iterations,
+                    cNtDirExport::ReadMode mode)
+{
+    clock_t start = clock();
+    for (uint i = 0; i < iterations; i++)
+    {
+        cMemoryAccesserStream stream(memory, DIRECTORY_RVA,
+                                     DIRECTORY_RVA + size);
+        cNtDirExport exports;
+        exports.read(stream, DIRECTORY_RVA, 0, false, mode);
+    }
+    return (uint)(((double)(clock() - start) * 1000000.0) /
+                  ((double)CLOCKS_PER_SEC * iterations));
+}
+
+/*
+ * The main entry point. Captures all unexpected exceptions and make sure
+ * that the application will notify the programmer.
+ */
+int main(const int argc, const char** argv)
+{
+    XSTL_TRY
+    {
+        uint count = (argc > 1) ? (uint)atoi(argv[1]) : DEFAULT_EXPORTS;
+        uint iterations = (argc > 2) ? (uint)atoi(argv[2]) :
+                                       DEFAULT_ITERATIONS;
+        if ((count == 0) || (count > cPeExportIndex::MAX_FUNCTIONS) ||
+            (iterations == 0))
+        {
+            cout << "Usage: peExportBench [exports [iterations]]" << endl;
+            return RC_ERROR;
+        }
+
+        cBufferPtr image(new cBuffer());
+        uint size = buildImage(count, *image);
+        cVirtualMemoryAccesserPtr memory(new cStreamMemoryAccesser(image));
+
+        // Check that both modes agree
+        cNtDirExport bulk, perElement;
+        {
+            cMemoryAccesserStream stream(memory, DIRECTORY_RVA,
+                                         DIRECTORY_RVA + size);
+            bulk.read(stream, DIRECTORY_RVA, 0, false,
+                      cNtDirExport::READ_BULK);
+        }
+        {
+            cMemoryAccesserStream stream(memory, DIRECTORY_RVA,
+                                         DIRECTORY_RVA + size);
+            perElement.read(stream, DIRECTORY_RVA, 0, false,
+                            cNtDirExport::READ_PER_ELEMENT);
+        }
+        CHECK(bulk.getExportArray().getSize() == count);
+        CHECK(perElement.getExportArray().getSize() == count);
+        for (uint i = 0; i < count; i++)
+        {
+            CHECK(bulk.getExportArray()[i].m_name ==
+                  perElement.getExportArray()[i].m_name);
+        }
+
+        uint perElementTime = measure(memory, size, iterations,
+                                      cNtDirExport::READ_PER_ELEMENT);
+        uint bulkTime = measure(memory, size, iterations,
+                                cNtDirExport::READ_BULK);
+
+        cout << count << " exports, " << size << " bytes directory" << endl;
+        cout << "  per-element  " << perElementTime << " us" << endl;
+        cout << "  bulk         " << bulkTime << " us" << endl;
+        if (bulkTime != 0)
+        {
+            cout << "  speedup      " << (perElementTime * 10 / bulkTime) / 10
+                 << "." << (perElementTime * 10 / bulkTime) % 10 << "x"
+                 << endl;
+        }
+        return RC_OK;
+    }
+    XSTL_CATCH(cException& e)
+    {
+        // Print the exception
+        e.print();
+        return RC_ERROR;
+    }
+    XSTL_CATCH_ALL
+    {
+        TRACE(TRACE_VERY_HIGH,
+                XSTL_STRING("Unknwon exceptions caught at main()..."));
+        return RC_ERROR;
+    }
+}